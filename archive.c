@@ -0,0 +1,1325 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "archive.h"
+#include "path.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAR_BLOCK 512
+#define CPIO_HEADER 110
+
+/* Most links followed while resolving one path, as the kernel's MAXSYMLINKS */
+#define MAX_FOLLOW 40
+
+/* Extension data (long names, pax records) larger than this is refused */
+#define MAX_EXTENSION (1 << 20)
+
+enum format {
+    FORMAT_TAR,
+    FORMAT_CPIO,
+};
+
+enum kind {
+    KIND_FILE,
+    KIND_DIR,
+    KIND_LINK,
+    KIND_OTHER,
+};
+
+enum action {
+    ACTION_KEEP,
+    ACTION_DELETE,
+    ACTION_RETARGET,
+};
+
+struct member {
+    char* path;      /* in the view */
+    char* value;     /* link value, or NULL */
+    char* new_value; /* ACTION_RETARGET */
+    unsigned char kind;
+    unsigned char action;
+    unsigned char replaced; /* a later member has the same path */
+};
+
+/*
+ * node:
+ *   A path of the view: a member, or a directory implied by one.  The
+ *   table is open addressing, keyed by the FNV-1a hash of the path.
+ */
+struct node {
+    uint64_t hash;
+    const char* path; /* NULL for an empty slot */
+    size_t len;
+    const char* value; /* link value */
+    long member;       /* -1 for an implied directory */
+    unsigned char kind;
+};
+
+struct archive {
+    enum format format;
+    int fd;
+    off_t start; /* where the archive begins in 'fd' */
+    FILE* spool; /* pipe input kept for archive_write(), or NULL */
+    struct member* members;
+    size_t count;
+    size_t cap;
+    struct node* nodes;
+    size_t nnodes;
+    size_t nodes_size; /* power of two */
+    char** implied;    /* paths of implied directories */
+    size_t nimplied;
+};
+
+/*
+ * reader, writer:
+ *   Buffered sequential access to the archive file descriptors.
+ */
+struct reader {
+    int fd;
+    int seekable;
+    size_t pos;
+    size_t len;
+    char buf[65536];
+};
+
+struct writer {
+    int fd;
+    size_t len;
+    char buf[65536];
+};
+
+/* Returns 0, 1 at the very end of input, or -1 (errno EIO if cut short) */
+static int reader_read(struct reader* r, void* out, size_t n) {
+    char* p = out;
+    size_t got = 0;
+    while (got < n) {
+        if (r->pos == r->len) {
+            ssize_t k = read(r->fd, r->buf, sizeof(r->buf));
+            if (k < 0 && errno == EINTR) {
+                continue;
+            }
+            if (k < 0) {
+                return -1;
+            }
+            if (k == 0) {
+                if (got == 0) {
+                    return 1;
+                }
+                errno = EIO;
+                return -1;
+            }
+            r->pos = 0;
+            r->len = (size_t)k;
+        }
+        size_t take = r->len - r->pos;
+        if (take > n - got) {
+            take = n - got;
+        }
+        memcpy(p + got, r->buf + r->pos, take);
+        r->pos += take;
+        got += take;
+    }
+    return 0;
+}
+
+/* Buffer the first 'n' bytes of input without consuming them */
+static int reader_peek(struct reader* r, size_t n) {
+    while (r->len < n) {
+        ssize_t k = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        }
+        if (k <= 0) {
+            return k < 0 ? -1 : 1;
+        }
+        r->len += (size_t)k;
+    }
+    return 0;
+}
+
+static int reader_skip(struct reader* r, uint64_t n) {
+    size_t buffered = r->len - r->pos;
+    if (n <= buffered) {
+        r->pos += (size_t)n;
+        return 0;
+    }
+    n -= buffered;
+    r->pos = r->len = 0;
+    if (r->seekable && lseek(r->fd, (off_t)n, SEEK_CUR) >= 0) {
+        return 0;
+    }
+    char scratch[8192];
+    while (n > 0) {
+        size_t take = n > sizeof(scratch) ? sizeof(scratch) : (size_t)n;
+        if (reader_read(r, scratch, take) != 0) {
+            errno = EIO;
+            return -1;
+        }
+        n -= take;
+    }
+    return 0;
+}
+
+static int writer_flush(struct writer* w) {
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t k = write(w->fd, w->buf + done, w->len - done);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        }
+        if (k < 0) {
+            return -1;
+        }
+        done += (size_t)k;
+    }
+    w->len = 0;
+    return 0;
+}
+
+static int writer_put(struct writer* w, const void* data, size_t n) {
+    const char* p = data;
+    while (n > 0) {
+        if (w->len == sizeof(w->buf) && writer_flush(w) != 0) {
+            return -1;
+        }
+        size_t take = sizeof(w->buf) - w->len;
+        if (take > n) {
+            take = n;
+        }
+        memcpy(w->buf + w->len, p, take);
+        w->len += take;
+        p += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/* Copy 'n' bytes from 'r' to 'w' */
+static int copy_bytes(struct reader* r, struct writer* w, uint64_t n) {
+    char chunk[8192];
+    while (n > 0) {
+        size_t take = n > sizeof(chunk) ? sizeof(chunk) : (size_t)n;
+        if (reader_read(r, chunk, take) != 0 || writer_put(w, chunk, take) != 0) {
+            if (errno == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        n -= take;
+    }
+    return 0;
+}
+
+/* Copy everything left in 'r' to 'w' */
+static int copy_rest(struct reader* r, struct writer* w) {
+    char chunk[8192];
+    for (;;) {
+        size_t buffered = r->len - r->pos;
+        if (buffered == 0) {
+            ssize_t k = read(r->fd, chunk, sizeof(chunk));
+            if (k < 0 && errno == EINTR) {
+                continue;
+            }
+            if (k <= 0) {
+                return (int)k;
+            }
+            if (writer_put(w, chunk, (size_t)k) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (writer_put(w, r->buf + r->pos, buffered) != 0) {
+            return -1;
+        }
+        r->pos = r->len;
+    }
+}
+
+static struct node* node_find(const struct archive* ar, const char* path, size_t len) {
+    if (ar->nodes_size == 0) {
+        return NULL;
+    }
+    uint64_t hash = hash_path(path, len);
+    for (size_t i = hash & (ar->nodes_size - 1);; i = (i + 1) & (ar->nodes_size - 1)) {
+        struct node* n = &ar->nodes[i];
+        if (!n->path) {
+            return NULL;
+        }
+        if (n->hash == hash && n->len == len && !memcmp(n->path, path, len)) {
+            return n;
+        }
+    }
+}
+
+static int nodes_grow(struct archive* ar) {
+    size_t size = ar->nodes_size ? ar->nodes_size * 2 : 1024;
+    struct node* nodes = calloc(size, sizeof(*nodes));
+    if (!nodes) {
+        return -1;
+    }
+    for (size_t i = 0; i < ar->nodes_size; i++) {
+        if (ar->nodes[i].path) {
+            size_t j = ar->nodes[i].hash & (size - 1);
+            while (nodes[j].path) {
+                j = (j + 1) & (size - 1);
+            }
+            nodes[j] = ar->nodes[i];
+        }
+    }
+    free(ar->nodes);
+    ar->nodes = nodes;
+    ar->nodes_size = size;
+    return 0;
+}
+
+/*
+ * node_add:
+ *   Add 'path' to the view.  A member replaces what was there, as it
+ *   would on extraction; an implied directory (member -1) never does.
+ */
+static int node_add(struct archive* ar, const char* path, size_t len, unsigned char kind, const char* value,
+                    long member) {
+    struct node* n = node_find(ar, path, len);
+    if (n) {
+        if (member >= 0) {
+            if (n->member >= 0) {
+                ar->members[n->member].replaced = 1;
+            }
+            n->path = path;
+            n->kind = kind;
+            n->value = value;
+            n->member = member;
+        }
+        return 0;
+    }
+    if ((ar->nnodes + 1) * 4 > ar->nodes_size * 3 && nodes_grow(ar) != 0) {
+        return -1;
+    }
+    uint64_t hash = hash_path(path, len);
+    size_t i = hash & (ar->nodes_size - 1);
+    while (ar->nodes[i].path) {
+        i = (i + 1) & (ar->nodes_size - 1);
+    }
+    struct node node = {hash, path, len, value, member, kind};
+    ar->nodes[i] = node;
+    ar->nnodes++;
+    return 0;
+}
+
+/*
+ * add_member:
+ *   Record a member named 'name' in the archive, and the directories above
+ *   it.  Returns 0, or -1 if out of memory.
+ */
+static int add_member(struct archive* ar, const char* name, unsigned char kind, const char* value) {
+    size_t name_len = strlen(name);
+    if (name_len > PATH_MAX - 2) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (ar->count == ar->cap) {
+        size_t cap = ar->cap ? ar->cap * 2 : 256;
+        struct member* members = realloc(ar->members, cap * sizeof(*members));
+        if (!members) {
+            return -1;
+        }
+        ar->members = members;
+        ar->cap = cap;
+    }
+    struct member* m = &ar->members[ar->count];
+    memset(m, 0, sizeof(*m));
+    m->kind = kind;
+    m->path = malloc(name_len + 2);
+    m->value = value ? strdup(value) : NULL;
+    if (!m->path || (value && !m->value)) {
+        free(m->path);
+        free(m->value);
+        return -1;
+    }
+    m->path[0] = '/';
+    memcpy(m->path + 1, name, name_len + 1);
+    tidy_path(m->path);
+    long index = (long)ar->count++;
+
+    /* Parents first, so that a member replacing a parent wins */
+    for (char* slash = strchr(m->path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = (size_t)(slash - m->path);
+        if (!node_find(ar, m->path, len)) {
+            if (ar->nimplied % 256 == 0) {
+                char** implied = realloc(ar->implied, (ar->nimplied + 256) * sizeof(*implied));
+                if (!implied) {
+                    return -1;
+                }
+                ar->implied = implied;
+            }
+            char* dir = strndup(m->path, len);
+            if (!dir) {
+                return -1;
+            }
+            ar->implied[ar->nimplied++] = dir;
+            if (node_add(ar, dir, len, KIND_DIR, NULL, -1) != 0) {
+                return -1;
+            }
+        }
+    }
+    return node_add(ar, m->path, strlen(m->path), kind, m->value, index);
+}
+
+/* An octal tar number field, or a base-256 one (GNU, for large values) */
+static uint64_t tar_number(const char* field, size_t size) {
+    const unsigned char* f = (const unsigned char*)field;
+    uint64_t v = 0;
+    if (f[0] & 0x80) {
+        v = f[0] & 0x3f;
+        for (size_t i = 1; i < size; i++) {
+            v = (v << 8) | f[i];
+        }
+        return v;
+    }
+    size_t i = 0;
+    while (i < size && (f[i] == ' ' || f[i] == '0')) {
+        i++;
+    }
+    for (; i < size && f[i] >= '0' && f[i] <= '7'; i++) {
+        v = (v << 3) | (uint64_t)(f[i] - '0');
+    }
+    return v;
+}
+
+static unsigned tar_checksum(const unsigned char* block) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : block[i];
+    }
+    return sum;
+}
+
+static int tar_header_valid(const unsigned char* block) {
+    return tar_number((const char*)block + 148, 8) == tar_checksum(block);
+}
+
+static void tar_set_checksum(unsigned char* block) {
+    snprintf((char*)block + 148, 8, "%06o", tar_checksum(block));
+    block[155] = ' ';
+}
+
+static int block_is_zero(const unsigned char* block) {
+    for (size_t i = 0; i < TAR_BLOCK; i++) {
+        if (block[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint64_t tar_padded(uint64_t size) {
+    return (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+/*
+ * tar_read_data:
+ *   Read the 'size' bytes of extension data following a header, with
+ *   their padding, into a NUL-terminated heap buffer.
+ */
+static char* tar_read_data(struct reader* r, uint64_t size) {
+    if (size > MAX_EXTENSION) {
+        errno = EFBIG;
+        return NULL;
+    }
+    char* data = malloc((size_t)tar_padded(size) + 1);
+    if (!data) {
+        return NULL;
+    }
+    if (reader_read(r, data, (size_t)tar_padded(size)) != 0) {
+        free(data);
+        errno = EIO;
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+/*
+ * pax_next:
+ *   The next "LEN key=value\n" record of pax extension data, or 0 at the
+ *   end (or on a malformed record).
+ */
+static int pax_next(const char** p, const char* end, const char** key, size_t* key_len, const char** value,
+                    size_t* value_len) {
+    const char* rec = *p;
+    char* num_end;
+    unsigned long len = strtoul(rec, &num_end, 10);
+    if (rec >= end || num_end == rec || *num_end != ' ' || len == 0 || len > (unsigned long)(end - rec) ||
+        rec[len - 1] != '\n') {
+        return 0;
+    }
+    const char* eq = memchr(num_end + 1, '=', (size_t)(rec + len - (num_end + 1)));
+    if (!eq) {
+        return 0;
+    }
+    *key = num_end + 1;
+    *key_len = (size_t)(eq - *key);
+    *value = eq + 1;
+    *value_len = (size_t)(rec + len - 1 - *value);
+    *p = rec + len;
+    return 1;
+}
+
+/* pax fields that matter here, from one extended header */
+struct pax_fields {
+    char* path;
+    char* linkpath;
+    int64_t size; /* -1 if not given */
+};
+
+static int pax_parse(const char* data, size_t len, struct pax_fields* fields) {
+    const char* p = data;
+    const char* key;
+    const char* value;
+    size_t key_len;
+    size_t value_len;
+    while (pax_next(&p, data + len, &key, &key_len, &value, &value_len)) {
+        char** target = NULL;
+        if (key_len == 4 && !memcmp(key, "path", 4)) {
+            target = &fields->path;
+        }
+        else if (key_len == 8 && !memcmp(key, "linkpath", 8)) {
+            target = &fields->linkpath;
+        }
+        else if (key_len == 4 && !memcmp(key, "size", 4)) {
+            fields->size = (int64_t)strtoull(value, NULL, 10);
+        }
+        if (target) {
+            free(*target);
+            *target = strndup(value, value_len);
+            if (!*target) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * tar_field:
+ *   A NUL-padded string field, copied out.
+ */
+static void tar_field(const unsigned char* block, size_t off, size_t size, char* out) {
+    size_t len = strnlen((const char*)block + off, size);
+    memcpy(out, block + off, len);
+    out[len] = '\0';
+}
+
+static int tar_index(struct archive* ar, struct reader* r, char* error, size_t error_size) {
+    unsigned char block[TAR_BLOCK];
+    char* long_name = NULL;
+    char* long_link = NULL;
+    struct pax_fields pax = {NULL, NULL, -1};
+    int status = 0;
+
+    for (;;) {
+        int rc = reader_read(r, block, TAR_BLOCK);
+        if (rc != 0 || block_is_zero(block)) {
+            if (rc < 0) {
+                snprintf(error, error_size, "archive cut short: %s", strerror(errno));
+                status = -1;
+            }
+            break;
+        }
+        if (!tar_header_valid(block)) {
+            snprintf(error, error_size, "bad tar header checksum after %zu members", ar->count);
+            errno = EINVAL;
+            status = -1;
+            break;
+        }
+        char type = (char)block[156];
+        uint64_t size = tar_number((const char*)block + 124, 12);
+        if (type == 'L' || type == 'K' || type == 'x') {
+            char* data = tar_read_data(r, size);
+            if (!data) {
+                snprintf(error, error_size, "cannot read extended header: %s", strerror(errno));
+                status = -1;
+                break;
+            }
+            if (type == 'L') {
+                free(long_name);
+                long_name = data;
+            }
+            else if (type == 'K') {
+                free(long_link);
+                long_link = data;
+            }
+            else {
+                int failed = pax_parse(data, (size_t)size, &pax);
+                free(data);
+                if (failed) {
+                    snprintf(error, error_size, "out of memory");
+                    status = -1;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (type == 'g') {
+            if (reader_skip(r, tar_padded(size)) != 0) {
+                snprintf(error, error_size, "archive cut short");
+                status = -1;
+                break;
+            }
+            continue;
+        }
+
+        char name[PATH_MAX * 2];
+        char link[PATH_MAX + 1];
+        if (long_name || pax.path) {
+            snprintf(name, sizeof(name), "%s", pax.path ? pax.path : long_name);
+        }
+        else {
+            char base[101];
+            tar_field(block, 0, 100, base);
+            if (!memcmp(block + 257, "ustar\0", 6) && block[345]) {
+                char prefix[156];
+                tar_field(block, 345, 155, prefix);
+                snprintf(name, sizeof(name), "%s/%s", prefix, base);
+            }
+            else {
+                snprintf(name, sizeof(name), "%s", base);
+            }
+        }
+        if (long_link || pax.linkpath) {
+            snprintf(link, sizeof(link), "%s", pax.linkpath ? pax.linkpath : long_link);
+        }
+        else {
+            tar_field(block, 157, 100, link);
+        }
+        if (pax.size >= 0) {
+            size = (uint64_t)pax.size;
+        }
+
+        unsigned char kind = KIND_OTHER;
+        if (type == '5' || ((type == '0' || type == '\0') && name[0] && name[strlen(name) - 1] == '/')) {
+            kind = KIND_DIR;
+        }
+        else if (type == '2') {
+            kind = KIND_LINK;
+        }
+        else if (type == '0' || type == '\0' || type == '1' || type == '7') {
+            kind = KIND_FILE;
+        }
+        if (add_member(ar, name, kind, kind == KIND_LINK ? link : NULL) != 0) {
+            snprintf(error, error_size, "cannot index %s: %s", name, strerror(errno));
+            status = -1;
+            break;
+        }
+
+        free(long_name);
+        free(long_link);
+        free(pax.path);
+        free(pax.linkpath);
+        long_name = long_link = NULL;
+        pax.path = pax.linkpath = NULL;
+        pax.size = -1;
+        if (reader_skip(r, tar_padded(size)) != 0) {
+            snprintf(error, error_size, "archive cut short in %s", name);
+            status = -1;
+            break;
+        }
+    }
+    free(long_name);
+    free(long_link);
+    free(pax.path);
+    free(pax.linkpath);
+    return status;
+}
+
+/* An 8-digit hex cpio field */
+static uint32_t cpio_field(const char* header, int index) {
+    uint32_t v = 0;
+    const char* f = header + 6 + index * 8;
+    for (int i = 0; i < 8; i++) {
+        char c = f[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') {
+            v |= (uint32_t)(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f') {
+            v |= (uint32_t)(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F') {
+            v |= (uint32_t)(c - 'A' + 10);
+        }
+    }
+    return v;
+}
+
+/* Fields of a newc header, after the magic */
+enum {
+    CPIO_MODE = 1,
+    CPIO_FILESIZE = 6,
+    CPIO_NAMESIZE = 11,
+    CPIO_CHECK = 12,
+};
+
+static size_t cpio_pad(size_t len) {
+    return (4 - len % 4) % 4;
+}
+
+/*
+ * cpio_header:
+ *   Read one header and the name after it, with its padding.  Returns 0,
+ *   1 at the trailer, or -1.
+ */
+static int cpio_header(struct reader* r, char* header, char* name, char* error, size_t error_size) {
+    if (reader_read(r, header, CPIO_HEADER) != 0) {
+        snprintf(error, error_size, "archive cut short (no trailer)");
+        errno = EIO;
+        return -1;
+    }
+    if (memcmp(header, "070701", 6) != 0 && memcmp(header, "070702", 6) != 0) {
+        snprintf(error, error_size, "bad cpio header magic");
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t namesize = cpio_field(header, CPIO_NAMESIZE);
+    if (namesize == 0 || namesize > PATH_MAX * 2) {
+        snprintf(error, error_size, "bad cpio name size");
+        errno = EINVAL;
+        return -1;
+    }
+    if (reader_read(r, name, namesize) != 0 || reader_skip(r, cpio_pad(CPIO_HEADER + namesize)) != 0) {
+        snprintf(error, error_size, "archive cut short");
+        errno = EIO;
+        return -1;
+    }
+    name[namesize - 1] = '\0';
+    return !strcmp(name, "TRAILER!!!");
+}
+
+static int cpio_index(struct archive* ar, struct reader* r, char* error, size_t error_size) {
+    char header[CPIO_HEADER];
+    char name[PATH_MAX * 2];
+    for (;;) {
+        int rc = cpio_header(r, header, name, error, error_size);
+        if (rc != 0) {
+            return rc > 0 ? 0 : -1;
+        }
+        uint32_t mode = cpio_field(header, CPIO_MODE);
+        uint32_t size = cpio_field(header, CPIO_FILESIZE);
+        char link[PATH_MAX + 1];
+        unsigned char kind = S_ISDIR(mode) ? KIND_DIR : S_ISLNK(mode) ? KIND_LINK : S_ISREG(mode) ? KIND_FILE
+                                                                                                     : KIND_OTHER;
+        if (kind == KIND_LINK) {
+            if (size > PATH_MAX || reader_read(r, link, size) != 0 || reader_skip(r, cpio_pad(size)) != 0) {
+                snprintf(error, error_size, "bad link %s", name);
+                errno = EINVAL;
+                return -1;
+            }
+            link[size] = '\0';
+        }
+        else if (reader_skip(r, (uint64_t)size + cpio_pad(size)) != 0) {
+            snprintf(error, error_size, "archive cut short in %s", name);
+            return -1;
+        }
+        if (add_member(ar, name, kind, kind == KIND_LINK ? link : NULL) != 0) {
+            snprintf(error, error_size, "cannot index %s: %s", name, strerror(errno));
+            return -1;
+        }
+    }
+}
+
+/*
+ * spool:
+ *   Copy all of 'fd' to a temporary file, for input that cannot be read
+ *   twice.
+ */
+static FILE* spool(int fd) {
+    FILE* f = tmpfile();
+    if (!f) {
+        return NULL;
+    }
+    struct reader* r = malloc(sizeof(*r));
+    struct writer* w = malloc(sizeof(*w));
+    int ok = r && w;
+    if (ok) {
+        r->fd = fd;
+        r->pos = r->len = 0;
+        w->fd = fileno(f);
+        w->len = 0;
+        ok = copy_rest(r, w) == 0 && writer_flush(w) == 0 && lseek(fileno(f), 0, SEEK_SET) == 0;
+    }
+    int err = errno;
+    free(r);
+    free(w);
+    if (!ok) {
+        fclose(f);
+        errno = err;
+        return NULL;
+    }
+    return f;
+}
+
+struct archive* archive_open(int fd, int rewrite, char* error, size_t error_size) {
+    struct archive* ar = calloc(1, sizeof(*ar));
+    struct reader* r = malloc(sizeof(*r));
+    if (!ar || !r) {
+        free(ar);
+        free(r);
+        snprintf(error, error_size, "out of memory");
+        errno = ENOMEM;
+        return NULL;
+    }
+    ar->start = lseek(fd, 0, SEEK_CUR);
+    if (ar->start < 0 && rewrite) {
+        ar->spool = spool(fd);
+        if (!ar->spool) {
+            snprintf(error, error_size, "cannot spool the archive: %s", strerror(errno));
+            free(r);
+            archive_close(ar);
+            return NULL;
+        }
+        fd = fileno(ar->spool);
+        ar->start = 0;
+    }
+    ar->fd = fd;
+
+    r->fd = fd;
+    r->seekable = ar->start >= 0;
+    r->pos = r->len = 0;
+    int status = 0;
+
+    /* Both formats have their magic within the first block */
+    const unsigned char* first = (const unsigned char*)r->buf;
+    int rc = reader_peek(r, CPIO_HEADER);
+    if (rc != 0) {
+        snprintf(error, error_size, "%s", rc > 0 ? "not a tar or cpio (newc) archive" : strerror(errno));
+        errno = rc > 0 ? EINVAL : errno;
+        status = -1;
+    }
+    else if (!memcmp(first, "070701", 6) || !memcmp(first, "070702", 6)) {
+        ar->format = FORMAT_CPIO;
+        status = cpio_index(ar, r, error, error_size);
+    }
+    else if (reader_peek(r, TAR_BLOCK) == 0 && (tar_header_valid(first) || block_is_zero(first))) {
+        ar->format = FORMAT_TAR;
+        status = tar_index(ar, r, error, error_size);
+    }
+    else {
+        snprintf(error, error_size, "not a tar or cpio (newc) archive");
+        errno = EINVAL;
+        status = -1;
+    }
+    free(r);
+    if (status != 0) {
+        int err = errno;
+        archive_close(ar);
+        errno = err;
+        return NULL;
+    }
+    return ar;
+}
+
+void archive_close(struct archive* ar) {
+    if (!ar) {
+        return;
+    }
+    for (size_t i = 0; i < ar->count; i++) {
+        free(ar->members[i].path);
+        free(ar->members[i].value);
+        free(ar->members[i].new_value);
+    }
+    for (size_t i = 0; i < ar->nimplied; i++) {
+        free(ar->implied[i]);
+    }
+    free(ar->implied);
+    free(ar->members);
+    free(ar->nodes);
+    if (ar->spool) {
+        fclose(ar->spool);
+    }
+    free(ar);
+}
+
+const char* archive_format(const struct archive* ar) {
+    return ar->format == FORMAT_TAR ? "tar" : "cpio";
+}
+
+size_t archive_members(const struct archive* ar) {
+    return ar->count;
+}
+
+int archive_link(const struct archive* ar, size_t i, const char** path, const char** value) {
+    const struct member* m = &ar->members[i];
+    if (m->kind != KIND_LINK || m->replaced) {
+        return 0;
+    }
+    *path = m->path;
+    *value = m->value;
+    return 1;
+}
+
+/*
+ * resolve:
+ *   Walk 'path' from the root one component at a time, the way the kernel
+ *   does: a link met on the way has its value put in front of the rest of
+ *   the path, from the root if it is absolute or from the link's directory
+ *   otherwise.  The last component is followed only with 'follow_last';
+ *   each link followed there counts in '*links'.  Fills 'out' (PATH_MAX +
+ *   1 bytes) and returns 0, or returns an errno value.
+ */
+static int resolve(const struct archive* ar, const char* path, int follow_last, char* out, unsigned* links,
+                   int* is_dir) {
+    char cur[PATH_MAX + 1];
+    size_t cur_len = 0; /* "" is the root */
+    char rest[PATH_MAX * 2 + 2];
+    char next[PATH_MAX * 2 + 2];
+    int follows = 0;
+    unsigned char kind = KIND_DIR;
+
+    if (strlen(path) >= sizeof(rest)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(rest, path);
+    *links = 0;
+    const char* p = rest;
+    for (;;) {
+        while (*p == '/') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        size_t len = strcspn(p, "/");
+        const char* after = p + len;
+        const char* q = after;
+        while (*q == '/') {
+            q++;
+        }
+        int last = (*q == '\0');
+
+        if (len == 1 && p[0] == '.') {
+            p = after;
+            continue;
+        }
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            while (cur_len > 0 && cur[cur_len - 1] != '/') {
+                cur_len--;
+            }
+            if (cur_len > 0) {
+                cur_len--;
+            }
+            kind = KIND_DIR;
+            p = after;
+            continue;
+        }
+        if (cur_len + 1 + len > PATH_MAX) {
+            return ENAMETOOLONG;
+        }
+        size_t parent_len = cur_len;
+        cur[cur_len++] = '/';
+        memcpy(cur + cur_len, p, len);
+        cur_len += len;
+
+        const struct node* n = node_find(ar, cur, cur_len);
+        if (!n) {
+            return ENOENT;
+        }
+        kind = n->kind;
+        if (n->kind == KIND_LINK && (!last || follow_last)) {
+            if (++follows > MAX_FOLLOW) {
+                return ELOOP;
+            }
+            if (last) {
+                (*links)++;
+            }
+            size_t value_len = strlen(n->value);
+            size_t after_len = strlen(after);
+            if (value_len + after_len + 1 > sizeof(next)) {
+                return ENAMETOOLONG;
+            }
+            memcpy(next, n->value, value_len);
+            memcpy(next + value_len, after, after_len + 1);
+            memcpy(rest, next, value_len + after_len + 1);
+            p = rest;
+            cur_len = (n->value[0] == '/') ? 0 : parent_len;
+            kind = KIND_DIR;
+            continue;
+        }
+        if (!last && n->kind != KIND_DIR) {
+            return ENOTDIR;
+        }
+        p = after;
+    }
+
+    if (cur_len == 0) {
+        strcpy(out, "/");
+    }
+    else {
+        memcpy(out, cur, cur_len);
+        out[cur_len] = '\0';
+    }
+    *is_dir = (kind == KIND_DIR);
+    return 0;
+}
+
+void archive_resolve(const struct archive* ar, const char* link_path, const char* value, struct archive_target* out) {
+    char full[PATH_MAX * 2 + 2];
+    if (value[0] == '/') {
+        snprintf(full, sizeof(full), "%s", value);
+    }
+    else {
+        const char* slash = strrchr(link_path, '/');
+        int dir_len = slash ? (int)(slash - link_path) : 0;
+        snprintf(full, sizeof(full), "%.*s/%s", dir_len, link_path, value);
+    }
+    out->is_dir = 0;
+    out->err = resolve(ar, full, 1, out->path, &out->links, &out->is_dir);
+    if (out->err == ENAMETOOLONG) {
+        out->err = ENOENT;
+    }
+}
+
+int archive_realpath(const struct archive* ar, const char* path, char* out) {
+    unsigned links;
+    int is_dir;
+    return resolve(ar, path, 1, out, &links, &is_dir) == 0 ? 0 : -1;
+}
+
+int archive_relative(const struct archive* ar, const char* from_dir, const char* to_path, char* out, size_t out_size) {
+    char dir[PATH_MAX + 1];
+    char to[PATH_MAX + 1];
+    if (archive_realpath(ar, from_dir, dir) != 0 || archive_realpath(ar, to_path, to) != 0) {
+        return -1;
+    }
+    return relative_path_lexical(dir, to, out, out_size);
+}
+
+int archive_retarget(struct archive* ar, size_t i, const char* value) {
+    char* copy = strdup(value);
+    if (!copy) {
+        return -1;
+    }
+    free(ar->members[i].new_value);
+    ar->members[i].new_value = copy;
+    ar->members[i].action = ACTION_RETARGET;
+    return 0;
+}
+
+void archive_delete(struct archive* ar, size_t i) {
+    ar->members[i].action = ACTION_DELETE;
+}
+
+/*
+ * pax_add:
+ *   Append the record "LEN key=value\n" to 'buf', where LEN counts its own
+ *   digits too.
+ */
+static size_t pax_add(char* buf, const char* key, const char* value) {
+    size_t body = strlen(key) + strlen(value) + 3; /* ' ', '=', '\n' */
+    size_t len = body + 1;
+    while (len != body + (size_t)snprintf(NULL, 0, "%zu", len)) {
+        len = body + (size_t)snprintf(NULL, 0, "%zu", len);
+    }
+    return (size_t)sprintf(buf, "%zu %s=%s\n", len, key, value);
+}
+
+/*
+ * tar_write_pax:
+ *   Write a pax extended header: 'header' as its header block (a new one
+ *   if NULL) with 'len' bytes of records.
+ */
+static int tar_write_pax(struct writer* w, const unsigned char* header, const char* records, size_t len) {
+    unsigned char block[TAR_BLOCK];
+    if (header) {
+        memcpy(block, header, TAR_BLOCK);
+    }
+    else {
+        memset(block, 0, sizeof(block));
+        strcpy((char*)block, "././@PaxHeader");
+        memcpy(block + 100, "0000644", 7);
+        memcpy(block + 108, "0000000", 7);
+        memcpy(block + 116, "0000000", 7);
+        memcpy(block + 136, "00000000000", 11);
+        block[156] = 'x';
+        memcpy(block + 257, "ustar\0" "00", 8);
+    }
+    snprintf((char*)block + 124, 12, "%011llo", (unsigned long long)len);
+    tar_set_checksum(block);
+    char pad[TAR_BLOCK] = {0};
+    if (writer_put(w, block, TAR_BLOCK) != 0 || writer_put(w, records, len) != 0 ||
+        writer_put(w, pad, (size_t)(tar_padded(len) - len)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* An extension header held back until the member it belongs to is known */
+struct pending {
+    unsigned char header[TAR_BLOCK];
+    char* data;
+    uint64_t size;
+};
+
+/*
+ * tar_write_retargeted:
+ *   Write the extension headers of a link getting 'value', and its header.
+ *   A GNU long link name is dropped and a pax linkpath replaced; a value
+ *   too long for the header goes into a pax record.
+ */
+static int tar_write_retargeted(struct writer* w, struct pending* pending, size_t npending, unsigned char* header,
+                                const char* value) {
+    size_t value_len = strlen(value);
+    int need_pax = value_len > 100;
+    int pax_written = 0;
+    for (size_t i = 0; i < npending; i++) {
+        struct pending* e = &pending[i];
+        char type = (char)e->header[156];
+        if (type == 'K') {
+            continue;
+        }
+        if (type != 'x') {
+            if (writer_put(w, e->header, TAR_BLOCK) != 0 ||
+                writer_put(w, e->data, (size_t)tar_padded(e->size)) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        char* records = malloc((size_t)e->size + value_len + 64);
+        if (!records) {
+            return -1;
+        }
+        size_t len = 0;
+        const char* p = e->data;
+        const char* key;
+        const char* v;
+        size_t key_len;
+        size_t v_len;
+        const char* rec = p;
+        while (pax_next(&p, e->data + e->size, &key, &key_len, &v, &v_len)) {
+            if (!(key_len == 8 && !memcmp(key, "linkpath", 8))) {
+                memcpy(records + len, rec, (size_t)(p - rec));
+                len += (size_t)(p - rec);
+            }
+            rec = p;
+        }
+        if (need_pax && !pax_written) {
+            len += pax_add(records + len, "linkpath", value);
+            pax_written = 1;
+        }
+        int rc = (len > 0) ? tar_write_pax(w, e->header, records, len) : 0;
+        free(records);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    if (need_pax && !pax_written) {
+        char* records = malloc(value_len + 64);
+        if (!records) {
+            return -1;
+        }
+        size_t len = pax_add(records, "linkpath", value);
+        int rc = tar_write_pax(w, NULL, records, len);
+        free(records);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    memset(header + 157, 0, 100);
+    memcpy(header + 157, value, need_pax ? 100 : value_len);
+    tar_set_checksum(header);
+    return writer_put(w, header, TAR_BLOCK);
+}
+
+static int tar_write(struct archive* ar, struct reader* r, struct writer* w, char* error, size_t error_size) {
+    unsigned char block[TAR_BLOCK];
+    struct pending pending[16];
+    size_t npending = 0;
+    size_t member = 0;
+    int status = 0;
+
+    for (;;) {
+        if (reader_read(r, block, TAR_BLOCK) != 0) {
+            snprintf(error, error_size, "archive changed while it was read");
+            errno = EIO;
+            status = -1;
+            break;
+        }
+        if (block_is_zero(block)) {
+            /* The end marker and anything after it */
+            if (writer_put(w, block, TAR_BLOCK) != 0 || copy_rest(r, w) != 0) {
+                snprintf(error, error_size, "%s", strerror(errno));
+                status = -1;
+            }
+            break;
+        }
+        char type = (char)block[156];
+        uint64_t size = tar_number((const char*)block + 124, 12);
+        if (type == 'L' || type == 'K' || type == 'x' || type == 'g') {
+            if (npending == sizeof(pending) / sizeof(pending[0]) ||
+                !(pending[npending].data = tar_read_data(r, size))) {
+                snprintf(error, error_size, "cannot read extended header: %s", strerror(errno));
+                status = -1;
+                break;
+            }
+            memcpy(pending[npending].header, block, TAR_BLOCK);
+            pending[npending].size = size;
+            npending++;
+            continue;
+        }
+
+        /* The data size may come from a pax record */
+        for (size_t i = 0; i < npending; i++) {
+            if (pending[i].header[156] == 'x') {
+                struct pax_fields pax = {NULL, NULL, -1};
+                pax_parse(pending[i].data, (size_t)pending[i].size, &pax);
+                free(pax.path);
+                free(pax.linkpath);
+                if (pax.size >= 0) {
+                    size = (uint64_t)pax.size;
+                }
+            }
+        }
+
+        const struct member* m = (member < ar->count) ? &ar->members[member] : NULL;
+        member++;
+        int rc = 0;
+        if (m && m->action == ACTION_DELETE) {
+            rc = reader_skip(r, tar_padded(size));
+        }
+        else {
+            if (m && m->action == ACTION_RETARGET) {
+                rc = tar_write_retargeted(w, pending, npending, block, m->new_value);
+            }
+            else {
+                for (size_t i = 0; i < npending && rc == 0; i++) {
+                    rc = writer_put(w, pending[i].header, TAR_BLOCK);
+                    if (rc == 0) {
+                        rc = writer_put(w, pending[i].data, (size_t)tar_padded(pending[i].size));
+                    }
+                }
+                if (rc == 0) {
+                    rc = writer_put(w, block, TAR_BLOCK);
+                }
+            }
+            if (rc == 0) {
+                rc = copy_bytes(r, w, tar_padded(size));
+            }
+        }
+        for (size_t i = 0; i < npending; i++) {
+            free(pending[i].data);
+        }
+        npending = 0;
+        if (rc != 0) {
+            snprintf(error, error_size, "%s", strerror(errno));
+            status = -1;
+            break;
+        }
+    }
+    for (size_t i = 0; i < npending; i++) {
+        free(pending[i].data);
+    }
+    return status;
+}
+
+static int cpio_write(struct archive* ar, struct reader* r, struct writer* w, char* error, size_t error_size) {
+    char header[CPIO_HEADER];
+    char name[PATH_MAX * 2];
+    static const char zeros[4] = {0};
+    size_t member = 0;
+    for (;;) {
+        int rc = cpio_header(r, header, name, error, error_size);
+        if (rc < 0) {
+            return -1;
+        }
+        size_t namesize = strlen(name) + 1;
+        uint32_t size = cpio_field(header, CPIO_FILESIZE);
+        const struct member* m = (rc == 0 && member < ar->count) ? &ar->members[member] : NULL;
+        member++;
+
+        if (m && m->action == ACTION_DELETE) {
+            if (reader_skip(r, (uint64_t)size + cpio_pad(size)) != 0) {
+                snprintf(error, error_size, "archive cut short");
+                return -1;
+            }
+            continue;
+        }
+        const char* value = (m && m->action == ACTION_RETARGET) ? m->new_value : NULL;
+        if (value) {
+            size_t len = strlen(value);
+            char field[9];
+            snprintf(field, sizeof(field), "%08X", (unsigned)len);
+            memcpy(header + 6 + CPIO_FILESIZE * 8, field, 8);
+            if (!memcmp(header, "070702", 6)) {
+                uint32_t sum = 0;
+                for (size_t i = 0; i < len; i++) {
+                    sum += (unsigned char)value[i];
+                }
+                snprintf(field, sizeof(field), "%08X", (unsigned)sum);
+                memcpy(header + 6 + CPIO_CHECK * 8, field, 8);
+            }
+        }
+        if (writer_put(w, header, CPIO_HEADER) != 0 || writer_put(w, name, namesize) != 0 ||
+            writer_put(w, zeros, cpio_pad(CPIO_HEADER + namesize)) != 0) {
+            snprintf(error, error_size, "%s", strerror(errno));
+            return -1;
+        }
+        if (rc > 0) {
+            /* The trailer, and the padding after it */
+            if (copy_rest(r, w) != 0) {
+                snprintf(error, error_size, "%s", strerror(errno));
+                return -1;
+            }
+            return 0;
+        }
+        if (value) {
+            size_t len = strlen(value);
+            rc = writer_put(w, value, len) || writer_put(w, zeros, cpio_pad(len)) ||
+                 reader_skip(r, (uint64_t)size + cpio_pad(size));
+        }
+        else {
+            rc = copy_bytes(r, w, (uint64_t)size + cpio_pad(size));
+        }
+        if (rc != 0) {
+            snprintf(error, error_size, "%s", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+int archive_write(struct archive* ar, int fd, char* error, size_t error_size) {
+    if (ar->start < 0 || lseek(ar->fd, ar->start, SEEK_SET) < 0) {
+        snprintf(error, error_size, "the archive cannot be read again");
+        errno = ESPIPE;
+        return -1;
+    }
+    struct reader* r = malloc(sizeof(*r));
+    struct writer* w = malloc(sizeof(*w));
+    if (!r || !w) {
+        free(r);
+        free(w);
+        snprintf(error, error_size, "out of memory");
+        errno = ENOMEM;
+        return -1;
+    }
+    r->fd = ar->fd;
+    r->seekable = 1;
+    r->pos = r->len = 0;
+    w->fd = fd;
+    w->len = 0;
+    int status = (ar->format == FORMAT_TAR) ? tar_write(ar, r, w, error, error_size)
+                                            : cpio_write(ar, r, w, error, error_size);
+    if (status == 0 && writer_flush(w) != 0) {
+        snprintf(error, error_size, "%s", strerror(errno));
+        status = -1;
+    }
+    int err = errno;
+    free(r);
+    free(w);
+    errno = err;
+    return status;
+}
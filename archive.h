@@ -0,0 +1,99 @@
+#ifndef SYMLINKS_ARCHIVE_H
+#define SYMLINKS_ARCHIVE_H
+
+/*
+ * Archives as a filesystem view (--archive FILE).
+ *
+ * A tar (ustar, GNU or pax) or cpio (newc or crc) archive is read once and
+ * its member names are indexed in memory, so that links inside it can be
+ * resolved against the archive's own contents, as they would be once it is
+ * extracted at some root: absolute targets start at the archive's root,
+ * and links, "." and ".." are followed the way the kernel follows them.
+ * Directories that only appear as parents of other members exist too.
+ *
+ * Paths in the view are absolute and tidy: member "./usr/bin/sh" is
+ * "/usr/bin/sh".  Changes (a new target, or deletion) are recorded per
+ * member and written out by archive_write(), in one pass that copies
+ * everything else as it was.
+ */
+
+#include <stddef.h>
+
+#include "path.h"
+
+struct archive;
+
+/*
+ * archive_open:
+ *   Read and index the archive on 'fd' (its format is detected).  With
+ *   'rewrite', it is kept for archive_write(): input that cannot be read a
+ *   second time (a pipe) is spooled to a temporary file on the way.
+ *   Returns NULL with errno set and a message in 'error'.
+ */
+struct archive* archive_open(int fd, int rewrite, char* error, size_t error_size);
+
+void archive_close(struct archive* ar);
+
+/* "tar" or "cpio" */
+const char* archive_format(const struct archive* ar);
+
+/* Number of members, in archive order */
+size_t archive_members(const struct archive* ar);
+
+/*
+ * archive_link:
+ *   If member 'i' is a symlink, set its path in the view and its value
+ *   and return 1; return 0 for anything else.  A member that a later one
+ *   of the same name replaces is not a link either.
+ */
+int archive_link(const struct archive* ar, size_t i, const char** path, const char** value);
+
+/*
+ * archive_target:
+ *   Where a link's value leads.  'err' is 0, ENOENT, ENOTDIR or ELOOP;
+ *   'links' counts the further links followed at the end of the chain, as
+ *   struct target_info does.
+ */
+struct archive_target {
+    int err;
+    int is_dir;
+    unsigned links;
+    char path[PATH_MAX + 1]; /* the final target, resolved, when err is 0 */
+};
+
+/*
+ * archive_resolve:
+ *   Resolve the value 'value' of the link at 'link_path'.
+ */
+void archive_resolve(const struct archive* ar, const char* link_path, const char* value, struct archive_target* out);
+
+/*
+ * archive_realpath:
+ *   realpath(3) inside the archive.  Returns 0, or -1 if 'path' does not
+ *   resolve.
+ */
+int archive_realpath(const struct archive* ar, const char* path, char* out);
+
+/*
+ * archive_relative:
+ *   build_relative_path() inside the archive.  Returns 0, or -1.
+ */
+int archive_relative(const struct archive* ar, const char* from_dir, const char* to_path, char* out, size_t out_size);
+
+/*
+ * archive_retarget, archive_delete:
+ *   Record a change to member 'i', a link, for archive_write().  The view
+ *   itself stays as it was read.  archive_retarget() returns -1 if out of
+ *   memory.
+ */
+int archive_retarget(struct archive* ar, size_t i, const char* value);
+void archive_delete(struct archive* ar, size_t i);
+
+/*
+ * archive_write:
+ *   Write the archive to 'fd' with the recorded changes.  Returns 0, or -1
+ *   with errno set and a message in 'error'.
+ */
+int archive_write(struct archive* ar, int fd, char* error, size_t error_size);
+
+#endif
@@ -0,0 +1,313 @@
+// bench_paths.c
+//
+// Microbenchmark for the path kernels in path.c.  Compares tidy_path()
+// against the replace_substring()-based implementation it replaced, on
+// short clean paths and on long, messy ones, and checks that both give
+// the same result where the old one was correct.  Then times
+// shorten_path() and build_relative_path() (which resolves both paths
+// with realpath(), over a scratch tree in /tmp) on their own, and
+// relative_path_from(), which resolves only the target.
+//
+// Run it through meson: `meson test --benchmark -C build` (or run
+// build/bench_paths directly).
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "path.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+/* ---- The previous implementation, kept verbatim as the baseline ---- */
+
+static int legacy_replace_substring(char* s, size_t bufsize, const char* old_sub, const char* new_sub) {
+    if (!s || !old_sub || !*old_sub) {
+        return 0;
+    }
+
+    size_t old_len = strlen(old_sub);
+    size_t new_len = (new_sub ? strlen(new_sub) : 0);
+    int total_replacements = 0;
+
+    while (1) {
+        char* match_pos = strstr(s, old_sub);
+        if (!match_pos) {
+            break;
+        }
+        if (new_len > old_len) {
+            size_t needed = strlen(s) + (new_len - old_len) + 1;
+            if (needed > bufsize) {
+                return -1;
+            }
+        }
+
+        char temp[PATH_MAX * 2];
+        memset(temp, 0, sizeof(temp));
+        size_t prefix_len = (size_t)(match_pos - s);
+        strncpy(temp, s, prefix_len);
+        if (new_sub) {
+            strncat(temp, new_sub, sizeof(temp) - strlen(temp) - 1);
+        }
+        strncat(temp, match_pos + old_len, sizeof(temp) - strlen(temp) - 1);
+        strncpy(s, temp, bufsize - 1);
+        s[bufsize - 1] = '\0';
+        total_replacements++;
+    }
+    return total_replacements;
+}
+
+static int legacy_tidy_path(char* path) {
+    if (!path || !*path) {
+        return 0;
+    }
+
+    int changed = 0;
+    char working[PATH_MAX * 2];
+    memset(working, 0, sizeof(working));
+
+    size_t len = strlen(path);
+    if (len + 2 < sizeof(working) && path[len - 1] != '/') {
+        snprintf(working, sizeof(working), "%s/", path);
+    }
+    else {
+        strncpy(working, path, sizeof(working) - 1);
+    }
+
+    while (legacy_replace_substring(working, sizeof(working), "/./", "/") > 0) {
+        changed = 1;
+    }
+    while (legacy_replace_substring(working, sizeof(working), "//", "/") > 0) {
+        changed = 1;
+    }
+    for (;;) {
+        char* p = strstr(working, "/../");
+        if (!p) {
+            break;
+        }
+        if (p == working) {
+            legacy_replace_substring(working, sizeof(working), "/../", "/");
+            changed = 1;
+            continue;
+        }
+        char* slash = p - 1;
+        while (slash > working && *slash != '/') {
+            slash--;
+        }
+        if (slash == working && *slash == '/') {
+            legacy_replace_substring(working, sizeof(working), "/../", "/");
+            changed = 1;
+        }
+        else {
+            memmove(slash, p + 3, strlen(p + 3) + 1);
+            changed = 1;
+        }
+    }
+
+    len = strlen(working);
+    while (len > 1 && working[len - 1] == '/') {
+        working[len - 1] = '\0';
+        --len;
+        changed = 1;
+    }
+    while (!strncmp(working, "./", 2)) {
+        memmove(working, working + 2, strlen(working + 2) + 1);
+        changed = 1;
+    }
+
+    strncpy(path, working, PATH_MAX - 1);
+    path[PATH_MAX - 1] = '\0';
+    return changed;
+}
+
+/* ---- Inputs ---- */
+
+/*
+ * make_messy_path:
+ *   Absolute path of roughly 'target_len' bytes mixing "//", "/./" and
+ *   "dir/.." pairs.  It starts with two plain components because the old
+ *   code collapsed every "/../" at once when the first component was popped,
+ *   so such inputs are left out of the comparison.
+ */
+static void make_messy_path(char* out, size_t target_len, unsigned seed) {
+    static const char* pieces[] = {"usr/", "lib//", "./", "x86_64-linux-gnu/", "tmp/../", ".cache/", "share/./", "a.b/"};
+    size_t len = strlen("/usr/share/");
+    memcpy(out, "/usr/share/", len);
+    while (len + 24 < target_len) {
+        seed = seed * 1103515245u + 12345u;
+        const char* piece = pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+        size_t n = strlen(piece);
+        memcpy(out + len, piece, n);
+        len += n;
+    }
+    memcpy(out + len, "libfoo.so.1", 12);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * time_kernel:
+ *   Average ns per call of 'fn' over 'iters' runs on a fresh copy of 'input'.
+ */
+static double time_kernel(int (*fn)(char*), const char* input, long iters) {
+    char buf[PATH_MAX];
+    volatile int sink = 0;
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        memcpy(buf, input, strlen(input) + 1);
+        sink += fn(buf);
+    }
+    (void)sink;
+    return (now_ns() - start) / (double)iters;
+}
+
+/*
+ * time_shorten:
+ *   Average ns per shorten_path() call, as time_kernel().
+ */
+static double time_shorten(const char* input, const char* base, long iters) {
+    char buf[PATH_MAX];
+    volatile int sink = 0;
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        memcpy(buf, input, strlen(input) + 1);
+        sink += shorten_path(buf, base);
+    }
+    (void)sink;
+    return (now_ns() - start) / (double)iters;
+}
+
+/*
+ * time_relative:
+ *   Average ns per build_relative_path() call, or -1 if it fails.
+ */
+static double time_relative(const char* from, const char* to, long iters) {
+    char out[PATH_MAX];
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        if (build_relative_path(from, to, out, sizeof(out)) != 0) {
+            return -1;
+        }
+    }
+    return (now_ns() - start) / (double)iters;
+}
+
+/*
+ * time_relative_from:
+ *   The same from a directory resolved once, as the scanner does for all
+ *   links of a directory.
+ */
+static double time_relative_from(const char* from, const char* to, long iters) {
+    struct path_base base;
+    char out[PATH_MAX];
+    if (path_base_init(&base, from) != 0) {
+        return -1;
+    }
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        if (relative_path_from(&base, to, out, sizeof(out)) != 0) {
+            return -1;
+        }
+    }
+    return (now_ns() - start) / (double)iters;
+}
+
+/*
+ * make_dirs:
+ *   mkdir -p for 'path' (which is modified on the way, then restored).
+ */
+static void make_dirs(char* path) {
+    for (char* p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+}
+
+int main(int argc, char** argv) {
+    long scale = (argc > 1) ? strtol(argv[1], NULL, 10) : 1;
+    if (scale < 1) {
+        scale = 1;
+    }
+
+    struct {
+        const char* name;
+        size_t len;
+        long iters;
+    } cases[] = {
+        {"short clean", 0, 400000},
+        {"messy 128B", 128, 100000},
+        {"messy 1KB", 1000, 10000},
+        {"messy 4KB", PATH_MAX - 8, 1000},
+    };
+
+    int mismatches = 0;
+    printf("%-12s %14s %14s %9s\n", "case", "legacy ns", "tidy_path ns", "speedup");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        char input[PATH_MAX];
+        if (cases[c].len == 0) {
+            snprintf(input, sizeof(input), "/usr/lib/x86_64-linux-gnu/libfoo.so.1");
+        }
+        else {
+            make_messy_path(input, cases[c].len, (unsigned)c);
+        }
+
+        char a[PATH_MAX], b[PATH_MAX];
+        memcpy(a, input, sizeof(a));
+        memcpy(b, input, sizeof(b));
+        legacy_tidy_path(a);
+        tidy_path(b);
+        if (strcmp(a, b) != 0) {
+            fprintf(stderr, "MISMATCH on %s:\n  legacy: %s\n  new:    %s\n", cases[c].name, a, b);
+            mismatches++;
+        }
+
+        long iters = cases[c].iters * scale;
+        double legacy_ns = time_kernel(legacy_tidy_path, input, iters);
+        double new_ns = time_kernel(tidy_path, input, iters);
+        printf("%-12s %14.1f %14.1f %8.1fx\n", cases[c].name, legacy_ns, new_ns, legacy_ns / new_ns);
+    }
+
+    printf("\n%-28s %14s\n", "kernel", "ns/call");
+    printf("%-28s %14.1f\n", "shorten_path short",
+           time_shorten("../lib/libfoo.so.1", "/usr/lib64/x", 400000 * scale));
+    printf("%-28s %14.1f\n", "shorten_path ../ x8",
+           time_shorten("../a/../b/../c/../d/../e/../f/../g/../h/libfoo.so.1", "/usr/lib64/x", 100000 * scale));
+
+    char scratch[] = "/tmp/bench_paths-XXXXXX";
+    if (mkdtemp(scratch)) {
+        char from[PATH_MAX], to[PATH_MAX];
+        snprintf(from, sizeof(from), "%s/usr/share/doc/pkg/examples", scratch);
+        snprintf(to, sizeof(to), "%s/usr/lib/x86_64-linux-gnu/pkg", scratch);
+        make_dirs(from);
+        make_dirs(to);
+        printf("%-28s %14.1f\n", "build_relative_path", time_relative(from, to, 20000 * scale));
+        printf("%-28s %14.1f\n", "relative_path_from", time_relative_from(from, to, 20000 * scale));
+        for (int i = 0; i < 2; i++) {
+            char* dir = i ? to : from;
+            while (strcmp(dir, scratch) != 0) {
+                rmdir(dir);
+                *strrchr(dir, '/') = '\0';
+            }
+        }
+        rmdir(scratch);
+    }
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+// bench_scan.c
+//
+// End-to-end scan benchmark.  Generates a synthetic tree (bench_tree.h)
+// and scans it through the library in several configurations, reporting
+// entries per second and system calls per entry:
+//
+//   bench_scan [generator options, see gen_tree.c] [DIR]
+//
+// The tree goes into DIR (created, must be empty) or a temporary directory,
+// and is removed afterwards.  Scans are dry runs, so every configuration
+// sees the same tree.  Times are the best of a few runs over a warm cache;
+// system calls are counted in one extra run of each configuration under
+// ptrace (all threads), and show as "n/a" where ptrace is not allowed.
+// io_uring submissions count as the io_uring_enter() calls they take.
+//
+// Run it through meson: `meson test --benchmark -C build` (or run
+// build/bench_scan directly, e.g. with -d 5 for about 5.5 million entries).
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_tree.h"
+#include "symlinks.h"
+
+#define TIMED_RUNS 3
+
+struct scan_case {
+    const char* name;
+    int jobs; /* 0 = one per CPU */
+    int io_uring;
+    int index; /* replay from an index written by an earlier run */
+};
+
+static const struct scan_case cases[] = {
+    {"sequential", 1, 0, 0},
+    {"io_uring", 1, 1, 0},
+    {"parallel", 0, 0, 0},
+    {"parallel+io_uring", 0, 1, 0},
+    {"index replay", 1, 0, 1},
+};
+
+static char index_path[64];
+
+static void count_link(const struct symlinks_link* link, void* user) {
+    (void)link;
+    atomic_fetch_add((atomic_ullong*)user, 1);
+}
+
+static void print_error(const char* path, int err, const char* message, void* user) {
+    (void)path;
+    (void)err;
+    (void)user;
+    fprintf(stderr, "%s\n", message);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * run_case:
+ *   One scan of 'root' in configuration 'c'.  Returns the number of links
+ *   reported, and whether io_uring was in use in '*io_uring'.
+ */
+static unsigned long long run_case(const struct scan_case* c, const char* root, int* io_uring) {
+    atomic_ullong links = 0;
+    struct symlinks_options opts;
+    symlinks_options_init(&opts);
+    opts.recurse = 1;
+    opts.dry_run = 1;
+    opts.jobs = c->jobs ? c->jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts.jobs < 1) {
+        opts.jobs = 1;
+    }
+    opts.io_uring = c->io_uring;
+    opts.index_path = c->index ? index_path : NULL;
+    opts.on_link = count_link;
+    opts.on_error = print_error;
+    opts.user = &links;
+
+    struct symlinks_ctx* ctx = symlinks_new(&opts);
+    if (!ctx) {
+        fprintf(stderr, "Cannot set up the scan: %s\n", strerror(errno));
+        return 0;
+    }
+    struct symlinks_stats stats;
+    symlinks_stats(ctx, &stats);
+    *io_uring = stats.io_uring;
+    symlinks_scan(ctx, &root, 1);
+    symlinks_free(ctx);
+    return links;
+}
+
+/*
+ * count_syscalls:
+ *   Run 'c' in a child traced with ptrace, counting the system calls made
+ *   by all of its threads.  Returns -1 if tracing is not possible.
+ */
+static long long count_syscalls(const struct scan_case* c, const char* root) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            _exit(2);
+        }
+        raise(SIGSTOP);
+        int io_uring;
+        run_case(c, root, &io_uring);
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+        return -1;
+    }
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)options) != 0 || ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+
+    /* Every system call stops twice: on entry and on exit */
+    long long stops = 0;
+    int exit_code = -1;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) {
+            break; /* every thread is gone */
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid) {
+                exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            }
+            continue;
+        }
+        int sig = 0;
+        int stopsig = WSTOPSIG(status);
+        if (stopsig == (SIGTRAP | 0x80)) {
+            stops++;
+        }
+        else if (stopsig != SIGTRAP && stopsig != SIGSTOP) {
+            sig = stopsig; /* not ours: deliver it */
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void*)(long)sig);
+    }
+    return exit_code == 0 ? stops / 2 : -1;
+}
+
+static int backdate_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)ftw;
+    if (type == FTW_D) {
+        struct timespec times[2] = {{0, UTIME_OMIT}, {time(NULL) - 60, 0}};
+        utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    struct tree_spec spec;
+    tree_spec_init(&spec);
+    int first = tree_spec_parse(&spec, argc, argv);
+    if (first < 0 || first < argc - 1) {
+        fprintf(stderr, "Usage: %s [-d depth] [-f fanout] [-F files] [-l links]\n"
+                        "       [-a absolute] [-m messy] [-g dangling] [-c chained] [-s seed] [DIR]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char root[PATH_MAX];
+    if (first < argc) {
+        snprintf(root, sizeof(root), "%s", argv[first]);
+        if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Cannot create %s: %s\n", root, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        snprintf(root, sizeof(root), "/tmp/bench_scan-XXXXXX");
+        if (!mkdtemp(root)) {
+            fprintf(stderr, "Cannot create a temporary directory: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct tree_counts counts;
+    double start = now_ns();
+    if (tree_generate(root, &spec, &counts) != 0) {
+        tree_remove(root);
+        return EXIT_FAILURE;
+    }
+    unsigned long long entries = counts.dirs + counts.files + counts.links;
+    printf("tree: %llu entries (%llu directories, %llu links) generated in %.0f ms\n", entries,
+           (unsigned long long)counts.dirs, (unsigned long long)counts.links, (now_ns() - start) / 1e6);
+
+    /* Directories changed within the last second are never indexed */
+    nftw(root, backdate_entry, 64, FTW_PHYS);
+
+    int fd;
+    snprintf(index_path, sizeof(index_path), "/tmp/bench_scan-index-XXXXXX");
+    if ((fd = mkstemp(index_path)) >= 0) {
+        close(fd);
+        unlink(index_path);
+    }
+
+    int failed = 0;
+    printf("%-20s %12s %14s %14s\n", "configuration", "ms", "entries/s", "syscalls/entry");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const struct scan_case* c = &cases[i];
+        int io_uring = 0;
+
+        /* Warm up (and, for the index case, write the index) */
+        run_case(c, root, &io_uring);
+
+        double best = 0;
+        for (int run = 0; run < TIMED_RUNS; run++) {
+            double t0 = now_ns();
+            unsigned long long links = run_case(c, root, &io_uring);
+            double elapsed = now_ns() - t0;
+            if (run == 0 || elapsed < best) {
+                best = elapsed;
+            }
+            if (links != counts.links) {
+                fprintf(stderr, "%s: %llu links reported, %llu expected\n", c->name, links,
+                        (unsigned long long)counts.links);
+                failed = 1;
+            }
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s%s", c->name, (c->io_uring && !io_uring) ? " (no io_uring)" : "");
+        long long syscalls = count_syscalls(c, root);
+        char per_entry[32];
+        if (syscalls < 0) {
+            snprintf(per_entry, sizeof(per_entry), "n/a");
+        }
+        else {
+            snprintf(per_entry, sizeof(per_entry), "%.3f", (double)syscalls / (double)entries);
+        }
+        printf("%-20s %12.1f %14.0f %14s\n", name, best / 1e6, (double)entries / (best / 1e9), per_entry);
+    }
+
+    unlink(index_path);
+    tree_remove(root);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
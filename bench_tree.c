@@ -0,0 +1,324 @@
+// bench_tree.c
+//
+// Synthetic symlink trees for the benchmarks; see bench_tree.h.
+
+#define _GNU_SOURCE
+
+#include "bench_tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+void tree_spec_init(struct tree_spec* spec) {
+    spec->depth = 3;
+    spec->fanout = 10;
+    spec->files = 10;
+    spec->links = 40;
+    spec->absolute = 0.20;
+    spec->messy = 0.10;
+    spec->dangling = 0.05;
+    spec->chained = 0.10;
+    spec->seed = 1;
+}
+
+static int parse_count(const char* arg, unsigned* out) {
+    char* end = NULL;
+    errno = 0;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (!*arg || *end || errno || v > 1000000) {
+        return -1;
+    }
+    *out = (unsigned)v;
+    return 0;
+}
+
+static int parse_fraction(const char* arg, double* out) {
+    char* end = NULL;
+    double v = strtod(arg, &end);
+    if (!*arg || *end || !(v >= 0.0 && v <= 1.0)) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+int tree_spec_parse(struct tree_spec* spec, int argc, char** argv) {
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+d:f:F:l:a:m:g:c:s:")) != -1) {
+        int bad = 0;
+        switch (opt) {
+            case 'd':
+                bad = parse_count(optarg, &spec->depth);
+                break;
+            case 'f':
+                bad = parse_count(optarg, &spec->fanout);
+                break;
+            case 'F':
+                bad = parse_count(optarg, &spec->files);
+                break;
+            case 'l':
+                bad = parse_count(optarg, &spec->links);
+                break;
+            case 'a':
+                bad = parse_fraction(optarg, &spec->absolute);
+                break;
+            case 'm':
+                bad = parse_fraction(optarg, &spec->messy);
+                break;
+            case 'g':
+                bad = parse_fraction(optarg, &spec->dangling);
+                break;
+            case 'c':
+                bad = parse_fraction(optarg, &spec->chained);
+                break;
+            case 's': {
+                char* end = NULL;
+                spec->seed = strtoull(optarg, &end, 10);
+                bad = (!*optarg || *end);
+                break;
+            }
+            default:
+                return -1;
+        }
+        if (bad) {
+            fprintf(stderr, "Invalid value for -%c: %s\n", opt, optarg);
+            return -1;
+        }
+    }
+
+    if (spec->absolute + spec->messy + spec->dangling + spec->chained > 1.0 + 1e-9) {
+        fprintf(stderr, "The link fractions add up to more than 1.\n");
+        return -1;
+    }
+    if (spec->links > 0 && spec->files == 0) {
+        fprintf(stderr, "Links need at least one file per directory to point at (-F).\n");
+        return -1;
+    }
+    if (spec->depth > 64 || tree_spec_entries(spec) > 1000000000ull) {
+        fprintf(stderr, "The tree would be too large.\n");
+        return -1;
+    }
+    return optind;
+}
+
+uint64_t tree_spec_entries(const struct tree_spec* spec) {
+    /* Directories other than the root, saturating rather than overflowing */
+    uint64_t dirs = 0;
+    uint64_t level = 1;
+    for (unsigned i = 0; i < spec->depth; i++) {
+        level *= spec->fanout;
+        dirs += level;
+        if (level > UINT32_MAX || dirs > UINT32_MAX) {
+            return UINT64_MAX;
+        }
+    }
+    return dirs + (dirs + 1) * ((uint64_t)spec->files + spec->links);
+}
+
+/* xorshift64*: small, fast and the same everywhere */
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static double random_fraction(uint64_t* state) {
+    return (double)(next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct generator {
+    const struct tree_spec* spec;
+    struct tree_counts* counts;
+    uint64_t state;
+    unsigned* good_links; /* links of the current directory that resolve */
+    char path[PATH_MAX];  /* absolute path of the current directory */
+};
+
+/*
+ * append_up:
+ *   Append 'up' "../" components (as "..//" when 'messy') at 'p'.
+ */
+static char* append_up(char* p, unsigned up, int messy) {
+    for (unsigned i = 0; i < up; i++) {
+        memcpy(p, messy ? "..//" : "../", messy ? 4 : 3);
+        p += messy ? 4 : 3;
+    }
+    return p;
+}
+
+/*
+ * make_target:
+ *   Pick the kind of the next link of the directory at 'level' and build
+ *   its value in 'out'.  Returns 1 if the link will resolve.
+ */
+static int make_target(struct generator* g, unsigned level, unsigned nlinks_good, char* out, size_t out_size) {
+    const struct tree_spec* spec = g->spec;
+    double r = random_fraction(&g->state);
+    unsigned up = (unsigned)(next_random(&g->state) % (level + 1));
+    unsigned file = (unsigned)(next_random(&g->state) % spec->files);
+    char* p = out;
+
+    if (r < spec->absolute) {
+        /* The ancestor 'up' levels above is a prefix of our own path */
+        size_t len = strlen(g->path);
+        for (unsigned i = 0; i < up; i++) {
+            while (len > 0 && g->path[len - 1] != '/') {
+                len--;
+            }
+            len--;
+        }
+        snprintf(out, out_size, "%.*s/f%u", (int)len, g->path, file);
+        g->counts->absolute++;
+        return 1;
+    }
+    r -= spec->absolute;
+
+    if (r < spec->messy) {
+        memcpy(p, "./", 2);
+        p += 2;
+        if (up > 0) {
+            /* Up into the parent, back down into ourselves, and up again */
+            const char* self = strrchr(g->path, '/') + 1;
+            p += sprintf(p, "../%s/../", self);
+            p = append_up(p, up - 1, 1);
+        }
+        sprintf(p, ".//f%u", file);
+        g->counts->messy++;
+        return 1;
+    }
+    r -= spec->messy;
+
+    if (r < spec->dangling) {
+        if (file & 1) {
+            sprintf(p, "missing%u", file);
+        }
+        else {
+            p = append_up(p, up, 0);
+            sprintf(p, "gone/f%u", file);
+        }
+        g->counts->dangling++;
+        return 0;
+    }
+    r -= spec->dangling;
+
+    if (r < spec->chained && nlinks_good > 0) {
+        sprintf(p, "l%u", g->good_links[next_random(&g->state) % nlinks_good]);
+        g->counts->chained++;
+        return 1;
+    }
+
+    p = append_up(p, up, 0);
+    sprintf(p, "f%u", file);
+    return 1;
+}
+
+/*
+ * generate_dir:
+ *   Fill the directory open as 'dirfd' (path in g->path) at 'level', then
+ *   its subdirectories.
+ */
+static int generate_dir(struct generator* g, int dirfd, unsigned level) {
+    const struct tree_spec* spec = g->spec;
+    char name[32];
+
+    for (unsigned i = 0; i < spec->files; i++) {
+        snprintf(name, sizeof(name), "f%u", i);
+        if (mknodat(dirfd, name, S_IFREG | 0644, 0) != 0) {
+            fprintf(stderr, "Cannot create %s/%s: %s\n", g->path, name, strerror(errno));
+            return -1;
+        }
+        g->counts->files++;
+    }
+
+    unsigned nlinks_good = 0;
+    for (unsigned i = 0; i < spec->links; i++) {
+        char target[PATH_MAX];
+        int good = make_target(g, level, nlinks_good, target, sizeof(target));
+        snprintf(name, sizeof(name), "l%u", i);
+        if (symlinkat(target, dirfd, name) != 0) {
+            fprintf(stderr, "Cannot create %s/%s: %s\n", g->path, name, strerror(errno));
+            return -1;
+        }
+        if (good) {
+            g->good_links[nlinks_good++] = i;
+        }
+        g->counts->links++;
+    }
+
+    if (level == spec->depth) {
+        return 0;
+    }
+    size_t len = strlen(g->path);
+    for (unsigned i = 0; i < spec->fanout; i++) {
+        snprintf(name, sizeof(name), "d%u", i);
+        if (mkdirat(dirfd, name, 0755) != 0) {
+            fprintf(stderr, "Cannot create %s/%s: %s\n", g->path, name, strerror(errno));
+            return -1;
+        }
+        g->counts->dirs++;
+        int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open %s/%s: %s\n", g->path, name, strerror(errno));
+            return -1;
+        }
+        snprintf(g->path + len, sizeof(g->path) - len, "/%s", name);
+        int rc = generate_dir(g, fd, level + 1);
+        g->path[len] = '\0';
+        close(fd);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int tree_generate(const char* root, const struct tree_spec* spec, struct tree_counts* counts) {
+    struct generator g;
+    memset(&g, 0, sizeof(g));
+    memset(counts, 0, sizeof(*counts));
+    g.spec = spec;
+    g.counts = counts;
+    g.state = spec->seed * 0x9e3779b97f4a7c15ull + 1; /* never zero */
+
+    if (!realpath(root, g.path)) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+    int fd = open(g.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", g.path, strerror(errno));
+        return -1;
+    }
+    g.good_links = calloc(spec->links + 1, sizeof(*g.good_links));
+    int rc = g.good_links ? generate_dir(&g, fd, 0) : -1;
+    free(g.good_links);
+    close(fd);
+    return rc;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+void tree_remove(const char* root) {
+    nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
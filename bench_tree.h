@@ -0,0 +1,82 @@
+#ifndef SYMLINKS_BENCH_TREE_H
+#define SYMLINKS_BENCH_TREE_H
+
+/*
+ * Deterministic synthetic symlink trees for the benchmarks (gen_tree,
+ * bench_scan).
+ *
+ * The tree is a complete 'fanout'-ary directory tree 'depth' levels deep.
+ * Every directory holds 'files' regular files f0, f1, ... and 'links'
+ * symlinks l0, l1, ...  Each link is, with the given probabilities:
+ *
+ *   absolute  an absolute path to a file in its directory or an ancestor
+ *   messy     a relative path to such a file, with "//", "./" and "sub/.."
+ *   dangling  a relative path to a name that does not exist
+ *   chained   a link to an earlier, non-dangling link of its directory
+ *   relative  (the rest) a clean relative path to such a file
+ *
+ * The same spec and seed always produce the same tree.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct tree_spec {
+    unsigned depth;  /* directory levels below the root */
+    unsigned fanout; /* subdirectories per directory */
+    unsigned files;  /* regular files per directory */
+    unsigned links;  /* symlinks per directory */
+    double absolute; /* fractions of the links; the rest are clean relative links */
+    double messy;
+    double dangling;
+    double chained;
+    uint64_t seed;
+};
+
+struct tree_counts {
+    uint64_t dirs;
+    uint64_t files;
+    uint64_t links;
+    uint64_t absolute;
+    uint64_t messy;
+    uint64_t dangling;
+    uint64_t chained;
+};
+
+/*
+ * tree_spec_init:
+ *   The defaults: depth 3, fan-out 10, 10 files and 40 links per
+ *   directory (about 56000 entries), 20% absolute, 10% messy, 5% dangling
+ *   and 10% chained links.
+ */
+void tree_spec_init(struct tree_spec* spec);
+
+/*
+ * tree_spec_parse:
+ *   Apply the generator options in argv (-d depth, -f fanout, -F files,
+ *   -l links, -a absolute, -m messy, -g dangling, -c chained, -s seed)
+ *   to 'spec'.  Returns the index of the first other argument, or -1 after
+ *   reporting an invalid option.
+ */
+int tree_spec_parse(struct tree_spec* spec, int argc, char** argv);
+
+/*
+ * tree_spec_entries:
+ *   Number of entries (directories, files and links) the spec produces.
+ */
+uint64_t tree_spec_entries(const struct tree_spec* spec);
+
+/*
+ * tree_generate:
+ *   Create the tree under 'root', which must exist and be empty.
+ *   Returns 0, or -1 after reporting the error.
+ */
+int tree_generate(const char* root, const struct tree_spec* spec, struct tree_counts* counts);
+
+/*
+ * tree_remove:
+ *   Delete everything below 'root', and 'root' itself.
+ */
+void tree_remove(const char* root);
+
+#endif
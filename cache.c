@@ -0,0 +1,206 @@
+#include "cache.h"
+#include "path.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Chained hash table whose entries are also threaded on an LRU list
+ * (most recently used at the head).  A single mutex protects both; the
+ * critical sections are a hash probe and a few pointer swaps.
+ */
+struct cache_entry {
+    struct cache_entry* next_hash;
+    struct cache_entry* lru_prev;
+    struct cache_entry* lru_next;
+    uint64_t hash;
+    struct target_info info;
+    char key[];
+};
+
+struct target_cache {
+    pthread_mutex_t lock;
+    struct cache_entry** buckets;
+    size_t nbuckets; /* power of two */
+    size_t count;
+    size_t capacity;
+    struct cache_entry* lru_head;
+    struct cache_entry* lru_tail;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+static void lru_unlink(struct target_cache* cache, struct cache_entry* e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    }
+    else {
+        cache->lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    }
+    else {
+        cache->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(struct target_cache* cache, struct cache_entry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = e;
+    }
+    cache->lru_head = e;
+    if (!cache->lru_tail) {
+        cache->lru_tail = e;
+    }
+}
+
+/*
+ * find_slot:
+ *   Returns the link pointing at the entry for 'key' (or at the NULL ending
+ *   its bucket chain), so callers can both test and unlink.
+ */
+static struct cache_entry** find_slot(struct target_cache* cache, const char* key, uint64_t hash) {
+    struct cache_entry** slot = &cache->buckets[hash & (cache->nbuckets - 1)];
+    while (*slot && ((*slot)->hash != hash || strcmp((*slot)->key, key) != 0)) {
+        slot = &(*slot)->next_hash;
+    }
+    return slot;
+}
+
+static void remove_entry(struct target_cache* cache, struct cache_entry** slot) {
+    struct cache_entry* e = *slot;
+    *slot = e->next_hash;
+    lru_unlink(cache, e);
+    free(e);
+    cache->count--;
+}
+
+struct target_cache* target_cache_new(size_t capacity) {
+    struct target_cache* cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    /* Keep the load factor at or below 1 */
+    size_t nbuckets = 16;
+    while (nbuckets < capacity) {
+        nbuckets *= 2;
+    }
+    cache->buckets = calloc(nbuckets, sizeof(*cache->buckets));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    cache->nbuckets = nbuckets;
+    cache->capacity = capacity;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void target_cache_free(struct target_cache* cache) {
+    if (!cache) {
+        return;
+    }
+    struct cache_entry* e = cache->lru_head;
+    while (e) {
+        struct cache_entry* next = e->lru_next;
+        free(e);
+        e = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+int target_cache_lookup(struct target_cache* cache, const char* key, struct target_info* out) {
+    uint64_t hash = hash_path(key, strlen(key));
+    int found = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry* e = *find_slot(cache, key, hash);
+    if (e) {
+        *out = e->info;
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        cache->hits++;
+        found = 1;
+    }
+    else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+void target_cache_insert(struct target_cache* cache, const char* key, const struct target_info* info) {
+    size_t key_len = strlen(key);
+    uint64_t hash = hash_path(key, key_len);
+
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry** slot = find_slot(cache, key, hash);
+    if (*slot) {
+        /* Another thread got here first; refresh it */
+        (*slot)->info = *info;
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    struct cache_entry* e = malloc(sizeof(*e) + key_len + 1);
+    if (!e) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    memcpy(e->key, key, key_len + 1);
+    e->hash = hash;
+    e->info = *info;
+    e->next_hash = NULL;
+    *slot = e;
+    lru_push_front(cache, e);
+    cache->count++;
+
+    if (cache->count > cache->capacity) {
+        struct cache_entry* victim = cache->lru_tail;
+        remove_entry(cache, find_slot(cache, victim->key, victim->hash));
+        cache->evictions++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void target_cache_forget(struct target_cache* cache, const char* key) {
+    uint64_t hash = hash_path(key, strlen(key));
+
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry** slot = find_slot(cache, key, hash);
+    if (*slot) {
+        remove_entry(cache, slot);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void target_cache_clear(struct target_cache* cache) {
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry* e = cache->lru_head;
+    while (e) {
+        struct cache_entry* next = e->lru_next;
+        free(e);
+        e = next;
+    }
+    memset(cache->buckets, 0, cache->nbuckets * sizeof(*cache->buckets));
+    cache->lru_head = cache->lru_tail = NULL;
+    cache->count = 0;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void target_cache_counters(struct target_cache* cache, size_t* hits, size_t* misses, size_t* evictions) {
+    pthread_mutex_lock(&cache->lock);
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *evictions = cache->evictions;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,65 @@
+#ifndef SYMLINKS_CACHE_H
+#define SYMLINKS_CACHE_H
+
+/*
+ * Bounded LRU cache of link-target lookups, shared by all scanning threads.
+ * Keys are absolute target paths; see target_cache_key() in symlinks.c.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * target_info:
+ *   What a link's target resolved to: errno from the stat (0 if it exists),
+ *   and the target's device and type.  'links' counts the links followed
+ *   from the target path to get there: 0 unless the target is itself a
+ *   link.  A link whose target cannot be resolved for a loop has ELOOP.
+ */
+struct target_info {
+    int err;
+    dev_t dev;
+    mode_t mode;
+    unsigned links;
+};
+
+struct target_cache;
+
+/*
+ * target_cache_new:
+ *   Create a cache holding at most 'capacity' targets (must be > 0).
+ *   Returns NULL if out of memory.
+ */
+struct target_cache* target_cache_new(size_t capacity);
+
+void target_cache_free(struct target_cache* cache);
+
+/*
+ * target_cache_lookup:
+ *   Returns 1 and fills 'out' if 'key' is cached, 0 otherwise.
+ */
+int target_cache_lookup(struct target_cache* cache, const char* key, struct target_info* out);
+
+/*
+ * target_cache_insert:
+ *   Remember the lookup result for 'key', evicting the least recently
+ *   used entry when full.  Failing to allocate just skips caching.
+ */
+void target_cache_insert(struct target_cache* cache, const char* key, const struct target_info* info);
+
+/*
+ * target_cache_forget:
+ *   Drop 'key' if cached, after the link it names was deleted or rewritten.
+ */
+void target_cache_forget(struct target_cache* cache, const char* key);
+
+/*
+ * target_cache_clear:
+ *   Drop every entry, e.g. when the filesystem is known to have changed in
+ *   ways the cache cannot track.  The counters are kept.
+ */
+void target_cache_clear(struct target_cache* cache);
+
+void target_cache_counters(struct target_cache* cache, size_t* hits, size_t* misses, size_t* evictions);
+
+#endif
@@ -0,0 +1,307 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Names of the counters in the file, by enum stats_counter */
+static const char* const counter_names[STATS_NCOUNTERS] = {
+    "directories", "entries", "links",   "dangling", "loops",   "other_fs",   "absolute",
+    "messy",       "chained", "relative", "changed", "deleted", "path_bytes",
+};
+
+void checkpoint_init(struct checkpoint* cp) {
+    memset(cp, 0, sizeof(*cp));
+}
+
+/*
+ * add_field:
+ *   Append one NUL-terminated field of 'len' bytes.
+ */
+static void add_field(struct checkpoint* cp, const char* s, size_t len) {
+    if (cp->out_of_memory) {
+        return;
+    }
+    if (cp->len + len + 1 > cp->cap) {
+        size_t cap = cp->cap ? cp->cap : 65536;
+        while (cap < cp->len + len + 1) {
+            cap *= 2;
+        }
+        char* data = realloc(cp->data, cap);
+        if (!data) {
+            cp->out_of_memory = 1;
+            return;
+        }
+        cp->data = data;
+        cp->cap = cap;
+    }
+    memcpy(cp->data + cp->len, s, len);
+    cp->data[cp->len + len] = '\0';
+    cp->len += len + 1;
+}
+
+static void add_string(struct checkpoint* cp, const char* s) {
+    add_field(cp, s, strlen(s));
+}
+
+static void add_number(struct checkpoint* cp, uint64_t n) {
+    char buf[24];
+    add_field(cp, buf, (size_t)snprintf(buf, sizeof(buf), "%" PRIu64, n));
+}
+
+void checkpoint_add_option(struct checkpoint* cp, const char* name, const char* value) {
+    add_string(cp, "option");
+    add_string(cp, name);
+    add_string(cp, value);
+}
+
+void checkpoint_add_counters(struct checkpoint* cp, const uint64_t counters[STATS_NCOUNTERS]) {
+    for (int i = 0; i < STATS_NCOUNTERS; i++) {
+        add_string(cp, "counter");
+        add_string(cp, counter_names[i]);
+        add_number(cp, counters[i]);
+    }
+}
+
+void checkpoint_add_root(struct checkpoint* cp, const char* path) {
+    add_string(cp, "root");
+    add_string(cp, path);
+}
+
+void checkpoint_add_dir(struct checkpoint* cp, const char* path, size_t path_len, uint64_t dev, uint64_t ino,
+                        uint64_t base_dev, int depth, const struct checkpoint_cursor* cursor) {
+    add_string(cp, "dir");
+    add_field(cp, path, path_len);
+    add_number(cp, dev);
+    add_number(cp, ino);
+    add_number(cp, base_dev);
+    add_number(cp, (uint64_t)depth);
+    add_number(cp, cursor->off);
+    add_number(cp, cursor->skip);
+    add_number(cp, (uint64_t)cursor->replayed);
+}
+
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int checkpoint_save(const struct checkpoint* cp, const char* path, char* error, size_t error_size) {
+    if (cp->out_of_memory) {
+        snprintf(error, error_size, "Out of memory building checkpoint; %s left unchanged.", path);
+        return -1;
+    }
+
+    size_t tmp_len = strlen(path) + 32;
+    char* tmp = malloc(tmp_len);
+    if (!tmp) {
+        snprintf(error, error_size, "Out of memory saving checkpoint %s", path);
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        snprintf(error, error_size, "Cannot create checkpoint %s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    int ok = write_all(fd, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) == 0 &&
+             write_all(fd, cp->data, cp->len) == 0 && fsync(fd) == 0;
+    int saved_errno = errno;
+    if (close(fd) != 0 && ok) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    if (ok && rename(tmp, path) != 0) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    if (!ok) {
+        snprintf(error, error_size, "Cannot write checkpoint %s: %s", path, strerror(saved_errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * read_all:
+ *   Read the regular file open as 'fd' into a NUL-terminated heap buffer.
+ *   Returns NULL with errno set on error.
+ */
+static char* read_all(int fd, size_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    char* buf = malloc((size_t)st.st_size + 1);
+    if (!buf) {
+        return NULL;
+    }
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + len, (size_t)st.st_size - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            int err = (n < 0) ? errno : EIO;
+            free(buf);
+            errno = err;
+            return NULL;
+        }
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    *size = len;
+    return buf;
+}
+
+static int parse_number(const char* s, uint64_t* out) {
+    char* end;
+    if (*s < '0' || *s > '9') {
+        return -1;
+    }
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (*end || errno) {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+/*
+ * parse_record:
+ *   Parse the record starting at 'fields[0]' into 'cp', taking as many of
+ *   the 'nfields' as it has.  Returns the number taken, or 0 if invalid.
+ */
+static size_t parse_record(struct checkpoint* cp, char** fields, size_t nfields) {
+    if (!strcmp(fields[0], "option") && nfields >= 3) {
+        cp->options[cp->noptions].name = fields[1];
+        cp->options[cp->noptions].value = fields[2];
+        cp->noptions++;
+        return 3;
+    }
+    if (!strcmp(fields[0], "counter") && nfields >= 3) {
+        uint64_t value;
+        if (parse_number(fields[2], &value) != 0) {
+            return 0;
+        }
+        for (int i = 0; i < STATS_NCOUNTERS; i++) {
+            if (!strcmp(fields[1], counter_names[i])) {
+                cp->counters[i] = value;
+            }
+        }
+        return 3; /* one from a later version is skipped */
+    }
+    struct checkpoint_entry* e = &cp->entries[cp->count];
+    memset(e, 0, sizeof(*e));
+    if (!strcmp(fields[0], "root") && nfields >= 2 && fields[1][0] == '/') {
+        e->path = fields[1];
+        e->is_root = 1;
+        cp->count++;
+        return 2;
+    }
+    if (!strcmp(fields[0], "dir") && nfields >= 9 && fields[1][0] == '/') {
+        uint64_t depth, replayed;
+        e->path = fields[1];
+        if (parse_number(fields[2], &e->dev) != 0 || parse_number(fields[3], &e->ino) != 0 ||
+            parse_number(fields[4], &e->base_dev) != 0 || parse_number(fields[5], &depth) != 0 ||
+            parse_number(fields[6], &e->cursor.off) != 0 || parse_number(fields[7], &e->cursor.skip) != 0 ||
+            parse_number(fields[8], &replayed) != 0 || depth > INT32_MAX || replayed > 1) {
+            return 0;
+        }
+        e->depth = (int)depth;
+        e->cursor.replayed = (int)replayed;
+        cp->count++;
+        return 9;
+    }
+    return 0;
+}
+
+int checkpoint_load(const char* path, struct checkpoint* cp, char* error, size_t error_size) {
+    checkpoint_init(cp);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(error, error_size, "Cannot open checkpoint %s: %s", path, strerror(errno));
+        return -1;
+    }
+    size_t size = 0;
+    cp->data = read_all(fd, &size);
+    int err = errno;
+    close(fd);
+    if (!cp->data) {
+        snprintf(error, error_size, "Cannot read checkpoint %s: %s", path, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    size_t magic_len = strlen(CHECKPOINT_MAGIC);
+    if (size < magic_len || memcmp(cp->data, CHECKPOINT_MAGIC, magic_len) != 0) {
+        snprintf(error, error_size, "%s is not a symlinks checkpoint.", path);
+        checkpoint_free(cp);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t nfields = 0;
+    for (size_t i = magic_len; i < size; i++) {
+        nfields += (cp->data[i] == '\0');
+    }
+    char** fields = malloc((nfields + 1) * sizeof(*fields));
+    cp->entries = calloc(nfields / 2 + 1, sizeof(*cp->entries));
+    cp->options = calloc(nfields / 3 + 1, sizeof(*cp->options));
+    if (!fields || !cp->entries || !cp->options) {
+        snprintf(error, error_size, "Out of memory reading checkpoint %s", path);
+        free(fields);
+        checkpoint_free(cp);
+        errno = ENOMEM;
+        return -1;
+    }
+    char* p = cp->data + magic_len;
+    for (size_t i = 0; i < nfields; i++) {
+        fields[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    int ok = (size == magic_len || cp->data[size - 1] == '\0');
+    for (size_t i = 0; ok && i < nfields;) {
+        size_t taken = parse_record(cp, fields + i, nfields - i);
+        ok = (taken > 0);
+        i += taken;
+    }
+    free(fields);
+    if (!ok) {
+        snprintf(error, error_size, "Checkpoint %s is truncated or corrupt.", path);
+        checkpoint_free(cp);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void checkpoint_free(struct checkpoint* cp) {
+    free(cp->data);
+    free(cp->entries);
+    free(cp->options);
+    checkpoint_init(cp);
+}
@@ -0,0 +1,102 @@
+#ifndef SYMLINKS_CHECKPOINT_H
+#define SYMLINKS_CHECKPOINT_H
+
+/*
+ * Scan checkpoints (--checkpoint FILE / --resume FILE).
+ *
+ * A checkpoint is the frontier of an unfinished scan: the arguments and
+ * directories still to scan, each directory with a cursor saying how far
+ * it was read, the scan's counters, and the options it must be resumed
+ * with.  Format: the line CHECKPOINT_MAGIC, then records of NUL-terminated
+ * fields, the first naming the record:
+ *
+ *   "option"   name value  in the order the scan lists them
+ *   "counter"  name value
+ *   "root"     path       an argument not looked at yet
+ *   "dir"      path dev ino base_dev depth off skip replayed
+ *
+ * Numbers are decimal.  A directory not opened yet has 'dev' and 'ino' 0
+ * and is scanned from its start.  For one being read, 'off' is the
+ * telldir() position after the last entry handled (0 for none) and 'skip'
+ * the entries handled past it: of its current --inode-order chunk, or, if
+ * 'replayed', of its entries in the index.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+#define CHECKPOINT_MAGIC "symlinks-checkpoint 1\n"
+
+struct checkpoint_cursor {
+    uint64_t off;
+    uint64_t skip;
+    int replayed;
+};
+
+struct checkpoint_option {
+    const char* name;
+    const char* value;
+};
+
+struct checkpoint_entry {
+    const char* path;
+    int is_root; /* a scan argument; the rest is unused */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t base_dev;
+    int depth;
+    struct checkpoint_cursor cursor;
+};
+
+/*
+ * checkpoint:
+ *   Built record by record and saved, or loaded.  When loaded, 'data' is
+ *   the whole file and the entries point into it.
+ */
+struct checkpoint {
+    char* data;
+    size_t len;
+    size_t cap;
+    int out_of_memory;
+    struct checkpoint_entry* entries;
+    size_t count;
+    struct checkpoint_option* options;
+    size_t noptions;
+    uint64_t counters[STATS_NCOUNTERS];
+};
+
+/* Start an empty checkpoint */
+void checkpoint_init(struct checkpoint* cp);
+
+void checkpoint_add_option(struct checkpoint* cp, const char* name, const char* value);
+
+void checkpoint_add_counters(struct checkpoint* cp, const uint64_t counters[STATS_NCOUNTERS]);
+
+void checkpoint_add_root(struct checkpoint* cp, const char* path);
+
+/*
+ * checkpoint_add_dir:
+ *   Add the directory of the first 'path_len' bytes of 'path'.
+ */
+void checkpoint_add_dir(struct checkpoint* cp, const char* path, size_t path_len, uint64_t dev, uint64_t ino,
+                        uint64_t base_dev, int depth, const struct checkpoint_cursor* cursor);
+
+/*
+ * checkpoint_save:
+ *   Atomically replace the file at 'path' with the records added.  Returns
+ *   0, or -1 with a message in 'error'.
+ */
+int checkpoint_save(const struct checkpoint* cp, const char* path, char* error, size_t error_size);
+
+/*
+ * checkpoint_load:
+ *   Read the checkpoint at 'path'.  Returns 0, or -1 with errno set and a
+ *   message in 'error'.
+ */
+int checkpoint_load(const char* path, struct checkpoint* cp, char* error, size_t error_size);
+
+void checkpoint_free(struct checkpoint* cp);
+
+#endif
@@ -0,0 +1,845 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* syscall() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "symlinks.h"
+
+/*
+ * The command-line tool on top of the library: option parsing, the report
+ * lines or records, plans, and signals.
+ */
+
+/* Reporting state shared by the callbacks */
+struct cli {
+    int verbose;            /* -v */
+    int convert;            /* -c: absolute links are not listed as such */
+    struct output* output;  /* --format=jsonl|nul; NULL for the classic text lines */
+    struct output* plan;    /* --plan FILE: changes are written here instead of being made */
+};
+
+/* ioprio_set(2), for which the C library has no wrapper */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_IDLE (3 << 13) /* class 3 in the top bits */
+
+static volatile sig_atomic_t g_stop_watching = 0;
+
+static void stop_watching(int sig) {
+    (void)sig;
+    g_stop_watching = 1;
+}
+
+/*
+ * print_link:
+ *   The classic text lines for one link: its class with -v, then what was
+ *   done to it.  Both come from one printf(), so lines from concurrent
+ *   workers (-j) never interleave.
+ */
+static void print_link(const struct cli* cli, const struct symlinks_link* link) {
+    const char* label = NULL;
+    char chained[48];
+    if (cli->verbose) {
+        if (!strcmp(link->cls, "dangling")) {
+            label = "dangling: ";
+        }
+        else if (!strcmp(link->cls, "loop")) {
+            label = "loop: ";
+        }
+        else if (!strcmp(link->cls, "other_fs")) {
+            label = "other_fs: ";
+        }
+        else if (!strcmp(link->cls, "absolute")) {
+            label = cli->convert ? NULL : "absolute: ";
+        }
+        else if (!strcmp(link->cls, "messy")) {
+            label = "relative (messy/shortened): ";
+        }
+        else if (!strcmp(link->cls, "chained")) {
+            snprintf(chained, sizeof(chained), "chained (%d links): ", link->chain);
+            label = chained;
+        }
+        else {
+            label = "relative: ";
+        }
+    }
+
+    const char* done = NULL;
+    const char* value = link->target;
+    if (!strcmp(link->action, "deleted")) {
+        done = "deleted:  ";
+    }
+    else if (!strcmp(link->action, "would_delete")) {
+        done = "(test) would delete: ";
+    }
+    else if (!strcmp(link->action, "changed")) {
+        done = "changed:  ";
+        value = link->new_target;
+    }
+    else if (!strcmp(link->action, "would_change")) {
+        done = "(test) would change: ";
+        value = link->new_target;
+    }
+
+    if (label && done) {
+        printf("%s%s -> %s\n%s%s -> %s\n", label, link->path, link->target, done, link->path, value);
+    }
+    else if (label) {
+        printf("%s%s -> %s\n", label, link->path, link->target);
+    }
+    else if (done) {
+        printf("%s%s -> %s\n", done, link->path, value);
+    }
+}
+
+/*
+ * report_link:
+ *   Link callback: print the link or emit its record, and plan it.
+ */
+static void report_link(const struct symlinks_link* link, void* arg) {
+    struct cli* cli = arg;
+    if (cli->output) {
+        output_record(cli->output, link);
+    }
+    else {
+        print_link(cli, link);
+    }
+    if (cli->plan && (!strcmp(link->action, "would_delete") ||
+                      (!strcmp(link->action, "would_change") && strcmp(link->new_target, link->target) != 0))) {
+        output_record(cli->plan, link);
+    }
+}
+
+/*
+ * flush_reports:
+ *   Checkpoint callback: the links reported so far must be out before the
+ *   checkpoint that skips them is saved.
+ */
+static void flush_reports(void* arg) {
+    struct cli* cli = arg;
+    fflush(stdout);
+    if (cli->output) {
+        output_flush(cli->output);
+    }
+}
+
+static void report_error(const char* path, int err, const char* message, void* arg) {
+    (void)path;
+    (void)err;
+    (void)arg;
+    fprintf(stderr, "%s\n", message);
+}
+
+/*
+ * progress:
+ *   The --progress thread, which samples the scan counters every
+ *   'interval' seconds until told to stop.
+ */
+struct progress {
+    const struct symlinks_ctx* ctx;
+    double interval;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int done;
+};
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void* progress_main(void* arg) {
+    struct progress* p = arg;
+    struct symlinks_stats prev;
+    symlinks_stats(p->ctx, &prev);
+    double prev_time = monotonic_seconds();
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        double next = (double)deadline.tv_nsec / 1e9 + p->interval;
+        deadline.tv_sec += (time_t)next;
+        deadline.tv_nsec = (long)((next - (double)(time_t)next) * 1e9);
+        int rc = 0;
+        while (!p->done && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&p->wake, &p->lock, &deadline);
+        }
+        if (p->done) {
+            break;
+        }
+
+        struct symlinks_stats now;
+        symlinks_stats(p->ctx, &now);
+        double now_time = monotonic_seconds();
+        double elapsed = now_time - prev_time;
+        fprintf(stderr, "progress: %llu directories, %llu entries, %llu links (%.0f directories/s, %.0f links/s)\n",
+                (unsigned long long)now.directories, (unsigned long long)now.entries,
+                (unsigned long long)now.links, (double)(now.directories - prev.directories) / elapsed,
+                (double)(now.links - prev.links) / elapsed);
+        prev = now;
+        prev_time = now_time;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/*
+ * progress_start:
+ *   Start reporting progress on 'ctx'.  Returns 0, or -1 if the thread
+ *   could not be started (the scan then runs without it).
+ */
+static int progress_start(struct progress* p, const struct symlinks_ctx* ctx, double interval) {
+    p->ctx = ctx;
+    p->interval = interval;
+    p->done = 0;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&p->thread, NULL, progress_main, p) != 0) {
+        pthread_cond_destroy(&p->wake);
+        pthread_mutex_destroy(&p->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void progress_stop(struct progress* p) {
+    pthread_mutex_lock(&p->lock);
+    p->done = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+}
+
+/*
+ * scan_archive:
+ *   --archive: examine the archive at 'path' and, with 'out_path', write
+ *   the result next to it under a temporary name first, renamed over
+ *   'out_path' once complete (so the input may also be the output).
+ *   Returns what symlinks_scan_archive() does.
+ */
+static int scan_archive(struct symlinks_ctx* ctx, const char* path, const char* out_path) {
+    int in_fd = strcmp(path, "-") ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (in_fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char tmp[PATH_MAX + 32];
+    int out_fd = -1;
+    if (out_path) {
+        snprintf(tmp, sizeof(tmp), "%s.symlinks-%ld", out_path, (long)getpid());
+        out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd < 0) {
+            fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+            if (in_fd != STDIN_FILENO) {
+                close(in_fd);
+            }
+            return -1;
+        }
+    }
+
+    int scanned = symlinks_scan_archive(ctx, in_fd, out_fd);
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        if (close(out_fd) != 0 && scanned >= 0) {
+            fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+            scanned = -1;
+        }
+        if (scanned >= 0 && rename(tmp, out_path) != 0) {
+            fprintf(stderr, "Cannot rename %s to %s: %s\n", tmp, out_path, strerror(errno));
+            scanned = -1;
+        }
+        if (scanned < 0) {
+            unlink(tmp);
+        }
+    }
+    return scanned;
+}
+
+/*
+ * print_usage:
+ *   Print usage help to stderr.
+ */
+static void print_usage(const char* progname) {
+    fprintf(stderr,
+            "\n"
+            "Usage: %s [OPTIONS] DIR...\n"
+            "Scan and fix symbolic links in the specified directories.\n\n"
+            "Version: %s\n"
+            "\n"
+            "Options:\n"
+            "  -c  Convert absolute or messy links to relative.\n"
+            "  -d  Delete dangling links (those pointing to nonexistent targets).\n"
+            "  -j N  Scan directories with N worker threads (0 = one per CPU).\n"
+            "  -o  Allow links across filesystems (otherwise just note 'other_fs').\n"
+            "  -r  Recurse into subdirectories.\n"
+            "  -s  Shorten links by removing unnecessary '../dir' sequences.\n"
+            "  --flatten  Point links to other links straight at the end of the chain.\n"
+            "  -t  Test mode: show what would be done with -c, but do not modify.\n"
+            "  -v  Verbose: show all symlinks, including relative.\n"
+            "  -x  Debug: display internal processing details.\n"
+            "  --io-uring  Batch target lookups through io_uring when the kernel allows it.\n"
+            "  --cache-size N  Remember up to N link targets (default 16384, 0 = off).\n"
+            "  --index FILE  Keep a directory index in FILE; unchanged directories are not re-read.\n"
+            "  --watch  After scanning, keep watching the directories and handle changes as they happen.\n"
+            "  --format=FMT  Report every link as a record: jsonl (JSON lines) or nul (NUL-separated fields).\n"
+            "  --plan FILE  Write the changes a scan would make to FILE instead of making them.\n"
+            "  --apply FILE  Make the changes planned in FILE (no DIR arguments).\n"
+            "  --from0 FILE  Examine the links listed in FILE (- for stdin), NUL-separated (no DIR arguments).\n"
+            "  --archive FILE  Examine the links inside a tar or cpio archive (- for stdin; no DIR arguments).\n"
+            "  --archive-out FILE  With --archive, write the archive with the links fixed to FILE.\n"
+            "  --stats[=counts]  Print counters, system call latencies and the slowest directories to stderr;\n"
+            "                with counts, only the counters, which is cheaper.\n"
+            "  --progress[=SECONDS]  Print scan progress to stderr every SECONDS (default 1).\n"
+            "  --inode-order[=N]  Handle each directory's entries in inode order, N at a time (default 16384).\n"
+            "  --exclude GLOB  Skip links and directories matching GLOB (name, or whole path if it has a '/').\n"
+            "  --include GLOB  Keep entries matching GLOB even if a later --exclude or --prune matches.\n"
+            "  --prune GLOB  Do not descend into directories matching GLOB.\n"
+            "  --nice-io[=OPS[,CHANGES]]  Idle I/O priority, at most OPS lookups and CHANGES fixes per second\n"
+            "                (default 2000,100; 0 = unlimited), backing off while the disk is busy.\n"
+            "  --checkpoint FILE  Save the scan's progress to FILE every 10 seconds, to resume it after a crash.\n"
+            "  --checkpoint-interval SECONDS  Save the checkpoint every SECONDS instead.\n"
+            "  --resume FILE  Continue the scan saved in FILE, with the same options (no DIR arguments).\n"
+            "  --summary[=DEPTH]  Instead of a line per link, print totals per class, the subtrees DEPTH levels\n"
+            "                below each DIR (default 1) with the most links, and the directories with the most\n"
+            "                dangling links.\n"
+            "\n"
+            "Examples:\n"
+            "  %s -r /path/to/dir       Recursively scan directories for symlinks\n"
+            "  %s -rc /path/to/dir      Convert absolute to relative while scanning\n"
+            "  %s -rd /path/to/dir      Remove dangling links during a recursive scan\n"
+            "\n",
+            progname, SYMLINKS_VERSION, progname, progname, progname);
+}
+
+/* Long-only options start above the range of short option characters */
+enum {
+    OPT_IO_URING = 256,
+    OPT_CACHE_SIZE,
+    OPT_INDEX,
+    OPT_WATCH,
+    OPT_FORMAT,
+    OPT_PLAN,
+    OPT_APPLY,
+    OPT_STATS,
+    OPT_PROGRESS,
+    OPT_FLATTEN,
+    OPT_EXCLUDE,
+    OPT_INCLUDE,
+    OPT_PRUNE,
+    OPT_INODE_ORDER,
+    OPT_FROM0,
+    OPT_ARCHIVE,
+    OPT_ARCHIVE_OUT,
+    OPT_NICE_IO,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_RESUME,
+    OPT_SUMMARY,
+};
+
+static const struct option long_options[] = {
+    {"io-uring", no_argument, NULL, OPT_IO_URING},
+    {"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+    {"index", required_argument, NULL, OPT_INDEX},
+    {"watch", no_argument, NULL, OPT_WATCH},
+    {"format", required_argument, NULL, OPT_FORMAT},
+    {"plan", required_argument, NULL, OPT_PLAN},
+    {"apply", required_argument, NULL, OPT_APPLY},
+    {"stats", optional_argument, NULL, OPT_STATS},
+    {"progress", optional_argument, NULL, OPT_PROGRESS},
+    {"flatten", no_argument, NULL, OPT_FLATTEN},
+    {"exclude", required_argument, NULL, OPT_EXCLUDE},
+    {"include", required_argument, NULL, OPT_INCLUDE},
+    {"prune", required_argument, NULL, OPT_PRUNE},
+    {"inode-order", optional_argument, NULL, OPT_INODE_ORDER},
+    {"from0", required_argument, NULL, OPT_FROM0},
+    {"archive", required_argument, NULL, OPT_ARCHIVE},
+    {"archive-out", required_argument, NULL, OPT_ARCHIVE_OUT},
+    {"nice-io", optional_argument, NULL, OPT_NICE_IO},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"checkpoint-interval", required_argument, NULL, OPT_CHECKPOINT_INTERVAL},
+    {"resume", required_argument, NULL, OPT_RESUME},
+    {"summary", optional_argument, NULL, OPT_SUMMARY},
+    {NULL, 0, NULL, 0},
+};
+
+int symlinks_main(int argc, char** argv) {
+    const char* progname = argv[0];
+    struct symlinks_options opts;
+    struct cli cli;
+    enum output_format format = OUTPUT_TEXT;
+    const char* plan_path = NULL;
+    const char* apply_path = NULL;
+    const char* list_path = NULL;
+    const char* archive_path = NULL;
+    const char* resume_path = NULL;
+    const char* archive_out = NULL;
+    double progress_interval = 0;
+    int print_stats = 0;
+    int opt;
+
+    symlinks_options_init(&opts);
+    memset(&cli, 0, sizeof(cli));
+
+    /* Filters in command-line order; there are fewer than arguments */
+    struct symlinks_filter* filters = calloc((size_t)argc, sizeof(*filters));
+    if (!filters) {
+        fprintf(stderr, "Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    opts.filters = filters;
+
+    while ((opt = getopt_long(argc, argv, "cdj:orstvx", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                opts.convert = 1;
+                break;
+            case 'd':
+                opts.delete_dangling = 1;
+                break;
+            case 'j': {
+                char* end = NULL;
+                long jobs = strtol(optarg, &end, 10);
+                if (!*optarg || *end || jobs < 0 || jobs > 1024) {
+                    fprintf(stderr, "Invalid job count: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                if (jobs == 0) {
+                    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                opts.jobs = (jobs > 0) ? (int)jobs : 1;
+                break;
+            }
+            case 'o':
+                opts.cross_fs = 1;
+                break;
+            case 'r':
+                opts.recurse = 1;
+                break;
+            case 's':
+                opts.shorten = 1;
+                break;
+            case 't':
+                opts.dry_run = 1;
+                break;
+            case 'v':
+                cli.verbose = 1;
+                break;
+            case 'x':
+                opts.debug = 1;
+                break;
+            case OPT_IO_URING:
+                opts.io_uring = 1;
+                break;
+            case OPT_CACHE_SIZE: {
+                char* end = NULL;
+                opts.cache_size = strtol(optarg, &end, 10);
+                if (!*optarg || *end || opts.cache_size < 0) {
+                    fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_INDEX:
+                opts.index_path = optarg;
+                break;
+            case OPT_WATCH:
+                opts.watch = 1;
+                break;
+            case OPT_FORMAT:
+                if (!strcmp(optarg, "text")) {
+                    format = OUTPUT_TEXT;
+                }
+                else if (!strcmp(optarg, "jsonl")) {
+                    format = OUTPUT_JSONL;
+                }
+                else if (!strcmp(optarg, "nul")) {
+                    format = OUTPUT_NUL;
+                }
+                else {
+                    fprintf(stderr, "Invalid format: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_PLAN:
+                plan_path = optarg;
+                break;
+            case OPT_APPLY:
+                apply_path = optarg;
+                break;
+            case OPT_FROM0:
+                list_path = optarg;
+                break;
+            case OPT_ARCHIVE:
+                archive_path = optarg;
+                break;
+            case OPT_ARCHIVE_OUT:
+                archive_out = optarg;
+                break;
+            case OPT_CHECKPOINT:
+                opts.checkpoint_path = optarg;
+                break;
+            case OPT_CHECKPOINT_INTERVAL: {
+                char* end = NULL;
+                opts.checkpoint_interval = strtod(optarg, &end);
+                if (!*optarg || *end || !(opts.checkpoint_interval >= 0.01 && opts.checkpoint_interval <= 86400)) {
+                    fprintf(stderr, "Invalid checkpoint interval: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_RESUME:
+                resume_path = optarg;
+                break;
+            case OPT_SUMMARY: {
+                char* end = NULL;
+                long depth = optarg ? strtol(optarg, &end, 10) : 1;
+                if (optarg && (!*optarg || *end || depth < 0 || depth > 4096)) {
+                    fprintf(stderr, "Invalid summary depth: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                opts.summary = 1;
+                opts.summary_depth = (int)depth;
+                break;
+            }
+            case OPT_FLATTEN:
+                opts.flatten = 1;
+                break;
+            case OPT_EXCLUDE:
+            case OPT_INCLUDE:
+            case OPT_PRUNE:
+                if (!*optarg) {
+                    fprintf(stderr, "Empty filter pattern.\n");
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                filters[opts.nfilters].kind = (opt == OPT_EXCLUDE)   ? SYMLINKS_EXCLUDE
+                                              : (opt == OPT_INCLUDE) ? SYMLINKS_INCLUDE
+                                                                     : SYMLINKS_PRUNE;
+                filters[opts.nfilters].pattern = optarg;
+                opts.nfilters++;
+                break;
+            case OPT_INODE_ORDER: {
+                char* end = NULL;
+                long chunk = optarg ? strtol(optarg, &end, 10) : 16384;
+                if (optarg && (!*optarg || *end || chunk < 1 || chunk > (1L << 24))) {
+                    fprintf(stderr, "Invalid inode order chunk: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                opts.inode_order = (int)chunk;
+                break;
+            }
+            case OPT_STATS:
+                /* Counting alone costs a load and a store; timing adds two clock reads per system call */
+                if (optarg && strcmp(optarg, "counts") != 0) {
+                    fprintf(stderr, "Invalid stats level: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                opts.stats = optarg ? 1 : 2;
+                print_stats = 1;
+                break;
+            case OPT_PROGRESS: {
+                char* end = NULL;
+                progress_interval = optarg ? strtod(optarg, &end) : 1.0;
+                if (optarg && (!*optarg || *end || !(progress_interval >= 0.01 && progress_interval <= 86400))) {
+                    fprintf(stderr, "Invalid progress interval: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                if (!opts.stats) {
+                    opts.stats = 1;
+                }
+                break;
+            }
+            case OPT_NICE_IO: {
+                char* end = NULL;
+                opts.nice_io = 1;
+                opts.max_ops = optarg ? strtod(optarg, &end) : 2000;
+                opts.max_changes = 100;
+                if (optarg && *end == ',' && end != optarg) {
+                    char* changes = end + 1;
+                    opts.max_changes = strtod(changes, &end);
+                    if (end == changes) {
+                        end = changes - 1; /* the ',' then marks the argument as invalid */
+                    }
+                }
+                if (optarg && (!*optarg || *end || !(opts.max_ops >= 0) || !(opts.max_changes >= 0))) {
+                    fprintf(stderr, "Invalid --nice-io rates: %s\n", optarg);
+                    print_usage(progname);
+                    free(filters);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            default:
+                print_usage(progname);
+                free(filters);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (plan_path && (apply_path || opts.watch)) {
+        fprintf(stderr, "--plan cannot be combined with --apply or --watch.\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    if (list_path && (apply_path || opts.watch)) {
+        fprintf(stderr, "--from0 cannot be combined with --apply or --watch.\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    if (archive_path && (apply_path || list_path || plan_path || opts.watch)) {
+        fprintf(stderr, "--archive cannot be combined with --apply, --from0, --plan or --watch.\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    if (archive_out && (!archive_path || opts.dry_run)) {
+        fprintf(stderr, "--archive-out needs --archive, and writes nothing in test mode (-t).\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    if ((opts.checkpoint_path || resume_path) && (apply_path || list_path || archive_path || plan_path || opts.watch)) {
+        fprintf(stderr,
+                "--checkpoint and --resume cannot be combined with --apply, --from0, --archive, --plan or --watch.\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    /* A resumed scan only sees the directories left, so its summary would be incomplete */
+    if (opts.summary && (format != OUTPUT_TEXT || apply_path || list_path || archive_path || plan_path || opts.watch ||
+                         opts.checkpoint_path || resume_path)) {
+        fprintf(stderr,
+                "--summary cannot be combined with --format, --apply, --from0, --archive, --plan, --watch, "
+                "--checkpoint or --resume.\n");
+        free(filters);
+        return EXIT_FAILURE;
+    }
+    /* A resumed scan goes on saving its progress to the same file */
+    if (resume_path && !opts.checkpoint_path) {
+        opts.checkpoint_path = resume_path;
+    }
+    if ((apply_path || list_path || archive_path || resume_path) ? optind < argc : optind >= argc) {
+        print_usage(progname);
+        free(filters);
+        return EXIT_FAILURE;
+    }
+
+    cli.convert = opts.convert;
+    opts.on_link = opts.summary ? NULL : report_link; /* the summary replaces the per-link lines */
+    opts.on_error = report_error;
+    opts.on_checkpoint = flush_reports;
+    opts.user = &cli;
+
+    /* SIGINT and SIGTERM stop watching; they are blocked except while symlinks_watch() waits, so none is lost */
+    sigset_t stop_signals, watch_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if (opts.watch) {
+        pthread_sigmask(SIG_SETMASK, NULL, &watch_mask);
+        sigdelset(&watch_mask, SIGINT);
+        sigdelset(&watch_mask, SIGTERM);
+        opts.watch_sigmask = &watch_mask;
+    }
+
+    if (format != OUTPUT_TEXT) {
+        cli.output = output_new(STDOUT_FILENO, format);
+        if (!cli.output) {
+            fprintf(stderr, "Cannot allocate the output buffer.\n");
+            free(filters);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* A plan records what test mode would change */
+    int plan_fd = -1;
+    if (plan_path) {
+        plan_fd = open(plan_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        cli.plan = (plan_fd >= 0) ? output_new(plan_fd, OUTPUT_PLAN) : NULL;
+        if (!cli.plan) {
+            fprintf(stderr, "Cannot write plan %s: %s\n", plan_path, strerror(plan_fd >= 0 ? ENOMEM : errno));
+            output_free(cli.output);
+            if (plan_fd >= 0) {
+                close(plan_fd);
+                unlink(plan_path);
+            }
+            free(filters);
+            return EXIT_FAILURE;
+        }
+        opts.dry_run = 1;
+    }
+
+    struct symlinks_ctx* ctx = symlinks_new(&opts);
+    free(filters);
+    if (!ctx) {
+        const char* what = opts.watch ? "Cannot watch for changes" : "Cannot set up the scan";
+        fprintf(stderr, "%s: %s\n", what, strerror(errno));
+        output_free(cli.output);
+        if (cli.plan) {
+            /* Nothing was planned: leave no empty plan behind */
+            output_free(cli.plan);
+            close(plan_fd);
+            unlink(plan_path);
+        }
+        return EXIT_FAILURE;
+    }
+
+    struct symlinks_stats stats;
+    symlinks_stats(ctx, &stats);
+    if (opts.io_uring && !stats.io_uring && (cli.verbose || opts.debug)) {
+        fprintf(stderr, "io_uring is not available; using synchronous stat().\n");
+    }
+
+    /* Idle I/O class: the disk serves us only when nobody else wants it; threads started later inherit it */
+    if (opts.nice_io && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_IDLE) != 0 &&
+        (cli.verbose || opts.debug)) {
+        fprintf(stderr, "Cannot set idle I/O priority: %s\n", strerror(errno));
+    }
+
+    if (apply_path) {
+        int status = symlinks_apply_plan(ctx, apply_path);
+        output_free(cli.output);
+        if (print_stats) {
+            symlinks_print_stats(ctx, stderr);
+        }
+        symlinks_free(ctx);
+        return status;
+    }
+
+    struct progress progress;
+    int progressing = progress_interval > 0 && progress_start(&progress, ctx, progress_interval) == 0;
+
+    int scanned;
+    if (list_path) {
+        int list_fd = strcmp(list_path, "-") ? open(list_path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        if (list_fd < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", list_path, strerror(errno));
+            scanned = -1;
+        }
+        else {
+            scanned = symlinks_scan_list(ctx, list_fd);
+            if (list_fd != STDIN_FILENO) {
+                close(list_fd);
+            }
+        }
+    }
+    else if (archive_path) {
+        scanned = scan_archive(ctx, archive_path, archive_out);
+    }
+    else if (resume_path) {
+        scanned = symlinks_resume(ctx, resume_path);
+        if (scanned >= 0 && (cli.verbose || opts.debug)) {
+            fprintf(stderr, "resumed %d directories and paths from %s\n", scanned, resume_path);
+        }
+    }
+    else {
+        /* Directory arguments are queued and scanned together (with -j, in parallel) */
+        scanned = symlinks_scan(ctx, (const char* const*)argv + optind, (size_t)(argc - optind));
+    }
+
+    if (progressing) {
+        progress_stop(&progress);
+    }
+
+    if (opts.watch) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stop_watching; /* no SA_RESTART, so ppoll() wakes up */
+        sigemptyset(&sa.sa_mask);
+        sigset_t saved_mask;
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &saved_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        if (cli.verbose || opts.debug) {
+            fprintf(stderr, "watching for changes (%s)\n", stats.watch_backend);
+        }
+        fflush(stdout);
+        while (symlinks_watch(ctx, &g_stop_watching) > 0) {
+            fflush(stdout);
+            if (cli.output) {
+                output_flush(cli.output);
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+    }
+
+    output_free(cli.output);
+    if (opts.summary) {
+        symlinks_print_summary(ctx, stdout);
+    }
+
+    int status = (scanned < 0) ? 1 : 0;
+    if (cli.plan) {
+        if (output_flush(cli.plan) != 0) {
+            status = 1;
+        }
+        output_free(cli.plan);
+        if (close(plan_fd) != 0) {
+            fprintf(stderr, "Cannot write plan %s: %s\n", plan_path, strerror(errno));
+            status = 1;
+        }
+    }
+
+    if (cli.verbose || opts.debug) {
+        symlinks_stats(ctx, &stats);
+        if (opts.cache_size > 0) {
+            fprintf(stderr, "target cache: %zu hits, %zu misses, %zu evictions\n", stats.cache_hits,
+                    stats.cache_misses, stats.cache_evictions);
+        }
+        if (opts.index_path) {
+            fprintf(stderr, "index: %llu directories replayed, %llu recorded\n",
+                    (unsigned long long)stats.index_replayed, (unsigned long long)stats.index_recorded);
+        }
+        if (opts.nice_io) {
+            fprintf(stderr, "nice-io: %.3f s paused, back-off x%.2f\n", (double)stats.nice_paused_ns / 1e9,
+                    stats.nice_slowdown);
+        }
+    }
+    if (print_stats) {
+        symlinks_print_stats(ctx, stderr);
+    }
+    symlinks_free(ctx);
+
+    if (scanned == 0 && !list_path && !archive_path && !resume_path) {
+        print_usage(progname);
+    }
+
+    return status;
+}
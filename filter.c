@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "filter.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Most patterns in practice are a plain name (".git", "node_modules"), an
+ * extension ("*.snapshot") or a prefix ("tmp*").  Those are recognised when
+ * compiling and matched with one comparison; anything else goes to
+ * fnmatch(), where '*' also matches '/' in a path pattern.
+ */
+enum rule_how {
+    MATCH_ANY,     /* "*" */
+    MATCH_LITERAL, /* no wildcard */
+    MATCH_PREFIX,  /* "text*" */
+    MATCH_SUFFIX,  /* "*text" */
+    MATCH_GLOB,
+};
+
+struct filter_rule {
+    enum symlinks_filter_kind kind;
+    enum rule_how how;
+    int full_path; /* the pattern has a slash: match the whole path */
+    size_t len;    /* of 'text' */
+    char* text;    /* the literal part, or the whole pattern for MATCH_GLOB */
+    char* pattern; /* as given */
+};
+
+struct scan_filter {
+    struct filter_rule* rules;
+    size_t nrules;
+};
+
+static int has_wildcard(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * compile_rule:
+ *   Classify 'pattern' into 'rule'.  Returns 0, or -1 with errno set.
+ */
+static int compile_rule(struct filter_rule* rule, enum symlinks_filter_kind kind, const char* pattern) {
+    size_t len = strlen(pattern);
+    /* "dir/" means the same as "dir" for a path */
+    while (len > 1 && pattern[len - 1] == '/') {
+        len--;
+    }
+    if (len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rule->kind = kind;
+    rule->full_path = memchr(pattern, '/', len) != NULL;
+    if (len == 1 && pattern[0] == '*') {
+        rule->how = MATCH_ANY;
+        pattern = "";
+        len = 0;
+    }
+    else if (!has_wildcard(pattern, len)) {
+        rule->how = MATCH_LITERAL;
+    }
+    else if (pattern[0] == '*' && !has_wildcard(pattern + 1, len - 1)) {
+        rule->how = MATCH_SUFFIX;
+        pattern++;
+        len--;
+    }
+    else if (pattern[len - 1] == '*' && !has_wildcard(pattern, len - 1)) {
+        rule->how = MATCH_PREFIX;
+        len--;
+    }
+    else {
+        rule->how = MATCH_GLOB;
+    }
+    rule->text = strndup(pattern, len);
+    rule->len = len;
+    return rule->text ? 0 : -1;
+}
+
+struct scan_filter* filter_new(const struct symlinks_filter* rules, size_t nrules) {
+    struct scan_filter* filter = calloc(1, sizeof(*filter));
+    if (!filter) {
+        return NULL;
+    }
+    filter->rules = calloc(nrules ? nrules : 1, sizeof(*filter->rules));
+    if (!filter->rules) {
+        free(filter);
+        return NULL;
+    }
+    for (size_t i = 0; i < nrules; i++) {
+        if (!rules[i].pattern || compile_rule(&filter->rules[i], rules[i].kind, rules[i].pattern) != 0) {
+            if (!rules[i].pattern) {
+                errno = EINVAL;
+            }
+            filter_free(filter);
+            return NULL;
+        }
+        filter->nrules++;
+        filter->rules[i].pattern = strdup(rules[i].pattern);
+        if (!filter->rules[i].pattern) {
+            filter_free(filter);
+            return NULL;
+        }
+    }
+    return filter;
+}
+
+void filter_free(struct scan_filter* filter) {
+    if (!filter) {
+        return;
+    }
+    for (size_t i = 0; i < filter->nrules; i++) {
+        free(filter->rules[i].text);
+        free(filter->rules[i].pattern);
+    }
+    free(filter->rules);
+    free(filter);
+}
+
+static int rule_matches(const struct filter_rule* rule, const char* s) {
+    size_t len;
+    switch (rule->how) {
+        case MATCH_ANY:
+            return 1;
+        case MATCH_LITERAL:
+            return !strcmp(s, rule->text);
+        case MATCH_PREFIX:
+            return !strncmp(s, rule->text, rule->len);
+        case MATCH_SUFFIX:
+            len = strlen(s);
+            return len >= rule->len && !memcmp(s + len - rule->len, rule->text, rule->len);
+        default:
+            return fnmatch(rule->text, s, 0) == 0;
+    }
+}
+
+enum filter_verdict filter_entry(const struct scan_filter* filter, const char* name, const char* path, int is_dir) {
+    for (size_t i = 0; i < filter->nrules; i++) {
+        const struct filter_rule* rule = &filter->rules[i];
+        if (rule->kind == SYMLINKS_PRUNE && is_dir == 0) {
+            continue;
+        }
+        if (!rule_matches(rule, rule->full_path ? path : name)) {
+            continue;
+        }
+        if (rule->kind == SYMLINKS_PRUNE && is_dir < 0) {
+            return FILTER_UNSURE;
+        }
+        return (rule->kind == SYMLINKS_INCLUDE) ? FILTER_KEEP : FILTER_SKIP;
+    }
+    return FILTER_KEEP;
+}
+
+const char* filter_rule(const struct scan_filter* filter, size_t i, enum symlinks_filter_kind* kind) {
+    if (!filter || i >= filter->nrules) {
+        return NULL;
+    }
+    *kind = filter->rules[i].kind;
+    return filter->rules[i].pattern;
+}
@@ -0,0 +1,48 @@
+#ifndef SYMLINKS_FILTER_H
+#define SYMLINKS_FILTER_H
+
+/*
+ * Entry filters (--exclude, --include, --prune), compiled once per context
+ * and consulted for every directory entry before anything is asked of the
+ * filesystem about it, so a pruned subtree costs nothing.
+ */
+
+#include <stddef.h>
+
+#include "symlinks.h"
+
+enum filter_verdict {
+    FILTER_KEEP,
+    FILTER_SKIP,
+    FILTER_UNSURE, /* a --prune rule matched an entry of unknown type: ask again once it is known */
+};
+
+struct scan_filter;
+
+/*
+ * filter_new:
+ *   Compile 'rules' (copied).  Returns NULL with errno set if a pattern is
+ *   empty (EINVAL) or if out of memory.
+ */
+struct scan_filter* filter_new(const struct symlinks_filter* rules, size_t nrules);
+
+void filter_free(struct scan_filter* filter);
+
+/*
+ * filter_entry:
+ *   The verdict of the first rule matching the entry 'name' at 'path':
+ *   patterns without a slash are matched against the name, the others
+ *   against the whole path.  'is_dir' is 1 for a directory, 0 for anything
+ *   else and -1 if not known yet.  --prune rules only apply to directories.
+ *   No match keeps the entry.
+ */
+enum filter_verdict filter_entry(const struct scan_filter* filter, const char* name, const char* path, int is_dir);
+
+/*
+ * filter_rule:
+ *   The pattern, as given, and the kind of rule 'i', or NULL past the last
+ *   rule (or with no filter at all).
+ */
+const char* filter_rule(const struct scan_filter* filter, size_t i, enum symlinks_filter_kind* kind);
+
+#endif
@@ -0,0 +1,279 @@
+// fuzz_paths.c
+//
+// In-process libFuzzer target for the path kernels in path.c: tidy_path(),
+// shorten_path() and relative_path_lexical() (build_relative_path()
+// without realpath()), each checked against a deliberately simple
+// reference normalizer.  Nothing touches the filesystem and no state
+// survives an input, so a run does hundreds of thousands of inputs per
+// second, unlike fuzz_symlinks.cpp, which drives the whole program.
+//
+// An input is a selector byte, whose value modulo 3 picks the kernel ('0'
+// tidy_path, '1' shorten_path, '2' relative_path_lexical), then one path,
+// or two separated by a newline: the link value and the link's own path
+// for shorten_path, the directory and the target for the relative path.
+// The seed corpus is in fuzz_paths_corpus/:
+//
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -I. fuzz_paths.c path.c -o fuzz_paths
+//   mkdir -p new && ./fuzz_paths new fuzz_paths_corpus
+//
+// Built with -DFUZZ_PATHS_STANDALONE (as meson does), it is a plain program
+// instead, running the files and directories of inputs given as arguments:
+// a regression check of the corpus without libFuzzer.
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+// Longer inputs are skipped: each path then fits the kernels' PATH_MAX
+#define MAX_FUZZ_INPUT (PATH_MAX - 2)
+
+__attribute__((noreturn)) static void mismatch(const char* what, const char* a, const char* b, const char* got,
+                                               const char* want) {
+    fprintf(stderr, "%s\n  input:  \"%s\"\n  second: \"%s\"\n  got:    \"%s\"\n  want:   \"%s\"\n", what, a, b,
+            got, want);
+    abort();
+}
+
+/*
+ * reference_tidy:
+ *   The obvious normalizer tidy_path() must agree with: split 'in' on
+ *   slashes, drop empty and "." components, let ".." pop the component
+ *   before it (or vanish at the root, or stay at the start of a relative
+ *   path), join the rest.  'out' must hold strlen(in) + 2 bytes.
+ */
+static void reference_tidy(const char* in, char* out) {
+    static size_t starts[PATH_MAX * 2];
+    static size_t lens[PATH_MAX * 2];
+    size_t n = 0;
+    int is_abs = (in[0] == '/');
+
+    for (size_t i = 0; in[i];) {
+        while (in[i] == '/') {
+            i++;
+        }
+        size_t start = i;
+        while (in[i] && in[i] != '/') {
+            i++;
+        }
+        size_t len = i - start;
+        if (len == 0 || (len == 1 && in[start] == '.')) {
+            continue;
+        }
+        if (len == 2 && in[start] == '.' && in[start + 1] == '.') {
+            int top_is_up = n > 0 && lens[n - 1] == 2 && !strncmp(in + starts[n - 1], "..", 2);
+            if (n > 0 && !top_is_up) {
+                n--;
+                continue;
+            }
+            if (is_abs) {
+                continue;
+            }
+        }
+        starts[n] = start;
+        lens[n] = len;
+        n++;
+    }
+
+    char* o = out;
+    if (is_abs) {
+        *o++ = '/';
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (k > 0) {
+            *o++ = '/';
+        }
+        memcpy(o, in + starts[k], lens[k]);
+        o += lens[k];
+    }
+    if (o == out) {
+        *o++ = '.';
+    }
+    *o = '\0';
+}
+
+static void check_tidy(const char* path) {
+    char got[PATH_MAX + 2];
+    char want[PATH_MAX + 2];
+    char again[PATH_MAX + 2];
+    if (!*path) {
+        return; // left alone by contract
+    }
+    strcpy(got, path);
+    int changed = tidy_path(got);
+    reference_tidy(path, want);
+    if (strcmp(got, want) != 0) {
+        mismatch("tidy_path differs from the reference", path, "", got, want);
+    }
+    if (!changed != !strcmp(path, got)) {
+        mismatch("tidy_path returned the wrong change flag", path, "", got, want);
+    }
+    strcpy(again, got);
+    if (tidy_path(again) || strcmp(again, got) != 0) {
+        mismatch("tidy_path is not idempotent", path, "", again, got);
+    }
+}
+
+/*
+ * check_shorten:
+ *   The shortened value must name the same place as the original, seen
+ *   from the link's directory, and never grow.
+ */
+static void check_shorten(const char* value, const char* link_path) {
+    static char before[PATH_MAX * 2 + 4];
+    static char after[PATH_MAX * 2 + 4];
+    static char want[PATH_MAX * 2 + 4];
+    static char got[PATH_MAX * 2 + 4];
+    char shortened[PATH_MAX + 2];
+    if (!*value || !*link_path) {
+        return;
+    }
+    strcpy(shortened, value);
+    int changed = shorten_path(shortened, link_path);
+    if (strlen(shortened) > strlen(value)) {
+        mismatch("shorten_path made the value longer", value, link_path, shortened, value);
+    }
+    if (!changed != !strcmp(value, shortened)) {
+        mismatch("shorten_path returned the wrong change flag", value, link_path, shortened, value);
+    }
+    if (!changed) {
+        return;
+    }
+    const char* slash = strrchr(link_path, '/');
+    if (!slash || value[0] == '/' || shortened[0] == '/' || !shortened[0]) {
+        mismatch("shorten_path changed a value it cannot shorten", value, link_path, shortened, value);
+    }
+    int dir_len = (int)(slash - link_path);
+    snprintf(before, sizeof(before), "%.*s/%s", dir_len, link_path, value);
+    snprintf(after, sizeof(after), "%.*s/%s", dir_len, link_path, shortened);
+    reference_tidy(before, want);
+    reference_tidy(after, got);
+    if (strcmp(got, want) != 0) {
+        mismatch("shorten_path changed where the link leads", value, link_path, got, want);
+    }
+}
+
+/*
+ * check_relative:
+ *   Both paths are made absolute and tidy first, as the function requires;
+ *   the result, appended to the directory, must lead to the target, and be
+ *   tidy itself.
+ */
+static void check_relative(const char* from_input, const char* to_input) {
+    static char joined[PATH_MAX * 6];
+    static char want[PATH_MAX * 5];
+    char from[PATH_MAX + 2];
+    char to[PATH_MAX + 2];
+    char tidy_out[PATH_MAX * 4 + 2];
+    char out[PATH_MAX * 4];
+
+    snprintf(joined, sizeof(joined), "/%s", from_input);
+    reference_tidy(joined, from);
+    snprintf(joined, sizeof(joined), "/%s", to_input);
+    reference_tidy(joined, to);
+
+    if (relative_path_lexical(from, to, out, sizeof(out)) != 0) {
+        mismatch("relative_path_lexical failed", from, to, "", "");
+    }
+    if (out[0] == '/' || !out[0]) {
+        mismatch("relative_path_lexical did not give a relative path", from, to, out, "");
+    }
+    reference_tidy(out, tidy_out);
+    if (strcmp(out, tidy_out) != 0) {
+        mismatch("relative_path_lexical gave an untidy path", from, to, out, tidy_out);
+    }
+    snprintf(joined, sizeof(joined), "%s/%s", from, out);
+    reference_tidy(joined, want);
+    if (strcmp(want, to) != 0) {
+        mismatch("relative_path_lexical leads elsewhere", from, to, want, to);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    char input[MAX_FUZZ_INPUT + 1];
+    if (size < 1 || size - 1 > MAX_FUZZ_INPUT) {
+        return 0;
+    }
+    memcpy(input, data + 1, size - 1);
+    input[size - 1] = '\0'; // an embedded NUL just ends the input early
+
+    const char* second = "";
+    char* newline = strchr(input, '\n');
+    if (newline) {
+        *newline = '\0';
+        second = newline + 1;
+    }
+
+    switch (data[0] % 3) {
+        case 0:
+            check_tidy(input);
+            break;
+        case 1:
+            check_shorten(input, second);
+            break;
+        default:
+            check_relative(input, second);
+            break;
+    }
+    return 0;
+}
+
+#ifdef FUZZ_PATHS_STANDALONE
+
+#include <sys/stat.h>
+
+static int run_file(const char* path) {
+    static uint8_t data[MAX_FUZZ_INPUT + 2];
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    size_t n = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, n);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int status = 0;
+    long inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            status |= run_file(argv[i]);
+            inputs++;
+            continue;
+        }
+        DIR* dir = opendir(argv[i]);
+        if (!dir) {
+            perror(argv[i]);
+            status = -1;
+            continue;
+        }
+        struct dirent* de;
+        while ((de = readdir(dir)) != NULL) {
+            char path[PATH_MAX * 2];
+            if (de->d_name[0] == '.') {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", argv[i], de->d_name);
+            status |= run_file(path);
+            inputs++;
+        }
+        closedir(dir);
+    }
+    printf("%ld inputs checked\n", inputs);
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
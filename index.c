@@ -0,0 +1,441 @@
+#define _GNU_SOURCE /* st_mtim, st_ctim */
+
+#include "index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A record collects one directory's entries while it is being scanned;
+ * committing appends them to the index's in-memory tables under the lock.
+ */
+struct index_record {
+    struct index_dir dir;
+    struct index_entry* entries;
+    uint32_t nentries;
+    uint32_t cap;
+    char* strings;
+    size_t strings_len;
+    size_t strings_cap;
+    int failed;
+};
+
+struct scan_index {
+    char* path;
+    symlinks_error_fn on_error;
+    void* user;
+
+    /* Index loaded from the previous run (read-only, shared by workers) */
+    void* map;
+    size_t map_size;
+    const struct index_dir* old_dirs;
+    const struct index_entry* old_entries;
+    const char* old_strings;
+    uint64_t old_ndirs;
+
+    /* Index being built by this run */
+    pthread_mutex_t lock;
+    struct index_dir* dirs;
+    size_t ndirs;
+    size_t dirs_cap;
+    struct index_entry* entries;
+    size_t nentries;
+    size_t entries_cap;
+    char* strings;
+    size_t strings_len;
+    size_t strings_cap;
+    int out_of_memory;
+
+    /* Directories changed at or after this time are not trusted */
+    time_t racy_after;
+
+    uint64_t replayed;
+    uint64_t recorded;
+};
+
+/*
+ * grow:
+ *   Make room for 'need' elements of 'size' bytes in '*buf'.
+ *   Returns 0 on success, -1 if out of memory.
+ */
+static int grow(void** buf, size_t* cap, size_t need, size_t size) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    void* p = realloc(*buf, new_cap * size);
+    if (!p) {
+        return -1;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * index_report:
+ *   Hand an error about the index (errno 'err', or 0) to the error callback.
+ */
+__attribute__((format(printf, 3, 4))) static void
+index_report(const struct scan_index* index, int err, const char* fmt, ...) {
+    if (!index->on_error) {
+        return;
+    }
+    char message[PATH_MAX + 256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    index->on_error(index->path, err, message, index->user);
+}
+
+/*
+ * load_index:
+ *   Map and validate the existing index.  Anything unexpected (missing
+ *   file, other version, truncation, stray offsets) leaves it unloaded.
+ */
+static void load_index(struct scan_index* index) {
+    int fd = open(index->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct index_header)) {
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const struct index_header* hdr = map;
+    int valid = memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) == 0 && hdr->version == INDEX_VERSION &&
+                hdr->header_size == sizeof(*hdr) && hdr->ndirs <= size / sizeof(struct index_dir) &&
+                hdr->nentries <= size / sizeof(struct index_entry);
+
+    /* Counts are bounded by the file size now, so these cannot overflow */
+    size_t dirs_off = sizeof(*hdr);
+    size_t entries_off = dirs_off + (valid ? hdr->ndirs * sizeof(struct index_dir) : 0);
+    size_t strings_off = entries_off + (valid ? hdr->nentries * sizeof(struct index_entry) : 0);
+    valid = valid && strings_off <= size && hdr->strings_size == size - strings_off;
+
+    const struct index_dir* dirs = (const struct index_dir*)((const char*)map + dirs_off);
+    const struct index_entry* entries = (const struct index_entry*)((const char*)map + entries_off);
+    const char* strings = (const char*)map + strings_off;
+
+    /* With the blob NUL-terminated, any in-range offset yields a valid string */
+    if (valid && hdr->strings_size > 0 && strings[hdr->strings_size - 1] != '\0') {
+        valid = 0;
+    }
+    for (uint64_t i = 0; valid && i < hdr->ndirs; i++) {
+        if (dirs[i].first_entry > hdr->nentries || dirs[i].nentries > hdr->nentries - dirs[i].first_entry) {
+            valid = 0;
+        }
+    }
+    for (uint64_t i = 0; valid && i < hdr->nentries; i++) {
+        if (entries[i].name_off >= hdr->strings_size ||
+            (entries[i].value_off != INDEX_NO_VALUE && entries[i].value_off >= hdr->strings_size)) {
+            valid = 0;
+        }
+    }
+
+    if (!valid) {
+        index_report(index, 0, "Ignoring invalid index %s; rescanning everything.", index->path);
+        munmap(map, size);
+        return;
+    }
+
+    index->map = map;
+    index->map_size = size;
+    index->old_dirs = dirs;
+    index->old_entries = entries;
+    index->old_strings = strings;
+    index->old_ndirs = hdr->ndirs;
+}
+
+struct scan_index* index_open(const char* path, symlinks_error_fn on_error, void* user) {
+    struct scan_index* index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->on_error = on_error;
+    index->user = user;
+    index->path = strdup(path);
+    if (!index->path) {
+        free(index);
+        return NULL;
+    }
+    pthread_mutex_init(&index->lock, NULL);
+
+    /* Same-second changes after the scan starts could go unnoticed next time */
+    index->racy_after = time(NULL) - 1;
+
+    load_index(index);
+    return index;
+}
+
+static int compare_dirs(const void* a, const void* b) {
+    const struct index_dir* x = a;
+    const struct index_dir* y = b;
+    if (x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    if (x->ino != y->ino) {
+        return x->ino < y->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * write_all:
+ *   write() the whole buffer, retrying on short writes.
+ */
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int index_save(struct scan_index* index) {
+    if (index->out_of_memory) {
+        index_report(index, ENOMEM, "Out of memory building index; %s left unchanged.", index->path);
+        return -1;
+    }
+
+    if (index->ndirs > 0) {
+        qsort(index->dirs, index->ndirs, sizeof(*index->dirs), compare_dirs);
+    }
+
+    /* Pad the string blob so the file size stays a multiple of 8 */
+    while (index->strings_len % 8 != 0) {
+        if (grow((void**)&index->strings, &index->strings_cap, index->strings_len + 1, 1) != 0) {
+            index_report(index, ENOMEM, "Out of memory building index; %s left unchanged.", index->path);
+            return -1;
+        }
+        index->strings[index->strings_len++] = '\0';
+    }
+
+    struct index_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = INDEX_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.ndirs = index->ndirs;
+    hdr.nentries = index->nentries;
+    hdr.strings_size = index->strings_len;
+
+    size_t tmp_len = strlen(index->path) + 32;
+    char* tmp = malloc(tmp_len);
+    if (!tmp) {
+        index_report(index, ENOMEM, "Out of memory building index; %s left unchanged.", index->path);
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", index->path, (long)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        index_report(index, errno, "Cannot create index %s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    int ok = write_all(fd, &hdr, sizeof(hdr)) == 0 &&
+             write_all(fd, index->dirs, index->ndirs * sizeof(*index->dirs)) == 0 &&
+             write_all(fd, index->entries, index->nentries * sizeof(*index->entries)) == 0 &&
+             write_all(fd, index->strings, index->strings_len) == 0 && fsync(fd) == 0;
+    int saved_errno = errno;
+    if (close(fd) != 0 && ok) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    if (ok && rename(tmp, index->path) != 0) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    if (!ok) {
+        index_report(index, saved_errno, "Cannot write index %s: %s", index->path, strerror(saved_errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+void index_close(struct scan_index* index) {
+    if (!index) {
+        return;
+    }
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    }
+    pthread_mutex_destroy(&index->lock);
+    free(index->dirs);
+    free(index->entries);
+    free(index->strings);
+    free(index->path);
+    free(index);
+}
+
+static void fill_stamp(struct index_dir* dir, const struct stat* st) {
+    dir->dev = (uint64_t)st->st_dev;
+    dir->ino = (uint64_t)st->st_ino;
+    dir->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    dir->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    dir->ctime_sec = (int64_t)st->st_ctim.tv_sec;
+    dir->ctime_nsec = (uint32_t)st->st_ctim.tv_nsec;
+}
+
+int index_replay_begin(const struct scan_index* index, const struct stat* st, struct index_replay* it) {
+    if (!index->map) {
+        return 0;
+    }
+
+    struct index_dir key;
+    memset(&key, 0, sizeof(key));
+    fill_stamp(&key, st);
+    const struct index_dir* dir = bsearch(&key, index->old_dirs, index->old_ndirs, sizeof(key), compare_dirs);
+    if (!dir || dir->mtime_sec != key.mtime_sec || dir->mtime_nsec != key.mtime_nsec ||
+        dir->ctime_sec != key.ctime_sec || dir->ctime_nsec != key.ctime_nsec) {
+        return 0;
+    }
+
+    it->index = index;
+    it->dir = dir;
+    it->pos = 0;
+    return 1;
+}
+
+int index_replay_next(struct index_replay* it, const char** name, const char** value) {
+    if (it->pos >= it->dir->nentries) {
+        return 0;
+    }
+    const struct index_entry* e = &it->index->old_entries[it->dir->first_entry + it->pos++];
+    *name = it->index->old_strings + e->name_off;
+    *value = (e->value_off == INDEX_NO_VALUE) ? NULL : it->index->old_strings + e->value_off;
+    return 1;
+}
+
+struct index_record* index_record_begin(const struct stat* st) {
+    struct index_record* rec = calloc(1, sizeof(*rec));
+    if (rec) {
+        fill_stamp(&rec->dir, st);
+    }
+    return rec;
+}
+
+/*
+ * record_string:
+ *   Append a NUL-terminated copy of 's' to the record's strings and return
+ *   its offset there, or -1 if out of memory.
+ */
+static int64_t record_string(struct index_record* rec, const char* s) {
+    size_t len = strlen(s) + 1;
+    if (grow((void**)&rec->strings, &rec->strings_cap, rec->strings_len + len, 1) != 0) {
+        return -1;
+    }
+    memcpy(rec->strings + rec->strings_len, s, len);
+    rec->strings_len += len;
+    return (int64_t)(rec->strings_len - len);
+}
+
+int index_record_add(struct index_record* rec, const char* name, const char* value) {
+    if (rec->failed) {
+        return -1;
+    }
+    size_t cap = rec->cap;
+    if (grow((void**)&rec->entries, &cap, (size_t)rec->nentries + 1, sizeof(*rec->entries)) != 0) {
+        rec->failed = 1;
+        return -1;
+    }
+    rec->cap = (uint32_t)cap;
+
+    int64_t name_off = record_string(rec, name);
+    int64_t value_off = value ? record_string(rec, value) : (int64_t)INDEX_NO_VALUE;
+    if (name_off < 0 || (value && value_off < 0)) {
+        rec->failed = 1;
+        return -1;
+    }
+    rec->entries[rec->nentries].name_off = (uint64_t)name_off;
+    rec->entries[rec->nentries].value_off = value ? (uint64_t)value_off : INDEX_NO_VALUE;
+    rec->nentries++;
+    return 0;
+}
+
+void index_record_commit(struct scan_index* index, struct index_record* rec) {
+    if (rec->failed || rec->dir.mtime_sec >= index->racy_after) {
+        index_record_discard(rec);
+        return;
+    }
+
+    pthread_mutex_lock(&index->lock);
+    if (grow((void**)&index->dirs, &index->dirs_cap, index->ndirs + 1, sizeof(*index->dirs)) != 0 ||
+        grow((void**)&index->entries, &index->entries_cap, index->nentries + rec->nentries, sizeof(*index->entries)) !=
+            0 ||
+        grow((void**)&index->strings, &index->strings_cap, index->strings_len + rec->strings_len, 1) != 0) {
+        index->out_of_memory = 1;
+        pthread_mutex_unlock(&index->lock);
+        index_record_discard(rec);
+        return;
+    }
+
+    struct index_dir* dir = &index->dirs[index->ndirs++];
+    *dir = rec->dir;
+    dir->first_entry = index->nentries;
+    dir->nentries = rec->nentries;
+    for (uint32_t i = 0; i < rec->nentries; i++) {
+        struct index_entry* e = &index->entries[index->nentries++];
+        e->name_off = rec->entries[i].name_off + index->strings_len;
+        e->value_off = (rec->entries[i].value_off == INDEX_NO_VALUE) ? INDEX_NO_VALUE
+                                                                     : rec->entries[i].value_off + index->strings_len;
+    }
+    memcpy(index->strings + index->strings_len, rec->strings, rec->strings_len);
+    index->strings_len += rec->strings_len;
+    index->recorded++;
+    pthread_mutex_unlock(&index->lock);
+
+    index_record_discard(rec);
+}
+
+void index_record_discard(struct index_record* rec) {
+    if (rec) {
+        free(rec->entries);
+        free(rec->strings);
+        free(rec);
+    }
+}
+
+void index_note_replayed(struct scan_index* index) {
+    pthread_mutex_lock(&index->lock);
+    index->replayed++;
+    pthread_mutex_unlock(&index->lock);
+}
+
+void index_counters(struct scan_index* index, uint64_t* replayed, uint64_t* recorded) {
+    pthread_mutex_lock(&index->lock);
+    *replayed = index->replayed;
+    *recorded = index->recorded;
+    pthread_mutex_unlock(&index->lock);
+}
@@ -0,0 +1,137 @@
+#ifndef SYMLINKS_INDEX_H
+#define SYMLINKS_INDEX_H
+
+/*
+ * Persistent directory index (--index FILE).
+ *
+ * For every directory scanned, the index records its identity and stamp
+ * (dev, ino, mtime, ctime) together with the names of its subdirectories
+ * and the names and values of its symlinks.  On the next run a directory
+ * whose stamp is unchanged is replayed from the index instead of being
+ * read again.
+ *
+ * On-disk layout (native byte order, every part 8-byte aligned, so the
+ * file is used directly through mmap):
+ *
+ *   struct index_header
+ *   struct index_dir    dirs[ndirs]        sorted by (dev, ino)
+ *   struct index_entry  entries[nentries]  grouped per directory
+ *   char                strings[strings_size]  NUL-terminated names/values
+ */
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "symlinks.h"
+
+#define INDEX_MAGIC "SLNKIDX1"
+#define INDEX_VERSION 1
+#define INDEX_NO_VALUE UINT64_MAX /* value_off of a subdirectory entry */
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t ndirs;
+    uint64_t nentries;
+    uint64_t strings_size;
+};
+
+struct index_dir {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    uint64_t first_entry;
+    uint32_t nentries;
+    uint32_t reserved;
+};
+
+struct index_entry {
+    uint64_t name_off;
+    uint64_t value_off;
+};
+
+struct scan_index;
+struct index_record;
+
+/*
+ * index_open:
+ *   Load the index at 'path' if it exists and is valid (a missing or
+ *   unreadable index just means every directory is scanned), and start a
+ *   new one to be written back by index_save().  Problems with the index
+ *   go to 'on_error' (may be NULL) with 'user'.  Returns NULL if out of
+ *   memory.
+ */
+struct scan_index* index_open(const char* path, symlinks_error_fn on_error, void* user);
+
+/*
+ * index_save:
+ *   Atomically replace the index file with the directories recorded in this
+ *   run.  Returns 0 on success, -1 after reporting the error.
+ */
+int index_save(struct scan_index* index);
+
+void index_close(struct scan_index* index);
+
+/*
+ * index_replay:
+ *   Cursor over the entries of an unchanged directory.
+ */
+struct index_replay {
+    const struct scan_index* index;
+    const struct index_dir* dir;
+    uint32_t pos;
+};
+
+/*
+ * index_replay_begin:
+ *   Returns 1 and sets up 'it' if the directory described by 'st' is in the
+ *   loaded index with the same stamp, 0 if it has to be read.
+ */
+int index_replay_begin(const struct scan_index* index, const struct stat* st, struct index_replay* it);
+
+/*
+ * index_replay_next:
+ *   Returns 1 with the next entry's name and, for a symlink, its value
+ *   ('value' is NULL for a subdirectory), or 0 at the end.
+ */
+int index_replay_next(struct index_replay* it, const char** name, const char** value);
+
+/*
+ * index_record_begin:
+ *   Start recording the directory described by 'st'.  Returns NULL if out
+ *   of memory, in which case the directory is simply not indexed.
+ */
+struct index_record* index_record_begin(const struct stat* st);
+
+/*
+ * index_record_add:
+ *   Add a subdirectory ('value' NULL) or a symlink with its value.
+ *   Returns 0 on success, -1 if out of memory (the record is then dropped
+ *   on commit).
+ */
+int index_record_add(struct index_record* rec, const char* name, const char* value);
+
+/*
+ * index_record_commit:
+ *   Hand a finished record to the index (thread-safe), and free it.
+ *   Records of directories modified too recently to be trusted (a further
+ *   change within the same timestamp tick would not move the mtime) are
+ *   dropped.
+ */
+void index_record_commit(struct scan_index* index, struct index_record* rec);
+
+void index_record_discard(struct index_record* rec);
+
+void index_counters(struct scan_index* index, uint64_t* replayed, uint64_t* recorded);
+
+/*
+ * index_note_replayed:
+ *   Count a directory served from the index.
+ */
+void index_note_replayed(struct scan_index* index);
+
+#endif
@@ -0,0 +1,295 @@
+#include "output.h"
+#include "plan.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Records are written out in chunks of this size */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* Records up to this size are formatted on the stack */
+#define OUTPUT_RECORD_STACK 8192
+
+struct output {
+    int fd;
+    enum output_format format;
+    int failed;
+    pthread_mutex_t lock;
+    size_t len;
+    char buf[];
+};
+
+struct output* output_new(int fd, enum output_format format) {
+    struct output* out = malloc(sizeof(*out) + OUTPUT_BUFFER_SIZE);
+    if (!out) {
+        return NULL;
+    }
+    out->fd = fd;
+    out->format = format;
+    out->failed = 0;
+    out->len = 0;
+    pthread_mutex_init(&out->lock, NULL);
+    if (format == OUTPUT_PLAN) {
+        out->len = strlen(PLAN_MAGIC);
+        memcpy(out->buf, PLAN_MAGIC, out->len);
+    }
+    return out;
+}
+
+/*
+ * write_out:
+ *   write() all of 'buf', retrying on short writes and EINTR.
+ *   Called with the lock held.
+ */
+static void write_out(struct output* out, const char* buf, size_t len) {
+    while (len > 0 && !out->failed) {
+        ssize_t n = write(out->fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Cannot write report: %s\n", strerror(errno));
+            out->failed = 1;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/*
+ * utf8_sequence_len:
+ *   Length of the valid UTF-8 sequence starting at 's' (whose first byte
+ *   is >= 0x80), or 0 if it is not one.
+ */
+static size_t utf8_sequence_len(const unsigned char* s) {
+    size_t len;
+    uint32_t min;
+    uint32_t cp;
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        len = 2;
+        min = 0x80;
+        cp = s[0] & 0x1f;
+    }
+    else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        len = 3;
+        min = 0x800;
+        cp = s[0] & 0x0f;
+    }
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        len = 4;
+        min = 0x10000;
+        cp = s[0] & 0x07;
+    }
+    else {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+        return 0;
+    }
+    return len;
+}
+
+/*
+ * put_json_string:
+ *   Append 's' as a JSON string at 'p' (at most 6 bytes per input byte
+ *   plus 2) and return the new end.
+ */
+static char* put_json_string(char* p, const char* s) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char* in = (const unsigned char*)s;
+
+    *p++ = '"';
+    while (*in) {
+        /* Copy runs of plain ASCII at once */
+        const unsigned char* run = in;
+        while (*in >= 0x20 && *in < 0x80 && *in != '"' && *in != '\\') {
+            in++;
+        }
+        memcpy(p, run, (size_t)(in - run));
+        p += in - run;
+        if (!*in) {
+            break;
+        }
+
+        unsigned char c = *in;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+            in++;
+        }
+        else if (c == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+            in++;
+        }
+        else if (c == '\t') {
+            *p++ = '\\';
+            *p++ = 't';
+            in++;
+        }
+        else if (c < 0x20) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 0xf];
+            p += 6;
+            in++;
+        }
+        else {
+            size_t len = utf8_sequence_len(in);
+            if (len) {
+                memcpy(p, in, len);
+                p += len;
+                in += len;
+            }
+            else {
+                /* Stray byte: U+DC80..U+DCFF, as Python's surrogateescape does */
+                memcpy(p, "\\udc", 4);
+                p[4] = hex[c >> 4];
+                p[5] = hex[c & 0xf];
+                p += 6;
+                in++;
+            }
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char* put_str(char* p, const char* s) {
+    size_t len = strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static char* put_int(char* p, int v) {
+    char digits[16];
+    int n = 0;
+    unsigned u = (v < 0) ? 0u - (unsigned)v : (unsigned)v;
+    if (v < 0) {
+        *p++ = '-';
+    }
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+/*
+ * format_record:
+ *   Format 'rec' at 'p' (which has room for record_bound() bytes) and
+ *   return the end.
+ */
+static char* format_record(enum output_format format, char* p, const struct symlinks_link* rec) {
+    if (format == OUTPUT_JSONL) {
+        p = put_str(p, "{\"path\":");
+        p = put_json_string(p, rec->path);
+        p = put_str(p, ",\"target\":");
+        p = put_json_string(p, rec->target);
+        p = put_str(p, ",\"class\":\"");
+        p = put_str(p, rec->cls);
+        p = put_str(p, "\",\"action\":\"");
+        p = put_str(p, rec->action);
+        p = put_str(p, "\",\"new_target\":");
+        if (rec->new_target) {
+            p = put_json_string(p, rec->new_target);
+        }
+        else {
+            p = put_str(p, "null");
+        }
+        p = put_str(p, ",\"chain\":");
+        p = put_int(p, rec->chain);
+        p = put_str(p, ",\"errno\":");
+        p = put_int(p, rec->err);
+        p = put_str(p, "}\n");
+    }
+    else if (format == OUTPUT_PLAN) {
+        const char* action = strcmp(rec->action, "would_delete") ? "change" : "delete";
+        const char* fields[] = {action, rec->cls, rec->path, rec->target, rec->new_target ? rec->new_target : ""};
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            p = put_str(p, fields[i]);
+            *p++ = '\0';
+        }
+    }
+    else {
+        const char* fields[] = {rec->path, rec->target, rec->cls, rec->action,
+                                rec->new_target ? rec->new_target : ""};
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            p = put_str(p, fields[i]);
+            *p++ = '\0';
+        }
+        p = put_int(p, rec->err);
+        *p++ = '\0';
+    }
+    return p;
+}
+
+/* Upper bound on the formatted size of 'rec' */
+static size_t record_bound(const struct symlinks_link* rec) {
+    size_t strings = strlen(rec->path) + strlen(rec->target) + (rec->new_target ? strlen(rec->new_target) : 0);
+    return 6 * strings + strlen(rec->cls) + strlen(rec->action) + 128;
+}
+
+void output_record(struct output* out, const struct symlinks_link* rec) {
+    char stack[OUTPUT_RECORD_STACK];
+    size_t bound = record_bound(rec);
+    char* buf = stack;
+    if (bound > sizeof(stack)) {
+        buf = malloc(bound);
+        if (!buf) {
+            return;
+        }
+    }
+    size_t len = (size_t)(format_record(out->format, buf, rec) - buf);
+
+    /* Only the copy into the shared buffer happens under the lock */
+    pthread_mutex_lock(&out->lock);
+    if (out->len + len > OUTPUT_BUFFER_SIZE) {
+        write_out(out, out->buf, out->len);
+        out->len = 0;
+    }
+    if (len > OUTPUT_BUFFER_SIZE) {
+        write_out(out, buf, len);
+    }
+    else {
+        memcpy(out->buf + out->len, buf, len);
+        out->len += len;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    if (buf != stack) {
+        free(buf);
+    }
+}
+
+int output_flush(struct output* out) {
+    pthread_mutex_lock(&out->lock);
+    write_out(out, out->buf, out->len);
+    out->len = 0;
+    int failed = out->failed;
+    pthread_mutex_unlock(&out->lock);
+    return failed ? -1 : 0;
+}
+
+void output_free(struct output* out) {
+    if (out) {
+        output_flush(out);
+        pthread_mutex_destroy(&out->lock);
+        free(out);
+    }
+}
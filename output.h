@@ -0,0 +1,60 @@
+#ifndef SYMLINKS_OUTPUT_H
+#define SYMLINKS_OUTPUT_H
+
+/*
+ * Machine-readable report stream (--format=jsonl|nul).
+ *
+ * One record per link, formatted without stdio into a large buffer that is
+ * shared by all scanning threads and written out in big chunks.  Records
+ * are never split across writes by other threads.
+ *
+ *   jsonl  {"path":…,"target":…,"class":…,"action":…,"new_target":…,"chain":N,"errno":N}
+ *          one object per line.  Bytes that are not valid UTF-8 are escaped
+ *          as \udc80-\udcff (the "surrogateescape" convention), so the raw
+ *          path can be recovered.  "new_target" is null when unchanged.
+ *   nul    the same fields but "chain", each terminated by a NUL byte;
+ *          "new_target" is empty when unchanged and "errno" is in decimal.
+ *   plan   a change plan (see plan.h), fed only the would_change and
+ *          would_delete records.
+ */
+
+#include <stddef.h>
+
+#include "symlinks.h"
+
+enum output_format {
+    OUTPUT_TEXT, /* the classic human-readable lines, through stdio */
+    OUTPUT_JSONL,
+    OUTPUT_NUL,
+    OUTPUT_PLAN,
+};
+
+struct output;
+
+/*
+ * output_new:
+ *   Start a record stream of format 'format' to 'fd'.  Returns NULL if out
+ *   of memory.
+ */
+struct output* output_new(int fd, enum output_format format);
+
+/*
+ * output_record:
+ *   Append the record of one link (thread-safe).
+ */
+void output_record(struct output* out, const struct symlinks_link* rec);
+
+/*
+ * output_flush:
+ *   Write out everything buffered.  Returns 0, or -1 once a write has
+ *   failed (reported once; later records are dropped).
+ */
+int output_flush(struct output* out);
+
+/*
+ * output_free:
+ *   Flush and release the stream.
+ */
+void output_free(struct output* out);
+
+#endif
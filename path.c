@@ -0,0 +1,376 @@
+#define _GNU_SOURCE /* realpath */
+
+#include "path.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATH_HAVE_X86 1
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+/*
+ * clean_span:
+ *   Length of the longest prefix of s[0..n) without a "//" or "/." pair,
+ *   i.e. the stretch tidy_path() can copy verbatim.  The returned position,
+ *   if < n, is the slash that starts such a pair.  s[n] must be readable
+ *   (the terminating NUL is fine).  The SIMD variants test two overlapping
+ *   loads per block: slashes in the first, slashes and dots one byte on.
+ */
+static size_t clean_span_scalar(const char* s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '/' && (s[i + 1] == '/' || s[i + 1] == '.')) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#ifdef PATH_HAVE_X86
+__attribute__((target("sse2"))) static size_t clean_span_sse2(const char* s, size_t n) {
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dot = _mm_set1_epi8('.');
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i next = _mm_loadu_si128((const __m128i*)(s + i + 1));
+        __m128i bad = _mm_and_si128(_mm_cmpeq_epi8(cur, slash),
+                                    _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(bad);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + clean_span_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t clean_span_avx2(const char* s, size_t n) {
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i dot = _mm256_set1_epi8('.');
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(s + i + 1));
+        __m256i bad = _mm256_and_si256(_mm256_cmpeq_epi8(cur, slash),
+                                       _mm256_or_si256(_mm256_cmpeq_epi8(next, slash), _mm256_cmpeq_epi8(next, dot)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    /* Not the SSE2 variant: mixing legacy SSE after 256-bit ops costs a state transition */
+    return i + clean_span_scalar(s + i, n - i);
+}
+#endif
+
+typedef size_t (*clean_span_fn)(const char* s, size_t n);
+
+/*
+ * pick_clean_span:
+ *   Choose the widest variant this CPU supports.
+ */
+static clean_span_fn pick_clean_span(void) {
+#ifdef PATH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return clean_span_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return clean_span_sse2;
+    }
+#endif
+    return clean_span_scalar;
+}
+
+static size_t clean_span(const char* s, size_t n) {
+    /* Racing initialisations all store the same pointer */
+    static clean_span_fn impl;
+    clean_span_fn fn = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = pick_clean_span();
+        __atomic_store_n(&impl, fn, __ATOMIC_RELAXED);
+    }
+    return fn(s, n);
+}
+
+/*
+ * tidy_path:
+ *   Single left-to-right pass over the components, keeping the output as a
+ *   stack of components written over the input; see path.h for the contract.
+ */
+int tidy_path(char* path) {
+    if (!path || !*path) {
+        return 0;
+    }
+
+    size_t orig_len = strlen(path);
+    const char* in = path;
+    const char* end = path + orig_len;
+    int is_abs = (path[0] == '/');
+
+    /*
+     * The result is written over the input: it never grows, so 'out' never
+     * overtakes 'in'.  'base' is where components start (after the root
+     * slash), and 'floor' marks the end of the leading ".." components of a
+     * relative path, which cannot be collapsed.
+     */
+    char* out = path;
+    if (is_abs) {
+        out++;
+        in++;
+    }
+    char* base = out;
+    char* floor = out;
+
+    while (in < end) {
+        if (*in == '/') {
+            in++;
+            continue;
+        }
+
+        /* At the start of a component */
+        if (in[0] == '.') {
+            const char* comp_end = memchr(in, '/', (size_t)(end - in));
+            if (!comp_end) {
+                comp_end = end;
+            }
+            size_t comp_len = (size_t)(comp_end - in);
+
+            if (comp_len == 1) {
+                in = comp_end;
+                continue;
+            }
+            if (comp_len == 2 && in[1] == '.') {
+                if (out > floor) {
+                    /* Drop the last component and the slash before it */
+                    char* q = out;
+                    while (q > base && q[-1] != '/') {
+                        q--;
+                    }
+                    out = (q > base) ? q - 1 : base;
+                }
+                else if (!is_abs) {
+                    if (out > base) {
+                        *out++ = '/';
+                    }
+                    *out++ = '.';
+                    *out++ = '.';
+                    floor = out;
+                }
+                in = comp_end;
+                continue;
+            }
+            /* Any other name starting with a dot is ordinary */
+        }
+
+        if (out > base) {
+            *out++ = '/';
+        }
+        /* Copy this component and any clean ones following it in one go */
+        size_t span = clean_span(in, (size_t)(end - in));
+        memmove(out, in, span);
+        out += span;
+        in += span;
+    }
+
+    /* A verbatim span may have carried the trailing slash along */
+    while (out > base && out[-1] == '/') {
+        out--;
+    }
+
+    if (out == path) {
+        *out++ = '.';
+    }
+    *out = '\0';
+
+    /* Output is never longer than the input, and only equal when untouched */
+    return (size_t)(out - path) != orig_len;
+}
+
+/*
+ * shorten_path:
+ *   Walks the leading "../" components of the link against the directory
+ *   of 'base_path', from the innermost one: "../name/" that climbs out of
+ *   a directory called 'name' only to enter it again is dropped.  Names
+ *   above the part of 'base_path' that is known are never guessed.
+ */
+int shorten_path(char* link_path, const char* base_path) {
+    if (!link_path || !*link_path || !base_path || !*base_path) {
+        return 0;
+    }
+
+    /* The components of the link's directory, outermost first */
+    const char* dir_end = strrchr(base_path, '/');
+    if (!dir_end || dir_end - base_path > PATH_MAX) {
+        return 0;
+    }
+    unsigned short names[PATH_MAX / 2]; /* offset of each in 'base_path' */
+    unsigned short name_lens[PATH_MAX / 2];
+    size_t ndirs = 0;
+    for (const char* p = base_path; p < dir_end;) {
+        while (p < dir_end && *p == '/') {
+            p++;
+        }
+        const char* q = p;
+        while (q < dir_end && *q != '/') {
+            q++;
+        }
+        size_t len = (size_t)(q - p);
+        if (len == 0) {
+            break;
+        }
+        if ((len == 2 && p[0] == '.' && p[1] == '.') || ndirs == sizeof(names) / sizeof(names[0])) {
+            return 0; /* not a plain path: leave the link alone */
+        }
+        if (!(len == 1 && p[0] == '.')) {
+            names[ndirs] = (unsigned short)(p - base_path);
+            name_lens[ndirs] = (unsigned short)len;
+            ndirs++;
+        }
+        p = q;
+    }
+
+    int shortened = 0;
+    for (;;) {
+        size_t ups = 0;
+        while (!strncmp(link_path + ups * 3, "../", 3)) {
+            ups++;
+        }
+        if (ups == 0 || ups > ndirs) {
+            break;
+        }
+        /* After climbing 'ups' levels, the next name must be where we came from */
+        const char* name = link_path + ups * 3;
+        size_t len = strcspn(name, "/");
+        const char* rest = name + len;
+        while (*rest == '/') {
+            rest++;
+        }
+        const char* expected = base_path + names[ndirs - ups];
+        if (len != name_lens[ndirs - ups] || strncmp(name, expected, len) != 0 || name[len] != '/' || !*rest) {
+            break;
+        }
+        memmove(link_path + (ups - 1) * 3, rest, strlen(rest) + 1);
+        shortened = 1;
+    }
+
+    return shortened;
+}
+
+/* Split base->path into its components */
+static void path_base_split(struct path_base* base) {
+    base->ncomponents = 0;
+    for (size_t i = 0; base->path[i]; i++) {
+        if (base->path[i] != '/' && (i == 0 || base->path[i - 1] == '/')) {
+            base->start[base->ncomponents++] = (unsigned short)i;
+        }
+    }
+}
+
+int path_base_init(struct path_base* base, const char* dir) {
+    if (!dir || !realpath(dir, base->path)) {
+        return -1;
+    }
+    path_base_split(base);
+    return 0;
+}
+
+/*
+ * relative_path_resolved:
+ *   The relative path from 'base' to the resolved path 'resolved_to'.
+ */
+static int relative_path_resolved(const struct path_base* base, const char* resolved_to, char* out, size_t out_size) {
+    /* Skip the components both paths share */
+    size_t matched = 0;
+    const char* rest = resolved_to;
+    while (*rest == '/') {
+        rest++;
+    }
+    while (matched < base->ncomponents && *rest) {
+        const char* component = base->path + base->start[matched];
+        size_t len = strcspn(component, "/");
+        if (strncmp(component, rest, len) != 0 || (rest[len] != '/' && rest[len] != '\0')) {
+            break;
+        }
+        rest += len;
+        while (*rest == '/') {
+            rest++;
+        }
+        matched++;
+    }
+
+    /* "../" for each remaining component of the base, then the rest of the target */
+    size_t ups = base->ncomponents - matched;
+    size_t rest_len = strlen(rest);
+    if (ups * 3 + rest_len + 1 > out_size) {
+        return -1;
+    }
+    char* p = out;
+    for (size_t i = 0; i < ups; i++) {
+        memcpy(p, "../", 3);
+        p += 3;
+    }
+    memcpy(p, rest, rest_len + 1);
+    if (rest_len == 0 && ups > 0) {
+        p[-1] = '\0'; /* the target is an ancestor: no trailing slash */
+    }
+
+    /* If nothing was added => same directory */
+    if (out[0] == '\0') {
+        if (out_size < 2) {
+            return -1;
+        }
+        strcpy(out, ".");
+    }
+    return 0;
+}
+
+int relative_path_from(const struct path_base* base, const char* to_path, char* out, size_t out_size) {
+    char resolved_to[PATH_MAX];
+    if (!to_path || !out || !realpath(to_path, resolved_to)) {
+        return -1;
+    }
+    return relative_path_resolved(base, resolved_to, out, out_size);
+}
+
+int relative_path_lexical(const char* from_dir, const char* to_path, char* out, size_t out_size) {
+    struct path_base base;
+    if (!from_dir || !to_path || !out || from_dir[0] != '/' || to_path[0] != '/' ||
+        strlen(from_dir) >= sizeof(base.path)) {
+        return -1;
+    }
+    strcpy(base.path, from_dir);
+    path_base_split(&base);
+    return relative_path_resolved(&base, to_path, out, out_size);
+}
+
+/*
+ * build_relative_path:
+ *   Builds a relative path from 'from_dir' to 'to_path' using realpath().
+ */
+int build_relative_path(const char* from_dir, const char* to_path, char* out, size_t out_size) {
+    struct path_base base;
+    if (!out || path_base_init(&base, from_dir) != 0) {
+        return -1;
+    }
+    return relative_path_from(&base, to_path, out, out_size);
+}
+
+/* FNV-1a */
+uint64_t hash_path(const char* path, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
@@ -0,0 +1,82 @@
+#ifndef SYMLINKS_PATH_H
+#define SYMLINKS_PATH_H
+
+/*
+ * Path kernels shared by the scanner, the benchmarks and the fuzz targets.
+ * All of them work on NUL-terminated strings of at most PATH_MAX bytes.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+/*
+ * tidy_path:
+ *   Removes redundant slashes, "." components and a trailing slash, and
+ *   collapses "dir/.." pairs.  Leading ".." components of a relative path
+ *   are kept; ".." at the root of an absolute path is dropped.  An empty
+ *   relative result becomes ".".  Modifies path in-place, in a single pass
+ *   without allocating.  Returns non-zero if modifications were made.
+ */
+int tidy_path(char* path);
+
+/*
+ * shorten_path:
+ *   Removes "../dir" detours from the relative link value 'link_path':
+ *   leading ".." components that climb out of a directory of the link's
+ *   own path 'base_path' only to come back into it.  Paths are compared
+ *   lexically.  Returns non-zero if changes were made.
+ */
+int shorten_path(char* link_path, const char* base_path);
+
+/*
+ * build_relative_path:
+ *   Builds a relative path from 'from_dir' to 'to_path' using realpath().
+ *   Returns 0 on success, -1 on failure.
+ */
+int build_relative_path(const char* from_dir, const char* to_path, char* out, size_t out_size);
+
+/*
+ * path_base:
+ *   A directory resolved with realpath() and split into components, once,
+ *   for building many relative paths from it.
+ */
+struct path_base {
+    char path[PATH_MAX];
+    size_t ncomponents;
+    unsigned short start[PATH_MAX / 2]; /* offset of each component in 'path' */
+};
+
+/*
+ * path_base_init:
+ *   Resolve 'dir' into 'base'.  Returns 0 on success, -1 on failure.
+ */
+int path_base_init(struct path_base* base, const char* dir);
+
+/*
+ * relative_path_from:
+ *   build_relative_path() from an already resolved directory: only
+ *   'to_path' goes through realpath().  Returns 0 on success, -1 on failure.
+ */
+int relative_path_from(const struct path_base* base, const char* to_path, char* out, size_t out_size);
+
+/*
+ * relative_path_lexical:
+ *   build_relative_path() for paths already resolved, without touching the
+ *   filesystem: 'from_dir' and 'to_path' must be absolute and tidy (see
+ *   tidy_path()).  Returns 0 on success, -1 on failure.
+ */
+int relative_path_lexical(const char* from_dir, const char* to_path, char* out, size_t out_size);
+
+/*
+ * hash_path:
+ *   The 64-bit FNV-1a hash of the first 'len' bytes of 'path', for the
+ *   tables keyed by path or link value.
+ */
+uint64_t hash_path(const char* path, size_t len);
+
+#endif
@@ -0,0 +1,152 @@
+#include "plan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PLAN_FIELDS 5
+
+/*
+ * read_file:
+ *   Read all of 'fd' into a NUL-terminated heap buffer.  Returns NULL on
+ *   error, with errno set.
+ */
+static char* read_file(int fd, size_t* size) {
+    size_t cap = 65536;
+    size_t len = 0;
+    char* buf = malloc(cap + 1);
+    if (!buf) {
+        return NULL;
+    }
+    for (;;) {
+        if (len == cap) {
+            char* bigger = realloc(buf, cap * 2 + 1);
+            if (!bigger) {
+                free(buf);
+                errno = ENOMEM;
+                return NULL;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int err = errno;
+            free(buf);
+            errno = err;
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    *size = len;
+    return buf;
+}
+
+/* Order by directory, then keep the plan's order within a directory */
+static int compare_entries(const void* a, const void* b) {
+    const struct plan_entry* x = a;
+    const struct plan_entry* y = b;
+    size_t len = (x->dir_len < y->dir_len) ? x->dir_len : y->dir_len;
+    int c = memcmp(x->path, y->path, len);
+    if (c != 0) {
+        return c;
+    }
+    if (x->dir_len != y->dir_len) {
+        return (x->dir_len < y->dir_len) ? -1 : 1;
+    }
+    return (x->path < y->path) ? -1 : (x->path > y->path);
+}
+
+int plan_load(const char* path, struct plan* plan, char* error, size_t error_size) {
+    memset(plan, 0, sizeof(*plan));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(error, error_size, "Cannot open plan %s: %s", path, strerror(errno));
+        return -1;
+    }
+    size_t size = 0;
+    plan->data = read_file(fd, &size);
+    int err = errno;
+    close(fd);
+    if (!plan->data) {
+        snprintf(error, error_size, "Cannot read plan %s: %s", path, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    size_t magic_len = strlen(PLAN_MAGIC);
+    if (size < magic_len || memcmp(plan->data, PLAN_MAGIC, magic_len) != 0) {
+        snprintf(error, error_size, "%s is not a symlinks plan.", path);
+        plan_free(plan);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Every record is five NUL-terminated fields */
+    size_t nuls = 0;
+    for (size_t i = magic_len; i < size; i++) {
+        nuls += (plan->data[i] == '\0');
+    }
+    if (nuls % PLAN_FIELDS != 0 || (size > magic_len && plan->data[size - 1] != '\0')) {
+        snprintf(error, error_size, "Plan %s is truncated or corrupt.", path);
+        plan_free(plan);
+        errno = EINVAL;
+        return -1;
+    }
+    plan->entries = calloc(nuls / PLAN_FIELDS + 1, sizeof(*plan->entries));
+    if (!plan->entries) {
+        snprintf(error, error_size, "Out of memory reading plan %s", path);
+        plan_free(plan);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    const char* p = plan->data + magic_len;
+    const char* end = plan->data + size;
+    while (p < end) {
+        const char* fields[PLAN_FIELDS];
+        for (int f = 0; f < PLAN_FIELDS; f++) {
+            fields[f] = p;
+            p += strlen(p) + 1;
+        }
+        struct plan_entry* e = &plan->entries[plan->count];
+        e->action = fields[0];
+        e->cls = fields[1];
+        e->path = fields[2];
+        e->old_target = fields[3];
+        e->new_target = fields[4];
+
+        const char* slash = strrchr(e->path, '/');
+        if (e->path[0] != '/' || !slash || !slash[1] ||
+            (strcmp(e->action, "change") != 0 && strcmp(e->action, "delete") != 0) ||
+            (!strcmp(e->action, "change") && !*e->new_target)) {
+            snprintf(error, error_size, "Plan %s has an invalid entry for %s", path, e->path);
+            plan_free(plan);
+            errno = EINVAL;
+            return -1;
+        }
+        e->dir_len = (size_t)(slash - e->path);
+        plan->count++;
+    }
+
+    qsort(plan->entries, plan->count, sizeof(*plan->entries), compare_entries);
+    return 0;
+}
+
+void plan_free(struct plan* plan) {
+    free(plan->entries);
+    free(plan->data);
+    memset(plan, 0, sizeof(*plan));
+}
@@ -0,0 +1,50 @@
+#ifndef SYMLINKS_PLAN_H
+#define SYMLINKS_PLAN_H
+
+/*
+ * Change plans (--plan FILE / --apply FILE).
+ *
+ * A plan is written by a scan (as the OUTPUT_PLAN record stream, see
+ * output.h) and executed later.  Format: the line PLAN_MAGIC, then one
+ * record per change, made of five NUL-terminated fields:
+ *
+ *   action      "change" or "delete"
+ *   class       the link's class when planned (see struct symlinks_link)
+ *   path        absolute path of the link
+ *   old target  the link's value when planned; the change is skipped if
+ *               it no longer matches
+ *   new target  the value to set ("" for "delete")
+ *
+ * `tr '\0' '\n' < FILE` makes a plan readable for review.
+ */
+
+#include <stddef.h>
+
+#define PLAN_MAGIC "symlinks-plan 1\n"
+
+struct plan_entry {
+    const char* action;
+    const char* cls;
+    const char* path;
+    const char* old_target;
+    const char* new_target;
+    size_t dir_len; /* length of the directory part of 'path', without the last slash */
+};
+
+struct plan {
+    char* data; /* the whole file; the entries point into it */
+    struct plan_entry* entries;
+    size_t count;
+};
+
+/*
+ * plan_load:
+ *   Read the plan at 'path' and sort its entries by directory, so each
+ *   directory is opened once and its changes are made together.
+ *   Returns 0, or -1 with errno set and a message in 'error'.
+ */
+int plan_load(const char* path, struct plan* plan, char* error, size_t error_size);
+
+void plan_free(struct plan* plan);
+
+#endif
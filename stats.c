@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Latency buckets: bucket b holds [2^(b-1), 2^b) ns, the last one the rest */
+#define STATS_BUCKETS 40
+
+/* Directories listed in the report */
+#define STATS_SLOWEST 10
+
+struct slow_dir {
+    uint64_t ns;
+    char* path;
+};
+
+/*
+ * stats_thread:
+ *   One thread's counters.  Only the owner writes them, so an update is a
+ *   relaxed load and store; the atomics only keep readers well-defined.
+ */
+struct stats_thread {
+    struct thread_block block; /* first, see thread_blocks_get() */
+    atomic_uint_least64_t counters[STATS_NCOUNTERS];
+    atomic_uint_least64_t op_count[STATS_NOPS];
+    atomic_uint_least64_t op_ns[STATS_NOPS];
+    atomic_uint_least64_t op_max[STATS_NOPS];
+    atomic_uint_least64_t hist[STATS_NOPS][STATS_BUCKETS];
+
+    /* Timing only: time of the directories scanned so far, and the slowest */
+    uint64_t nested_ns;
+    size_t nslowest;
+    struct slow_dir slowest[STATS_SLOWEST];
+};
+
+struct scan_stats {
+    int timing;
+    struct thread_blocks threads; /* of struct stats_thread; the lock also guards the slowest directories */
+};
+
+static const char* const op_names[STATS_NOPS] = {
+    "opendir", "readdir", "lstat", "readlink", "stat target", "statx batch", "realpath", "rewrite", "unlink",
+};
+
+/* Tells thread_blocks apart, for the thread_block_cache */
+static atomic_uint_least64_t next_id = 1;
+
+static _Thread_local struct thread_block_cache tls_block;
+
+void thread_blocks_init(struct thread_blocks* blocks, size_t size) {
+    blocks->id = atomic_fetch_add(&next_id, 1);
+    blocks->size = size;
+    pthread_mutex_init(&blocks->lock, NULL);
+    blocks->head = NULL;
+}
+
+void thread_blocks_destroy(struct thread_blocks* blocks) {
+    struct thread_block* b = blocks->head;
+    while (b) {
+        struct thread_block* next = b->next;
+        free(b);
+        b = next;
+    }
+    pthread_mutex_destroy(&blocks->lock);
+}
+
+void* thread_blocks_get(struct thread_blocks* blocks, struct thread_block_cache* cache) {
+    if (cache->id == blocks->id) {
+        return cache->block;
+    }
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&blocks->lock);
+    struct thread_block* b = blocks->head;
+    while (b && !pthread_equal(b->owner, self)) {
+        b = b->next;
+    }
+    if (!b) {
+        b = calloc(1, blocks->size);
+        if (b) {
+            b->owner = self;
+            b->next = blocks->head;
+            blocks->head = b;
+        }
+    }
+    pthread_mutex_unlock(&blocks->lock);
+    if (b) {
+        cache->id = blocks->id;
+        cache->block = b;
+    }
+    return b;
+}
+
+struct scan_stats* stats_new(int timing) {
+    struct scan_stats* stats = calloc(1, sizeof(*stats));
+    if (!stats) {
+        return NULL;
+    }
+    stats->timing = timing;
+    thread_blocks_init(&stats->threads, sizeof(struct stats_thread));
+    return stats;
+}
+
+void stats_free(struct scan_stats* stats) {
+    if (!stats) {
+        return;
+    }
+    for (struct thread_block* b = stats->threads.head; b; b = b->next) {
+        struct stats_thread* t = (struct stats_thread*)b;
+        for (size_t i = 0; i < t->nslowest; i++) {
+            free(t->slowest[i].path);
+        }
+    }
+    thread_blocks_destroy(&stats->threads);
+    free(stats);
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * thread_counters:
+ *   The calling thread's counters, set up on first use.
+ */
+static struct stats_thread* thread_counters(struct scan_stats* stats) {
+    return thread_blocks_get(&stats->threads, &tls_block);
+}
+
+static inline void bump(atomic_uint_least64_t* counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint64_t get(atomic_uint_least64_t* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+uint64_t stats_begin(const struct scan_stats* stats) {
+    return (stats && stats->timing) ? stats_now() : 0;
+}
+
+void stats_end(struct scan_stats* stats, enum stats_op op, uint64_t start) {
+    if (!stats) {
+        return;
+    }
+    struct stats_thread* t = thread_counters(stats);
+    if (!t) {
+        return;
+    }
+    bump(&t->op_count[op], 1);
+    if (start) {
+        uint64_t ns = stats_now() - start;
+        int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+        bump(&t->op_ns[op], ns);
+        bump(&t->hist[op][bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1], 1);
+        if (ns > get(&t->op_max[op])) {
+            atomic_store_explicit(&t->op_max[op], ns, memory_order_relaxed);
+        }
+    }
+}
+
+void stats_add(struct scan_stats* stats, enum stats_counter counter, uint64_t n) {
+    if (!stats) {
+        return;
+    }
+    struct stats_thread* t = thread_counters(stats);
+    if (t) {
+        bump(&t->counters[counter], n);
+    }
+}
+
+uint64_t stats_dir_begin(struct scan_stats* stats, uint64_t* nested) {
+    if (!stats || !stats->timing) {
+        return 0;
+    }
+    struct stats_thread* t = thread_counters(stats);
+    if (!t) {
+        return 0;
+    }
+    *nested = t->nested_ns;
+    return stats_now();
+}
+
+void stats_dir_end(struct scan_stats* stats, const char* path, uint64_t start, uint64_t nested) {
+    if (!start) {
+        return;
+    }
+    struct stats_thread* t = thread_counters(stats);
+    if (!t) {
+        return;
+    }
+    uint64_t elapsed = stats_now() - start;
+    uint64_t own = elapsed - (t->nested_ns - nested);
+    t->nested_ns = nested + elapsed;
+
+    /* Replace the fastest of the slowest once the list is full */
+    size_t slot = t->nslowest;
+    if (slot == STATS_SLOWEST) {
+        slot = 0;
+        for (size_t i = 1; i < STATS_SLOWEST; i++) {
+            if (t->slowest[i].ns < t->slowest[slot].ns) {
+                slot = i;
+            }
+        }
+        if (own <= t->slowest[slot].ns) {
+            return;
+        }
+    }
+    char* copy = strdup(path);
+    if (!copy) {
+        return;
+    }
+    pthread_mutex_lock(&stats->threads.lock);
+    if (slot == t->nslowest) {
+        t->nslowest++;
+    }
+    else {
+        free(t->slowest[slot].path);
+    }
+    t->slowest[slot].ns = own;
+    t->slowest[slot].path = copy;
+    pthread_mutex_unlock(&stats->threads.lock);
+}
+
+void stats_counters(struct scan_stats* stats, uint64_t counters[STATS_NCOUNTERS]) {
+    memset(counters, 0, STATS_NCOUNTERS * sizeof(counters[0]));
+    pthread_mutex_lock(&stats->threads.lock);
+    for (struct thread_block* b = stats->threads.head; b; b = b->next) {
+        struct stats_thread* t = (struct stats_thread*)b;
+        for (int i = 0; i < STATS_NCOUNTERS; i++) {
+            counters[i] += get(&t->counters[i]);
+        }
+    }
+    pthread_mutex_unlock(&stats->threads.lock);
+}
+
+/*
+ * percentile_us:
+ *   Upper bound, in microseconds, of the histogram bucket holding the
+ *   'p' quantile.
+ */
+static double percentile_us(const uint64_t* hist, uint64_t count, double p) {
+    uint64_t rank = (uint64_t)(p * (double)count);
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            return (double)(1ull << b) / 1000.0;
+        }
+    }
+    return (double)(1ull << (STATS_BUCKETS - 1)) / 1000.0;
+}
+
+static int compare_slowest(const void* a, const void* b) {
+    const struct slow_dir* x = a;
+    const struct slow_dir* y = b;
+    return (x->ns < y->ns) - (x->ns > y->ns);
+}
+
+void stats_print(struct scan_stats* stats, FILE* out) {
+    uint64_t counters[STATS_NCOUNTERS];
+    stats_counters(stats, counters);
+
+    fprintf(out, "directories: %llu, entries: %llu, links: %llu\n", (unsigned long long)counters[STATS_DIRS],
+            (unsigned long long)counters[STATS_ENTRIES], (unsigned long long)counters[STATS_LINKS]);
+    fprintf(out,
+            "links by class: %llu dangling, %llu loop, %llu other_fs, %llu absolute, %llu messy, %llu chained, "
+            "%llu relative\n",
+            (unsigned long long)counters[STATS_DANGLING], (unsigned long long)counters[STATS_LOOP],
+            (unsigned long long)counters[STATS_OTHER_FS], (unsigned long long)counters[STATS_ABSOLUTE],
+            (unsigned long long)counters[STATS_MESSY], (unsigned long long)counters[STATS_CHAINED],
+            (unsigned long long)counters[STATS_RELATIVE]);
+    fprintf(out, "links changed: %llu, deleted: %llu; path bytes processed: %llu\n",
+            (unsigned long long)counters[STATS_CHANGED], (unsigned long long)counters[STATS_DELETED],
+            (unsigned long long)counters[STATS_PATH_BYTES]);
+
+    pthread_mutex_lock(&stats->threads.lock);
+    fprintf(out, "%-12s %10s", "operation", "count");
+    if (stats->timing) {
+        fprintf(out, " %10s %9s %9s %9s %10s", "total ms", "mean us", "p50 us", "p99 us", "max us");
+    }
+    fprintf(out, "\n");
+    for (int op = 0; op < STATS_NOPS; op++) {
+        uint64_t count = 0, ns = 0, max = 0;
+        uint64_t hist[STATS_BUCKETS] = {0};
+        for (struct thread_block* b = stats->threads.head; b; b = b->next) {
+            struct stats_thread* t = (struct stats_thread*)b;
+            count += get(&t->op_count[op]);
+            ns += get(&t->op_ns[op]);
+            if (get(&t->op_max[op]) > max) {
+                max = get(&t->op_max[op]);
+            }
+            for (int b = 0; b < STATS_BUCKETS; b++) {
+                hist[b] += get(&t->hist[op][b]);
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        fprintf(out, "%-12s %10llu", op_names[op], (unsigned long long)count);
+        if (stats->timing) {
+            fprintf(out, " %10.1f %9.2f %9.2f %9.2f %10.2f", (double)ns / 1e6, (double)ns / (double)count / 1e3,
+                    percentile_us(hist, count, 0.5), percentile_us(hist, count, 0.99), (double)max / 1e3);
+        }
+        fprintf(out, "\n");
+    }
+
+    if (stats->timing) {
+        /* Merge the threads' lists into the slowest of all, however many threads there are */
+        struct slow_dir top[STATS_SLOWEST];
+        size_t n = 0;
+        for (struct thread_block* b = stats->threads.head; b; b = b->next) {
+            struct stats_thread* t = (struct stats_thread*)b;
+            for (size_t i = 0; i < t->nslowest; i++) {
+                size_t slot = n;
+                if (n == STATS_SLOWEST) {
+                    slot = 0;
+                    for (size_t j = 1; j < STATS_SLOWEST; j++) {
+                        if (top[j].ns < top[slot].ns) {
+                            slot = j;
+                        }
+                    }
+                    if (t->slowest[i].ns <= top[slot].ns) {
+                        continue;
+                    }
+                }
+                else {
+                    n++;
+                }
+                top[slot] = t->slowest[i];
+            }
+        }
+        qsort(top, n, sizeof(top[0]), compare_slowest);
+        if (n > 0) {
+            fprintf(out, "slowest directories (own time, without subdirectories):\n");
+        }
+        for (size_t i = 0; i < n; i++) {
+            fprintf(out, "%10.2f ms  %s\n", (double)top[i].ns / 1e6, top[i].path);
+        }
+    }
+    pthread_mutex_unlock(&stats->threads.lock);
+}
@@ -0,0 +1,137 @@
+#ifndef SYMLINKS_STATS_H
+#define SYMLINKS_STATS_H
+
+/*
+ * Scan instrumentation (--stats, --progress).
+ *
+ * Every thread updates its own block of counters, found through a
+ * thread-local pointer, so counting costs a plain load and store with no
+ * lock and no shared cache line; readers add the blocks up.  Latencies are
+ * only taken when timing is on: one clock_gettime() (vDSO) on each side of
+ * the system call, into a log2 histogram per operation.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum stats_op {
+    STATS_OPENDIR,  /* open()/openat() of a directory */
+    STATS_READDIR,  /* readdir(), one entry or the end of the directory */
+    STATS_LSTAT,    /* fstatat() of an entry without d_type */
+    STATS_READLINK, /* readlinkat() */
+    STATS_STAT,     /* fstatat() of a link target */
+    STATS_STATX,    /* io_uring_enter() submitting a batch of target statx and waiting for it */
+    STATS_REALPATH, /* build_relative_path() for -c */
+    STATS_REWRITE,  /* replacing a link */
+    STATS_UNLINK,   /* deleting a link */
+    STATS_NOPS
+};
+
+enum stats_counter {
+    STATS_DIRS,
+    STATS_ENTRIES,
+    STATS_LINKS,
+    STATS_DANGLING,
+    STATS_LOOP,
+    STATS_OTHER_FS,
+    STATS_ABSOLUTE,
+    STATS_MESSY,
+    STATS_CHAINED,
+    STATS_RELATIVE,
+    STATS_CHANGED,
+    STATS_DELETED,
+    STATS_PATH_BYTES, /* link paths and values examined */
+    STATS_NCOUNTERS
+};
+
+/*
+ * thread_block / thread_blocks:
+ *   The per-thread blocks of one owner (the stats here, the summary's
+ *   tables), each starting with a struct thread_block.  'lock' guards the
+ *   list; a block is only written by its thread.
+ */
+struct thread_block {
+    struct thread_block* next;
+    pthread_t owner;
+};
+
+struct thread_blocks {
+    uint64_t id;
+    size_t size; /* of a block */
+    pthread_mutex_t lock;
+    struct thread_block* head;
+};
+
+/* The calling thread's last block, and the id of its thread_blocks; one per module, _Thread_local */
+struct thread_block_cache {
+    uint64_t id;
+    struct thread_block* block;
+};
+
+void thread_blocks_init(struct thread_blocks* blocks, size_t size);
+
+/*
+ * thread_blocks_destroy:
+ *   Free the blocks; whatever they point to must be freed first.
+ */
+void thread_blocks_destroy(struct thread_blocks* blocks);
+
+/*
+ * thread_blocks_get:
+ *   The calling thread's block, zeroed on first use, found through 'cache'
+ *   without a lock while the thread keeps to one owner.  A block left by a
+ *   finished thread is taken over by a new thread with the same id.
+ *   Returns NULL if out of memory.
+ */
+void* thread_blocks_get(struct thread_blocks* blocks, struct thread_block_cache* cache);
+
+struct scan_stats;
+
+/*
+ * stats_new:
+ *   Start counting; with 'timing', also keep latency histograms and the
+ *   slowest directories.  Returns NULL if out of memory.
+ */
+struct scan_stats* stats_new(int timing);
+
+void stats_free(struct scan_stats* stats);
+
+/* Nanoseconds on the monotonic clock */
+uint64_t stats_now(void);
+
+/*
+ * stats_begin:
+ *   Start timing an operation: the current time if timing is on, else 0.
+ */
+uint64_t stats_begin(const struct scan_stats* stats);
+
+/*
+ * stats_end:
+ *   Count one 'op' started at 'start' (from stats_begin()).
+ */
+void stats_end(struct scan_stats* stats, enum stats_op op, uint64_t start);
+
+void stats_add(struct scan_stats* stats, enum stats_counter counter, uint64_t n);
+
+/*
+ * stats_dir_begin / stats_dir_end:
+ *   Bracket the scan of one directory.  Time spent in directories scanned
+ *   in between (recursion) is not charged to it.
+ */
+uint64_t stats_dir_begin(struct scan_stats* stats, uint64_t* nested);
+void stats_dir_end(struct scan_stats* stats, const char* path, uint64_t start, uint64_t nested);
+
+/*
+ * stats_counters:
+ *   Current totals of all threads (safe while scans are running).
+ */
+void stats_counters(struct scan_stats* stats, uint64_t counters[STATS_NCOUNTERS]);
+
+/*
+ * stats_print:
+ *   Write the full report to 'out'.
+ */
+void stats_print(struct scan_stats* stats, FILE* out);
+
+#endif
@@ -0,0 +1,359 @@
+#include "summary.h"
+#include "path.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Subtrees and directories listed in the report */
+#define SUMMARY_TOP 10
+
+static const char* const count_names[SUMMARY_NCLASSES] = {
+    "dangling", "loop", "other_fs", "absolute", "messy", "chained", "relative",
+};
+
+/* One subtree at the summary depth, in an open-addressing table */
+struct subtree {
+    char* path; /* NULL: free slot */
+    uint64_t hash;
+    uint64_t links;
+    uint64_t counts[SUMMARY_NCOUNTS];
+};
+
+struct subtree_table {
+    struct subtree* slots;
+    size_t size; /* power of two, or 0 */
+    size_t count;
+};
+
+struct dangling_dir {
+    uint64_t count;
+    char* path;
+};
+
+/*
+ * summary_thread:
+ *   One thread's tables.  Only the owner writes them, and they are only
+ *   read once the scans are over, so they need no atomics.
+ */
+struct summary_thread {
+    struct thread_block block; /* first, see thread_blocks_get() */
+    uint64_t totals[SUMMARY_NCOUNTS];
+    uint64_t links;
+    struct subtree_table subtrees;
+    size_t ndangling;
+    struct dangling_dir dangling[SUMMARY_TOP];
+};
+
+struct scan_summary {
+    int depth;
+    atomic_int incomplete; /* a subtree could not be added: out of memory */
+    struct thread_blocks threads; /* of struct summary_thread */
+};
+
+static _Thread_local struct thread_block_cache tls_block;
+
+struct scan_summary* summary_new(int depth) {
+    struct scan_summary* summary = calloc(1, sizeof(*summary));
+    if (!summary) {
+        return NULL;
+    }
+    summary->depth = depth;
+    atomic_init(&summary->incomplete, 0);
+    thread_blocks_init(&summary->threads, sizeof(struct summary_thread));
+    return summary;
+}
+
+static void table_free(struct subtree_table* table) {
+    for (size_t i = 0; i < table->size; i++) {
+        free(table->slots[i].path);
+    }
+    free(table->slots);
+}
+
+void summary_free(struct scan_summary* summary) {
+    if (!summary) {
+        return;
+    }
+    for (struct thread_block* b = summary->threads.head; b; b = b->next) {
+        struct summary_thread* t = (struct summary_thread*)b;
+        table_free(&t->subtrees);
+        for (size_t i = 0; i < t->ndangling; i++) {
+            free(t->dangling[i].path);
+        }
+    }
+    thread_blocks_destroy(&summary->threads);
+    free(summary);
+}
+
+/*
+ * thread_tables:
+ *   The calling thread's tables, set up on first use.
+ */
+static struct summary_thread* thread_tables(struct scan_summary* summary) {
+    return thread_blocks_get(&summary->threads, &tls_block);
+}
+
+/*
+ * table_find:
+ *   The entry for the first 'len' bytes of 'path', added (zeroed) if new.
+ *   Returns NULL if out of memory.
+ */
+static struct subtree* table_find(struct subtree_table* table, const char* path, size_t len, uint64_t hash) {
+    if (table->count + 1 > table->size / 4 * 3) {
+        size_t size = table->size ? table->size * 2 : 64;
+        struct subtree* slots = calloc(size, sizeof(*slots));
+        if (!slots) {
+            return NULL;
+        }
+        for (size_t i = 0; i < table->size; i++) {
+            if (table->slots[i].path) {
+                size_t j = table->slots[i].hash & (size - 1);
+                while (slots[j].path) {
+                    j = (j + 1) & (size - 1);
+                }
+                slots[j] = table->slots[i];
+            }
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->size = size;
+    }
+
+    size_t i = hash & (table->size - 1);
+    while (table->slots[i].path) {
+        struct subtree* s = &table->slots[i];
+        if (s->hash == hash && !strncmp(s->path, path, len) && s->path[len] == '\0') {
+            return s;
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+    char* copy = malloc(len + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    table->slots[i].path = copy;
+    table->slots[i].hash = hash;
+    table->count++;
+    return &table->slots[i];
+}
+
+/*
+ * dangling_before:
+ *   Whether 'count' dangling links in the directory 'path' (of 'len' bytes)
+ *   come before 'd' in the report: more links first, then by path, so the
+ *   threads' lists merge into the same report whoever scanned what.
+ */
+static int dangling_before(uint64_t count, const char* path, size_t len, const struct dangling_dir* d) {
+    if (count != d->count) {
+        return count > d->count;
+    }
+    int cmp = strncmp(path, d->path, len);
+    return cmp < 0 || (cmp == 0 && d->path[len] != '\0');
+}
+
+/*
+ * note_dangling:
+ *   Keep 'path' among the thread's directories with the most dangling
+ *   links, replacing the last of them once the list is full.
+ */
+static void note_dangling(struct summary_thread* t, const char* path, size_t len, uint64_t count) {
+    size_t slot = t->ndangling;
+    if (slot == SUMMARY_TOP) {
+        slot = 0;
+        for (size_t i = 1; i < SUMMARY_TOP; i++) {
+            const struct dangling_dir* d = &t->dangling[i];
+            if (!dangling_before(d->count, d->path, strlen(d->path), &t->dangling[slot])) {
+                slot = i;
+            }
+        }
+        if (!dangling_before(count, path, len, &t->dangling[slot])) {
+            return;
+        }
+    }
+    char* copy = malloc(len + 1);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    if (slot == t->ndangling) {
+        t->ndangling++;
+    }
+    else {
+        free(t->dangling[slot].path);
+    }
+    t->dangling[slot].count = count;
+    t->dangling[slot].path = copy;
+}
+
+void summary_dir_end(struct scan_summary* summary,
+                     const char* path,
+                     size_t path_len,
+                     int depth,
+                     const uint64_t counts[SUMMARY_NCOUNTS]) {
+    uint64_t links = 0;
+    for (int i = 0; i < SUMMARY_NCLASSES; i++) {
+        links += counts[i];
+    }
+    if (links == 0) {
+        return;
+    }
+    struct summary_thread* t = thread_tables(summary);
+    if (!t) {
+        atomic_store(&summary->incomplete, 1);
+        return;
+    }
+    for (int i = 0; i < SUMMARY_NCOUNTS; i++) {
+        t->totals[i] += counts[i];
+    }
+    t->links += links;
+    if (counts[SUMMARY_DANGLING] > 0) {
+        note_dangling(t, path, path_len, counts[SUMMARY_DANGLING]);
+    }
+    if (depth < summary->depth) {
+        return;
+    }
+
+    /* Roll up into the ancestor at the summary depth: drop a name per level */
+    size_t len = path_len;
+    for (int d = depth; d > summary->depth && len > 0; d--) {
+        while (len > 0 && path[len - 1] != '/') {
+            len--;
+        }
+        while (len > 1 && path[len - 1] == '/') {
+            len--;
+        }
+    }
+    struct subtree* s = table_find(&t->subtrees, path, len, hash_path(path, len));
+    if (!s) {
+        atomic_store(&summary->incomplete, 1);
+        return;
+    }
+    for (int i = 0; i < SUMMARY_NCOUNTS; i++) {
+        s->counts[i] += counts[i];
+    }
+    s->links += links;
+}
+
+static int compare_subtrees(const void* a, const void* b) {
+    const struct subtree* x = *(const struct subtree* const*)a;
+    const struct subtree* y = *(const struct subtree* const*)b;
+    if (x->links != y->links) {
+        return (x->links < y->links) - (x->links > y->links);
+    }
+    return strcmp(x->path, y->path);
+}
+
+static int compare_dangling(const void* a, const void* b) {
+    const struct dangling_dir* x = a;
+    const struct dangling_dir* y = b;
+    if (x->count != y->count) {
+        return (x->count < y->count) - (x->count > y->count);
+    }
+    return strcmp(x->path, y->path);
+}
+
+void summary_print(struct scan_summary* summary, FILE* out) {
+    uint64_t totals[SUMMARY_NCOUNTS] = {0};
+    uint64_t links = 0;
+    struct subtree_table merged = {NULL, 0, 0};
+    int incomplete = atomic_load(&summary->incomplete);
+
+    /* Add up the threads' partial tables */
+    pthread_mutex_lock(&summary->threads.lock);
+    for (struct thread_block* b = summary->threads.head; b; b = b->next) {
+        const struct summary_thread* t = (const struct summary_thread*)b;
+        for (int i = 0; i < SUMMARY_NCOUNTS; i++) {
+            totals[i] += t->totals[i];
+        }
+        links += t->links;
+        for (size_t i = 0; i < t->subtrees.size; i++) {
+            const struct subtree* from = &t->subtrees.slots[i];
+            if (!from->path) {
+                continue;
+            }
+            struct subtree* s = table_find(&merged, from->path, strlen(from->path), from->hash);
+            if (!s) {
+                incomplete = 1;
+                continue;
+            }
+            for (int c = 0; c < SUMMARY_NCOUNTS; c++) {
+                s->counts[c] += from->counts[c];
+            }
+            s->links += from->links;
+        }
+    }
+
+    fprintf(out, "links: %llu; by class:", (unsigned long long)links);
+    for (int i = 0; i < SUMMARY_NCLASSES; i++) {
+        fprintf(out, "%s %llu %s", i ? "," : "", (unsigned long long)totals[i], count_names[i]);
+    }
+    fprintf(out, "\nlinks changed: %llu, deleted: %llu\n", (unsigned long long)totals[SUMMARY_CHANGED],
+            (unsigned long long)totals[SUMMARY_DELETED]);
+
+    struct subtree** order = merged.count ? malloc(merged.count * sizeof(*order)) : NULL;
+    if (order) {
+        size_t n = 0;
+        for (size_t i = 0; i < merged.size; i++) {
+            if (merged.slots[i].path) {
+                order[n++] = &merged.slots[i];
+            }
+        }
+        qsort(order, n, sizeof(order[0]), compare_subtrees);
+        fprintf(out, "subtrees at depth %d with the most links (%zu of %zu):\n", summary->depth,
+                n < SUMMARY_TOP ? n : SUMMARY_TOP, n);
+        fprintf(out, "%10s", "links");
+        for (int c = 0; c < SUMMARY_NCLASSES; c++) {
+            fprintf(out, " %9s", count_names[c]);
+        }
+        fprintf(out, "  path\n");
+        for (size_t i = 0; i < n && i < SUMMARY_TOP; i++) {
+            fprintf(out, "%10llu", (unsigned long long)order[i]->links);
+            for (int c = 0; c < SUMMARY_NCLASSES; c++) {
+                fprintf(out, " %9llu", (unsigned long long)order[i]->counts[c]);
+            }
+            fprintf(out, "  %s\n", order[i]->path[0] ? order[i]->path : "/");
+        }
+        free(order);
+    }
+    else if (merged.count) {
+        incomplete = 1;
+    }
+    table_free(&merged);
+
+    size_t n = 0;
+    for (struct thread_block* b = summary->threads.head; b; b = b->next) {
+        n += ((const struct summary_thread*)b)->ndangling;
+    }
+    struct dangling_dir* all = n ? malloc(n * sizeof(*all)) : NULL;
+    if (!all && n > 0) {
+        incomplete = 1;
+    }
+    n = 0;
+    for (struct thread_block* b = summary->threads.head; all && b; b = b->next) {
+        const struct summary_thread* t = (const struct summary_thread*)b;
+        for (size_t i = 0; i < t->ndangling; i++) {
+            all[n++] = t->dangling[i];
+        }
+    }
+    if (n > 0) {
+        qsort(all, n, sizeof(all[0]), compare_dangling);
+    }
+    if (n > 0) {
+        fprintf(out, "directories with the most dangling links:\n");
+    }
+    for (size_t i = 0; i < n && i < SUMMARY_TOP; i++) {
+        fprintf(out, "%10llu  %s\n", (unsigned long long)all[i].count, all[i].path[0] ? all[i].path : "/");
+    }
+    free(all);
+    pthread_mutex_unlock(&summary->threads.lock);
+
+    if (incomplete) {
+        fprintf(out, "(out of memory: some subtrees are missing)\n");
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef SYMLINKS_SUMMARY_H
+#define SYMLINKS_SUMMARY_H
+
+/*
+ * Aggregated reports (--summary[=DEPTH]).
+ *
+ * Instead of a line per link: totals per class, the subtrees at a given
+ * depth below the roots with the most links, and the directories with the
+ * most dangling links.  Each directory counts its links while it is read
+ * and, once done, adds them to its ancestor at that depth (or to the
+ * totals alone when it is shallower), so the tables hold one entry per
+ * directory at that depth, however many links there are.  As with the
+ * stats, every thread keeps its own tables, found through a thread-local
+ * pointer, and the report adds them up.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum summary_count {
+    SUMMARY_DANGLING,
+    SUMMARY_LOOP,
+    SUMMARY_OTHER_FS,
+    SUMMARY_ABSOLUTE,
+    SUMMARY_MESSY,
+    SUMMARY_CHAINED,
+    SUMMARY_RELATIVE,
+    SUMMARY_CHANGED, /* changed, or would be in a dry run */
+    SUMMARY_DELETED, /* deleted, or would be in a dry run */
+    SUMMARY_NCOUNTS
+};
+
+/* Counts of the classes alone, which add up to the links */
+#define SUMMARY_NCLASSES (SUMMARY_RELATIVE + 1)
+
+struct scan_summary;
+
+/*
+ * summary_new:
+ *   Roll subtrees up to 'depth' (0 = the roots).  Returns NULL if out of
+ *   memory.
+ */
+struct scan_summary* summary_new(int depth);
+
+void summary_free(struct scan_summary* summary);
+
+/*
+ * summary_dir_end:
+ *   Add the 'counts' of the links found directly in the directory whose
+ *   path is the first 'path_len' bytes of 'path', 'depth' levels below its
+ *   root.
+ */
+void summary_dir_end(struct scan_summary* summary,
+                     const char* path,
+                     size_t path_len,
+                     int depth,
+                     const uint64_t counts[SUMMARY_NCOUNTS]);
+
+/*
+ * summary_print:
+ *   Write the report to 'out'.
+ */
+void summary_print(struct scan_summary* summary, FILE* out);
+
+#endif
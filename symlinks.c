@@ -1,20 +1,38 @@
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 700
+#define _GNU_SOURCE /* dirent.d_type, statx */
 
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <getopt.h>
-#include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "archive.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "index.h"
+#include "path.h"
+#include "plan.h"
+#include "stats.h"
+#include "summary.h"
+#include "symlinks.h"
+#include "throttle.h"
+#include "uring.h"
+#include "visited.h"
+#include "watch.h"
+
 #ifndef S_ISLNK
 #define S_ISLNK(mode) (((mode) & S_IFMT) == S_IFLNK)
 #endif
@@ -23,375 +41,607 @@
 #define PATH_MAX 1024
 #endif
 
-#define PROGRAM_VERSION "1.4.3"
-
-/* Global flags set by command-line options */
-static int g_verbose = 0;   /* -v */
-static int g_fix_links = 0; /* -c */
-static int g_recurse = 0;   /* -r */
-static int g_delete = 0;    /* -d */
-static int g_shorten = 0;   /* -s */
-static int g_testing = 0;   /* -t */
-static int g_single_fs = 1; /* -o (off by default => single-fs=1) */
-static int g_debug = 0;     /* -x (new debug switch) */
-
 /*
- * replace_substring:
- *   Replace occurrences of 'old_sub' in 's' with 'new_sub' in-place, up to bufsize.
- *   Returns the number of replacements performed, or -1 if there is not enough space.
+ * symlinks_ctx:
+ *   Everything a scan needs, shared by all of its threads.
  */
-static int replace_substring(char* s, size_t bufsize, const char* old_sub, const char* new_sub) {
-    if (!s || !old_sub || !*old_sub) {
-        return 0;
-    }
+struct symlinks_ctx {
+    struct symlinks_options opts;
+    int io_uring; /* opts.io_uring, and the kernel allows it */
 
-    size_t old_len = strlen(old_sub);
-    size_t new_len = (new_sub ? strlen(new_sub) : 0);
-    if (old_len == 0) {
-        /* Prevent infinite loop if old_sub is an empty string */
-        return 0;
-    }
+    /* Target lookups shared by all workers; NULL when disabled */
+    struct target_cache* target_cache;
 
-    int total_replacements = 0;
+    /* Directory index (index_path), NULL when not used */
+    struct scan_index* index;
 
-    while (1) {
-        char* match_pos = strstr(s, old_sub);
-        if (!match_pos) {
-            break; /* no more matches */
-        }
+    /* Change notifications (watch), NULL when not used */
+    struct watcher* watcher;
+    sigset_t watch_sigmask; /* opts.watch_sigmask points here when set */
+    pthread_mutex_t roots_lock;
+    char** roots; /* directories scanned so far, for a rescan after lost events */
+    size_t nroots;
+    size_t roots_cap;
 
-        /* Check buffer space if the replacement is larger. */
-        if (new_len > old_len) {
-            size_t needed = strlen(s) + (new_len - old_len) + 1;
-            if (needed > bufsize) {
-                return -1; /* not enough space */
-            }
-        }
+    /* Instrumentation (stats), NULL when not counting */
+    struct scan_stats* stats;
 
-        /* Temporary buffer for building the replaced string. */
-        char temp[PATH_MAX * 2];
-        memset(temp, 0, sizeof(temp));
+    /* Entry filters (filters), NULL when there are none */
+    struct scan_filter* filter;
 
-        size_t prefix_len = (size_t)(match_pos - s);
+    /* Pacing (nice_io), NULL when not used */
+    struct throttle* throttle;
 
-        /* Copy up to the match */
-        strncpy(temp, s, prefix_len);
+    /* Aggregated report (summary), NULL when not used */
+    struct scan_summary* summary;
+};
 
-        /* Append new_sub */
-        if (new_sub) {
-            strncat(temp, new_sub, sizeof(temp) - strlen(temp) - 1);
-        }
+/*
+ * report_error:
+ *   Hand an error about 'path' (errno 'err', or 0) to the error callback.
+ */
+__attribute__((format(printf, 4, 5))) static void
+report_error(const struct symlinks_ctx* ctx, const char* path, int err, const char* fmt, ...) {
+    if (!ctx->opts.on_error) {
+        return;
+    }
+    char message[PATH_MAX * 2 + 256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    ctx->opts.on_error(path, err, message, ctx->opts.user);
+}
 
-        /* Append whatever comes after old_sub */
-        strncat(temp, match_pos + old_len, sizeof(temp) - strlen(temp) - 1);
+/*
+ * op_begin / op_end:
+ *   Bracket one system call of kind 'op' (or a batch of 'n' of them): count
+ *   and time it as stats_begin() and stats_end() do and, with nice_io, wait
+ *   for the throttle first and report the call's latency to it after.
+ */
+static uint64_t op_begin_n(struct symlinks_ctx* ctx, enum stats_op op, unsigned n) {
+    if (!ctx->throttle) {
+        return stats_begin(ctx->stats);
+    }
+    enum throttle_kind kind = (op == STATS_REWRITE || op == STATS_UNLINK) ? THROTTLE_CHANGE : THROTTLE_METADATA;
+    throttle_wait(ctx->throttle, kind, n);
+    return stats_now();
+}
 
-        /* Copy back to s */
-        strncpy(s, temp, bufsize - 1);
-        s[bufsize - 1] = '\0';
+static uint64_t op_begin(struct symlinks_ctx* ctx, enum stats_op op) {
+    return op_begin_n(ctx, op, 1);
+}
 
-        total_replacements++;
+static void op_end(struct symlinks_ctx* ctx, enum stats_op op, uint64_t start) {
+    if (!ctx->throttle) {
+        stats_end(ctx->stats, op, start);
+        return;
     }
-
-    return total_replacements;
+    uint64_t ns = stats_now() - start;
+    stats_end(ctx->stats, op, ctx->opts.stats > 1 ? start : 0);
+    throttle_observe(ctx->throttle, op, ns);
 }
 
 /*
- * tidy_path:
- *   Removes redundant slashes, "./" references, and collapses "/../" if possible.
- *   Modifies path in-place. Returns non-zero if modifications were made.
+ * read_symlink:
+ *   readlinkat() 'name' into link_value (PATH_MAX + 1 bytes).
+ *   Returns 0 on success, -1 after reporting the error.
  */
-static int tidy_path(char* path) {
-    if (!path || !*path) {
-        return 0;
+static int read_symlink(struct symlinks_ctx* ctx,
+                        int dirfd,
+                        const char* name,
+                        const char* symlink_path,
+                        char* link_value) {
+    uint64_t start = op_begin(ctx, STATS_READLINK);
+    ssize_t n = readlinkat(dirfd, name, link_value, PATH_MAX);
+    op_end(ctx, STATS_READLINK, start);
+    if (n < 0) {
+        /* Gone since it was listed (e.g. replaced meanwhile): nothing to report */
+        if (errno != ENOENT || ctx->opts.debug) {
+            report_error(ctx, symlink_path, errno, "readlink error on %s: %s", symlink_path, strerror(errno));
+        }
+        return -1;
     }
+    link_value[n] = '\0';
 
-    int changed = 0;
-    char working[PATH_MAX * 2];
-    memset(working, 0, sizeof(working));
-
-    /* 1) Ensure a trailing slash to simplify some patterns. */
-    size_t len = strlen(path);
-    if (len + 2 < sizeof(working) && path[len - 1] != '/') {
-        snprintf(working, sizeof(working), "%s/", path);
-    }
-    else {
-        strncpy(working, path, sizeof(working) - 1);
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] Symlink: %s -> %s\n", symlink_path, link_value);
     }
+    return 0;
+}
 
-    int r;
-    /* Remove "/./" occurrences */
-    while ((r = replace_substring(working, sizeof(working), "/./", "/")) > 0) {
-        changed = 1;
+/*
+ * target_cache_key:
+ *   Build the cache key for a link's target: the absolute path the kernel
+ *   will resolve.  Only "//" and "/./" are squeezed out; ".." is kept because
+ *   collapsing it lexically is wrong when it follows a symlinked directory.
+ *   Returns 0 on success, -1 if the key does not fit.
+ */
+static int target_cache_key(const char* symlink_path, const char* link_value, char* key, size_t key_size) {
+    size_t dir_len = 0;
+    if (link_value[0] != '/') {
+        const char* slash = strrchr(symlink_path, '/');
+        dir_len = slash ? (size_t)(slash - symlink_path) + 1 : 0;
     }
-    /* Remove consecutive slashes "//" */
-    while ((r = replace_substring(working, sizeof(working), "//", "/")) > 0) {
-        changed = 1;
+    size_t value_len = strlen(link_value);
+    if (dir_len + value_len + 1 > key_size) {
+        return -1;
     }
-
-    /*
-     * Collapse "/../" - naive approach: for each occurrence of "/../",
-     * remove one preceding directory component if possible.
-     */
-    for (;;) {
-        char* p = strstr(working, "/../");
-        if (!p) {
-            break;
-        }
-        if (p == working) {
-            /* "/../" at the start => remove it */
-            replace_substring(working, sizeof(working), "/../", "/");
-            changed = 1;
-            continue;
-        }
-        /* Find slash before "/../" */
-        char* slash = p - 1;
-        while (slash > working && *slash != '/') {
-            slash--;
+    memcpy(key, symlink_path, dir_len);
+    memcpy(key + dir_len, link_value, value_len + 1);
+
+    char* out = key;
+    const char* in = key;
+    while (*in) {
+        if (*in == '/') {
+            if (out == key || out[-1] != '/') {
+                *out++ = '/';
+            }
+            in++;
         }
-        if (slash == working && *slash == '/') {
-            /* At root => remove the "/.." part */
-            replace_substring(working, sizeof(working), "/../", "/");
-            changed = 1;
+        else if (in[0] == '.' && (in[1] == '/' || in[1] == '\0') && out > key && out[-1] == '/') {
+            in++;
         }
         else {
-            memmove(slash, p + 3, strlen(p + 3) + 1);
-            changed = 1;
+            while (*in && *in != '/') {
+                *out++ = *in++;
+            }
         }
     }
-
-    /* Remove trailing slash if not root "/" */
-    len = strlen(working);
-    while (len > 1 && working[len - 1] == '/') {
-        working[len - 1] = '\0';
-        --len;
-        changed = 1;
-    }
-
-    /* Remove leading "./" if any */
-    while (!strncmp(working, "./", 2)) {
-        memmove(working, working + 2, strlen(working + 2) + 1);
-        changed = 1;
-    }
-
-    strncpy(path, working, PATH_MAX - 1);
-    path[PATH_MAX - 1] = '\0';
-    return changed;
+    *out = '\0';
+    return 0;
 }
 
 /*
- * shorten_path:
- *   Attempts to remove unnecessary "../dir" segments (a naive approach).
- *   Returns non-zero if changes were made.
+ * forget_cached_link:
+ *   After deleting or rewriting the link at 'symlink_path', drop any cached
+ *   lookup of that very path.  Lookups that merely pass through it are not
+ *   affected: a deleted link was dangling, so nothing resolved through it,
+ *   and a rewritten link still resolves to the same target.
  */
-static int shorten_path(char* link_path, const char* base_path) {
-    if (!link_path || !*link_path || !base_path || !*base_path) {
-        return 0;
+static void forget_cached_link(struct symlinks_ctx* ctx, const char* symlink_path) {
+    char key[PATH_MAX * 2];
+    if (ctx->target_cache && target_cache_key(symlink_path, symlink_path, key, sizeof(key)) == 0) {
+        target_cache_forget(ctx->target_cache, key);
     }
+}
 
-    int shortened = 0;
+/* Most links followed in one chain, as the kernel's MAXSYMLINKS */
+#define MAX_CHAIN_LINKS 40
 
+/*
+ * follow_chain:
+ *   The target at 'key' (a target cache key) is itself a link: follow the
+ *   chain one link at a time until it ends at something that is not a
+ *   link, fails to resolve, or comes back to a link already on it (ELOOP).
+ *   Every link on the way goes into the target cache with its own
+ *   resolution, so the next chain joining this one stops where it does.
+ *   Fills 'target' with the resolution of 'key'.
+ */
+static void follow_chain(struct symlinks_ctx* ctx, const char* key, struct target_info* target) {
+    char* chain[MAX_CHAIN_LINKS];
+    size_t n = 0;
+    char node[PATH_MAX * 2];
+    struct target_info end = {0, 0, 0, 0};
+
+    snprintf(node, sizeof(node), "%s", key);
     for (;;) {
-        char* p = strstr(link_path, "../");
-        if (!p) {
-            break;
+        size_t i = 0;
+        while (i < n && strcmp(chain[i], node) != 0) {
+            i++;
         }
-        /* If base_path is "/", can't go higher. */
-        if (!strcmp(base_path, "/")) {
+        if (i < n || n == MAX_CHAIN_LINKS) {
+            end.err = ELOOP;
             break;
         }
+        if (n > 0) {
+            if (ctx->target_cache && target_cache_lookup(ctx->target_cache, node, &end)) {
+                break;
+            }
+            struct stat st;
+            uint64_t start = op_begin(ctx, STATS_STAT);
+            int rc = lstat(node, &st);
+            op_end(ctx, STATS_STAT, start);
+            if (rc != 0) {
+                end.err = errno;
+                break;
+            }
+            if (!S_ISLNK(st.st_mode)) {
+                end.dev = st.st_dev;
+                end.mode = st.st_mode;
+                break;
+            }
+        }
 
-        char* slash_after_dir = strchr(p + 3, '/');
-        if (!slash_after_dir) {
+        if (!(chain[n] = strdup(node))) {
+            end.err = ENOMEM;
+            break;
+        }
+        n++;
+        char value[PATH_MAX + 1];
+        uint64_t start = op_begin(ctx, STATS_READLINK);
+        ssize_t len = readlink(node, value, PATH_MAX);
+        op_end(ctx, STATS_READLINK, start);
+        if (len < 0) {
+            end.err = errno;
+            break;
+        }
+        value[len] = '\0';
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] chain: %s -> %s\n", node, value);
+        }
+        char next[PATH_MAX * 2];
+        if (target_cache_key(node, value, next, sizeof(next)) != 0) {
+            end.err = ENAMETOOLONG;
             break;
         }
-        /* Remove the entire "../xxx/" portion from link_path */
-        memmove(p, slash_after_dir + 1, strlen(slash_after_dir + 1) + 1);
-        shortened = 1;
+        memcpy(node, next, strlen(next) + 1);
     }
 
-    return shortened;
+    /* chain[i] is n - i links away from where the chain ended */
+    for (size_t i = n; i-- > 0;) {
+        struct target_info info = end;
+        info.links = end.links + (unsigned)(n - i);
+        if (ctx->target_cache) {
+            target_cache_insert(ctx->target_cache, chain[i], &info);
+        }
+        if (i == 0) {
+            *target = info;
+        }
+        free(chain[i]);
+    }
+    if (n == 0) {
+        *target = end;
+        target->links = 1;
+    }
 }
 
 /*
- * build_relative_path:
- *   Builds a relative path from 'from_dir' to 'to_path' using realpath().
+ * stat_target:
+ *   Resolve a link value the way the kernel does: relative targets against
+ *   the link's own directory fd, so there is no need to rebuild and re-walk
+ *   the full path.  A target that is itself a link is followed through
+ *   follow_chain().  Results are shared through the target cache, since
+ *   many links usually point at the same few targets.
  */
-static int build_relative_path(const char* from_dir, const char* to_path, char* out, size_t out_size) {
-    if (!from_dir || !to_path || !out) {
-        return -1;
+static void stat_target(struct symlinks_ctx* ctx,
+                        int dirfd,
+                        const char* symlink_path,
+                        const char* link_value,
+                        struct target_info* target) {
+    char key[PATH_MAX * 2];
+    int have_key = target_cache_key(symlink_path, link_value, key, sizeof(key)) == 0;
+
+    if (have_key && ctx->target_cache && target_cache_lookup(ctx->target_cache, key, target)) {
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] target cache hit: %s\n", key);
+        }
+        return;
     }
 
-    char resolved_from[PATH_MAX];
-    char resolved_to[PATH_MAX];
-
-    if (!realpath(from_dir, resolved_from)) {
-        return -1;
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] fstatat() target relative to directory fd: %s\n", link_value);
     }
-    if (!realpath(to_path, resolved_to)) {
-        return -1;
+    struct stat stbuf;
+    uint64_t start = op_begin(ctx, STATS_STAT);
+    int rc = fstatat(dirfd, link_value, &stbuf, AT_SYMLINK_NOFOLLOW);
+    op_end(ctx, STATS_STAT, start);
+    target->links = 0;
+    if (rc == -1) {
+        target->err = errno;
+        target->dev = 0;
+        target->mode = 0;
+    }
+    else if (S_ISLNK(stbuf.st_mode) && have_key) {
+        follow_chain(ctx, key, target);
+        return;
+    }
+    else if (S_ISLNK(stbuf.st_mode)) {
+        /* No room to follow it by hand; let the kernel do it */
+        rc = fstatat(dirfd, link_value, &stbuf, 0);
+        target->err = (rc == -1) ? errno : 0;
+        target->dev = (rc == -1) ? 0 : stbuf.st_dev;
+        target->mode = (rc == -1) ? 0 : stbuf.st_mode;
+        target->links = 1;
+        return;
+    }
+    else {
+        target->err = 0;
+        target->dev = stbuf.st_dev;
+        target->mode = stbuf.st_mode;
+    }
+    if (have_key && ctx->target_cache) {
+        target_cache_insert(ctx->target_cache, key, target);
     }
+}
 
-    /* Tokenize each resolved path */
-    char from_copy[PATH_MAX], to_copy[PATH_MAX];
-    strncpy(from_copy, resolved_from, sizeof(from_copy) - 1);
-    from_copy[sizeof(from_copy) - 1] = '\0';
-    strncpy(to_copy, resolved_to, sizeof(to_copy) - 1);
-    to_copy[sizeof(to_copy) - 1] = '\0';
+/* Relative paths remembered per directory, at most */
+#define DIR_MEMO_MAX 4096
 
-    char *from_tokens[PATH_MAX], *to_tokens[PATH_MAX];
-    int from_count = 0, to_count = 0;
+struct dir_memo_entry {
+    uint64_t hash;
+    char* value; /* the link value, then (after its NUL) the relative path */
+};
 
-    {
-        char* p = strtok(from_copy, "/");
-        while (p && from_count < (int)(sizeof(from_tokens) / sizeof(from_tokens[0]))) {
-            from_tokens[from_count++] = p;
-            p = strtok(NULL, "/");
-        }
+/*
+ * dir_context:
+ *   What -c and --flatten need of the directory being scanned, set up on
+ *   first use: the directory resolved and split once, instead of one
+ *   realpath() of it per link, and the relative paths built so far, by
+ *   link value, since the links of one directory often share values.
+ */
+struct dir_context {
+    struct path_base* base; /* NULL until needed */
+    int unresolvable;       /* path_base_init() failed: resolve per link */
+    struct dir_memo_entry* memo;
+    size_t memo_size; /* power of two, or 0 */
+    size_t memo_count;
+    struct archive* archive; /* links inside an archive: resolve and change there */
+    size_t member;           /* the archive member being examined */
+    int read_only;           /* the archive is not written out: report as a dry run */
+    uint64_t summary[SUMMARY_NCOUNTS]; /* links found here, for the summary */
+};
+
+static const char* dir_memo_find(const struct dir_context* dir, const char* value, uint64_t hash) {
+    if (dir->memo_size == 0) {
+        return NULL;
     }
-    {
-        char* q = strtok(to_copy, "/");
-        while (q && to_count < (int)(sizeof(to_tokens) / sizeof(to_tokens[0]))) {
-            to_tokens[to_count++] = q;
-            q = strtok(NULL, "/");
+    for (size_t i = hash & (dir->memo_size - 1);; i = (i + 1) & (dir->memo_size - 1)) {
+        const struct dir_memo_entry* e = &dir->memo[i];
+        if (!e->value) {
+            return NULL;
         }
-    }
-
-    /* Find common prefix */
-    int i = 0;
-    while (i < from_count && i < to_count) {
-        if (strcmp(from_tokens[i], to_tokens[i]) != 0) {
-            break;
+        if (e->hash == hash && !strcmp(e->value, value)) {
+            return e->value + strlen(e->value) + 1;
         }
-        i++;
     }
+}
 
-    /* Build a relative path */
-    out[0] = '\0';
-    int needed_len = 0;
-
-    /* Add ../ for each remaining component in 'from' */
-    for (int j = i; j < from_count; j++) {
-        if (needed_len + 4 >= (int)out_size) {
-            return -1;
-        }
-        strcat(out, "../");
-        needed_len += 3;
+static void dir_memo_insert(struct dir_memo_entry* memo, size_t size, const struct dir_memo_entry* entry) {
+    size_t i = entry->hash & (size - 1);
+    while (memo[i].value) {
+        i = (i + 1) & (size - 1);
     }
+    memo[i] = *entry;
+}
 
-    /* Add forward path for remainder of 'to' */
-    for (int j = i; j < to_count; j++) {
-        size_t seg_len = strlen(to_tokens[j]);
-        /* +1 for '/', +1 for final '\0' */
-        if (needed_len + seg_len + 2 >= out_size) {
-            return -1;
+/*
+ * dir_memo_add:
+ *   Remember 'relative' for 'value'.  Failing to allocate, or a full memo,
+ *   just skips remembering.
+ */
+static void dir_memo_add(struct dir_context* dir, const char* value, uint64_t hash, const char* relative) {
+    if (dir->memo_count >= DIR_MEMO_MAX) {
+        return;
+    }
+    if ((dir->memo_count + 1) * 4 > dir->memo_size * 3) {
+        size_t size = dir->memo_size ? dir->memo_size * 2 : 64;
+        struct dir_memo_entry* memo = calloc(size, sizeof(*memo));
+        if (!memo) {
+            return;
         }
-        strcat(out, to_tokens[j]);
-        needed_len += seg_len;
-        if (j < to_count - 1) {
-            strcat(out, "/");
-            needed_len += 1;
+        for (size_t i = 0; i < dir->memo_size; i++) {
+            if (dir->memo[i].value) {
+                dir_memo_insert(memo, size, &dir->memo[i]);
+            }
         }
+        free(dir->memo);
+        dir->memo = memo;
+        dir->memo_size = size;
     }
 
-    /* If nothing was added => same directory */
-    if (out[0] == '\0') {
-        if (out_size > 1) {
-            strcpy(out, ".");
-        }
-        else {
-            return -1;
-        }
+    size_t value_len = strlen(value);
+    size_t relative_len = strlen(relative);
+    struct dir_memo_entry entry = {hash, malloc(value_len + relative_len + 2)};
+    if (!entry.value) {
+        return;
+    }
+    memcpy(entry.value, value, value_len + 1);
+    memcpy(entry.value + value_len + 1, relative, relative_len + 1);
+    dir_memo_insert(dir->memo, dir->memo_size, &entry);
+    dir->memo_count++;
+}
+
+static void dir_context_release(struct dir_context* dir) {
+    for (size_t i = 0; i < dir->memo_size; i++) {
+        free(dir->memo[i].value);
     }
+    free(dir->memo);
+    free(dir->base);
+    memset(dir, 0, sizeof(*dir));
+}
 
+/*
+ * relative_target:
+ *   build_relative_path() from 'symlink_dir' to 'to_path', which is the
+ *   target of the link value 'link_value' in that directory: through the
+ *   directory context 'dir' if there is one, so the directory is resolved
+ *   only once and each link value only once.  Inside an archive, both are
+ *   resolved in it instead.
+ */
+static int relative_target(struct dir_context* dir,
+                           const char* symlink_dir,
+                           const char* link_value,
+                           const char* to_path,
+                           char* out) {
+    if (dir && dir->archive) {
+        return archive_relative(dir->archive, symlink_dir, to_path, out, PATH_MAX + 1);
+    }
+    if (!dir || dir->unresolvable) {
+        return build_relative_path(symlink_dir, to_path, out, PATH_MAX + 1);
+    }
+    uint64_t hash = hash_path(link_value, strlen(link_value));
+    const char* known = dir_memo_find(dir, link_value, hash);
+    if (known) {
+        snprintf(out, PATH_MAX + 1, "%s", known);
+        return 0;
+    }
+    if (!dir->base) {
+        dir->base = malloc(sizeof(*dir->base));
+        if (!dir->base || path_base_init(dir->base, symlink_dir) != 0) {
+            free(dir->base);
+            dir->base = NULL;
+            dir->unresolvable = 1;
+            return build_relative_path(symlink_dir, to_path, out, PATH_MAX + 1);
+        }
+    }
+    if (relative_path_from(dir->base, to_path, out, PATH_MAX + 1) != 0) {
+        return -1;
+    }
+    dir_memo_add(dir, link_value, hash, out);
     return 0;
 }
 
 /*
- * fix_symlink:
- *   Processes a symlink at 'symlink_path'.
+ * link_directory:
+ *   The directory part of 'symlink_path', with its trailing slash, into
+ *   'dir' (PATH_MAX + 1 bytes).  Returns -1 if the path is too long.
  */
-static void fix_symlink(const char* symlink_path, dev_t base_dev) {
-    char link_value[PATH_MAX + 1];
-    memset(link_value, 0, sizeof(link_value));
+static int link_directory(const char* symlink_path, char* dir) {
+    if (strlen(symlink_path) > PATH_MAX) {
+        return -1; /* only reachable by the walk, not by path */
+    }
+    snprintf(dir, PATH_MAX + 1, "%s", symlink_path);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        slash[1] = '\0';
+    }
+    else {
+        strcpy(dir, "./");
+    }
+    return 0;
+}
 
-    ssize_t n = readlink(symlink_path, link_value, PATH_MAX);
-    if (n < 0) {
-        fprintf(stderr, "readlink error on %s: %s\n", symlink_path, strerror(errno));
-        return;
+/*
+ * flatten_link:
+ *   The value for a chained link that points straight at the end of its
+ *   chain: absolute for an absolute link, else relative to the link's own
+ *   directory.  Builds it in 'out' (PATH_MAX + 1 bytes); returns 0, or -1
+ *   if the chain cannot be resolved.
+ */
+static int flatten_link(struct dir_context* dir, const char* symlink_path, const char* link_value, char* out) {
+    char key[PATH_MAX * 2];
+    if (target_cache_key(symlink_path, link_value, key, sizeof(key)) != 0 || strlen(key) >= PATH_MAX) {
+        return -1;
+    }
+    if (link_value[0] == '/') {
+        char real[PATH_MAX + 1];
+        if (dir && dir->archive ? archive_realpath(dir->archive, key, real) != 0 : !realpath(key, real)) {
+            return -1;
+        }
+        snprintf(out, PATH_MAX + 1, "%s", real);
+        return 0;
     }
-    link_value[n] = '\0';
 
-    if (g_debug) {
-        fprintf(stderr, "[DEBUG] Symlink: %s -> %s\n", symlink_path, link_value);
+    char symlink_dir[PATH_MAX + 1];
+    if (link_directory(symlink_path, symlink_dir) != 0) {
+        return -1;
     }
+    return relative_target(dir, symlink_dir, link_value, key, out);
+}
 
-    /* Build absolute version to check if it's dangling or cross-FS. */
-    char abs_resolved[PATH_MAX * 2];
-    memset(abs_resolved, 0, sizeof(abs_resolved));
+/*
+ * replace_symlink:
+ *   Point the link 'name' in 'dirfd' at 'new_value' atomically: create the
+ *   new link under a temporary name in the same directory and rename it
+ *   over the old one, so the link is never missing.  Returns 0, or -1
+ *   with errno set.
+ */
+static int replace_symlink(int dirfd, const char* name, const char* new_value) {
+    static atomic_uint counter;
+    char tmp[64];
 
-    if (link_value[0] == '/') {
-        strncpy(abs_resolved, link_value, sizeof(abs_resolved) - 1);
-    }
-    else {
-        strncpy(abs_resolved, symlink_path, sizeof(abs_resolved) - 1);
-        char* last_slash = strrchr(abs_resolved, '/');
-        if (last_slash) {
-            *(last_slash + 1) = '\0';
+    for (int attempt = 0;; attempt++) {
+        snprintf(tmp, sizeof(tmp), ".symlinks-%ld-%u", (long)getpid(), atomic_fetch_add(&counter, 1));
+        if (symlinkat(new_value, dirfd, tmp) == 0) {
+            break;
         }
-        else {
-            strcpy(abs_resolved, "./");
+        if (errno != EEXIST || attempt == 100) {
+            return -1;
         }
-        strncat(abs_resolved, link_value, sizeof(abs_resolved) - strlen(abs_resolved) - 1);
     }
-
-    tidy_path(abs_resolved);
-
-    if (g_debug) {
-        fprintf(stderr, "[DEBUG] Resolved path for stat(): %s\n", abs_resolved);
+    if (renameat(dirfd, tmp, dirfd, name) != 0) {
+        int err = errno;
+        unlinkat(dirfd, tmp, 0);
+        errno = err;
+        return -1;
     }
+    return 0;
+}
 
-    struct stat stbuf;
-    if (stat(abs_resolved, &stbuf) == -1) {
-        /* Dangling link. */
-        if (g_verbose) {
-            printf("dangling: %s -> %s\n", symlink_path, link_value);
-        }
-        if (g_debug) {
+/*
+ * apply_symlink:
+ *   Classifies and, depending on the options, fixes or deletes the symlink
+ *   'name' in the directory open as 'dirfd', once its value and target are
+ *   known.  'symlink_path' is its full path, used for reporting and -c;
+ *   'dir' the context of its directory, or NULL; for a link inside an
+ *   archive, the change is recorded in it and 'dirfd' is not used.
+ *   What was found and done is filled into 'rec', whose new target (if
+ *   any) is built in 'new_link_buf' (PATH_MAX + 1 bytes).  Returns 1 if
+ *   the link was deleted or rewritten, 0 otherwise.
+ */
+static int apply_symlink(struct symlinks_ctx* ctx,
+                         struct dir_context* dir,
+                         int dirfd,
+                         const char* name,
+                         const char* symlink_path,
+                         const char* link_value,
+                         const struct target_info* target,
+                         dev_t base_dev,
+                         struct symlinks_link* rec,
+                         char* new_link_buf) {
+    int dry_run = ctx->opts.dry_run || (dir && dir->read_only);
+    rec->chain = (target->err == ELOOP) ? 0 : 1 + (int)target->links;
+    if (target->err) {
+        /* Dangling link; a loop never resolves either */
+        rec->cls = (target->err == ELOOP) ? "loop" : "dangling";
+        rec->err = target->err;
+        if (ctx->opts.debug) {
             fprintf(stderr, "[DEBUG] stat failed; link is dangling.\n");
         }
-        if (g_delete) {
-            if (unlink(symlink_path) == 0) {
-                printf("deleted:  %s -> %s\n", symlink_path, link_value);
+        if (ctx->opts.delete_dangling && dry_run) {
+            rec->action = "would_delete";
+        }
+        else if (ctx->opts.delete_dangling) {
+            if (dir && dir->archive) {
+                archive_delete(dir->archive, dir->member);
+                rec->action = "deleted";
+                return 1;
             }
-            else {
-                perror("unlink");
+            uint64_t start = op_begin(ctx, STATS_UNLINK);
+            int rc = unlinkat(dirfd, name, 0);
+            op_end(ctx, STATS_UNLINK, start);
+            if (rc == 0) {
+                forget_cached_link(ctx, symlink_path);
+                rec->action = "deleted";
+                return 1;
             }
+            rec->err = errno;
+            report_error(ctx, symlink_path, errno, "unlink: %s", strerror(errno));
         }
-        return;
+        return 0;
     }
 
-    /* Check filesystem boundaries if -o is NOT set => g_single_fs=1 */
-    if (g_single_fs && stbuf.st_dev != base_dev) {
-        if (g_verbose) {
-            printf("other_fs: %s -> %s\n", symlink_path, link_value);
-        }
-        if (g_debug) {
+    /* Check filesystem boundaries unless cross_fs (-o) is set */
+    if (!ctx->opts.cross_fs && target->dev != base_dev) {
+        rec->cls = "other_fs";
+        if (ctx->opts.debug) {
             fprintf(stderr, "[DEBUG] Different filesystem, skipping unless -o used.\n");
         }
-        return;
+        return 0;
     }
 
-    char new_link[PATH_MAX + 1];
-    snprintf(new_link, sizeof(new_link), "%s", link_value);
+    char* new_link = new_link_buf;
+    snprintf(new_link, PATH_MAX + 1, "%s", link_value);
 
     int is_abs = (link_value[0] == '/');
     int changed_messy = tidy_path(new_link);
     int changed_short = 0;
-    if (g_shorten) {
+    if (ctx->opts.shorten) {
         changed_short = shorten_path(new_link, symlink_path);
     }
 
-    if (g_debug) {
+    if (ctx->opts.debug) {
         fprintf(stderr, "[DEBUG] new_link after tidy/shorten: %s\n", new_link);
     }
 
@@ -400,279 +650,3313 @@ static void fix_symlink(const char* symlink_path, dev_t base_dev) {
         changed_short = 0;
     }
 
-    if (g_verbose) {
-        if (is_abs && !g_fix_links) {
-            printf("absolute: %s -> %s\n", symlink_path, link_value);
+    if (is_abs) {
+        rec->cls = "absolute";
+    }
+    else if (changed_messy || changed_short) {
+        rec->cls = "messy";
+    }
+    else {
+        rec->cls = target->links ? "chained" : "relative";
+    }
+
+    /* -c makes absolute links relative to their final target anyway */
+    int changed_flat = 0;
+    if (ctx->opts.flatten && target->links && !(ctx->opts.convert && is_abs)) {
+        char flat[PATH_MAX + 1];
+        if (flatten_link(dir, symlink_path, link_value, flat) == 0) {
+            snprintf(new_link, PATH_MAX + 1, "%s", flat);
+            changed_flat = strcmp(new_link, link_value) != 0;
         }
-        else if (!is_abs) {
-            if (changed_messy || changed_short) {
-                printf("relative (messy/shortened): %s -> %s\n", symlink_path, link_value);
-            }
-            else {
-                printf("relative: %s -> %s\n", symlink_path, link_value);
-            }
+        else if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] cannot resolve the chain to flatten it\n");
         }
     }
 
     /* If not converting links and not in test mode, do nothing unless they changed. */
-    if ((!g_fix_links && !g_testing) && !(changed_messy || changed_short)) {
-        if (g_debug) {
+    if ((!ctx->opts.convert && !dry_run) && !(changed_messy || changed_short || changed_flat)) {
+        if (ctx->opts.debug) {
             fprintf(stderr, "[DEBUG] No conversion needed, returning.\n");
         }
-        return;
+        return 0;
     }
 
     /* Convert absolute link to relative if -c is set. */
-    if (g_fix_links && is_abs) {
-        char symlink_dir[PATH_MAX + 1];
-        strncpy(symlink_dir, symlink_path, sizeof(symlink_dir) - 1);
-        symlink_dir[sizeof(symlink_dir) - 1] = '\0';
-
-        char* slash = strrchr(symlink_dir, '/');
-        if (slash) {
-            *(slash + 1) = '\0';
-        }
-        else {
-            strcpy(symlink_dir, "./");
-        }
+    if (ctx->opts.convert && is_abs) {
+        char abs_resolved[PATH_MAX + 1];
+        snprintf(abs_resolved, sizeof(abs_resolved), "%s", link_value);
+        tidy_path(abs_resolved);
 
-        if (g_debug) {
-            fprintf(stderr, "[DEBUG] symlink_dir = %s\n", symlink_dir);
-            fprintf(stderr, "[DEBUG] abs_resolved = %s\n", abs_resolved);
+        char symlink_dir[PATH_MAX + 1];
+        int rc = link_directory(symlink_path, symlink_dir);
+        if (rc == 0) {
+            if (ctx->opts.debug) {
+                fprintf(stderr, "[DEBUG] symlink_dir = %s\n", symlink_dir);
+                fprintf(stderr, "[DEBUG] abs_resolved = %s\n", abs_resolved);
+            }
+            uint64_t start = op_begin(ctx, STATS_REALPATH);
+            rc = relative_target(dir, symlink_dir, link_value, abs_resolved, new_link);
+            op_end(ctx, STATS_REALPATH, start);
         }
-
-        if (build_relative_path(symlink_dir, abs_resolved, new_link, sizeof(new_link)) < 0) {
+        if (rc < 0) {
             /* Fallback */
-            strncpy(new_link, link_value, sizeof(new_link) - 1);
-            new_link[sizeof(new_link) - 1] = '\0';
-            if (g_debug) {
+            strncpy(new_link, link_value, PATH_MAX);
+            new_link[PATH_MAX] = '\0';
+            if (ctx->opts.debug) {
                 fprintf(stderr, "[DEBUG] build_relative_path failed; fallback to link_value\n");
             }
         }
         else {
-            if (g_shorten) {
+            if (ctx->opts.shorten) {
                 shorten_path(new_link, symlink_path);
             }
-            if (g_debug) {
+            if (ctx->opts.debug) {
                 fprintf(stderr, "[DEBUG] new_link after build_relative_path: %s\n", new_link);
             }
         }
     }
 
-    if (g_testing) {
-        printf("(test) would change: %s -> %s\n", symlink_path, new_link);
-        if (g_debug) {
+    if (dry_run) {
+        rec->action = "would_change";
+        rec->new_target = new_link;
+        if (ctx->opts.debug) {
             fprintf(stderr, "[DEBUG] In test mode; not changing filesystem.\n");
         }
-        return;
+        return 0;
     }
 
     if (strcmp(new_link, link_value) == 0) {
-        if (g_debug) {
+        if (ctx->opts.debug) {
             fprintf(stderr, "[DEBUG] final link is identical to existing; skipping rewrite.\n");
         }
-        return;
+        return 0;
     }
 
     /* Perform the actual change */
-    if (unlink(symlink_path) != 0) {
-        fprintf(stderr, "Cannot unlink %s: %s\n", symlink_path, strerror(errno));
-        return;
+    int in_archive = dir && dir->archive;
+    uint64_t start = op_begin(ctx, STATS_REWRITE);
+    int rc = in_archive ? archive_retarget(dir->archive, dir->member, new_link)
+                        : replace_symlink(dirfd, name, new_link);
+    op_end(ctx, STATS_REWRITE, start);
+    if (rc != 0) {
+        rec->err = errno;
+        report_error(ctx, symlink_path, errno, "Cannot replace %s: %s", symlink_path, strerror(errno));
+        return 0;
     }
-    if (symlink(new_link, symlink_path) != 0) {
-        fprintf(stderr, "Cannot symlink %s -> %s: %s\n", symlink_path, new_link, strerror(errno));
-        return;
+    if (!in_archive) {
+        forget_cached_link(ctx, symlink_path);
     }
 
-    printf("changed:  %s -> %s\n", symlink_path, new_link);
+    rec->action = "changed";
+    rec->new_target = new_link;
+    return 1;
 }
 
 /*
- * scan_directory:
- *   Recursively scans directory at 'path'.
+ * count_link:
+ *   Add one link's class and action to the counters, and to the summary
+ *   counts of its directory ('dir', or the link alone if NULL).
  */
-static void scan_directory(char* path, dev_t base_dev, int depth) {
-    if (!path) {
-        return;
+static void count_link(struct symlinks_ctx* ctx, struct dir_context* dir, const struct symlinks_link* rec) {
+    static const char* const classes[] = {"dangling", "loop", "other_fs", "absolute", "messy", "chained", "relative"};
+    static const enum stats_counter class_counters[] = {STATS_DANGLING, STATS_LOOP, STATS_OTHER_FS, STATS_ABSOLUTE,
+                                                        STATS_MESSY, STATS_CHAINED, STATS_RELATIVE};
+    static const enum summary_count class_counts[] = {SUMMARY_DANGLING, SUMMARY_LOOP,    SUMMARY_OTHER_FS,
+                                                      SUMMARY_ABSOLUTE, SUMMARY_MESSY,   SUMMARY_CHAINED,
+                                                      SUMMARY_RELATIVE};
+    struct scan_stats* stats = ctx->stats;
+    uint64_t alone[SUMMARY_NCOUNTS] = {0};
+    uint64_t* counts = dir ? dir->summary : alone;
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (rec->cls == classes[i] || !strcmp(rec->cls, classes[i])) {
+            stats_add(stats, class_counters[i], 1);
+            counts[class_counts[i]]++;
+            break;
+        }
     }
-    if (depth > 128) {
-        fprintf(stderr, "Recursion limit reached at %s; skipping.\n", path);
-        return;
+    if (!strcmp(rec->action, "changed") || !strcmp(rec->action, "would_change")) {
+        stats_add(stats, STATS_CHANGED, 1);
+        counts[SUMMARY_CHANGED]++;
+    }
+    else if (!strcmp(rec->action, "deleted") || !strcmp(rec->action, "would_delete")) {
+        stats_add(stats, STATS_DELETED, 1);
+        counts[SUMMARY_DELETED]++;
     }
+    stats_add(stats, STATS_LINKS, 1);
+    stats_add(stats, STATS_PATH_BYTES, strlen(rec->path) + strlen(rec->target));
+    if (!dir && ctx->summary) {
+        summary_dir_end(ctx->summary, rec->path, strlen(rec->path), 0, alone);
+    }
+}
 
-    if (g_debug) {
-        fprintf(stderr, "[DEBUG] scan_directory: %s (depth=%d)\n", path, depth);
+/*
+ * classify_symlink:
+ *   apply_symlink(), then hand the result to the link callback, once per
+ *   link, so a callback printing it in one call never interleaves with
+ *   concurrent workers (-j).  Returns 1 if the link was deleted or
+ *   rewritten, 0 otherwise.
+ */
+static int classify_symlink(struct symlinks_ctx* ctx,
+                            struct dir_context* dir,
+                            int dirfd,
+                            const char* name,
+                            const char* symlink_path,
+                            const char* link_value,
+                            const struct target_info* target,
+                            dev_t base_dev) {
+    if (ctx->watcher && !target->err && !(dir && dir->archive)) {
+        /*
+         * Remember which links to re-check when this target goes away: by
+         * the path the link names, and by where that finally resolves when
+         * it goes through other links.
+         */
+        char key[PATH_MAX * 2];
+        if (target_cache_key(symlink_path, link_value, key, sizeof(key)) == 0) {
+            char real[PATH_MAX];
+            tidy_path(key);
+            watch_note_link(ctx->watcher, symlink_path, key);
+            if (strlen(key) < PATH_MAX && realpath(key, real) && strcmp(real, key) != 0) {
+                watch_note_link(ctx->watcher, symlink_path, real);
+            }
+        }
     }
 
-    DIR* dfd = opendir(path);
-    if (!dfd) {
-        fprintf(stderr, "opendir failed on %s: %s\n", path, strerror(errno));
-        return;
+    struct symlinks_link rec = {symlink_path, link_value, "relative", "none", NULL, 0, 0};
+    char new_link[PATH_MAX + 1];
+    int modified = apply_symlink(ctx, dir, dirfd, name, symlink_path, link_value, target, base_dev, &rec, new_link);
+    if (ctx->stats || ctx->summary) {
+        count_link(ctx, dir, &rec);
+    }
+    if (ctx->opts.on_link) {
+        ctx->opts.on_link(&rec, ctx->opts.user);
     }
+    return modified;
+}
 
-    char original_path[PATH_MAX + 1];
-    strncpy(original_path, path, sizeof(original_path) - 1);
-    original_path[sizeof(original_path) - 1] = '\0';
+/*
+ * fix_symlink:
+ *   Processes the symlink 'name' in the directory open as 'dirfd'
+ *   synchronously: read it, stat its target, classify it.
+ */
+static void fix_symlink(struct symlinks_ctx* ctx,
+                        int dirfd,
+                        const char* name,
+                        const char* symlink_path,
+                        dev_t base_dev) {
+    char link_value[PATH_MAX + 1];
+    struct target_info target;
 
-    /* Append slash if needed */
-    size_t path_len = strlen(path);
-    if (path_len + 2 < PATH_MAX && path[path_len - 1] != '/') {
-        path[path_len++] = '/';
-        path[path_len] = '\0';
+    if (read_symlink(ctx, dirfd, name, symlink_path, link_value) != 0) {
+        return;
     }
+    stat_target(ctx, dirfd, symlink_path, link_value, &target);
+    classify_symlink(ctx, NULL, dirfd, name, symlink_path, link_value, &target, base_dev);
+}
 
-    struct dirent* dp;
-    while ((dp = readdir(dfd)) != NULL) {
-        const char* name = dp->d_name;
-        if (!strcmp(name, ".") || !strcmp(name, "..")) {
-            continue;
-        }
-
-        strncpy(path + path_len, name, PATH_MAX - path_len);
-        path[path_len + PATH_MAX - path_len - 1] = '\0'; /* ensure termination */
+/*
+ * fix_symlink_path:
+ *   fix_symlink() for a link known only by its absolute path: open its
+ *   directory so the target resolves relative to it.
+ */
+static void fix_symlink_path(struct symlinks_ctx* ctx, const char* symlink_path, dev_t base_dev) {
+    char dir[PATH_MAX + 1];
+    snprintf(dir, sizeof(dir), "%s", symlink_path);
+    char* slash = strrchr(dir, '/');
+    if (!slash) {
+        return;
+    }
+    *slash = '\0';
 
-        if (g_debug) {
-            fprintf(stderr, "[DEBUG] Checking entry: %s\n", path);
-        }
+    int dirfd = open(slash == dir ? "/" : dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        report_error(ctx, symlink_path, errno, "Cannot open directory of %s: %s", symlink_path, strerror(errno));
+        return;
+    }
+    fix_symlink(ctx, dirfd, slash + 1, symlink_path, base_dev);
+    close(dirfd);
+}
 
-        struct stat st;
-        if (lstat(path, &st) == -1) {
-            fprintf(stderr, "lstat failed on %s: %s\n", path, strerror(errno));
-            path[path_len] = '\0';
-            continue;
-        }
+/*
+ * With --io-uring, the links of a directory are read as they are found but
+ * the target stats are queued as a batch of statx requests; each link is
+ * classified as its completion arrives.  A batch is flushed when full,
+ * before descending into a subdirectory and when the directory is done.
+ */
+#define LINK_BATCH_SIZE 64
 
-        if (S_ISLNK(st.st_mode)) {
-            fix_symlink(path, base_dev);
-        }
-        else if (S_ISDIR(st.st_mode) && g_recurse) {
-            if (!g_single_fs || (st.st_dev == base_dev)) {
-                scan_directory(path, base_dev, depth + 1);
-            }
-        }
+struct link_batch_entry {
+    int dirfd;
+    struct dir_context* dir;
+    size_t name_off; /* offset of the link name in 'path' */
+    char path[PATH_MAX + 1];
+    char link_value[PATH_MAX + 1];
+    struct statx stx;
+};
+
+struct link_batch {
+    struct symlinks_ctx* ctx;
+    struct uring* ring;
+    dev_t base_dev;
+    int count;
+    int modified; /* a flushed link was deleted or rewritten */
+    struct link_batch_entry entries[LINK_BATCH_SIZE];
+};
 
-        /* Restore the original directory path */
-        path[path_len] = '\0';
+/*
+ * link_batch_new:
+ *   Allocate a batch with its own ring.  Returns NULL if io_uring is not
+ *   usable here, in which case links are processed synchronously.
+ */
+static struct link_batch* link_batch_new(struct symlinks_ctx* ctx) {
+    struct link_batch* batch = calloc(1, sizeof(*batch));
+    if (!batch) {
+        return NULL;
     }
+    batch->ctx = ctx;
+    batch->ring = uring_open(LINK_BATCH_SIZE);
+    if (!batch->ring) {
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
 
-    closedir(dfd);
-    strncpy(path, original_path, PATH_MAX);
-    path[PATH_MAX - 1] = '\0';
+static void link_batch_free(struct link_batch* batch) {
+    if (batch) {
+        uring_close(batch->ring);
+        free(batch);
+    }
 }
 
 /*
- * print_usage:
- *   Print usage help to stderr.
+ * link_batch_flush:
+ *   Submit all queued statx requests and classify each link as its
+ *   completion arrives.  Falls back to fstatat() if submission fails.
  */
-static void print_usage(const char* progname) {
-    fprintf(stderr,
-            "\n"
-            "Usage: %s [OPTIONS] DIR...\n"
-            "Scan and fix symbolic links in the specified directories.\n\n"
-            "Version: %s\n"
-            "\n"
-            "Options:\n"
-            "  -c  Convert absolute or messy links to relative.\n"
-            "  -d  Delete dangling links (those pointing to nonexistent targets).\n"
-            "  -o  Allow links across filesystems (otherwise just note 'other_fs').\n"
-            "  -r  Recurse into subdirectories.\n"
-            "  -s  Shorten links by removing unnecessary '../dir' sequences.\n"
-            "  -t  Test mode: show what would be done with -c, but do not modify.\n"
-            "  -v  Verbose: show all symlinks, including relative.\n"
-            "  -x  Debug: display internal processing details.\n"
-            "\n"
-            "Examples:\n"
-            "  %s -r /path/to/dir       Recursively scan directories for symlinks\n"
-            "  %s -rc /path/to/dir      Convert absolute to relative while scanning\n"
-            "  %s -rd /path/to/dir      Remove dangling links during a recursive scan\n"
-            "\n",
-            progname, PROGRAM_VERSION, progname, progname, progname);
-}
+static void link_batch_flush(struct link_batch* batch) {
+    struct symlinks_ctx* ctx = batch->ctx;
+    if (batch->count == 0) {
+        return;
+    }
 
-int symlinks_main(int argc, char** argv) {
-    const char* progname = argv[0];
-    int opt;
+    int done[LINK_BATCH_SIZE] = {0};
+    int remaining = batch->count;
+
+    uint64_t start = op_begin_n(ctx, STATS_STATX, (unsigned)batch->count);
+    int submitted = uring_submit(batch->ring, (unsigned)batch->count);
+    op_end(ctx, STATS_STATX, start);
+    while (submitted >= 0 && remaining > 0) {
+        uint64_t idx;
+        int res;
+        if (!uring_reap(batch->ring, &idx, &res)) {
+            start = op_begin(ctx, STATS_STATX);
+            submitted = uring_submit(batch->ring, 1);
+            op_end(ctx, STATS_STATX, start);
+            continue;
+        }
+        if (idx >= (uint64_t)batch->count || done[idx]) {
+            continue;
+        }
+
+        struct link_batch_entry* e = &batch->entries[idx];
+        struct target_info target = {0, 0, 0, 0};
+        char key[PATH_MAX * 2];
+        int have_key = target_cache_key(e->path, e->link_value, key, sizeof(key)) == 0;
+        if (res < 0) {
+            target.err = -res;
+        }
+        else {
+            target.dev = makedev(e->stx.stx_dev_major, e->stx.stx_dev_minor);
+            target.mode = e->stx.stx_mode;
+        }
+        if (res >= 0 && S_ISLNK(target.mode)) {
+            /* A chain: follow it synchronously (it also fills the cache) */
+            if (have_key) {
+                follow_chain(ctx, key, &target);
+            }
+            else {
+                stat_target(ctx, e->dirfd, e->path, e->link_value, &target);
+            }
+        }
+        else if (have_key && ctx->target_cache) {
+            target_cache_insert(ctx->target_cache, key, &target);
+        }
+        batch->modified |= classify_symlink(ctx, e->dir, e->dirfd, e->path + e->name_off, e->path, e->link_value,
+                                            &target, batch->base_dev);
+        done[idx] = 1;
+        remaining--;
+    }
+
+    /*
+     * After a failure, requests may still be queued or in flight, writing
+     * into entries the next batch reuses: wait for all of them first, or
+     * give up on the ring for good if even that fails.
+     */
+    if (submitted < 0 && uring_drain(batch->ring) != 0) {
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] io_uring failed; looking up targets synchronously from now on\n");
+        }
+        uring_close(batch->ring);
+        batch->ring = NULL;
+    }
+
+    /* Anything the ring did not complete is handled synchronously */
+    for (int i = 0; i < batch->count && remaining > 0; i++) {
+        if (!done[i]) {
+            struct link_batch_entry* e = &batch->entries[i];
+            struct target_info target;
+            stat_target(ctx, e->dirfd, e->path, e->link_value, &target);
+            batch->modified |= classify_symlink(ctx, e->dir, e->dirfd, e->path + e->name_off, e->path, e->link_value,
+                                                &target, batch->base_dev);
+            remaining--;
+        }
+    }
+    batch->count = 0;
+}
+
+/*
+ * link_batch_add:
+ *   Queue the stat of the target of the symlink 'name', whose value has
+ *   already been read.
+ */
+static void link_batch_add(struct link_batch* batch, struct dir_context* dir, int dirfd, const char* name,
+                           const char* symlink_path, const char* link_value, dev_t base_dev) {
+    struct symlinks_ctx* ctx = batch->ctx;
+    if (batch->count > 0 && batch->base_dev != base_dev) {
+        link_batch_flush(batch);
+    }
+
+    /* Paths past PATH_MAX (deep walks) do not fit an entry */
+    if (strlen(symlink_path) > PATH_MAX) {
+        struct target_info target;
+        stat_target(ctx, dirfd, symlink_path, link_value, &target);
+        batch->modified |= classify_symlink(ctx, dir, dirfd, name, symlink_path, link_value, &target, base_dev);
+        return;
+    }
+
+    struct link_batch_entry* e = &batch->entries[batch->count];
+    snprintf(e->link_value, sizeof(e->link_value), "%s", link_value);
+    e->dirfd = dirfd;
+    e->dir = dir;
+    snprintf(e->path, sizeof(e->path), "%s", symlink_path);
+    e->name_off = strlen(symlink_path) - strlen(name);
+
+    /* Targets already in the cache need no request at all */
+    char key[PATH_MAX * 2];
+    struct target_info target;
+    if (ctx->target_cache && target_cache_key(symlink_path, e->link_value, key, sizeof(key)) == 0 &&
+        target_cache_lookup(ctx->target_cache, key, &target)) {
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] target cache hit: %s\n", key);
+        }
+        batch->modified |= classify_symlink(ctx, dir, dirfd, name, symlink_path, e->link_value, &target, base_dev);
+        return;
+    }
+
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] queueing statx() of target: %s\n", e->link_value);
+    }
+    if (!batch->ring || uring_queue_statx(batch->ring, dirfd, e->link_value, AT_SYMLINK_NOFOLLOW, STATX_TYPE,
+                                          &e->stx, (uint64_t)batch->count) != 0) {
+        stat_target(ctx, dirfd, symlink_path, e->link_value, &target);
+        batch->modified |= classify_symlink(ctx, dir, dirfd, name, symlink_path, e->link_value, &target, base_dev);
+        return;
+    }
+    batch->base_dev = base_dev;
+    if (++batch->count == LINK_BATCH_SIZE) {
+        link_batch_flush(batch);
+    }
+}
+
+/*
+ * Work-stealing pool used by -j.  Each worker owns a deque of pending
+ * directories: the owner pushes and pops at the tail (depth-first, which
+ * keeps its frontier small), idle workers steal from the head of someone
+ * else's deque, where the oldest and usually largest subtrees sit.
+ */
+/*
+ * dir_ref:
+ *   A directory fd shared by the queued subdirectories that will be opened
+ *   relative to it; closed when the last of them has been opened.
+ */
+struct dir_ref {
+    int fd;
+    atomic_int refs;
+};
+
+struct scan_task {
+    char* path;             /* heap-allocated directory path */
+    size_t name_off;        /* offset of the last component in 'path' */
+    struct dir_ref* parent; /* NULL for roots, which are opened by path */
+    dev_t base_dev;
+    int depth;
+    ino_t ino; /* of the directory, to order a device lane */
+    int lane;  /* device lane the task is queued on and counted against, or -1 */
+    const struct checkpoint_entry* resume; /* where to start scanning it, NULL for its start */
+};
+
+struct task_deque {
+    pthread_mutex_t lock;
+    struct scan_task* items;
+    size_t head; /* index of the oldest task (steal end) */
+    size_t count;
+    size_t cap;
+};
+
+/*
+ * dev_lane:
+ *   A device that limits how many of its directories are scanned at once
+ *   (a rotational disk, where more in flight only adds seeks).  Its tasks
+ *   wait here rather than on the worker deques, in a min-heap by inode
+ *   number, which roughly follows their order on disk.  Devices without a
+ *   limit get a lane too, with 'limit' 0 and nothing queued, to remember
+ *   that they were looked at.
+ */
+struct dev_lane {
+    dev_t dev;
+    int limit;
+    int active; /* tasks of the lane being scanned */
+    struct scan_task* heap;
+    size_t count;
+    size_t cap;
+};
+
+struct scan_pool;
+
+struct walk_frame;
+
+/*
+ * inode_chunk:
+ *   --inode-order: the next entries of a frame's directory, up to
+ *   opts.inode_order of them, read ahead and sorted by inode number, so
+ *   that the lstat()s and readlink()s that follow visit the inode table in
+ *   order instead of in hash order.  There is one per frame depth, kept
+ *   for the next directory at that depth.
+ */
+struct chunk_entry {
+    ino_t ino;
+    size_t name_off; /* in 'names' */
+    unsigned char type;
+};
+
+struct inode_chunk {
+    struct chunk_entry* entries;
+    size_t count;
+    size_t pos; /* next entry to hand out */
+    size_t cap;
+    char* names;
+    size_t names_len;
+    size_t names_cap;
+};
+
+/*
+ * walk:
+ *   Explicit stack of the directories a worker is inside of, so that tree
+ *   depth costs heap instead of C stack.  The current path lives in one
+ *   buffer shared by all frames, each owning the prefix up to its trailing
+ *   slash; it grows to the deepest path seen and is kept for the next walk.
+ *   Only WALK_MAX_OPEN directories stay open: below that, the shallowest
+ *   open frame is parked by reading the rest of its entries into 'arena'
+ *   (a type byte, the telldir() position after the entry, 8 bytes, and a
+ *   NUL-terminated name each), which grows and shrinks
+ *   as a stack in step with the frames.
+ */
+struct walk {
+    struct walk_frame* frames;
+    size_t depth;      /* frames in use */
+    size_t cap;        /* frames allocated */
+    size_t first_open; /* frames below this one are parked */
+    char* path;
+    size_t path_cap;
+    char* arena;
+    size_t arena_len;
+    size_t arena_cap;
+    struct inode_chunk* chunks; /* --inode-order: 'cap' of them, one per frame; NULL otherwise */
+};
+
+/*
+ * pool_worker:
+ *   Per-thread scanning state.  The sequential scan uses a single worker
+ *   with no pool, which makes scan_directory() descend instead of queueing.
+ */
+struct pool_worker {
+    struct symlinks_ctx* ctx;
+    struct scan_pool* pool;
+    int id;
+    pthread_t thread;
+    struct task_deque deque;
+    struct link_batch* batch;     /* --io-uring, NULL when unavailable */
+    struct visited_set* visited; /* directories entered by this scan; NULL when not deduplicating */
+    struct walk walk;
+    dev_t lane_dev;              /* last device looked up in the pool's lanes... */
+    int lane_id;                 /* ...and its lane if limited, -1 if not, -2 before the first lookup */
+
+    /* --checkpoint: held while the worker has work in hand, see checkpoint_take() */
+    struct checkpointer* ckpt;
+    pthread_mutex_t ckpt_lock;
+    unsigned ckpt_ticks;
+};
+
+/*
+ * pool_worker_release:
+ *   Free the link batch and walk buffers of a worker that is done.
+ */
+static void pool_worker_release(struct pool_worker* worker) {
+    link_batch_free(worker->batch);
+    worker->batch = NULL;
+    free(worker->walk.frames);
+    free(worker->walk.path);
+    free(worker->walk.arena);
+    if (worker->walk.chunks) {
+        for (size_t i = 0; i < worker->walk.cap; i++) {
+            free(worker->walk.chunks[i].entries);
+            free(worker->walk.chunks[i].names);
+        }
+        free(worker->walk.chunks);
+    }
+    memset(&worker->walk, 0, sizeof(worker->walk));
+}
+
+struct scan_pool {
+    struct pool_worker* workers;
+    int nworkers;
+    atomic_size_t pending; /* tasks queued or being scanned */
+    atomic_size_t queued;  /* tasks sitting in a deque */
+    atomic_int sleepers;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+
+    /* Device lanes, under 'lanes_lock'; 'lane_ready' counts the tasks they would let start now */
+    pthread_mutex_t lanes_lock;
+    struct dev_lane* lanes;
+    size_t nlanes;
+    atomic_size_t lane_ready;
+};
+
+/*
+ * deque_push:
+ *   Append a task at the owner's end, growing the ring buffer if needed.
+ *   Returns 0 on success, -1 if out of memory.
+ */
+static int deque_push(struct task_deque* dq, const struct scan_task* task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t new_cap = dq->cap ? dq->cap * 2 : 64;
+        struct scan_task* items = malloc(new_cap * sizeof(*items));
+        if (!items) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < dq->count; i++) {
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        }
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = new_cap;
+    }
+    dq->items[(dq->head + dq->count) % dq->cap] = *task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+/*
+ * deque_take:
+ *   Remove a task from the tail (owner) or from the head (thief).
+ *   Returns non-zero if a task was taken.
+ */
+static int deque_take(struct task_deque* dq, int steal, struct scan_task* out) {
+    int taken = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        if (steal) {
+            *out = dq->items[dq->head];
+            dq->head = (dq->head + 1) % dq->cap;
+        }
+        else {
+            *out = dq->items[(dq->head + dq->count - 1) % dq->cap];
+        }
+        dq->count--;
+        taken = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return taken;
+}
+
+static void dir_ref_put(struct dir_ref* ref) {
+    if (ref && atomic_fetch_sub(&ref->refs, 1) == 1) {
+        close(ref->fd);
+        free(ref);
+    }
+}
+
+/* Directories of one rotational disk scanned at once */
+#define ROTATIONAL_JOBS 2
+
+/*
+ * device_jobs:
+ *   How many directories of 'dev' to scan at once: ROTATIONAL_JOBS on a
+ *   rotational disk, 0 (no limit) on solid-state disks and on filesystems
+ *   without a block device of their own, such as NFS or tmpfs.
+ */
+static int device_jobs(dev_t dev) {
+    if (major(dev) == 0) {
+        return 0;
+    }
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(dev), minor(dev));
+    FILE* f = fopen(path, "re");
+    if (!f) {
+        /* A partition: the queue is its disk's */
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(dev), minor(dev));
+        f = fopen(path, "re");
+    }
+    int rotational = 0;
+    if (f) {
+        rotational = (fgetc(f) == '1');
+        fclose(f);
+    }
+    return rotational ? ROTATIONAL_JOBS : 0;
+}
+
+/*
+ * lanes_update:
+ *   Recount the lane tasks that may start now.  Called with lanes_lock held.
+ */
+static void lanes_update(struct scan_pool* pool) {
+    size_t ready = 0;
+    for (size_t i = 0; i < pool->nlanes; i++) {
+        const struct dev_lane* lane = &pool->lanes[i];
+        if (lane->active < lane->limit) {
+            size_t slots = (size_t)(lane->limit - lane->active);
+            ready += (lane->count < slots) ? lane->count : slots;
+        }
+    }
+    atomic_store(&pool->lane_ready, ready);
+}
+
+/*
+ * pool_lane:
+ *   The lane of device 'dev' if the device has a limit, else -1.  A
+ *   device is classified on its first lookup; 'worker' remembers the last
+ *   answer, so a scan that stays on one device asks only once per worker.
+ */
+static int pool_lane(struct pool_worker* worker, dev_t dev) {
+    if (worker->lane_id != -2 && worker->lane_dev == dev) {
+        return worker->lane_id;
+    }
+    struct scan_pool* pool = worker->pool;
+    pthread_mutex_lock(&pool->lanes_lock);
+    size_t i = 0;
+    while (i < pool->nlanes && pool->lanes[i].dev != dev) {
+        i++;
+    }
+    if (i == pool->nlanes) {
+        struct dev_lane* lanes = realloc(pool->lanes, (pool->nlanes + 1) * sizeof(*lanes));
+        if (!lanes) {
+            pthread_mutex_unlock(&pool->lanes_lock);
+            return -1;
+        }
+        pool->lanes = lanes;
+        memset(&lanes[i], 0, sizeof(lanes[i]));
+        lanes[i].dev = dev;
+        lanes[i].limit = device_jobs(dev);
+        pool->nlanes++;
+        if (worker->ctx->opts.debug) {
+            if (lanes[i].limit) {
+                fprintf(stderr, "[DEBUG] device %u:%u is rotational: %d directories at a time, in inode order\n",
+                        major(dev), minor(dev), lanes[i].limit);
+            }
+            else {
+                fprintf(stderr, "[DEBUG] device %u:%u: no limit on directories at a time\n", major(dev), minor(dev));
+            }
+        }
+    }
+    int lane = pool->lanes[i].limit ? (int)i : -1;
+    pthread_mutex_unlock(&pool->lanes_lock);
+    worker->lane_dev = dev;
+    worker->lane_id = lane;
+    return lane;
+}
+
+/*
+ * lane_push:
+ *   Add a task to the lane's heap.  Returns 0 on success, -1 if out of
+ *   memory.
+ */
+static int lane_push(struct dev_lane* lane, const struct scan_task* task) {
+    if (lane->count == lane->cap) {
+        size_t cap = lane->cap ? lane->cap * 2 : 64;
+        struct scan_task* heap = realloc(lane->heap, cap * sizeof(*heap));
+        if (!heap) {
+            return -1;
+        }
+        lane->heap = heap;
+        lane->cap = cap;
+    }
+    size_t i = lane->count++;
+    while (i > 0 && lane->heap[(i - 1) / 2].ino > task->ino) {
+        lane->heap[i] = lane->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    lane->heap[i] = *task;
+    return 0;
+}
+
+/*
+ * lane_pop:
+ *   Remove the task with the lowest inode number from a non-empty lane.
+ */
+static void lane_pop(struct dev_lane* lane, struct scan_task* out) {
+    *out = lane->heap[0];
+    struct scan_task last = lane->heap[--lane->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= lane->count) {
+            break;
+        }
+        if (child + 1 < lane->count && lane->heap[child + 1].ino < lane->heap[child].ino) {
+            child++;
+        }
+        if (last.ino <= lane->heap[child].ino) {
+            break;
+        }
+        lane->heap[i] = lane->heap[child];
+        i = child;
+    }
+    lane->heap[i] = last;
+}
+
+/*
+ * lanes_take:
+ *   Start a task from a lane that has room for one.  Returns non-zero if a
+ *   task was taken.
+ */
+static int lanes_take(struct scan_pool* pool, struct scan_task* out) {
+    int taken = 0;
+    pthread_mutex_lock(&pool->lanes_lock);
+    for (size_t i = 0; i < pool->nlanes; i++) {
+        struct dev_lane* lane = &pool->lanes[i];
+        if (lane->count > 0 && lane->active < lane->limit) {
+            lane_pop(lane, out);
+            lane->active++;
+            taken = 1;
+            break;
+        }
+    }
+    if (taken) {
+        lanes_update(pool);
+    }
+    pthread_mutex_unlock(&pool->lanes_lock);
+    return taken;
+}
+
+/*
+ * pool_wake:
+ *   Wake one sleeping worker, if any, after work was made available.
+ */
+static void pool_wake(struct scan_pool* pool) {
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+/*
+ * pool_push:
+ *   Queue the directory 'path' for scanning and wake a sleeper: on its
+ *   device's lane if the device has a limit, else on 'worker's deque.
+ *   'st' is the directory's own lstat, or NULL if unknown (deque).  If
+ *   'parent' is given, the last component of 'path' will be opened
+ *   relative to it and the task holds a reference until then.  'resume' is
+ *   where to start reading it, NULL for its start.  Returns 0 on success,
+ *   -1 if out of memory.
+ */
+static int pool_push(struct pool_worker* worker, const char* path, struct dir_ref* parent, dev_t base_dev, int depth,
+                     const struct stat* st, const struct checkpoint_entry* resume) {
+    struct scan_pool* pool = worker->pool;
+    const char* slash = strrchr(path, '/');
+    struct scan_task task = {
+        strdup(path), slash ? (size_t)(slash - path) + 1 : 0, parent, base_dev, depth, st ? st->st_ino : 0,
+        st ? pool_lane(worker, st->st_dev) : -1, resume,
+    };
+    if (!task.path) {
+        return -1;
+    }
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (parent) {
+        atomic_fetch_add(&parent->refs, 1);
+    }
+    int rc;
+    if (task.lane >= 0) {
+        pthread_mutex_lock(&pool->lanes_lock);
+        rc = lane_push(&pool->lanes[task.lane], &task);
+        lanes_update(pool);
+        pthread_mutex_unlock(&pool->lanes_lock);
+    }
+    else {
+        rc = deque_push(&worker->deque, &task);
+        if (rc == 0) {
+            atomic_fetch_add(&pool->queued, 1);
+        }
+    }
+    if (rc != 0) {
+        atomic_fetch_sub(&pool->pending, 1);
+        dir_ref_put(parent);
+        free(task.path);
+        return -1;
+    }
+
+    pool_wake(pool);
+    return 0;
+}
+
+/*
+ * pool_next_task:
+ *   Fetch the next task for 'worker': a device lane with room first, so
+ *   slow devices are kept busy, then its own deque, then steal from the
+ *   others.  Sleeps while nothing can start but scans are still running,
+ *   since those may yet push subdirectories or free a lane.  Returns 0 once
+ *   all work is done.
+ */
+static int pool_next_task(struct pool_worker* worker, struct scan_task* out) {
+    struct scan_pool* pool = worker->pool;
+
+    for (;;) {
+        if (atomic_load(&pool->lane_ready) > 0 && lanes_take(pool, out)) {
+            return 1;
+        }
+        if (deque_take(&worker->deque, 0, out)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            return 1;
+        }
+        for (int i = 1; i < pool->nworkers; i++) {
+            struct pool_worker* victim = &pool->workers[(worker->id + i) % pool->nworkers];
+            if (deque_take(&victim->deque, 1, out)) {
+                atomic_fetch_sub(&pool->queued, 1);
+                return 1;
+            }
+        }
+
+        /* An idle worker has nothing a checkpoint needs to wait for */
+        if (worker->ckpt) {
+            pthread_mutex_unlock(&worker->ckpt_lock);
+        }
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->queued) == 0 && atomic_load(&pool->lane_ready) == 0 &&
+               atomic_load(&pool->pending) > 0) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        int done = (atomic_load(&pool->pending) == 0);
+        pthread_mutex_unlock(&pool->idle_lock);
+        if (worker->ckpt) {
+            pthread_mutex_lock(&worker->ckpt_lock);
+        }
+        if (done) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * pool_task_done:
+ *   Retire a finished task, freeing its place in its lane; the last one
+ *   wakes every worker so they exit.
+ */
+static void pool_task_done(struct scan_pool* pool, const struct scan_task* task) {
+    if (task->lane >= 0) {
+        pthread_mutex_lock(&pool->lanes_lock);
+        pool->lanes[task->lane].active--;
+        lanes_update(pool);
+        pthread_mutex_unlock(&pool->lanes_lock);
+        if (atomic_load(&pool->lane_ready) > 0) {
+            pool_wake(pool);
+        }
+    }
+    if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_broadcast(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+/* Flags for opening a directory we are about to read */
+#define SCAN_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/* Directories a walk keeps open at once; the shallowest are parked beyond that */
+#define WALK_MAX_OPEN 64
+
+/*
+ * dir_scan:
+ *   State of one directory being scanned, shared by its entries.
+ */
+struct dir_scan {
+    char* path;      /* the walk's path: directory path with a trailing slash; entry names are appended */
+    size_t path_len; /* length of 'path' up to and including the slash */
+    int fd;
+    dev_t base_dev;
+    int depth;
+    struct pool_worker* worker;
+    struct dir_ref* self_ref;     /* created on first use, so subdirectories queued under -j open relative to us */
+    struct index_record* record;  /* --index: entries seen so far */
+    struct dir_context dir;       /* -c and --flatten: the directory resolved */
+    int dirty;                    /* modified or not fully read; do not index */
+    int child_fd;                 /* sequential walk: subdirectory to descend into next, or -1 */
+    char child_name[NAME_MAX + 1];
+};
+
+/*
+ * walk_frame:
+ *   A directory on the walk's stack.
+ */
+struct walk_frame {
+    struct dir_scan ds; /* ds.fd is -1 while parked */
+    DIR* dfd;           /* NULL when replaying from the index or reading a snapshot */
+    struct index_replay replay;
+    int replaying;
+    int sorted;         /* --inode-order: entries come through the frame's inode chunk first */
+    int snapshot;       /* entries left are in the walk's arena, from snap_pos to snap_end */
+    size_t snap_start;
+    size_t snap_pos;
+    size_t snap_end;
+    size_t orig_len;    /* length of the path without the slash appended */
+    dev_t dev;          /* of the directory, to recognise it when reopened */
+    ino_t ino;
+    struct checkpoint_cursor cursor; /* how far the entries have been handled */
+    uint64_t read_off;               /* telldir() position after the last entry read */
+    uint64_t chunk_off;              /* 'read_off' when the inode chunk was filled */
+    uint64_t entries;
+    uint64_t dir_start;
+    uint64_t nested;
+};
+
+/*
+ * dir_scan_flush:
+ *   Flush the worker's link batch, noting whether it changed the directory.
+ */
+static void dir_scan_flush(struct dir_scan* ds) {
+    struct link_batch* batch = ds->worker->batch;
+    if (batch) {
+        link_batch_flush(batch);
+        if (batch->modified) {
+            ds->dirty = 1;
+            batch->modified = 0;
+        }
+    }
+}
+
+/*
+ * scan_subdirectory:
+ *   Descend into, or queue, the subdirectory whose path is in 'ds->path'
+ *   and whose lstat is 'st' (NULL if not known).
+ *   Without a pool it is only opened here; the walk enters it once the
+ *   current entry is done.
+ */
+static void scan_subdirectory(struct dir_scan* ds, const char* name, const struct stat* st) {
+    struct pool_worker* worker = ds->worker;
+    struct symlinks_ctx* ctx = worker->ctx;
+
+    if (!worker->pool) {
+        dir_scan_flush(ds);
+        uint64_t start = op_begin(ctx, STATS_OPENDIR);
+        int child = openat(ds->fd, name, SCAN_OPEN_FLAGS);
+        op_end(ctx, STATS_OPENDIR, start);
+        if (child < 0) {
+            report_error(ctx, ds->path, errno, "opendir failed on %s: %s", ds->path, strerror(errno));
+        }
+        else {
+            ds->child_fd = child;
+            snprintf(ds->child_name, sizeof(ds->child_name), "%s", name);
+        }
+        return;
+    }
+
+    if (!ds->self_ref) {
+        ds->self_ref = malloc(sizeof(*ds->self_ref));
+        if (ds->self_ref) {
+            ds->self_ref->fd = fcntl(ds->fd, F_DUPFD_CLOEXEC, 0);
+            atomic_init(&ds->self_ref->refs, 1);
+            if (ds->self_ref->fd < 0) {
+                free(ds->self_ref);
+                ds->self_ref = NULL;
+            }
+        }
+    }
+    if (pool_push(worker, ds->path, ds->self_ref, ds->base_dev, ds->depth + 1, st, NULL) != 0) {
+        report_error(ctx, ds->path, ENOMEM, "Out of memory queueing %s; skipping.", ds->path);
+    }
+}
+
+/*
+ * skip_entry:
+ *   Leave out an entry the filters skip.  The index still needs it, so
+ *   that a later run with other filters can replay the directory; a link
+ *   whose value was never read, or an entry of unknown type, keeps the
+ *   directory out of the index instead.
+ */
+static void skip_entry(struct dir_scan* ds, const char* name, unsigned char type, const char* link_value) {
+    if (ds->worker->ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] filtered out: %s\n", ds->path);
+    }
+    if (ds->record) {
+        if (type == DT_DIR || (type == DT_LNK && link_value)) {
+            index_record_add(ds->record, name, link_value);
+        }
+        else {
+            ds->dirty = 1;
+        }
+    }
+    ds->path[ds->path_len] = '\0';
+}
+
+/*
+ * scan_entry:
+ *   Handle one directory entry of type 'type' (a DT_* value).  'link_value'
+ *   is the symlink's value when replaying it from the index, NULL when it
+ *   still has to be read.  'ds->path' has room for the name.
+ */
+static void scan_entry(struct dir_scan* ds, const char* name, unsigned char type, const char* link_value) {
+    struct symlinks_ctx* ctx = ds->worker->ctx;
+    char* path = ds->path;
+
+    if (type != DT_LNK && type != DT_DIR && type != DT_UNKNOWN) {
+        return;
+    }
+    /* Subdirectories are indexed even without -r, so the record stays complete */
+    if (type == DT_DIR && !ctx->opts.recurse) {
+        if (ds->record) {
+            index_record_add(ds->record, name, NULL);
+        }
+        return;
+    }
+
+    size_t name_len = strlen(name);
+    if (name_len > NAME_MAX) {
+        report_error(ctx, path, ENAMETOOLONG, "Entry name too long in %s; skipping.", path);
+        ds->dirty = 1;
+        return;
+    }
+    memcpy(path + ds->path_len, name, name_len + 1);
+
+    /* Filters only need the name and path, so a skipped entry costs no system call */
+    enum filter_verdict verdict = FILTER_KEEP;
+    if (ctx->filter) {
+        verdict = filter_entry(ctx->filter, name, path, (type == DT_DIR) ? 1 : (type == DT_LNK) ? 0 : -1);
+        if (verdict == FILTER_SKIP) {
+            skip_entry(ds, name, type, link_value);
+            return;
+        }
+    }
+
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] Checking entry: %s\n", path);
+    }
+
+    /* Directories need st_dev only to stay on one filesystem */
+    struct stat st;
+    int have_stat = 0;
+    if (type == DT_UNKNOWN || (type == DT_DIR && !ctx->opts.cross_fs)) {
+        uint64_t start = op_begin(ctx, STATS_LSTAT);
+        int rc = fstatat(ds->fd, name, &st, AT_SYMLINK_NOFOLLOW);
+        op_end(ctx, STATS_LSTAT, start);
+        if (rc == -1) {
+            report_error(ctx, path, errno, "lstat failed on %s: %s", path, strerror(errno));
+            ds->dirty = 1;
+            path[ds->path_len] = '\0';
+            return;
+        }
+        have_stat = 1;
+        if (S_ISLNK(st.st_mode)) {
+            type = DT_LNK;
+        }
+        else if (S_ISDIR(st.st_mode)) {
+            type = DT_DIR;
+        }
+        if (verdict == FILTER_UNSURE && type != DT_UNKNOWN &&
+            filter_entry(ctx->filter, name, path, type == DT_DIR) == FILTER_SKIP) {
+            skip_entry(ds, name, type, link_value);
+            return;
+        }
+    }
+
+    if (type == DT_LNK) {
+        char value[PATH_MAX + 1];
+        if (!link_value) {
+            if (read_symlink(ctx, ds->fd, name, path, value) != 0) {
+                ds->dirty = 1;
+                path[ds->path_len] = '\0';
+                return;
+            }
+            link_value = value;
+        }
+        if (ds->record) {
+            index_record_add(ds->record, name, link_value);
+        }
+        if (ds->worker->batch) {
+            link_batch_add(ds->worker->batch, &ds->dir, ds->fd, name, path, link_value, ds->base_dev);
+        }
+        else {
+            struct target_info target;
+            stat_target(ctx, ds->fd, path, link_value, &target);
+            ds->dirty |= classify_symlink(ctx, &ds->dir, ds->fd, name, path, link_value, &target, ds->base_dev);
+        }
+    }
+    else if (type == DT_DIR) {
+        if (ds->record) {
+            index_record_add(ds->record, name, NULL);
+        }
+        if (ctx->opts.recurse && (!!ctx->opts.cross_fs || (have_stat && st.st_dev == ds->base_dev))) {
+            struct visited_set* visited = ds->worker->visited;
+            if (visited && !have_stat) {
+                uint64_t start = op_begin(ctx, STATS_LSTAT);
+                have_stat = fstatat(ds->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+                op_end(ctx, STATS_LSTAT, start);
+            }
+            if (!visited || !have_stat || visited_add(visited, st.st_dev, st.st_ino)) {
+                scan_subdirectory(ds, name, have_stat ? &st : NULL);
+            }
+            else if (ctx->opts.debug) {
+                fprintf(stderr, "[DEBUG] already scanned: %s\n", path);
+            }
+        }
+    }
+
+    /* Restore the original directory path */
+    path[ds->path_len] = '\0';
+}
+
+/*
+ * walk_reserve_path:
+ *   Make room for 'len' bytes of path.  The frames point into the buffer,
+ *   so they follow it when it moves.  Returns 0, or -1 if out of memory.
+ */
+static int walk_reserve_path(struct walk* walk, size_t len) {
+    if (len <= walk->path_cap) {
+        return 0;
+    }
+    size_t cap = walk->path_cap ? walk->path_cap : PATH_MAX + NAME_MAX + 2;
+    while (cap < len) {
+        cap *= 2;
+    }
+    char* path = realloc(walk->path, cap);
+    if (!path) {
+        return -1;
+    }
+    walk->path = path;
+    walk->path_cap = cap;
+    for (size_t i = 0; i < walk->depth; i++) {
+        walk->frames[i].ds.path = path;
+    }
+    return 0;
+}
+
+/* Bytes of an arena entry before its name */
+#define ARENA_HEADER (1 + sizeof(uint64_t))
+
+/*
+ * walk_arena_add:
+ *   Append one parked entry to the arena.  Returns 0, or -1 if out of
+ *   memory.
+ */
+static int walk_arena_add(struct walk* walk, unsigned char type, uint64_t off, const char* name) {
+    size_t len = ARENA_HEADER + strlen(name) + 1;
+    if (walk->arena_len + len > walk->arena_cap) {
+        size_t cap = walk->arena_cap ? walk->arena_cap : 4096;
+        while (cap < walk->arena_len + len) {
+            cap *= 2;
+        }
+        char* arena = realloc(walk->arena, cap);
+        if (!arena) {
+            return -1;
+        }
+        walk->arena = arena;
+        walk->arena_cap = cap;
+    }
+    walk->arena[walk->arena_len] = (char)type;
+    memcpy(walk->arena + walk->arena_len + 1, &off, sizeof(off));
+    memcpy(walk->arena + walk->arena_len + ARENA_HEADER, name, len - ARENA_HEADER);
+    walk->arena_len += len;
+    return 0;
+}
+
+/*
+ * walk_park:
+ *   Close the directory of frame 'f' to free its descriptor.  A directory
+ *   being read has the rest of its entries saved in the arena first.
+ *   Returns 0, or -1 if it has to stay open.
+ */
+static int walk_park(struct pool_worker* worker, struct walk_frame* f) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    struct walk* walk = &worker->walk;
+    struct stat st;
+    if (fstat(f->ds.fd, &st) != 0) {
+        return -1;
+    }
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+
+    if (f->dfd) {
+        f->snapshot = 1;
+        f->snap_start = walk->arena_len;
+        for (;;) {
+            uint64_t start = op_begin(ctx, STATS_READDIR);
+            struct dirent* dp = readdir(f->dfd);
+            op_end(ctx, STATS_READDIR, start);
+            if (!dp) {
+                break;
+            }
+            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+                continue;
+            }
+            if (walk_arena_add(walk, dp->d_type, (uint64_t)dp->d_off, dp->d_name) != 0) {
+                report_error(ctx, f->ds.path, ENOMEM, "Out of memory reading %s; skipping the rest.", f->ds.path);
+                f->ds.dirty = 1;
+                break;
+            }
+        }
+        f->snap_pos = f->snap_start;
+        f->snap_end = walk->arena_len;
+        closedir(f->dfd);
+        f->dfd = NULL;
+    }
+    else {
+        close(f->ds.fd);
+    }
+    f->ds.fd = -1;
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] parked %.*s\n", (int)f->ds.path_len, f->ds.path);
+    }
+    return 0;
+}
+
+/*
+ * open_long_path:
+ *   open() a directory path of any length, a PATH_MAX-sized piece at a
+ *   time when it does not fit in one call.
+ */
+static int open_long_path(const char* path) {
+    int dirfd = AT_FDCWD;
+    char piece[PATH_MAX];
+    for (;;) {
+        size_t len = strlen(path);
+        if (len < PATH_MAX) {
+            int fd = openat(dirfd, path, SCAN_OPEN_FLAGS);
+            if (dirfd != AT_FDCWD) {
+                close(dirfd);
+            }
+            return fd;
+        }
+        /* Cut at the last slash that fits */
+        size_t cut = PATH_MAX - 1;
+        while (cut > 0 && path[cut] != '/') {
+            cut--;
+        }
+        if (cut == 0) {
+            if (dirfd != AT_FDCWD) {
+                close(dirfd);
+            }
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(piece, path, cut);
+        piece[cut] = '\0';
+        int fd = openat(dirfd, piece, SCAN_OPEN_FLAGS);
+        if (dirfd != AT_FDCWD) {
+            close(dirfd);
+        }
+        if (fd < 0) {
+            return -1;
+        }
+        dirfd = fd;
+        path += cut + 1;
+    }
+}
+
+/*
+ * walk_unpark:
+ *   Reopen the parked top frame 'f', making sure it is still the same
+ *   directory.  Returns 0, or -1 if the rest of it cannot be scanned.
+ */
+static int walk_unpark(struct pool_worker* worker, struct walk_frame* f) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    f->ds.path[f->ds.path_len] = '\0'; /* drop the subdirectory just left */
+    uint64_t start = op_begin(ctx, STATS_OPENDIR);
+    int fd = open_long_path(f->ds.path);
+    op_end(ctx, STATS_OPENDIR, start);
+    if (fd < 0) {
+        report_error(ctx, f->ds.path, errno, "opendir failed on %s: %s", f->ds.path, strerror(errno));
+        f->ds.dirty = 1;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_dev != f->dev || st.st_ino != f->ino) {
+        report_error(ctx, f->ds.path, 0, "%s was replaced during the scan; skipping the rest.", f->ds.path);
+        f->ds.dirty = 1;
+        close(fd);
+        return -1;
+    }
+    f->ds.fd = fd;
+    worker->walk.first_open = worker->walk.depth - 1;
+    return 0;
+}
+
+/*
+ * walk_push:
+ *   Start scanning the directory open as 'fd' (ownership passes to the
+ *   walk), whose path of 'len' bytes is in the walk's buffer.  Parks the
+ *   shallowest open directory if too many are open.
+ */
+static void walk_push(struct pool_worker* worker, size_t len, int fd, dev_t base_dev, int depth) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    struct walk* walk = &worker->walk;
+    char* path = walk->path;
+
+    if (walk->depth == walk->cap) {
+        size_t cap = walk->cap ? walk->cap * 2 : 16;
+        struct walk_frame* frames = realloc(walk->frames, cap * sizeof(*frames));
+        struct inode_chunk* chunks = NULL;
+        if (frames) {
+            walk->frames = frames;
+            if (ctx->opts.inode_order > 0) {
+                chunks = realloc(walk->chunks, cap * sizeof(*chunks));
+            }
+        }
+        if (!frames || (ctx->opts.inode_order > 0 && !chunks)) {
+            report_error(ctx, path, ENOMEM, "Out of memory entering %s; skipping.", path);
+            close(fd);
+            return;
+        }
+        if (chunks) {
+            memset(chunks + walk->cap, 0, (cap - walk->cap) * sizeof(*chunks));
+            walk->chunks = chunks;
+        }
+        walk->cap = cap;
+    }
+    while (walk->depth - walk->first_open >= WALK_MAX_OPEN && walk_park(worker, &walk->frames[walk->first_open]) == 0) {
+        walk->first_open++;
+    }
+
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] scan_directory: %s (depth=%d)\n", path, depth);
+    }
+    struct walk_frame* f = &walk->frames[walk->depth];
+    memset(f, 0, sizeof(*f));
+    f->dir_start = stats_dir_begin(ctx->stats, &f->nested);
+
+    /* Watch before reading, so entries created meanwhile are not missed */
+    if (ctx->watcher) {
+        watch_add_dir(ctx->watcher, path);
+    }
+
+    struct dir_scan* ds = &f->ds;
+    ds->path = path;
+    ds->fd = fd;
+    ds->base_dev = base_dev;
+    ds->depth = depth;
+    ds->worker = worker;
+    ds->child_fd = -1;
+
+    if (ctx->index) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            f->replaying = index_replay_begin(ctx->index, &st, &f->replay);
+            ds->record = index_record_begin(&st);
+        }
+    }
+
+    if (!f->replaying) {
+        f->dfd = fdopendir(fd);
+        if (!f->dfd) {
+            report_error(ctx, path, errno, "opendir failed on %s: %s", path, strerror(errno));
+            index_record_discard(ds->record);
+            close(fd);
+            stats_dir_end(ctx->stats, path, f->dir_start, f->nested);
+            return;
+        }
+    }
+    else if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] replaying %s from the index\n", path);
+    }
+    if (f->dfd && walk->chunks) {
+        f->sorted = 1;
+        walk->chunks[walk->depth].count = 0;
+        walk->chunks[walk->depth].pos = 0;
+    }
+
+    /* Append slash if needed */
+    f->orig_len = len;
+    ds->path_len = len;
+    if (len == 0 || path[len - 1] != '/') {
+        path[ds->path_len++] = '/';
+        path[ds->path_len] = '\0';
+    }
+    walk->depth++;
+}
+
+static int chunk_entry_cmp(const void* a, const void* b) {
+    ino_t x = ((const struct chunk_entry*)a)->ino;
+    ino_t y = ((const struct chunk_entry*)b)->ino;
+    return (x > y) - (x < y);
+}
+
+/*
+ * walk_fill_chunk:
+ *   Read the next entries of the top frame 'f' into its chunk 'c' and sort
+ *   them by inode.  Room is made before each readdir(), so running out of
+ *   memory loses no entry: the chunk just ends early, or, if it is empty,
+ *   the rest of the directory is read unsorted.
+ */
+static void walk_fill_chunk(struct pool_worker* worker, struct walk_frame* f, struct inode_chunk* c) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    size_t max = (size_t)ctx->opts.inode_order;
+    int out_of_memory = 0;
+    c->count = 0;
+    c->pos = 0;
+    c->names_len = 0;
+    f->chunk_off = f->read_off;
+    while (c->count < max) {
+        if (c->count == c->cap) {
+            size_t cap = c->cap ? c->cap * 2 : 64;
+            if (cap > max) {
+                cap = max;
+            }
+            struct chunk_entry* entries = realloc(c->entries, cap * sizeof(*entries));
+            if (!entries) {
+                out_of_memory = 1;
+                break;
+            }
+            c->entries = entries;
+            c->cap = cap;
+        }
+        if (c->names_len + NAME_MAX + 1 > c->names_cap) {
+            size_t cap = c->names_cap ? c->names_cap * 2 : 4096;
+            char* names = realloc(c->names, cap);
+            if (!names) {
+                out_of_memory = 1;
+                break;
+            }
+            c->names = names;
+            c->names_cap = cap;
+        }
+
+        uint64_t start = op_begin(ctx, STATS_READDIR);
+        struct dirent* dp = readdir(f->dfd);
+        op_end(ctx, STATS_READDIR, start);
+        if (!dp) {
+            break;
+        }
+        f->read_off = (uint64_t)dp->d_off;
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+            continue;
+        }
+        size_t len = strlen(dp->d_name);
+        if (len > NAME_MAX) {
+            report_error(ctx, f->ds.path, ENAMETOOLONG, "Entry name too long in %s; skipping.", f->ds.path);
+            f->ds.dirty = 1;
+            continue;
+        }
+        struct chunk_entry* e = &c->entries[c->count++];
+        e->ino = dp->d_ino;
+        e->name_off = c->names_len;
+        e->type = dp->d_type;
+        memcpy(c->names + c->names_len, dp->d_name, len + 1);
+        c->names_len += len + 1;
+    }
+    if (out_of_memory && c->count == 0) {
+        report_error(ctx, f->ds.path, ENOMEM, "Out of memory sorting %s; reading it unsorted.", f->ds.path);
+        f->sorted = 0;
+        return;
+    }
+    qsort(c->entries, c->count, sizeof(*c->entries), chunk_entry_cmp);
+}
+
+/*
+ * walk_next:
+ *   The next entry of the top frame 'f': from the index, its inode chunk,
+ *   its parked snapshot or readdir().  Returns 0 at the end.  The frame's
+ *   cursor moves past the entry, which is handled before the next call.
+ */
+static int walk_next(struct pool_worker* worker, struct walk_frame* f, const char** name, unsigned char* type,
+                     const char** value) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    *value = NULL;
+    if (f->replaying) {
+        if (!index_replay_next(&f->replay, name, value)) {
+            return 0;
+        }
+        *type = *value ? DT_LNK : DT_DIR;
+        f->cursor.replayed = 1;
+        f->cursor.skip++;
+        return 1;
+    }
+    if (f->sorted) {
+        struct inode_chunk* c = &worker->walk.chunks[f - worker->walk.frames];
+        if (c->pos == c->count && f->dfd) {
+            walk_fill_chunk(worker, f, c);
+        }
+        if (c->pos < c->count) {
+            const struct chunk_entry* e = &c->entries[c->pos++];
+            *name = c->names + e->name_off;
+            *type = e->type;
+            f->cursor.off = f->chunk_off;
+            f->cursor.skip = c->pos;
+            return 1;
+        }
+        if (f->sorted && f->dfd) {
+            return 0;
+        }
+    }
+    if (f->snapshot) {
+        if (f->snap_pos == f->snap_end) {
+            return 0;
+        }
+        const char* entry = worker->walk.arena + f->snap_pos;
+        *type = (unsigned char)entry[0];
+        memcpy(&f->cursor.off, entry + 1, sizeof(f->cursor.off));
+        f->cursor.skip = 0;
+        *name = entry + ARENA_HEADER;
+        f->snap_pos += ARENA_HEADER + strlen(*name) + 1;
+        return 1;
+    }
+    for (;;) {
+        uint64_t start = op_begin(ctx, STATS_READDIR);
+        struct dirent* dp = readdir(f->dfd);
+        op_end(ctx, STATS_READDIR, start);
+        if (!dp) {
+            return 0;
+        }
+        f->read_off = (uint64_t)dp->d_off;
+        f->cursor.off = f->read_off;
+        f->cursor.skip = 0;
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+            continue;
+        }
+        *name = dp->d_name;
+        *type = dp->d_type;
+        return 1;
+    }
+}
+
+/*
+ * walk_pop:
+ *   Finish the top frame: flush its links, index it and close it.
+ */
+static void walk_pop(struct pool_worker* worker) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    struct walk* walk = &worker->walk;
+    struct walk_frame* f = &walk->frames[walk->depth - 1];
+    struct dir_scan* ds = &f->ds;
+
+    if (ds->fd >= 0) {
+        dir_scan_flush(ds);
+    }
+    if (f->replaying) {
+        index_note_replayed(ctx->index);
+    }
+    if (ctx->summary) {
+        summary_dir_end(ctx->summary, ds->path, f->orig_len, ds->depth, ds->dir.summary);
+    }
+    dir_context_release(&ds->dir);
+    if (ds->record) {
+        if (ds->dirty) {
+            index_record_discard(ds->record);
+        }
+        else {
+            index_record_commit(ctx->index, ds->record);
+        }
+    }
+    dir_ref_put(ds->self_ref);
+    if (f->dfd) {
+        closedir(f->dfd);
+    }
+    else if (ds->fd >= 0) {
+        close(ds->fd);
+    }
+    if (f->snapshot) {
+        walk->arena_len = f->snap_start;
+    }
+    ds->path[f->orig_len] = '\0';
+
+    stats_add(ctx->stats, STATS_DIRS, 1);
+    stats_add(ctx->stats, STATS_ENTRIES, f->entries);
+    stats_dir_end(ctx->stats, ds->path, f->dir_start, f->nested);
+
+    walk->depth--;
+    if (walk->first_open > walk->depth) {
+        walk->first_open = walk->depth;
+    }
+}
+
+/* Entries handled between looks at the clock for the next checkpoint */
+#define CHECKPOINT_CHECK_EVERY 16
+
+/*
+ * checkpointer:
+ *   --checkpoint state of one scan.  A checkpoint must see every directory
+ *   exactly once, either queued or in a walk frame, with the cursors of the
+ *   frames in step with what was queued.  So each worker holds its
+ *   'ckpt_lock' whenever it has work in hand, and lets go of it only while
+ *   idle and at safe points between two entries; the worker that takes a
+ *   checkpoint raises 'want', collects the locks of all the others, copies
+ *   the frontier, and writes it out once they are running again.
+ */
+struct checkpointer {
+    struct symlinks_ctx* ctx;
+    struct pool_worker* seq;             /* the worker scanning outside the pool */
+    struct scan_pool* pool;              /* NULL for a sequential scan */
+    char* const* roots;                  /* roots[next_root..nroots) are not started yet */
+    size_t nroots;
+    size_t next_root;
+    const struct checkpoint* resume;     /* its entries from next_entry on are not started yet */
+    size_t next_entry;
+    uint64_t interval_ns;
+    pthread_mutex_t lock;
+    pthread_cond_t resumed;              /* 'want' was lowered */
+    int saving;                          /* under 'lock': a checkpoint is being taken */
+    atomic_int want;
+    _Atomic uint64_t due;                /* stats_now() of the next checkpoint */
+};
+
+static int checkpoint_nworkers(const struct checkpointer* ck) {
+    return 1 + (ck->pool ? ck->pool->nworkers : 0);
+}
+
+static struct pool_worker* checkpoint_worker(struct checkpointer* ck, int i) {
+    return i == 0 ? ck->seq : &ck->pool->workers[i - 1];
+}
+
+/*
+ * walk_flush_top:
+ *   Flush the link batch of the directory being read, whose entries the
+ *   cursor may have passed already; the ones above were flushed before the
+ *   walk descended from them.
+ */
+static void walk_flush_top(struct pool_worker* worker) {
+    struct walk* walk = &worker->walk;
+    if (walk->depth > 0 && walk->frames[walk->depth - 1].ds.fd >= 0) {
+        dir_scan_flush(&walk->frames[walk->depth - 1].ds);
+    }
+}
+
+/*
+ * scan_options:
+ *   Hand 'fn' the name and value of each option a checkpoint must be
+ *   resumed with: those deciding which directories are read, how their
+ *   cursors count entries, and what is done to the links.
+ */
+static void scan_options(const struct symlinks_ctx* ctx,
+                         void (*fn)(const char* name, const char* value, void* arg),
+                         void* arg) {
+    static const char* const filter_names[] = {"--exclude", "--include", "--prune"};
+    const struct symlinks_options* o = &ctx->opts;
+    char number[24];
+
+    fn("-r", o->recurse ? "on" : "off", arg);
+    fn("-o", o->cross_fs ? "on" : "off", arg);
+    fn("-c", o->convert ? "on" : "off", arg);
+    fn("-d", o->delete_dangling ? "on" : "off", arg);
+    fn("-s", o->shorten ? "on" : "off", arg);
+    fn("--flatten", o->flatten ? "on" : "off", arg);
+    fn("-t", o->dry_run ? "on" : "off", arg);
+    snprintf(number, sizeof(number), "%d", o->inode_order);
+    fn("--inode-order", number, arg);
+    fn("--index", o->index_path ? o->index_path : "", arg);
+    enum symlinks_filter_kind kind;
+    const char* pattern;
+    for (size_t i = 0; (pattern = filter_rule(ctx->filter, i, &kind)) != NULL; i++) {
+        fn(filter_names[kind], pattern, arg);
+    }
+}
+
+static void checkpoint_add_scan_option(const char* name, const char* value, void* arg) {
+    checkpoint_add_option(arg, name, value);
+}
+
+/*
+ * option_check:
+ *   scan_options() of a context against those saved in a checkpoint, with
+ *   a message about the first difference.
+ */
+struct option_check {
+    const struct checkpoint* cp;
+    const char* path;
+    size_t next;
+    int differs;
+    char message[PATH_MAX * 2 + 256];
+};
+
+static void check_scan_option(const char* name, const char* value, void* arg) {
+    struct option_check* check = arg;
+    if (check->differs) {
+        return;
+    }
+    if (check->next == check->cp->noptions) {
+        snprintf(check->message, sizeof(check->message),
+                 "Checkpoint %s was saved without %s %s; resume it with the options it was saved with.", check->path,
+                 name, value);
+        check->differs = 1;
+        return;
+    }
+    const struct checkpoint_option* saved = &check->cp->options[check->next++];
+    if (strcmp(saved->name, name) != 0 || strcmp(saved->value, value) != 0) {
+        snprintf(check->message, sizeof(check->message),
+                 "Checkpoint %s was saved with %s %s, not %s %s; resume it with the options it was saved with.",
+                 check->path, saved->name, saved->value, name, value);
+        check->differs = 1;
+    }
+}
+
+static void checkpoint_add_task(struct checkpoint* cp, const struct scan_task* task) {
+    static const struct checkpoint_cursor start;
+    const struct checkpoint_entry* at = task->resume;
+    checkpoint_add_dir(cp, task->path, strlen(task->path), at ? at->dev : 0, at ? at->ino : 0, task->base_dev,
+                       task->depth, at ? &at->cursor : &start);
+}
+
+/*
+ * checkpoint_collect:
+ *   Copy the frontier, with every worker stopped: the walks' frames, the
+ *   queued directories, and what was not started.
+ */
+static void checkpoint_collect(struct checkpointer* ck, struct checkpoint* cp) {
+    uint64_t counters[STATS_NCOUNTERS];
+    stats_counters(ck->ctx->stats, counters);
+    checkpoint_add_counters(cp, counters);
+
+    for (int i = 0; i < checkpoint_nworkers(ck); i++) {
+        struct walk* walk = &checkpoint_worker(ck, i)->walk;
+        for (size_t d = 0; d < walk->depth; d++) {
+            struct walk_frame* f = &walk->frames[d];
+            struct stat st;
+            if (f->ds.fd >= 0 && fstat(f->ds.fd, &st) == 0) {
+                f->dev = st.st_dev;
+                f->ino = st.st_ino;
+            }
+            checkpoint_add_dir(cp, walk->path, f->orig_len, f->dev, f->ino, f->ds.base_dev, f->ds.depth, &f->cursor);
+        }
+    }
+    if (ck->pool) {
+        struct scan_pool* pool = ck->pool;
+        for (int i = 0; i < pool->nworkers; i++) {
+            struct task_deque* dq = &pool->workers[i].deque;
+            pthread_mutex_lock(&dq->lock);
+            for (size_t k = 0; k < dq->count; k++) {
+                checkpoint_add_task(cp, &dq->items[(dq->head + k) % dq->cap]);
+            }
+            pthread_mutex_unlock(&dq->lock);
+        }
+        pthread_mutex_lock(&pool->lanes_lock);
+        for (size_t i = 0; i < pool->nlanes; i++) {
+            for (size_t k = 0; k < pool->lanes[i].count; k++) {
+                checkpoint_add_task(cp, &pool->lanes[i].heap[k]);
+            }
+        }
+        pthread_mutex_unlock(&pool->lanes_lock);
+    }
+    for (size_t i = ck->resume ? ck->next_entry : 0; ck->resume && i < ck->resume->count; i++) {
+        const struct checkpoint_entry* e = &ck->resume->entries[i];
+        if (!e->is_root) {
+            checkpoint_add_dir(cp, e->path, strlen(e->path), e->dev, e->ino, e->base_dev, e->depth, &e->cursor);
+        }
+    }
+    for (size_t i = ck->next_root; i < ck->nroots; i++) {
+        if (ck->roots[i]) {
+            checkpoint_add_root(cp, ck->roots[i]);
+        }
+    }
+}
+
+/*
+ * checkpoint_take:
+ *   Called by 'self' at a safe point once a checkpoint is due: take it,
+ *   unless another worker already is.
+ */
+static void checkpoint_take(struct pool_worker* self) {
+    struct checkpointer* ck = self->ckpt;
+    struct symlinks_ctx* ctx = ck->ctx;
+
+    pthread_mutex_lock(&ck->lock);
+    int elected = !ck->saving && stats_now() >= atomic_load(&ck->due);
+    if (elected) {
+        ck->saving = 1;
+        atomic_store(&ck->want, 1);
+    }
+    pthread_mutex_unlock(&ck->lock);
+    if (!elected) {
+        return;
+    }
+
+    walk_flush_top(self);
+    for (int i = 0; i < checkpoint_nworkers(ck); i++) {
+        if (checkpoint_worker(ck, i) != self) {
+            pthread_mutex_lock(&checkpoint_worker(ck, i)->ckpt_lock);
+        }
+    }
+    struct checkpoint cp;
+    checkpoint_init(&cp);
+    scan_options(ctx, checkpoint_add_scan_option, &cp);
+    checkpoint_collect(ck, &cp);
+    for (int i = 0; i < checkpoint_nworkers(ck); i++) {
+        if (checkpoint_worker(ck, i) != self) {
+            pthread_mutex_unlock(&checkpoint_worker(ck, i)->ckpt_lock);
+        }
+    }
+    pthread_mutex_lock(&ck->lock);
+    atomic_store(&ck->want, 0);
+    pthread_cond_broadcast(&ck->resumed);
+    pthread_mutex_unlock(&ck->lock);
+
+    /* Written while the others carry on, after what was reported before it */
+    if (ctx->opts.on_checkpoint) {
+        ctx->opts.on_checkpoint(ctx->opts.user);
+    }
+    char error[PATH_MAX + 128];
+    if (checkpoint_save(&cp, ctx->opts.checkpoint_path, error, sizeof(error)) != 0) {
+        report_error(ctx, ctx->opts.checkpoint_path, 0, "%s", error);
+    }
+    else if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] checkpoint saved to %s\n", ctx->opts.checkpoint_path);
+    }
+    checkpoint_free(&cp);
+
+    pthread_mutex_lock(&ck->lock);
+    ck->saving = 0;
+    atomic_store(&ck->due, stats_now() + ck->interval_ns);
+    pthread_mutex_unlock(&ck->lock);
+}
+
+/*
+ * checkpoint_point:
+ *   A safe point of 'worker': everything before its cursors is handled.
+ *   Stand still while a checkpoint is taken, or take one if it is due.
+ */
+static void checkpoint_point(struct pool_worker* worker) {
+    struct checkpointer* ck = worker->ckpt;
+    if (atomic_load_explicit(&ck->want, memory_order_acquire)) {
+        walk_flush_top(worker);
+        pthread_mutex_unlock(&worker->ckpt_lock);
+        pthread_mutex_lock(&ck->lock);
+        while (atomic_load(&ck->want)) {
+            pthread_cond_wait(&ck->resumed, &ck->lock);
+        }
+        pthread_mutex_unlock(&ck->lock);
+        pthread_mutex_lock(&worker->ckpt_lock);
+    }
+    else if (++worker->ckpt_ticks % CHECKPOINT_CHECK_EVERY == 0 &&
+             stats_now() >= atomic_load_explicit(&ck->due, memory_order_relaxed)) {
+        checkpoint_take(worker);
+    }
+}
+
+/*
+ * walk_resume:
+ *   Move the frame 'f', just pushed, to where the checkpoint entry 'at' left
+ *   its directory.  A directory replaced since, or now read another way
+ *   (from the index or not, in inode order or not), is scanned from its
+ *   start instead.
+ */
+static void walk_resume(struct pool_worker* worker, struct walk_frame* f, const struct checkpoint_entry* at) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    const struct checkpoint_cursor* cur = &at->cursor;
+    if (at->ino == 0 || (cur->off == 0 && cur->skip == 0)) {
+        return;
+    }
+    struct stat st;
+    if (fstat(f->ds.fd, &st) != 0 || st.st_dev != (dev_t)at->dev || st.st_ino != (ino_t)at->ino ||
+        cur->replayed != f->replaying || (cur->skip > 0 && !cur->replayed && !f->sorted)) {
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] %s differs from the checkpoint; scanning all of it\n", f->ds.path);
+        }
+        return;
+    }
+    if (worker->visited) {
+        visited_add(worker->visited, st.st_dev, st.st_ino);
+    }
+    f->ds.dirty = 1; /* the index needs all of its entries */
+    f->cursor = *cur;
+
+    if (f->replaying) {
+        const char* name;
+        const char* value;
+        for (uint64_t i = 0; i < cur->skip && index_replay_next(&f->replay, &name, &value); i++) {
+        }
+        return;
+    }
+    seekdir(f->dfd, (long)cur->off);
+    f->read_off = cur->off;
+    if (cur->skip > 0) {
+        struct inode_chunk* c = &worker->walk.chunks[f - worker->walk.frames];
+        walk_fill_chunk(worker, f, c);
+        c->pos = (cur->skip < c->count) ? (size_t)cur->skip : c->count;
+    }
+}
+
+/*
+ * scan_directory:
+ *   Scans the directory at 'path', open as 'fd' (ownership passes to this
+ *   function).  Entries are examined relative to their directory's fd, and
+ *   dirent.d_type is trusted so that only DT_UNKNOWN entries need an
+ *   fstatat() to classify.  Subdirectories are walked depth-first on the
+ *   worker's own stack of frames, with no depth limit, or queued on its
+ *   deque when running under the -j pool.  With --io-uring, links go
+ *   through the worker's batch, which is flushed before the walk leaves or
+ *   descends from a directory.
+ *
+ *   With --index, a directory whose stamp matches the index is not read at
+ *   all: its subdirectories and link values come from the index, and only
+ *   the link targets are looked up again, since they live elsewhere.
+ *
+ *   With 'resume', the directory is read from where that checkpoint entry
+ *   left it.
+ */
+static void scan_directory(const char* path, int fd, dev_t base_dev, int depth, struct pool_worker* worker,
+                           const struct checkpoint_entry* resume) {
+    struct symlinks_ctx* ctx = worker->ctx;
+    struct walk* walk = &worker->walk;
+    size_t len = strlen(path);
+    if (walk_reserve_path(walk, len + 2) != 0) {
+        report_error(ctx, path, ENOMEM, "Out of memory scanning %s; skipping.", path);
+        close(fd);
+        return;
+    }
+    memcpy(walk->path, path, len + 1);
+    walk_push(worker, len, fd, base_dev, depth);
+    if (resume && walk->depth > 0) {
+        walk_resume(worker, &walk->frames[walk->depth - 1], resume);
+    }
+
+    while (walk->depth > 0) {
+        if (worker->ckpt) {
+            checkpoint_point(worker);
+        }
+        struct walk_frame* f = &walk->frames[walk->depth - 1];
+        const char* name;
+        const char* value;
+        unsigned char type;
+        if ((f->ds.fd < 0 && walk_unpark(worker, f) != 0) || !walk_next(worker, f, &name, &type, &value)) {
+            walk_pop(worker);
+            continue;
+        }
+        if (walk_reserve_path(walk, f->ds.path_len + NAME_MAX + 2) != 0) {
+            report_error(ctx, f->ds.path, ENOMEM, "Out of memory scanning %s; skipping entries.", f->ds.path);
+            f->ds.dirty = 1;
+            continue;
+        }
+        scan_entry(&f->ds, name, type, value);
+        f->entries++;
+
+        if (f->ds.child_fd >= 0) {
+            int child = f->ds.child_fd;
+            f->ds.child_fd = -1;
+            size_t child_len = f->ds.path_len + strlen(f->ds.child_name);
+            memcpy(walk->path + f->ds.path_len, f->ds.child_name, child_len - f->ds.path_len + 1);
+            walk_push(worker, child_len, child, f->ds.base_dev, f->ds.depth + 1);
+        }
+    }
+}
+
+/*
+ * scan_path:
+ *   Open the directory at 'path' and scan it.
+ */
+static void scan_path(const char* path, dev_t base_dev, struct pool_worker* worker) {
+    uint64_t start = op_begin(worker->ctx, STATS_OPENDIR);
+    int fd = open(path, SCAN_OPEN_FLAGS);
+    op_end(worker->ctx, STATS_OPENDIR, start);
+    if (fd < 0) {
+        report_error(worker->ctx, path, errno, "opendir failed on %s: %s", path, strerror(errno));
+        return;
+    }
+    scan_directory(path, fd, base_dev, 0, worker, NULL);
+}
+
+/*
+ * pool_worker_main:
+ *   Thread body: scan queued directories until the pool drains.
+ */
+static void* pool_worker_main(void* arg) {
+    struct pool_worker* worker = arg;
+    struct symlinks_ctx* ctx = worker->ctx;
+    struct scan_task task;
+
+    if (ctx->io_uring) {
+        worker->batch = link_batch_new(ctx);
+    }
+    if (worker->ckpt) {
+        pthread_mutex_lock(&worker->ckpt_lock);
+    }
+    while (pool_next_task(worker, &task)) {
+        int fd;
+        uint64_t start = op_begin(ctx, STATS_OPENDIR);
+        if (task.parent) {
+            fd = openat(task.parent->fd, task.path + task.name_off, SCAN_OPEN_FLAGS);
+        }
+        else {
+            fd = open_long_path(task.path); /* a root, or a directory from a checkpoint */
+        }
+        op_end(ctx, STATS_OPENDIR, start);
+        if (fd < 0) {
+            report_error(ctx, task.path, errno, "opendir failed on %s: %s", task.path, strerror(errno));
+        }
+        else {
+            scan_directory(task.path, fd, task.base_dev, task.depth, worker, task.resume);
+        }
+        dir_ref_put(task.parent);
+        free(task.path);
+        pool_task_done(worker->pool, &task);
+    }
+    if (worker->ckpt) {
+        pthread_mutex_unlock(&worker->ckpt_lock);
+    }
+    pool_worker_release(worker);
+    return NULL;
+}
+
+/*
+ * pool_init:
+ *   Set up a pool of 'nworkers' idle workers.  Returns 0 on success.
+ */
+static int pool_init(struct scan_pool* pool, struct symlinks_ctx* ctx, int nworkers) {
+    memset(pool, 0, sizeof(*pool));
+    pool->workers = calloc((size_t)nworkers, sizeof(*pool->workers));
+    if (!pool->workers) {
+        return -1;
+    }
+    pool->nworkers = nworkers;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->sleepers, 0);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    pthread_mutex_init(&pool->lanes_lock, NULL);
+    atomic_init(&pool->lane_ready, 0);
+    for (int i = 0; i < nworkers; i++) {
+        pool->workers[i].ctx = ctx;
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pool->workers[i].lane_id = -2;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+        pthread_mutex_init(&pool->workers[i].ckpt_lock, NULL);
+    }
+    return 0;
+}
+
+/*
+ * pool_run:
+ *   Start the workers on whatever has been queued and wait for the whole
+ *   tree to drain.  If a thread cannot be started, the remaining ones
+ *   (at minimum the calling thread) pick up its share.
+ */
+static void pool_run(struct scan_pool* pool) {
+    int started = 1;
+    for (int i = 1; i < pool->nworkers; i++) {
+        int err = pthread_create(&pool->workers[i].thread, NULL, pool_worker_main, &pool->workers[i]);
+        if (err != 0) {
+            report_error(pool->workers[0].ctx, NULL, err, "pthread_create failed: %s", strerror(err));
+            break;
+        }
+        started++;
+    }
+    pool_worker_main(&pool->workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+/*
+ * pool_destroy:
+ *   Release the pool's resources once pool_run() has returned.
+ */
+static void pool_destroy(struct scan_pool* pool) {
+    for (int i = 0; i < pool->nworkers; i++) {
+        free(pool->workers[i].deque.items);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        pthread_mutex_destroy(&pool->workers[i].ckpt_lock);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    for (size_t i = 0; i < pool->nlanes; i++) {
+        free(pool->lanes[i].heap);
+    }
+    free(pool->lanes);
+    pthread_mutex_destroy(&pool->lanes_lock);
+    free(pool->workers);
+}
+
+/*
+ * recheck_link:
+ *   watch_links_gone() callback: the target of this link went away.
+ */
+static void recheck_link(const char* link_path, void* arg) {
+    struct symlinks_ctx* ctx = arg;
+    struct stat st;
+    if (lstat(link_path, &st) == 0 && S_ISLNK(st.st_mode)) {
+        fix_symlink_path(ctx, link_path, st.st_dev);
+    }
+}
+
+/*
+ * rescan_roots:
+ *   Scan every root again, after change events were lost.
+ */
+static void rescan_roots(struct symlinks_ctx* ctx, struct pool_worker* worker) {
+    char path[PATH_MAX + 1];
+    for (size_t i = 0;; i++) {
+        pthread_mutex_lock(&ctx->roots_lock);
+        int more = (i < ctx->nroots);
+        if (more) {
+            snprintf(path, sizeof(path), "%s", ctx->roots[i]);
+        }
+        pthread_mutex_unlock(&ctx->roots_lock);
+        if (!more) {
+            break;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            scan_path(path, st.st_dev, worker);
+        }
+    }
+}
+
+/*
+ * path_filtered:
+ *   Whether the filters skip 'path' or a directory on the way to it, below
+ *   its first 'root_len' bytes.
+ */
+static int path_filtered(const struct scan_filter* filter, const char* path, size_t root_len, int is_dir) {
+    char prefix[PATH_MAX + 1];
+    snprintf(prefix, sizeof(prefix), "%s", path);
+    char* p = prefix + root_len;
+    for (;;) {
+        while (*p == '/') {
+            p++;
+        }
+        if (!*p) {
+            return 0;
+        }
+        char* slash = strchr(p, '/');
+        if (slash) {
+            *slash = '\0';
+        }
+        if (filter_entry(filter, p, prefix, slash ? 1 : is_dir) == FILTER_SKIP) {
+            return 1;
+        }
+        if (!slash) {
+            return 0;
+        }
+        *slash = '/';
+        p = slash + 1;
+    }
+}
+
+/*
+ * change_filtered:
+ *   Whether the filters keep the scan away from the changed entry 'path':
+ *   it, or a directory between it and the root it is under, is skipped.
+ */
+static int change_filtered(struct symlinks_ctx* ctx, const char* path, int is_dir) {
+    if (!ctx->filter) {
+        return 0;
+    }
+    size_t root_len = 0;
+    pthread_mutex_lock(&ctx->roots_lock);
+    for (size_t i = 0; i < ctx->nroots; i++) {
+        const char* root = ctx->roots[i];
+        size_t len = strlen(root);
+        if (len > root_len && !strncmp(root, path, len) && (path[len] == '/' || !strcmp(root, "/"))) {
+            root_len = len;
+        }
+    }
+    pthread_mutex_unlock(&ctx->roots_lock);
+    return path_filtered(ctx->filter, path, root_len, is_dir);
+}
+
+/*
+ * symlinks_watch:
+ *   New or replaced links are classified, new directories scanned (with
+ *   'recurse'), and links whose target was deleted or moved away are
+ *   checked again.
+ */
+int symlinks_watch(struct symlinks_ctx* ctx, volatile sig_atomic_t* stop) {
+    pthread_mutex_lock(&ctx->roots_lock);
+    size_t nroots = ctx->nroots;
+    pthread_mutex_unlock(&ctx->roots_lock);
+    if (!ctx->watcher || nroots == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct watch_batch batch;
+    memset(&batch, 0, sizeof(batch));
+    if (watch_wait(ctx->watcher, &batch, stop, ctx->opts.watch_sigmask) != 0) {
+        watch_batch_free(&batch);
+        return 0;
+    }
+
+    struct pool_worker worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.ctx = ctx;
+    if (ctx->io_uring) {
+        worker.batch = link_batch_new(ctx);
+    }
+
+    /* Targets may have changed anywhere; start the cache afresh */
+    if (ctx->target_cache) {
+        target_cache_clear(ctx->target_cache);
+    }
+
+    if (batch.overflow) {
+        report_error(ctx, NULL, 0, "Change events were lost; rescanning.");
+        rescan_roots(ctx, &worker);
+    }
+    else {
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] watch: %zu changed entries\n", batch.count);
+        }
+        char path[PATH_MAX + 1];
+        for (size_t i = 0; i < batch.count; i++) {
+            const struct watch_change* c = &batch.changes[i];
+            if (ctx->opts.recurse && watch_batch_in_dir(&batch, c->path)) {
+                continue; /* scanned along with its new directory */
+            }
+            struct stat st;
+            if (lstat(c->path, &st) != 0) {
+                continue; /* gone; handled below through the links pointing at it */
+            }
+            if (change_filtered(ctx, c->path, S_ISDIR(st.st_mode))) {
+                continue;
+            }
+            if (S_ISLNK(st.st_mode)) {
+                fix_symlink_path(ctx, c->path, st.st_dev);
+            }
+            else if (S_ISDIR(st.st_mode) && ctx->opts.recurse) {
+                snprintf(path, sizeof(path), "%s", c->path);
+                scan_path(path, st.st_dev, &worker);
+            }
+        }
+        watch_links_gone(ctx->watcher, &batch, recheck_link, ctx);
+    }
+
+    pool_worker_release(&worker);
+    watch_batch_free(&batch);
+    return 1;
+}
+
+/*
+ * symlinks_apply_plan:
+ *   Changes are made one directory at a time from a directory fd.
+ */
+int symlinks_apply_plan(struct symlinks_ctx* ctx, const char* plan_path) {
+    struct plan plan;
+    char message[PATH_MAX + 256];
+    if (plan_load(plan_path, &plan, message, sizeof(message)) != 0) {
+        report_error(ctx, plan_path, errno, "%s", message);
+        return 1;
+    }
+
+    int failed = 0;
+    size_t i = 0;
+    while (i < plan.count) {
+        /* Entries are sorted by directory; take this directory's run */
+        const struct plan_entry* first = &plan.entries[i];
+        size_t end = i + 1;
+        while (end < plan.count && plan.entries[end].dir_len == first->dir_len &&
+               memcmp(plan.entries[end].path, first->path, first->dir_len) == 0) {
+            end++;
+        }
+
+        char dir[PATH_MAX + 1];
+        snprintf(dir, sizeof(dir), "%.*s", (int)first->dir_len, first->path);
+        uint64_t start = op_begin(ctx, STATS_OPENDIR);
+        int dirfd = open(first->dir_len ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        op_end(ctx, STATS_OPENDIR, start);
+        if (dirfd < 0) {
+            report_error(ctx, dir, errno, "Cannot open directory %s: %s", dir, strerror(errno));
+            failed = 1;
+            i = end;
+            continue;
+        }
+
+        for (; i < end; i++) {
+            const struct plan_entry* e = &plan.entries[i];
+            const char* name = e->path + e->dir_len + 1;
+            char value[PATH_MAX + 1];
+            start = op_begin(ctx, STATS_READLINK);
+            ssize_t n = readlinkat(dirfd, name, value, PATH_MAX);
+            op_end(ctx, STATS_READLINK, start);
+            if (n >= 0) {
+                value[n] = '\0';
+            }
+            if (n < 0 || strcmp(value, e->old_target) != 0) {
+                report_error(ctx, e->path, 0, "Skipping %s: no longer the planned link.", e->path);
+                failed = 1;
+                continue;
+            }
+
+            struct symlinks_link rec = {e->path, e->old_target, e->cls, "none", NULL, 0, 0};
+            if (!strcmp(e->action, "delete")) {
+                struct stat st;
+                start = op_begin(ctx, STATS_STAT);
+                int alive = fstatat(dirfd, name, &st, 0) == 0;
+                op_end(ctx, STATS_STAT, start);
+                if (alive) {
+                    report_error(ctx, e->path, 0, "Skipping %s: no longer dangling.", e->path);
+                    failed = 1;
+                    continue;
+                }
+            }
+            if (ctx->opts.dry_run) {
+                /* Test mode: checked against the tree, but not made */
+                int delete = !strcmp(e->action, "delete");
+                rec.action = delete ? "would_delete" : "would_change";
+                rec.new_target = delete ? NULL : e->new_target;
+            }
+            else if (!strcmp(e->action, "delete")) {
+                start = op_begin(ctx, STATS_UNLINK);
+                int rc = unlinkat(dirfd, name, 0);
+                op_end(ctx, STATS_UNLINK, start);
+                if (rc != 0) {
+                    rec.err = errno;
+                    report_error(ctx, e->path, errno, "Cannot unlink %s: %s", e->path, strerror(errno));
+                    failed = 1;
+                }
+                else {
+                    rec.action = "deleted";
+                }
+            }
+            else {
+                start = op_begin(ctx, STATS_REWRITE);
+                int rc = replace_symlink(dirfd, name, e->new_target);
+                op_end(ctx, STATS_REWRITE, start);
+                if (rc != 0) {
+                    rec.err = errno;
+                    report_error(ctx, e->path, errno, "Cannot replace %s: %s", e->path, strerror(errno));
+                    failed = 1;
+                }
+                else {
+                    rec.action = "changed";
+                    rec.new_target = e->new_target;
+                }
+            }
+            if (ctx->opts.on_link) {
+                ctx->opts.on_link(&rec, ctx->opts.user);
+            }
+        }
+        close(dirfd);
+    }
+
+    plan_free(&plan);
+    return failed;
+}
+
+/*
+ * Path lists (symlinks_scan_list): the list is read in large blocks, and
+ * each block is handed out cut after its last NUL, so a path never spans
+ * two blocks.  With -j, worker threads examine blocks while the caller
+ * reads the next ones, through a short queue that bounds the memory used.
+ */
+#define LIST_BLOCK_SIZE (1 << 20)
+
+/* Blocks waiting in the queue, per worker */
+#define LIST_QUEUE_DEPTH 2
+
+struct list_block {
+    struct list_block* next;
+    size_t len; /* of complete, NUL-terminated paths */
+    char data[];
+};
+
+struct list_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct list_block* head;
+    struct list_block* tail;
+    size_t count;
+    size_t limit;
+    int done; /* no more blocks will come */
+};
+
+/*
+ * list_worker:
+ *   Per-thread state of a list scan.  Consecutive links in one directory
+ *   (as find(1) lists them) share its fd, its -c context and an io_uring
+ *   batch, as they do in a directory walk.
+ */
+struct list_worker {
+    struct symlinks_ctx* ctx;
+    struct list_queue* queue;
+    const char* cwd;  /* for relative paths, looked up once per list */
+    atomic_size_t* examined;
+    pthread_t thread;
+    struct link_batch* batch;
+    int dirfd;        /* directory of the last link, or -1 */
+    char dir_path[PATH_MAX + 1];
+    struct dir_context dir;
+};
+
+static struct list_block* list_block_new(void) {
+    struct list_block* block = malloc(sizeof(*block) + LIST_BLOCK_SIZE + 1);
+    if (block) {
+        block->next = NULL;
+        block->len = 0;
+    }
+    return block;
+}
+
+/*
+ * list_leave_dir:
+ *   Finish with the worker's current directory.
+ */
+static void list_leave_dir(struct list_worker* w) {
+    if (w->batch) {
+        link_batch_flush(w->batch);
+        w->batch->modified = 0;
+    }
+    dir_context_release(&w->dir);
+    if (w->dirfd >= 0) {
+        close(w->dirfd);
+        w->dirfd = -1;
+    }
+    w->dir_path[0] = '\0';
+}
+
+/*
+ * list_check:
+ *   Examine the link at 'input', a path from the list.
+ */
+static void list_check(struct list_worker* w, const char* input) {
+    struct symlinks_ctx* ctx = w->ctx;
+    char buf[PATH_MAX + 1];
+    const char* path = input;
 
-    while ((opt = getopt(argc, argv, "cdorstvx")) != -1) {
-        switch (opt) {
-            case 'c':
-                g_fix_links = 1;
-                break;
-            case 'd':
-                g_delete = 1;
-                break;
-            case 'o':
-                g_single_fs = 0;
-                break; /* allow cross-FS */
-            case 'r':
-                g_recurse = 1;
-                break;
-            case 's':
-                g_shorten = 1;
-                break;
-            case 't':
-                g_testing = 1;
-                break;
-            case 'v':
-                g_verbose = 1;
-                break;
-            case 'x':
-                g_debug = 1;
-                break;
-            default:
-                print_usage(progname);
-                exit(EXIT_FAILURE);
+    while (path[0] == '.' && path[1] == '/') {
+        for (path += 2; *path == '/'; path++) {
+        }
+    }
+    if (path[0] != '/') {
+        if ((size_t)snprintf(buf, sizeof(buf), "%s/%s", w->cwd, path) >= sizeof(buf)) {
+            report_error(ctx, input, ENAMETOOLONG, "Path too long: %s; skipping.", input);
+            return;
         }
+        path = buf;
+    }
+    else if (strlen(path) > PATH_MAX) {
+        report_error(ctx, input, ENAMETOOLONG, "Path too long: %s; skipping.", input);
+        return;
     }
 
-    if (optind >= argc) {
-        print_usage(progname);
-        exit(EXIT_FAILURE);
+    const char* name = strrchr(path, '/') + 1;
+    size_t dir_len = (size_t)(name - path) - 1;
+    if (!*name) {
+        report_error(ctx, path, ENOTDIR, "%s is not a symlink; skipping.", path);
+        return;
+    }
+    if (w->dirfd < 0 || strncmp(w->dir_path, path, dir_len) != 0 || w->dir_path[dir_len] != '\0') {
+        list_leave_dir(w);
+        memcpy(w->dir_path, path, dir_len);
+        w->dir_path[dir_len] = '\0';
+        uint64_t start = op_begin(ctx, STATS_OPENDIR);
+        w->dirfd = open(dir_len ? w->dir_path : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        op_end(ctx, STATS_OPENDIR, start);
+        if (w->dirfd < 0) {
+            report_error(ctx, path, errno, "Cannot open directory of %s: %s", path, strerror(errno));
+            w->dir_path[0] = '\0';
+            return;
+        }
     }
 
-    int dircount = 0;
-    while (optind < argc) {
-        char path[PATH_MAX + 1];
-        memset(path, 0, sizeof(path));
+    struct stat st;
+    uint64_t start = op_begin(ctx, STATS_LSTAT);
+    int rc = fstatat(w->dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+    op_end(ctx, STATS_LSTAT, start);
+    if (rc != 0) {
+        /* Gone since the list was made: nothing to report, as in a walk */
+        if (errno != ENOENT || ctx->opts.debug) {
+            report_error(ctx, path, errno, "Cannot lstat %s: %s", path, strerror(errno));
+        }
+        return;
+    }
+    if (!S_ISLNK(st.st_mode)) {
+        report_error(ctx, path, EINVAL, "%s is not a symlink; skipping.", path);
+        return;
+    }
+
+    char value[PATH_MAX + 1];
+    if (read_symlink(ctx, w->dirfd, name, path, value) != 0) {
+        return;
+    }
+    if (w->batch) {
+        link_batch_add(w->batch, &w->dir, w->dirfd, name, path, value, st.st_dev);
+    }
+    else {
+        struct target_info target;
+        stat_target(ctx, w->dirfd, path, value, &target);
+        classify_symlink(ctx, &w->dir, w->dirfd, name, path, value, &target, st.st_dev);
+    }
+}
+
+static void list_check_block(struct list_worker* w, struct list_block* block) {
+    size_t n = 0;
+    for (size_t pos = 0; pos < block->len;) {
+        const char* path = block->data + pos;
+        size_t len = strlen(path);
+        if (len > 0) {
+            list_check(w, path);
+            n++;
+        }
+        pos += len + 1;
+    }
+    atomic_fetch_add(w->examined, n);
+    free(block);
+}
+
+static void* list_worker_main(void* arg) {
+    struct list_worker* w = arg;
+    struct list_queue* q = w->queue;
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        while (!q->head && !q->done) {
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        }
+        struct list_block* block = q->head;
+        if (block) {
+            q->head = block->next;
+            if (!q->head) {
+                q->tail = NULL;
+            }
+            q->count--;
+            pthread_cond_signal(&q->not_full);
+        }
+        pthread_mutex_unlock(&q->lock);
+        if (!block) {
+            break;
+        }
+        list_check_block(w, block);
+    }
+    list_leave_dir(w);
+    return NULL;
+}
+
+/*
+ * list_dispatch:
+ *   Hand a block of paths to the workers, or examine it here when there
+ *   are none.
+ */
+static void list_dispatch(struct list_queue* q, struct list_worker* self, struct list_block* block) {
+    if (!q) {
+        list_check_block(self, block);
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    while (q->count >= q->limit) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    if (q->tail) {
+        q->tail->next = block;
+    }
+    else {
+        q->head = block;
+    }
+    q->tail = block;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * list_read:
+ *   Read the list from 'fd' and dispatch it block by block.  A block goes
+ *   out after every read that completes a path, so a slow producer (a
+ *   pipe from find(1)) does not hold up the links already listed.  A path
+ *   longer than a block is reported and skipped.  Returns 0, or -1 after
+ *   reporting a read error or running out of memory.
+ */
+static int list_read(struct symlinks_ctx* ctx, int fd, struct list_queue* q, struct list_worker* self) {
+    struct list_block* block = list_block_new();
+    int skipping = 0; /* inside a path too long to keep */
+    if (!block) {
+        report_error(ctx, NULL, ENOMEM, "Out of memory reading the path list");
+        return -1;
+    }
+    size_t len = 0;
+    for (;;) {
+        ssize_t n = read(fd, block->data + len, LIST_BLOCK_SIZE - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            report_error(ctx, NULL, errno, "Cannot read the path list: %s", strerror(errno));
+            free(block);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+
+        if (skipping) {
+            char* end = memchr(block->data, '\0', len);
+            size_t skip = end ? (size_t)(end - block->data) + 1 : len;
+            memmove(block->data, block->data + skip, len - skip);
+            len -= skip;
+            skipping = !end;
+        }
+        char* last = len ? memrchr(block->data, '\0', len) : NULL;
+        if (!last) {
+            if (len == LIST_BLOCK_SIZE) {
+                report_error(ctx, NULL, ENAMETOOLONG, "Path too long in the path list; skipping it.");
+                len = 0;
+                skipping = 1;
+            }
+            continue;
+        }
+
+        struct list_block* next = list_block_new();
+        if (!next) {
+            report_error(ctx, NULL, ENOMEM, "Out of memory reading the path list");
+            free(block);
+            return -1;
+        }
+        block->len = (size_t)(last - block->data) + 1;
+        len -= block->len;
+        memcpy(next->data, last + 1, len);
+        list_dispatch(q, self, block);
+        block = next;
+    }
+
+    /* A last path without its NUL */
+    if (len > 0 && !skipping) {
+        block->data[len] = '\0';
+        block->len = len + 1;
+        list_dispatch(q, self, block);
+    }
+    else {
+        free(block);
+    }
+    return 0;
+}
+
+/*
+ * symlinks_scan_list:
+ *   No directory is read and nothing is resolved per path: the current
+ *   directory is looked up once, and each link costs its lstat, readlink
+ *   and target lookup, plus an open of its directory when that changes.
+ */
+int symlinks_scan_list(struct symlinks_ctx* ctx, int fd) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        report_error(ctx, NULL, errno, "getcwd() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    atomic_size_t examined;
+    atomic_init(&examined, 0);
+    int nworkers = ctx->opts.jobs > 1 ? ctx->opts.jobs : 0;
+    struct list_worker* workers = calloc((size_t)nworkers + 1, sizeof(*workers));
+    if (!workers) {
+        report_error(ctx, NULL, ENOMEM, "Out of memory starting the scan");
+        return -1;
+    }
+    struct list_queue queue;
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+    queue.limit = (size_t)nworkers * LIST_QUEUE_DEPTH;
+
+    /* workers[nworkers] is the reader's own, used when there are no threads */
+    int started = 0;
+    for (int i = 0; i <= nworkers; i++) {
+        struct list_worker* w = &workers[i];
+        w->ctx = ctx;
+        w->queue = &queue;
+        w->cwd = cwd;
+        w->examined = &examined;
+        w->dirfd = -1;
+        if (i == nworkers) {
+            break;
+        }
+        if (ctx->io_uring) {
+            w->batch = link_batch_new(ctx);
+        }
+        if (pthread_create(&w->thread, NULL, list_worker_main, w) != 0) {
+            link_batch_free(w->batch);
+            w->batch = NULL;
+            break;
+        }
+        started++;
+    }
+    struct list_worker* self = &workers[nworkers];
+    if (started == 0 && ctx->io_uring) {
+        self->batch = link_batch_new(ctx);
+    }
+
+    int rc = list_read(ctx, fd, started ? &queue : NULL, self);
+
+    pthread_mutex_lock(&queue.lock);
+    queue.done = 1;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        link_batch_free(workers[i].batch);
+    }
+    list_leave_dir(self);
+    link_batch_free(self->batch);
+    free(workers);
+    pthread_cond_destroy(&queue.not_full);
+    pthread_cond_destroy(&queue.not_empty);
+    pthread_mutex_destroy(&queue.lock);
+
+    return rc == 0 ? (int)atomic_load(&examined) : -1;
+}
+
+/*
+ * symlinks_scan_archive:
+ *   The archive is read once to index it, and once more only if it is
+ *   written out; nothing in it is extracted.
+ */
+int symlinks_scan_archive(struct symlinks_ctx* ctx, int in_fd, int out_fd) {
+    char error[PATH_MAX + 128];
+    struct archive* ar = archive_open(in_fd, out_fd >= 0, error, sizeof(error));
+    if (!ar) {
+        report_error(ctx, NULL, errno, "Cannot read the archive: %s", error);
+        return -1;
+    }
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] %s archive, %zu members\n", archive_format(ar), archive_members(ar));
+    }
+
+    struct dir_context dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.archive = ar;
+    dir.read_only = out_fd < 0;
+    int examined = 0;
+    for (size_t i = 0; i < archive_members(ar); i++) {
+        const char* path;
+        const char* value;
+        stats_add(ctx->stats, STATS_ENTRIES, 1);
+        if (!archive_link(ar, i, &path, &value)) {
+            continue;
+        }
+        if (ctx->filter && path_filtered(ctx->filter, path, 0, 0)) {
+            continue;
+        }
+        if (ctx->opts.debug) {
+            fprintf(stderr, "[DEBUG] Symlink: %s -> %s\n", path, value);
+        }
+        struct archive_target resolved;
+        archive_resolve(ar, path, value, &resolved);
+        struct target_info target = {resolved.err, 0, resolved.is_dir ? S_IFDIR : S_IFREG, resolved.links};
+        dir.member = i;
+        classify_symlink(ctx, &dir, -1, strrchr(path, '/') + 1, path, value, &target, 0);
+        examined++;
+    }
 
-        const char* input = argv[optind++];
-        if (input[0] == '/') {
-            strncpy(path, input, sizeof(path) - 1);
+    int rc = 0;
+    if (out_fd >= 0 && archive_write(ar, out_fd, error, sizeof(error)) != 0) {
+        report_error(ctx, NULL, errno, "Cannot write the archive: %s", error);
+        rc = -1;
+    }
+    archive_close(ar);
+    return rc == 0 ? examined : -1;
+}
+
+/*
+ * watch_root:
+ *   Start watching the directory argument 'path' and remember it.
+ */
+static void watch_root(struct symlinks_ctx* ctx, const char* path) {
+    pthread_mutex_lock(&ctx->roots_lock);
+    if (watch_add_root(ctx->watcher, path) == 0) {
+        if (ctx->nroots == ctx->roots_cap) {
+            size_t cap = ctx->roots_cap ? ctx->roots_cap * 2 : 8;
+            char** roots = realloc(ctx->roots, cap * sizeof(*roots));
+            if (roots) {
+                ctx->roots = roots;
+                ctx->roots_cap = cap;
+            }
+        }
+        char* root = (ctx->nroots < ctx->roots_cap) ? strdup(path) : NULL;
+        if (root) {
+            ctx->roots[ctx->nroots++] = root;
         }
         else {
-            char cwd[PATH_MAX];
-            if (!getcwd(cwd, sizeof(cwd))) {
-                fprintf(stderr, "getcwd() failed: %s\n", strerror(errno));
-                exit(EXIT_FAILURE);
+            report_error(ctx, path, ENOMEM, "Out of memory watching %s", path);
+        }
+    }
+    pthread_mutex_unlock(&ctx->roots_lock);
+}
+
+/*
+ * absolute_root:
+ *   'input' made absolute from the current directory and tidied, into
+ *   'path' (PATH_MAX + 1 bytes).  Returns 0, or -1 after reporting.
+ */
+static int absolute_root(struct symlinks_ctx* ctx, const char* input, char* path) {
+    if (input[0] == '/') {
+        snprintf(path, PATH_MAX + 1, "%s", input);
+    }
+    else {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            report_error(ctx, input, errno, "getcwd() failed: %s", strerror(errno));
+            return -1;
+        }
+        strncat(cwd, "/", sizeof(cwd) - strlen(cwd) - 1);
+        strncat(cwd, input, sizeof(cwd) - strlen(cwd) - 1);
+        snprintf(path, PATH_MAX + 1, "%s", cwd);
+    }
+    tidy_path(path);
+    return 0;
+}
+
+/*
+ * root_covered:
+ *   Whether scanning another of the 'roots' already scans roots[i]: an
+ *   earlier copy of it, or, with 'recurse', a directory above it that the
+ *   walk reaches it from, through directories only and, without
+ *   'cross_fs', on the same filesystem.  NULL roots are skipped.
+ */
+static int root_covered(const struct symlinks_ctx* ctx, char* const* roots, size_t nroots, size_t i) {
+    const char* root = roots[i];
+    for (size_t j = 0; j < nroots; j++) {
+        const char* above = roots[j];
+        if (j == i || !above) {
+            continue;
+        }
+        size_t len = strlen(above);
+        if (!strcmp(above, root)) {
+            if (j < i) {
+                return 1;
+            }
+            continue;
+        }
+        if (!ctx->opts.recurse || strncmp(above, root, len) != 0 || (root[len] != '/' && strcmp(above, "/") != 0)) {
+            continue;
+        }
+
+        struct stat st;
+        if (lstat(above, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        dev_t dev = st.st_dev;
+        char path[PATH_MAX + 1];
+        snprintf(path, sizeof(path), "%s", root);
+        int reached = 1;
+        for (char* p = path + len + (above[len - 1] != '/'); reached && p;) {
+            char* slash = strchr(p, '/');
+            if (slash) {
+                *slash = '\0';
+            }
+            reached = lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && (ctx->opts.cross_fs || st.st_dev == dev);
+            if (slash) {
+                *slash = '/';
+                p = slash + 1;
+            }
+            else {
+                p = NULL;
+            }
+        }
+        if (reached) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * scan_resumed:
+ *   Scan the directory of checkpoint entry 'e' from where it was left.
+ */
+static void scan_resumed(const struct checkpoint_entry* e, struct pool_worker* worker) {
+    uint64_t start = op_begin(worker->ctx, STATS_OPENDIR);
+    int fd = open_long_path(e->path);
+    op_end(worker->ctx, STATS_OPENDIR, start);
+    if (fd < 0) {
+        report_error(worker->ctx, e->path, errno, "opendir failed on %s: %s", e->path, strerror(errno));
+        return;
+    }
+    scan_directory(e->path, fd, (dev_t)e->base_dev, e->depth, worker, e);
+}
+
+/*
+ * scan_run:
+ *   Scan the directories of 'resume' (or NULL) from where they were left,
+ *   then the 'roots', absolute paths or NULL for none.  Each directory is
+ *   read once: roots inside other roots are dropped beforehand, and the
+ *   walks share a set of the directories entered, which also catches bind
+ *   mounts and roots reached through symlinks.  Returns the number of roots
+ *   that could be examined at all.
+ */
+static int scan_run(struct symlinks_ctx* ctx, char* const* roots, size_t nroots, const struct checkpoint* resume) {
+    struct visited_set* visited = visited_new();
+    if (!visited) {
+        report_error(ctx, NULL, ENOMEM, "Out of memory starting the scan");
+        return 0;
+    }
+
+    /* With jobs > 1, directories are queued and scanned together at the end */
+    struct scan_pool pool;
+    int use_pool = 0;
+    if (ctx->opts.jobs > 1) {
+        if (pool_init(&pool, ctx, ctx->opts.jobs) == 0) {
+            use_pool = 1;
+            for (int i = 0; i < pool.nworkers; i++) {
+                pool.workers[i].visited = visited;
             }
-            strncat(cwd, "/", sizeof(cwd) - strlen(cwd) - 1);
-            strncat(cwd, input, sizeof(cwd) - strlen(cwd) - 1);
-            strncpy(path, cwd, sizeof(path) - 1);
         }
+        else {
+            report_error(ctx, NULL, ENOMEM, "Cannot allocate %d workers; scanning sequentially.", ctx->opts.jobs);
+        }
+    }
+
+    /* The worker used for everything scanned outside the pool */
+    struct pool_worker seq_worker;
+    memset(&seq_worker, 0, sizeof(seq_worker));
+    seq_worker.ctx = ctx;
+    seq_worker.visited = visited;
+    pthread_mutex_init(&seq_worker.ckpt_lock, NULL);
+    if (ctx->io_uring) {
+        seq_worker.batch = link_batch_new(ctx);
+    }
+
+    struct checkpointer ck;
+    memset(&ck, 0, sizeof(ck));
+    ck.ctx = ctx;
+    ck.seq = &seq_worker;
+    ck.pool = use_pool ? &pool : NULL;
+    ck.roots = roots;
+    ck.nroots = nroots;
+    ck.resume = resume;
+    ck.interval_ns = (uint64_t)(ctx->opts.checkpoint_interval * 1e9);
+    pthread_mutex_init(&ck.lock, NULL);
+    pthread_cond_init(&ck.resumed, NULL);
+    atomic_init(&ck.want, 0);
+    atomic_init(&ck.due, stats_now() + ck.interval_ns);
+    if (ctx->opts.checkpoint_path) {
+        seq_worker.ckpt = &ck;
+        for (int i = 0; use_pool && i < pool.nworkers; i++) {
+            pool.workers[i].ckpt = &ck;
+        }
+        pthread_mutex_lock(&seq_worker.ckpt_lock);
+    }
+
+    for (size_t i = 0; resume && i < resume->count; i++) {
+        const struct checkpoint_entry* e = &resume->entries[i];
+        ck.next_entry = i + 1;
+        if (!e->is_root &&
+            (!use_pool || pool_push(&pool.workers[0], e->path, NULL, (dev_t)e->base_dev, e->depth, NULL, e) != 0)) {
+            scan_resumed(e, &seq_worker);
+        }
+    }
 
-        tidy_path(path);
+    int scanned = 0;
+    for (size_t i = 0; i < nroots; i++) {
+        const char* path = roots[i];
+        ck.next_root = i + 1;
+        if (!path) {
+            continue;
+        }
 
         struct stat st;
         if (lstat(path, &st) == -1) {
-            fprintf(stderr, "Cannot lstat %s: %s\n", path, strerror(errno));
+            report_error(ctx, path, errno, "Cannot lstat %s: %s", path, strerror(errno));
             continue;
         }
 
         if (S_ISDIR(st.st_mode)) {
-            scan_directory(path, st.st_dev, 0);
+            if (root_covered(ctx, roots, nroots, i) || !visited_add(visited, st.st_dev, st.st_ino)) {
+                if (ctx->opts.debug) {
+                    fprintf(stderr, "[DEBUG] %s is scanned along with another root\n", path);
+                }
+            }
+            else {
+                if (ctx->watcher) {
+                    watch_root(ctx, path);
+                }
+                if (!use_pool || pool_push(&pool.workers[0], path, NULL, st.st_dev, 0, &st, NULL) != 0) {
+                    scan_path(path, st.st_dev, &seq_worker);
+                }
+            }
         }
         else if (S_ISLNK(st.st_mode)) {
-            fix_symlink(path, st.st_dev);
+            fix_symlink_path(ctx, path, st.st_dev);
         }
         else {
-            fprintf(stderr, "%s is not a directory or symlink; skipping.\n", path);
+            report_error(ctx, path, ENOTDIR, "%s is not a directory or symlink; skipping.", path);
         }
-        dircount++;
+        scanned++;
+    }
+    if (seq_worker.ckpt) {
+        pthread_mutex_unlock(&seq_worker.ckpt_lock);
     }
 
-    if (dircount == 0) {
-        print_usage(progname);
+    if (use_pool) {
+        pool_run(&pool);
+        pool_destroy(&pool);
+    }
+    pool_worker_release(&seq_worker);
+    pthread_mutex_destroy(&seq_worker.ckpt_lock);
+    visited_free(visited);
+
+    /* Done: nothing is left to resume */
+    if (ctx->opts.checkpoint_path && unlink(ctx->opts.checkpoint_path) != 0 && errno != ENOENT) {
+        report_error(ctx, ctx->opts.checkpoint_path, errno, "Cannot remove checkpoint %s: %s",
+                     ctx->opts.checkpoint_path, strerror(errno));
     }
+    pthread_mutex_destroy(&ck.lock);
+    pthread_cond_destroy(&ck.resumed);
+    return scanned;
+}
 
-    return 0;
+int symlinks_scan(struct symlinks_ctx* ctx, const char* const* paths, size_t npaths) {
+    char** roots = calloc(npaths ? npaths : 1, sizeof(*roots));
+    if (!roots) {
+        report_error(ctx, NULL, ENOMEM, "Out of memory starting the scan");
+        return 0;
+    }
+    for (size_t i = 0; i < npaths; i++) {
+        char path[PATH_MAX + 1];
+        if (absolute_root(ctx, paths[i], path) == 0) {
+            roots[i] = strdup(path);
+            if (!roots[i]) {
+                report_error(ctx, path, ENOMEM, "Out of memory; skipping %s", path);
+            }
+        }
+    }
+
+    int scanned = scan_run(ctx, roots, npaths, NULL);
+    for (size_t i = 0; i < npaths; i++) {
+        free(roots[i]);
+    }
+    free(roots);
+    return scanned;
+}
+
+int symlinks_resume(struct symlinks_ctx* ctx, const char* path) {
+    struct checkpoint cp;
+    char error[PATH_MAX + 128];
+    if (checkpoint_load(path, &cp, error, sizeof(error)) != 0) {
+        report_error(ctx, path, errno, "%s", error);
+        return -1;
+    }
+    /* Resumed with other options, the rest of the scan would not match what was done; keep the checkpoint */
+    struct option_check check = {&cp, path, 0, 0, ""};
+    scan_options(ctx, check_scan_option, &check);
+    if (!check.differs && check.next < cp.noptions) {
+        const struct checkpoint_option* extra = &cp.options[check.next];
+        snprintf(check.message, sizeof(check.message),
+                 "Checkpoint %s was saved with %s %s; resume it with the options it was saved with.", path, extra->name,
+                 extra->value);
+        check.differs = 1;
+    }
+    if (check.differs) {
+        report_error(ctx, path, EINVAL, "%s", check.message);
+        checkpoint_free(&cp);
+        errno = EINVAL;
+        return -1;
+    }
+    char** roots = calloc(cp.count ? cp.count : 1, sizeof(*roots));
+    if (!roots) {
+        report_error(ctx, path, ENOMEM, "Out of memory resuming from %s", path);
+        checkpoint_free(&cp);
+        return -1;
+    }
+    size_t nroots = 0;
+    for (size_t i = 0; i < cp.count; i++) {
+        if (cp.entries[i].is_root) {
+            roots[nroots++] = (char*)cp.entries[i].path; /* points into cp.data */
+        }
+    }
+    for (int i = 0; ctx->stats && i < STATS_NCOUNTERS; i++) {
+        stats_add(ctx->stats, (enum stats_counter)i, cp.counters[i]);
+    }
+    if (ctx->opts.debug) {
+        fprintf(stderr, "[DEBUG] resuming %zu directories and %zu arguments from %s\n", cp.count - nroots, nroots,
+                path);
+    }
+
+    scan_run(ctx, roots, nroots, &cp);
+    int resumed = (int)cp.count;
+    free(roots);
+    checkpoint_free(&cp);
+    return resumed;
+}
+
+void symlinks_options_init(struct symlinks_options* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->jobs = 1;
+    opts->cache_size = 16384;
+    opts->checkpoint_interval = 10;
+}
+
+struct symlinks_ctx* symlinks_new(const struct symlinks_options* opts) {
+    if (opts->jobs < 1 || opts->cache_size < 0 || opts->inode_order < 0 || !(opts->max_ops >= 0) ||
+        !(opts->max_changes >= 0) || (opts->checkpoint_path && !(opts->checkpoint_interval > 0)) ||
+        opts->summary_depth < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct symlinks_ctx* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->opts = *opts;
+    pthread_mutex_init(&ctx->roots_lock, NULL);
+    if (opts->watch_sigmask) {
+        ctx->watch_sigmask = *opts->watch_sigmask;
+        ctx->opts.watch_sigmask = &ctx->watch_sigmask;
+    }
+
+    /* A checkpoint keeps the counters too */
+    if (opts->stats || opts->checkpoint_path) {
+        ctx->stats = stats_new(opts->stats > 1);
+        if (!ctx->stats) {
+            symlinks_free(ctx);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    if (opts->summary) {
+        ctx->summary = summary_new(opts->summary_depth);
+        if (!ctx->summary) {
+            symlinks_free(ctx);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    if (opts->nice_io) {
+        ctx->throttle = throttle_new(opts->max_ops, opts->max_changes);
+        if (!ctx->throttle) {
+            symlinks_free(ctx);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    if (opts->nfilters > 0) {
+        ctx->filter = filter_new(opts->filters, opts->nfilters);
+        if (!ctx->filter) {
+            int err = errno;
+            symlinks_free(ctx);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    if (opts->cache_size > 0) {
+        ctx->target_cache = target_cache_new((size_t)opts->cache_size);
+    }
+
+    if (opts->index_path) {
+        ctx->index = index_open(opts->index_path, opts->on_error, opts->user);
+        if (!ctx->index) {
+            report_error(ctx, opts->index_path, ENOMEM, "Cannot set up index %s; scanning without it.",
+                         opts->index_path);
+        }
+    }
+
+    /* Each scanning thread sets up its own ring; see whether one works at all */
+    if (opts->io_uring) {
+        struct link_batch* probe = link_batch_new(ctx);
+        ctx->io_uring = (probe != NULL);
+        link_batch_free(probe);
+    }
+
+    /* Set up before the first scan, which registers the directories to watch */
+    if (opts->watch) {
+        ctx->watcher = watch_open(opts->recurse, opts->on_error, opts->user);
+        if (!ctx->watcher) {
+            int err = errno;
+            symlinks_free(ctx);
+            errno = err;
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+void symlinks_stats(const struct symlinks_ctx* ctx, struct symlinks_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (ctx->target_cache) {
+        target_cache_counters(ctx->target_cache, &stats->cache_hits, &stats->cache_misses, &stats->cache_evictions);
+    }
+    if (ctx->index) {
+        index_counters(ctx->index, &stats->index_replayed, &stats->index_recorded);
+    }
+    if (ctx->throttle) {
+        throttle_counters(ctx->throttle, &stats->nice_paused_ns, &stats->nice_slowdown);
+    }
+    stats->io_uring = ctx->io_uring;
+    stats->watch_backend = ctx->watcher ? watch_backend(ctx->watcher) : NULL;
+
+    if (ctx->stats) {
+        uint64_t counters[STATS_NCOUNTERS];
+        stats_counters(ctx->stats, counters);
+        stats->directories = counters[STATS_DIRS];
+        stats->entries = counters[STATS_ENTRIES];
+        stats->links = counters[STATS_LINKS];
+        stats->dangling = counters[STATS_DANGLING];
+        stats->loops = counters[STATS_LOOP];
+        stats->other_fs = counters[STATS_OTHER_FS];
+        stats->absolute = counters[STATS_ABSOLUTE];
+        stats->messy = counters[STATS_MESSY];
+        stats->chained = counters[STATS_CHAINED];
+        stats->relative = counters[STATS_RELATIVE];
+        stats->changed = counters[STATS_CHANGED];
+        stats->deleted = counters[STATS_DELETED];
+        stats->path_bytes = counters[STATS_PATH_BYTES];
+    }
+}
+
+void symlinks_print_stats(const struct symlinks_ctx* ctx, FILE* out) {
+    if (ctx->stats && ctx->opts.stats) {
+        stats_print(ctx->stats, out);
+    }
+}
+
+void symlinks_print_summary(const struct symlinks_ctx* ctx, FILE* out) {
+    if (ctx->summary) {
+        summary_print(ctx->summary, out);
+    }
+}
+
+int symlinks_free(struct symlinks_ctx* ctx) {
+    if (!ctx) {
+        return 0;
+    }
+    int status = 0;
+    if (ctx->index) {
+        if (index_save(ctx->index) != 0) {
+            status = -1;
+        }
+        index_close(ctx->index);
+    }
+    if (ctx->watcher) {
+        watch_close(ctx->watcher);
+    }
+    for (size_t i = 0; i < ctx->nroots; i++) {
+        free(ctx->roots[i]);
+    }
+    free(ctx->roots);
+    if (ctx->target_cache) {
+        target_cache_free(ctx->target_cache);
+    }
+    stats_free(ctx->stats);
+    summary_free(ctx->summary);
+    filter_free(ctx->filter);
+    throttle_free(ctx->throttle);
+    pthread_mutex_destroy(&ctx->roots_lock);
+    free(ctx);
+    return status;
 }
@@ -0,0 +1,298 @@
+#ifndef SYMLINKS_H
+#define SYMLINKS_H
+
+/*
+ * libsymlinks: scan directory trees for symbolic links, classify them and
+ * optionally fix them, in-process.
+ *
+ * All state lives in a struct symlinks_ctx created from a struct
+ * symlinks_options; the library has no global settings and never exits
+ * the process.  Results and errors are handed to callbacks.  Contexts are
+ * independent of each other, and symlinks_scan() may also be called on
+ * the same context from several threads at once (its callbacks then run
+ * concurrently too).
+ *
+ *     struct symlinks_options opts;
+ *     symlinks_options_init(&opts);
+ *     opts.recurse = 1;
+ *     opts.on_link = my_link_fn;
+ *     struct symlinks_ctx* ctx = symlinks_new(&opts);
+ *     const char* roots[] = {"/srv/tree"};
+ *     symlinks_scan(ctx, roots, 1);
+ *     symlinks_free(ctx);
+ */
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SYMLINKS_VERSION "1.4.3"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * symlinks_link:
+ *   What was found and done for one link.  'cls' is one of "dangling",
+ *   "loop", "other_fs", "absolute", "messy", "chained" (relative, to
+ *   another link) or "relative"; 'action' one of "none", "deleted",
+ *   "changed", "would_change" or "would_delete" (dry run).  'err' is the
+ *   errno of the target lookup for a dangling link (ELOOP for a loop), or
+ *   of a failed deletion/rewrite, 0 otherwise.  The strings are only valid
+ *   during the callback.
+ */
+struct symlinks_link {
+    const char* path;
+    const char* target;
+    const char* cls;
+    const char* action;
+    const char* new_target; /* NULL unless changed or would_change */
+    int err;
+    int chain; /* links followed to the final target, this one included; 0 for a loop or if not known */
+};
+
+/* Called once per link examined */
+typedef void (*symlinks_link_fn)(const struct symlinks_link* link, void* user);
+
+/*
+ * Called for every error, with the path concerned (or NULL), its errno
+ * (or 0) and a complete one-line message without the newline.
+ */
+typedef void (*symlinks_error_fn)(const char* path, int err, const char* message, void* user);
+
+/*
+ * Called before each checkpoint is saved: links reported so far will not
+ * be reported again on resuming, so buffered reports should be flushed.
+ */
+typedef void (*symlinks_checkpoint_fn)(void* user);
+
+/*
+ * symlinks_filter:
+ *   A rule deciding whether the scan looks at a directory entry.  Rules are
+ *   tried in order and the first that matches decides; an entry no rule
+ *   matches is kept.  A pattern is a shell glob (fnmatch) matched against
+ *   the entry's name, or, if it contains a slash, against its whole path,
+ *   where '*' also matches slashes.  Roots themselves are never filtered.
+ */
+enum symlinks_filter_kind {
+    SYMLINKS_EXCLUDE, /* skip matching links and directories (--exclude) */
+    SYMLINKS_INCLUDE, /* keep matching entries despite later rules (--include) */
+    SYMLINKS_PRUNE,   /* do not enter matching directories; other entries are unaffected (--prune) */
+};
+
+struct symlinks_filter {
+    enum symlinks_filter_kind kind;
+    const char* pattern;
+};
+
+struct symlinks_options {
+    int convert;            /* make absolute links relative (-c) */
+    int delete_dangling;    /* delete dangling links (-d) */
+    int cross_fs;           /* follow and fix links across filesystems (-o) */
+    int recurse;            /* descend into subdirectories (-r) */
+    int shorten;            /* drop needless "../dir" detours (-s) */
+    int flatten;            /* point chained links straight at their final target (--flatten) */
+    int dry_run;            /* report would_change/would_delete, modify nothing (-t) */
+    int debug;              /* trace the processing on stderr (-x) */
+    int jobs;               /* scanning threads per symlinks_scan() call (-j), >= 1 */
+    int io_uring;           /* batch target lookups through io_uring if available */
+    long cache_size;        /* targets remembered across links, 0 = off */
+    const char* index_path; /* directory index file (--index), or NULL */
+    int watch;              /* allow symlinks_watch() on the scanned directories */
+    int stats;              /* 1 = count operations and links, 2 = also time them */
+    int inode_order;        /* handle each directory's entries in inode order, this many at a time; 0 = off */
+    int nice_io;            /* pace the scan: the limits below, plus back-off while the device is busy */
+    double max_ops;         /* with nice_io: metadata system calls per second, 0 = unlimited */
+    double max_changes;     /* with nice_io: rewrites and deletions per second, 0 = unlimited */
+    int summary;            /* keep totals per class, subtree and directory for symlinks_print_summary() */
+    int summary_depth;      /* with summary: depth of the subtrees below the roots, >= 0 */
+
+    const char* checkpoint_path; /* save the progress of symlinks_scan() here (--checkpoint), or NULL */
+    double checkpoint_interval;  /* seconds between checkpoints, > 0 */
+
+    /* With watch: the signal mask while symlinks_watch() waits (see ppoll()), copied by symlinks_new(); NULL
+     * leaves it alone.  Block the stop signals outside the wait and unblock them here, so none is lost. */
+    const sigset_t* watch_sigmask;
+
+    const struct symlinks_filter* filters; /* entry filters, copied by symlinks_new() */
+    size_t nfilters;
+
+    symlinks_link_fn on_link;             /* may be NULL */
+    symlinks_error_fn on_error;           /* may be NULL: errors are then dropped */
+    symlinks_checkpoint_fn on_checkpoint; /* may be NULL */
+    void* user;                           /* passed to the callbacks */
+};
+
+/*
+ * symlinks_stats:
+ *   Counters of a context, for reporting.
+ */
+struct symlinks_stats {
+    size_t cache_hits;
+    size_t cache_misses;
+    size_t cache_evictions;
+    uint64_t index_replayed;   /* directories taken from the index */
+    uint64_t index_recorded;   /* directories written to the index */
+    int io_uring;              /* io_uring was asked for and is in use */
+    const char* watch_backend; /* "fanotify", "inotify", or NULL */
+    uint64_t nice_paused_ns;   /* with nice_io: time threads spent waiting or backing off */
+    double nice_slowdown;      /* with nice_io: current back-off, 1 when the device is not busy */
+
+    /* Only counted with 'stats' set in the options; totals over all scans */
+    uint64_t directories;
+    uint64_t entries;
+    uint64_t links;
+    uint64_t dangling;
+    uint64_t loops;
+    uint64_t other_fs;
+    uint64_t absolute;
+    uint64_t messy;
+    uint64_t chained;
+    uint64_t relative;
+    uint64_t changed;    /* changed, or would be in a dry run */
+    uint64_t deleted;    /* deleted, or would be in a dry run */
+    uint64_t path_bytes; /* bytes of link paths and values examined */
+};
+
+struct symlinks_ctx;
+
+/*
+ * symlinks_options_init:
+ *   Fill 'opts' with the defaults: report only, one filesystem, one job,
+ *   a 16384-entry target cache, no callbacks.
+ */
+void symlinks_options_init(struct symlinks_options* opts);
+
+/*
+ * symlinks_new:
+ *   Create a context; 'opts' is copied, its strings must outlive the
+ *   context.  An index that cannot be set up is reported and skipped.
+ *   Returns NULL with errno set if out of memory, if 'opts' is invalid
+ *   (EINVAL), or if watching was asked for and is not available.
+ */
+struct symlinks_ctx* symlinks_new(const struct symlinks_options* opts);
+
+/*
+ * symlinks_scan:
+ *   Examine each of 'paths': a directory is scanned (with its subtree if
+ *   'recurse'), a symlink is examined by itself.  Relative paths are taken
+ *   from the current directory.  Each directory is read once per call,
+ *   however the paths overlap.  Returns the number of paths that could be
+ *   examined at all; everything else is reported through on_error.
+ *
+ *   With 'checkpoint_path', the directories still to scan and the counters
+ *   are saved there every 'checkpoint_interval' seconds, atomically, for
+ *   symlinks_resume() after a crash; the file is removed once the scan is
+ *   complete.
+ */
+int symlinks_scan(struct symlinks_ctx* ctx, const char* const* paths, size_t npaths);
+
+/*
+ * symlinks_resume:
+ *   Continue the symlinks_scan() whose progress was saved to the checkpoint
+ *   file 'path' (see 'checkpoint_path').  The options deciding what is
+ *   read and done (recurse, cross_fs, convert, delete_dangling, shorten,
+ *   flatten, dry_run, inode_order, index_path and the filters) must be
+ *   those of the interrupted scan.  The counters are restored, and the
+ *   directories are read on from where the scan left them, so subtrees it
+ *   finished are not read again; a directory replaced since is read from
+ *   its start.  While scanning, 'checkpoint_path' is saved as by
+ *   symlinks_scan().  Returns the number of directories and paths taken
+ *   up, or -1, leaving the checkpoint alone, if it could not be read or
+ *   was saved with other options (reported through on_error).
+ */
+int symlinks_resume(struct symlinks_ctx* ctx, const char* path);
+
+/*
+ * symlinks_scan_list:
+ *   Examine each link named in the NUL-separated list read from 'fd' until
+ *   its end, as symlinks_scan() examines a symlink argument, without
+ *   reading any directory.  Relative paths are taken from the current
+ *   directory.  With 'jobs' > 1, that many threads examine the links while
+ *   the list is still being read.  Returns the number of paths read, or -1
+ *   if the list could not be read (reported through on_error).
+ */
+int symlinks_scan_list(struct symlinks_ctx* ctx, int fd);
+
+/*
+ * symlinks_scan_archive:
+ *   Examine the links inside the uncompressed tar or cpio archive read from
+ *   'in_fd', resolved against the archive's own contents as if it were
+ *   extracted at the root (see archive.h); other_fs does not apply.  Paths
+ *   reported are the members' names made absolute.  With 'out_fd' >= 0 the
+ *   archive is written there with the deletions and rewrites made (it is
+ *   written unchanged in a dry run); without it, links are reported as in a
+ *   dry run.  'jobs', 'io_uring', 'cache_size', 'index_path', 'watch' and
+ *   'checkpoint_path' do not apply.  Returns the number of links examined,
+ *   or -1 if the archive could not be read or written (reported through
+ *   on_error).
+ */
+int symlinks_scan_archive(struct symlinks_ctx* ctx, int in_fd, int out_fd);
+
+/*
+ * symlinks_watch:
+ *   After symlinks_scan() with 'watch' set: wait for changes below the
+ *   scanned directories, then handle them as one batch.  Call it in a loop;
+ *   returns 1 after a batch, 0 once '*stop' is raised (e.g. by a signal
+ *   handler, which also interrupts the wait; see 'watch_sigmask') or
+ *   waiting failed, -1 if there is nothing to watch.
+ */
+int symlinks_watch(struct symlinks_ctx* ctx, volatile sig_atomic_t* stop);
+
+/*
+ * symlinks_apply_plan:
+ *   Make the changes planned in the file 'plan_path' (see plan.h), each
+ *   reported through on_link as "changed" or "deleted"; with 'dry_run',
+ *   nothing is changed and they are reported as "would_change" or
+ *   "would_delete".  A link whose value is no longer the planned one is
+ *   left alone.  Returns 0, or 1 if some change was skipped or failed.
+ */
+int symlinks_apply_plan(struct symlinks_ctx* ctx, const char* plan_path);
+
+/*
+ * symlinks_stats:
+ *   Current counters; may be called while scans are running (e.g. from a
+ *   progress thread).
+ */
+void symlinks_stats(const struct symlinks_ctx* ctx, struct symlinks_stats* stats);
+
+/*
+ * symlinks_print_stats:
+ *   With 'stats' set: write the counters, the per-operation counts and,
+ *   with 'stats' at 2, their latency distribution and the slowest
+ *   directories to 'out'.  Does nothing otherwise.
+ */
+void symlinks_print_stats(const struct symlinks_ctx* ctx, FILE* out);
+
+/*
+ * symlinks_print_summary:
+ *   With 'summary' set, once the scans are over: write the links found by
+ *   symlinks_scan() and symlinks_resume() per class, the subtrees
+ *   'summary_depth' levels below the roots with the most links, and the
+ *   directories with the most dangling links to 'out'.  A resumed scan
+ *   only counts what it scanned itself, not the directories finished
+ *   before the checkpoint, so its report is incomplete.  Does nothing
+ *   otherwise.
+ */
+void symlinks_print_summary(const struct symlinks_ctx* ctx, FILE* out);
+
+/*
+ * symlinks_free:
+ *   Save the index, if any, and release the context.  Returns 0, or -1 if
+ *   the index could not be saved.
+ */
+int symlinks_free(struct symlinks_ctx* ctx);
+
+/*
+ * symlinks_main:
+ *   The command-line tool, argv and all.  Returns the exit status.
+ */
+int symlinks_main(int argc, char** argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -76,6 +76,19 @@ create_test_env() {
   #     We’ll create subdir_link -> subdir, then link_into_subdir -> subdir_link/file2
   ln -s subdir "$TESTDIR/subdir_link"
   ln -s subdir_link/file2 "$TESTDIR/link_into_subdir"
+
+  # 12) A messy relative link that climbs out of a directory it entered
+  ln -s subdir/.././file1 "$TESTDIR/updown_link"
+}
+
+# wait_for FILE PATTERN: poll FILE until a line matches PATTERN, for up to 20 seconds
+wait_for() {
+  local i
+  for i in $(seq 1 200); do
+    grep -q "$2" "$1" 2>/dev/null && return 0
+    sleep 0.1
+  done
+  return 1
 }
 
 check_binary() {
@@ -187,6 +200,690 @@ test_test_mode() {
     echo "Test 9 failed."
     FAIL=1
   fi
+
+  # Test mode modifies nothing, deletions included
+  local before after
+  before="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  if ! "$SYMLINKS_BINARY" -rtd "$TESTDIR" | grep -q "^(test) would delete: "; then
+    echo "FAIL: -td did not report the dangling links it would delete"
+    FAIL=1
+  fi
+  after="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  if [ "$before" != "$after" ]; then
+    echo "FAIL: -td modified the tree"
+    FAIL=1
+  fi
+  echo
+}
+
+test_parallel() {
+  echo "==== Test 11: Parallel Scan (-j) ===="
+  create_test_env
+  "$SYMLINKS_BINARY" -x -r -j 4 "$TESTDIR"
+  if [ $? -ne 0 ]; then
+    echo "Test 11 failed."
+    FAIL=1
+  fi
+
+  # A parallel scan must report exactly the same links as a sequential one
+  local seq par
+  create_test_env
+  seq="$("$SYMLINKS_BINARY" -r -v "$TESTDIR" | sort)"
+  create_test_env
+  par="$("$SYMLINKS_BINARY" -r -v -j 4 "$TESTDIR" | sort)"
+  if [ "$seq" != "$par" ]; then
+    echo "FAIL: -j 4 output differs from sequential scan"
+    FAIL=1
+  else
+    echo "OK: -j 4 output matches sequential scan."
+  fi
+  echo
+}
+
+test_io_uring() {
+  echo "==== Test 12: io_uring Backend (--io-uring) ===="
+  create_test_env
+  "$SYMLINKS_BINARY" -x -r --io-uring "$TESTDIR"
+  if [ $? -ne 0 ]; then
+    echo "Test 12 failed."
+    FAIL=1
+  fi
+
+  # Batched classification (or its synchronous fallback) must not change results
+  local sync batched
+  create_test_env
+  sync="$("$SYMLINKS_BINARY" -r -v "$TESTDIR" | sort)"
+  create_test_env
+  batched="$("$SYMLINKS_BINARY" -r -v --io-uring "$TESTDIR" 2>/dev/null | sort)"
+  if [ "$sync" != "$batched" ]; then
+    echo "FAIL: --io-uring output differs from synchronous scan"
+    FAIL=1
+  else
+    echo "OK: --io-uring output matches synchronous scan."
+  fi
+  echo
+}
+
+create_shared_target_env() {
+  create_test_env
+  # Several links sharing targets, including a chain through a dangling link
+  ln -s file1 "$TESTDIR/shared_a"
+  ln -s ./file1 "$TESTDIR/shared_b"
+  ln -s dangling "$TESTDIR/via_dangling"
+}
+
+test_target_cache() {
+  echo "==== Test 13: Target Cache (--cache-size) ===="
+  local uncached cached
+  create_shared_target_env
+  uncached="$("$SYMLINKS_BINARY" -r -v --cache-size 0 "$TESTDIR" | sort)"
+  create_shared_target_env
+  cached="$("$SYMLINKS_BINARY" -r -v --cache-size 2 "$TESTDIR" 2>/dev/null | sort)"
+  if [ "$uncached" != "$cached" ]; then
+    echo "FAIL: cached scan output differs from uncached scan"
+    FAIL=1
+  else
+    echo "OK: cached scan output matches uncached scan."
+  fi
+
+  # Deleting dangling links must not disturb cached lookups of live targets
+  create_shared_target_env
+  "$SYMLINKS_BINARY" -r -d "$TESTDIR" > /dev/null
+  if [ -L "$TESTDIR/dangling" ] || [ -L "$TESTDIR/via_dangling" ] || [ ! -L "$TESTDIR/shared_a" ]; then
+    echo "FAIL: -d with target cache deleted the wrong links"
+    FAIL=1
+  else
+    echo "OK: -d with target cache deleted exactly the dangling links."
+  fi
+  echo
+}
+
+test_index() {
+  echo "==== Test 14: Directory Index (--index) ===="
+  local index="$TESTDIR.idx" first second
+  create_test_env
+  rm -f "$index"
+  # Directories changed within the last second are never indexed
+  find "$TESTDIR" -type d -exec touch -d '1 minute ago' {} +
+
+  first="$("$SYMLINKS_BINARY" -r -v -t --index "$index" "$TESTDIR" | sort)"
+  second="$("$SYMLINKS_BINARY" -r -v -t --index "$index" "$TESTDIR" 2>"$index.log" | sort)"
+  if [ "$first" != "$second" ]; then
+    echo "FAIL: output replayed from the index differs from a full scan"
+    FAIL=1
+  elif ! grep -q "index: [1-9][0-9]* directories replayed" "$index.log"; then
+    echo "FAIL: second --index run did not replay any directory"
+    FAIL=1
+  else
+    echo "OK: --index replays unchanged directories with identical output."
+  fi
+
+  # A directory that changed since must be read again
+  ln -s missing "$TESTDIR/subdir/new_dangling"
+  if ! "$SYMLINKS_BINARY" -r -v -t --index "$index" "$TESTDIR" | grep -q "dangling: .*/subdir/new_dangling"; then
+    echo "FAIL: --index missed a link added to a changed directory"
+    FAIL=1
+  else
+    echo "OK: --index rescans changed directories."
+  fi
+  rm -f "$index" "$index.log"
+  echo
+}
+
+test_watch() {
+  echo "==== Test 15: Watch Mode (--watch) ===="
+  local out="$TESTDIR.watch" pid
+  create_test_env
+  "$SYMLINKS_BINARY" -r -v --watch "$TESTDIR" > "$out" 2>&1 &
+  pid=$!
+  wait_for "$out" "^watching for changes"
+
+  # A new dangling link, a new directory with a link, and a deleted target
+  ln -s /nonexistent_watch "$TESTDIR/new_dangling"
+  mkdir -p "$TESTDIR/newdir/deeper"
+  ln -s ../../file1 "$TESTDIR/newdir/deeper/new_rel"
+  wait_for "$out" "dangling: .*/new_dangling" && wait_for "$out" "relative: .*/newdir/deeper/new_rel"
+  rm "$TESTDIR/subdir/file2"
+  wait_for "$out" "dangling: .*/link_into_subdir"
+  kill -TERM "$pid"
+  wait "$pid"
+
+  if ! grep -q "dangling: .*/new_dangling" "$out"; then
+    echo "FAIL: --watch did not report a newly created dangling link"
+    FAIL=1
+  elif ! grep -q "relative: .*/newdir/deeper/new_rel" "$out"; then
+    echo "FAIL: --watch did not scan a newly created directory"
+    FAIL=1
+  elif ! grep -q "dangling: .*/link_into_subdir" "$out"; then
+    echo "FAIL: --watch did not re-check a link whose target was deleted"
+    FAIL=1
+  else
+    echo "OK: --watch handled new links, new directories and deleted targets."
+  fi
+  rm -f "$out"
+  echo
+}
+
+test_format() {
+  echo "==== Test 16: Machine-Readable Output (--format) ===="
+  local links records fields
+  create_test_env
+  ln -s file1 "$TESTDIR/arrow -> name"
+  links="$(find "$TESTDIR" -type l | wc -l)"
+
+  # One JSON line per link, whatever the link is called
+  records="$("$SYMLINKS_BINARY" -r -t --format=jsonl "$TESTDIR" | grep -c '^{"path":.*"errno":[0-9]*}$')"
+  if [ "$records" -ne "$links" ]; then
+    echo "FAIL: --format=jsonl emitted $records records for $links links"
+    FAIL=1
+  elif ! "$SYMLINKS_BINARY" -r -t --format=jsonl "$TESTDIR" |
+    grep -q '"path":"[^"]*/arrow -> name","target":"file1","class":"relative"'; then
+    echo "FAIL: --format=jsonl mangled a path containing ' -> '"
+    FAIL=1
+  else
+    echo "OK: --format=jsonl emits one record per link."
+  fi
+
+  # Six NUL-terminated fields per link
+  fields="$("$SYMLINKS_BINARY" -r -t --format=nul "$TESTDIR" | tr -cd '\0' | wc -c)"
+  if [ "$fields" -ne $((links * 6)) ]; then
+    echo "FAIL: --format=nul emitted $fields fields for $links links"
+    FAIL=1
+  else
+    echo "OK: --format=nul emits six fields per link."
+  fi
+  echo
+}
+
+test_plan_apply() {
+  echo "==== Test 17: Plan and Apply (--plan / --apply) ===="
+  local plan="$TESTDIR.plan" before planned direct applied
+  create_test_env
+  before="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  "$SYMLINKS_BINARY" -r -c -d --plan "$plan" "$TESTDIR" > /dev/null
+  planned="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  if [ "$before" != "$planned" ]; then
+    echo "FAIL: --plan modified the tree"
+    FAIL=1
+  fi
+
+  # In test mode, applying changes nothing either
+  "$SYMLINKS_BINARY" -t --apply "$plan" > /dev/null
+  if [ "$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)" != "$before" ]; then
+    echo "FAIL: -t --apply modified the tree"
+    FAIL=1
+  else
+    echo "OK: -t --apply only reports the planned changes."
+  fi
+
+  "$SYMLINKS_BINARY" --apply "$plan" > /dev/null
+  applied="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  create_test_env
+  "$SYMLINKS_BINARY" -r -c -d "$TESTDIR" > /dev/null
+  direct="$(find "$TESTDIR" -type l -printf '%p %l\n' | sort)"
+  if [ "$applied" != "$direct" ]; then
+    echo "FAIL: applying a plan differs from fixing directly"
+    FAIL=1
+  else
+    echo "OK: --apply makes exactly the changes of a direct -cd run."
+  fi
+
+  # A link changed after planning is left alone
+  create_test_env
+  "$SYMLINKS_BINARY" -r -c --plan "$plan" "$TESTDIR" > /dev/null
+  ln -sfn /var "$TESTDIR/abs_link"
+  "$SYMLINKS_BINARY" --apply "$plan" > /dev/null 2>&1
+  if [ "$(readlink "$TESTDIR/abs_link")" != "/var" ]; then
+    echo "FAIL: --apply overwrote a link changed since the plan"
+    FAIL=1
+  else
+    echo "OK: --apply skips links changed since the plan."
+  fi
+  rm -f "$plan"
+  echo
+}
+
+test_library_api() {
+  echo "==== Test 18: Library API ===="
+  # Concurrent scans through symlinks.h, without the command-line tool
+  if ! build/test_api; then
+    echo "FAIL: the library API test failed"
+    FAIL=1
+  fi
+  echo
+}
+
+test_stats() {
+  echo "==== Test 19: Instrumentation (--stats / --progress) ===="
+  local links report
+  create_test_env
+  links="$(find "$TESTDIR" -type l | wc -l)"
+
+  # The counters match the tree, and the operations are timed
+  report="$("$SYMLINKS_BINARY" -r -t --stats "$TESTDIR" 2>&1 > /dev/null)"
+  if ! echo "$report" | grep -q "links: $links\$"; then
+    echo "FAIL: --stats did not count $links links"
+    echo "$report"
+    FAIL=1
+  elif ! echo "$report" | grep -Eq '^readlink +[0-9]+ +[0-9.]+ +[0-9.]+ +[0-9.]+ +[0-9.]+ +[0-9.]+$' ||
+    ! echo "$report" | grep -q '^slowest directories'; then
+    echo "FAIL: --stats did not report latencies and the slowest directories"
+    echo "$report"
+    FAIL=1
+  else
+    echo "OK: --stats counts links and times operations."
+  fi
+
+  # Counts alone: the same totals, with no latency columns or slowest directories
+  report="$("$SYMLINKS_BINARY" -r -t --stats=counts "$TESTDIR" 2>&1 > /dev/null)"
+  if ! echo "$report" | grep -q "links: $links\$" ||
+    ! echo "$report" | grep -Eq '^readlink +[0-9]+$' ||
+    echo "$report" | grep -q '^slowest directories'; then
+    echo "FAIL: --stats=counts did not report the counts alone"
+    echo "$report"
+    FAIL=1
+  elif "$SYMLINKS_BINARY" -r -t --stats=bogus "$TESTDIR" > /dev/null 2>&1; then
+    echo "FAIL: --stats=bogus was accepted"
+    FAIL=1
+  else
+    echo "OK: --stats=counts counts without timing."
+  fi
+
+  # Progress goes to stderr only, and leaves the report lines alone
+  if [ "$("$SYMLINKS_BINARY" -r -v -t --progress=0.01 "$TESTDIR" 2> /dev/null)" != \
+    "$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2> /dev/null)" ]; then
+    echo "FAIL: --progress changed the report"
+    FAIL=1
+  else
+    echo "OK: --progress leaves the report unchanged."
+  fi
+  echo
+}
+
+test_chains() {
+  echo "==== Test 20: Link Chains and Loops (--flatten) ===="
+  local report
+  create_test_env
+  ln -s symlink_to_symlink "$TESTDIR/chain3"
+  report="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null)"
+  if ! echo "$report" | grep -q "^chained (3 links): .*/chain3 -> symlink_to_symlink$" ||
+    ! echo "$report" | grep -q "^loop: .*/loop_a -> loop_b$" ||
+    ! echo "$report" | grep -q "^loop: .*/self_link -> self_link$"; then
+    echo "FAIL: chains and loops were not classified"
+    echo "$report"
+    FAIL=1
+  elif [ "$(echo "$report" | sort)" != "$("$SYMLINKS_BINARY" -r -v -t --io-uring "$TESTDIR" 2>/dev/null | sort)" ]; then
+    echo "FAIL: --io-uring classifies chains differently"
+    FAIL=1
+  else
+    echo "OK: chained links and loops are classified."
+  fi
+
+  "$SYMLINKS_BINARY" -r --flatten "$TESTDIR" > /dev/null
+  if [ "$(readlink "$TESTDIR/chain3")" != "file1" ] || [ "$(readlink "$TESTDIR/symlink_to_symlink")" != "file1" ] ||
+    [ "$(readlink "$TESTDIR/loop_a")" != "loop_b" ]; then
+    echo "FAIL: --flatten did not point the chains at their final target"
+    FAIL=1
+  else
+    echo "OK: --flatten points chained links straight at their target."
+  fi
+  echo
+}
+
+test_deep_tree() {
+  echo "==== Test 21: Deep Trees (no depth limit, paths past PATH_MAX) ===="
+  local report errors jobs
+  create_test_env
+  # 300 levels of 40-character names: far below the old limit of 128, and over 12 KB of path
+  (
+    cd "$TESTDIR" || exit 1
+    for i in $(seq 300); do
+      mkdir "level_${i}_xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" && cd "level_${i}_xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" || exit 1
+    done
+    ln -s nowhere deep_dangling
+  )
+  for jobs in 1 4; do
+    report="$("$SYMLINKS_BINARY" -r -v -t -j "$jobs" "$TESTDIR" 2>/dev/null)"
+    errors="$("$SYMLINKS_BINARY" -r -t -j "$jobs" "$TESTDIR" 2>&1 >/dev/null)"
+    if ! echo "$report" | grep -q "^dangling: .*/level_300_x*/deep_dangling -> nowhere$" || [ -n "$errors" ]; then
+      echo "FAIL: -j $jobs did not reach the bottom of a 300-level tree"
+      echo "$errors"
+      FAIL=1
+    else
+      echo "OK: -j $jobs scans a 300-level tree to the bottom."
+    fi
+  done
+  echo
+}
+
+test_overlapping_roots() {
+  echo "==== Test 22: Overlapping Roots Are Scanned Once ===="
+  local single overlapping jobs
+  create_test_env
+  ln -s "$(pwd)/$TESTDIR" "$TESTDIR.alias"
+  single="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null | sort)"
+  for jobs in 1 4; do
+    # A nested root, a repeated root, and the same directory through a symlinked parent
+    overlapping="$("$SYMLINKS_BINARY" -r -v -t -j "$jobs" "$TESTDIR/subdir" "$TESTDIR" "$TESTDIR" \
+      "$TESTDIR.alias/subdir" 2>/dev/null | sort)"
+    if [ "$overlapping" != "$single" ]; then
+      echo "FAIL: -j $jobs reported overlapping roots more than once"
+      diff <(echo "$single") <(echo "$overlapping")
+      FAIL=1
+    else
+      echo "OK: -j $jobs reads every directory once."
+    fi
+  done
+  rm -f "$TESTDIR.alias"
+  echo
+}
+
+test_device_lanes() {
+  echo "==== Test 23: Per-Device Scheduling under -j ===="
+  local debug
+  create_test_env
+  # Every device is classified once; a rotational one is scanned through its own limited lane
+  debug="$("$SYMLINKS_BINARY" -r -v -t -o -j 4 -x "$TESTDIR" 2>&1 >/dev/null | grep '^\[DEBUG\] device ')"
+  if [ "$(echo "$debug" | grep -c .)" -ne 1 ]; then
+    echo "FAIL: the device of the tree was not classified exactly once"
+    echo "$debug"
+    FAIL=1
+  elif [ "$("$SYMLINKS_BINARY" -r -v -t -o -j 4 "$TESTDIR" 2>/dev/null | sort)" != \
+    "$("$SYMLINKS_BINARY" -r -v -t -o "$TESTDIR" 2>/dev/null | sort)" ]; then
+    echo "FAIL: device lanes changed what -j reports"
+    FAIL=1
+  else
+    echo "OK: $(echo "$debug" | sed 's/^\[DEBUG\] //')"
+  fi
+  echo
+}
+
+test_filters() {
+  echo "==== Test 24: Filters (--exclude, --include, --prune) ===="
+  local report jobs
+  create_test_env
+  mkdir -p "$TESTDIR/.git/objects"
+  ln -s /nonexistent "$TESTDIR/.git/objects/dangling_in_git"
+  for jobs in 1 4; do
+    report="$("$SYMLINKS_BINARY" -r -v -t -j "$jobs" --prune .git --prune subdir_link --include abs_link \
+      --exclude 'abs*' --exclude '*/subdir2/subsubdir' "$TESTDIR" 2>/dev/null)"
+    if echo "$report" | grep -q -e "dangling_in_git" -e "deep_dangling" -e "abs_dangling"; then
+      echo "FAIL: -j $jobs scanned filtered entries"
+      echo "$report"
+      FAIL=1
+    elif ! echo "$report" | grep -q "^absolute: .*/abs_link -> /tmp$" ||
+      ! echo "$report" | grep -q "/subdir_link -> subdir$" ||
+      ! echo "$report" | grep -q "^dangling: .*/dangling -> /nonexistent$"; then
+      echo "FAIL: -j $jobs filtered out entries it should keep"
+      echo "$report"
+      FAIL=1
+    else
+      echo "OK: -j $jobs skips excluded and pruned entries only."
+    fi
+  done
+  echo
+}
+
+test_inode_order() {
+  echo "==== Test 25: Inode-Ordered Entries (--inode-order) ===="
+  local plain inodes jobs i
+  create_test_env
+  mkdir "$TESTDIR/many"
+  for i in $(seq 40); do
+    ln -s "/nonexistent/$i" "$TESTDIR/many/link_$i"
+  done
+  plain="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null | sort)"
+  # One chunk for the whole directory: entries must be checked in inode order
+  inodes="$("$SYMLINKS_BINARY" -v -t -x --inode-order "$TESTDIR/many" 2>&1 >/dev/null |
+    sed -n 's/^\[DEBUG\] Checking entry: //p' | xargs stat -c %i)"
+  if [ "$(echo "$inodes" | grep -c .)" -ne 40 ] || [ "$inodes" != "$(echo "$inodes" | sort -n)" ]; then
+    echo "FAIL: --inode-order did not check the entries in inode order"
+    FAIL=1
+  else
+    echo "OK: --inode-order checks entries in inode order."
+  fi
+  for jobs in 1 4; do
+    # Chunks of 3 entries, so directories are read in several sorted pieces
+    if [ "$("$SYMLINKS_BINARY" -r -v -t -j "$jobs" --inode-order=3 "$TESTDIR" 2>/dev/null | sort)" != "$plain" ]; then
+      echo "FAIL: --inode-order=3 with -j $jobs reports different links"
+      FAIL=1
+    else
+      echo "OK: --inode-order=3 with -j $jobs reports the same links."
+    fi
+  done
+  echo
+}
+
+test_path_list() {
+  echo "==== Test 26: Path Lists (--from0) ===="
+  local walked listed jobs
+  create_test_env
+  walked="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null | sort)"
+  for jobs in 1 4; do
+    # Relative paths with "./", plus a regular file and a path that is gone
+    listed="$( (cd "$TESTDIR" && { find . -type l -print0; printf 'file1\0gone_link\0'; } |
+      "../$SYMLINKS_BINARY" -v -t -j "$jobs" --from0 -) 2>/dev/null | sort)"
+    if [ "$listed" != "$walked" ]; then
+      echo "FAIL: --from0 with -j $jobs reported differently from a walk"
+      diff <(echo "$walked") <(echo "$listed")
+      FAIL=1
+    else
+      echo "OK: --from0 with -j $jobs reports the same links as a walk."
+    fi
+  done
+
+  find "$TESTDIR" -type l -print0 > "$TESTDIR.list"
+  "$SYMLINKS_BINARY" -d --from0 "$TESTDIR.list" > /dev/null 2>&1
+  if [ -L "$TESTDIR/dangling" ] || [ -L "$TESTDIR/subdir2/subsubdir/deep_dangling" ] || [ ! -L "$TESTDIR/rel_link" ]; then
+    echo "FAIL: -d --from0 did not delete exactly the dangling links"
+    FAIL=1
+  else
+    echo "OK: -d --from0 deletes the dangling links of the list."
+  fi
+  rm -f "$TESTDIR.list"
+  echo
+}
+
+test_archive() {
+  echo "==== Test 27: Links Inside Archives (--archive, --archive-out) ===="
+  local root="$TESTDIR/root" report listing
+  rm -rf "$TESTDIR"
+  mkdir -p "$root/usr/lib" "$root/usr/bin" "$root/etc"
+  touch "$root/usr/lib/libc.so"
+  ln -s /usr/lib/libc.so "$root/usr/bin/abs"
+  ln -s ../lib/libc.so "$root/usr/bin/rel"
+  ln -s rel "$root/usr/bin/chain"
+  ln -s /nowhere "$root/usr/bin/dang"
+  ln -s /usr/lib "$root/etc/libdir"
+  ln -s /etc/libdir/libc.so "$root/etc/via_libdir"
+  tar -C "$root" -cf "$TESTDIR/in.tar" .
+
+  # Absolute targets resolve inside the archive, not on this system
+  report="$("$SYMLINKS_BINARY" -v --archive - < "$TESTDIR/in.tar" 2>/dev/null)"
+  if ! echo "$report" | grep -q "^absolute: /usr/bin/abs -> /usr/lib/libc.so$" ||
+    ! echo "$report" | grep -q "^absolute: /etc/via_libdir -> /etc/libdir/libc.so$" ||
+    ! echo "$report" | grep -q "^chained (2 links): /usr/bin/chain -> rel$" ||
+    ! echo "$report" | grep -q "^dangling: /usr/bin/dang -> /nowhere$"; then
+    echo "FAIL: --archive classified links differently"
+    echo "$report"
+    FAIL=1
+  else
+    echo "OK: --archive classifies links against the archive's contents."
+  fi
+
+  "$SYMLINKS_BINARY" -c -d --archive "$TESTDIR/in.tar" --archive-out "$TESTDIR/out.tar" > /dev/null 2>&1
+  listing="$(tar -tvf "$TESTDIR/out.tar" 2>/dev/null | sed -n 's/^l.* \.\//\//p' | sort)"
+  if [ "$listing" != "$(printf '%s\n' "/etc/libdir -> ../usr/lib" "/etc/via_libdir -> ../usr/lib/libc.so" \
+    "/usr/bin/abs -> ../lib/libc.so" "/usr/bin/chain -> rel" "/usr/bin/rel -> ../lib/libc.so")" ] ||
+    ! tar -tf "$TESTDIR/out.tar" | grep -q "usr/lib/libc.so$"; then
+    echo "FAIL: --archive-out did not rewrite the archive as expected"
+    echo "$listing"
+    FAIL=1
+  else
+    echo "OK: -c -d --archive-out writes the archive with relative links and no dangling ones."
+  fi
+  echo
+}
+
+test_path_fuzz_corpus() {
+  echo "==== Test 28: Path Kernels Against the Reference (fuzz corpus) ===="
+  # The fuzz target's seed corpus, checked without libFuzzer
+  if ! build/fuzz_paths fuzz_paths_corpus; then
+    echo "FAIL: a path kernel disagreed with the reference normalizer"
+    FAIL=1
+  fi
+  echo
+}
+
+test_nice_io() {
+  echo "==== Test 29: Paced Scans (--nice-io) ===="
+  local plain paced start elapsed_ms i
+  create_test_env
+  for i in $(seq 1 100); do
+    ln -s "$TESTDIR/file1" "$TESTDIR/subdir/abs_$i"
+  done
+  plain="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null | sort)"
+  start=$(date +%s%N)
+  # 100 links alone take a few hundred lookups, at 200 per second
+  paced="$("$SYMLINKS_BINARY" -r -v -t -j 4 --nice-io=200 "$TESTDIR" 2>/dev/null | sort)"
+  elapsed_ms=$(( ($(date +%s%N) - start) / 1000000 ))
+  if [ "$paced" != "$plain" ]; then
+    echo "FAIL: --nice-io reported differently from a plain scan"
+    diff <(echo "$plain") <(echo "$paced")
+    FAIL=1
+  elif [ "$elapsed_ms" -lt 1000 ]; then
+    echo "FAIL: --nice-io=200 finished in ${elapsed_ms} ms, too fast for its limit"
+    FAIL=1
+  else
+    echo "OK: --nice-io=200 reports the same links, paced (${elapsed_ms} ms)."
+  fi
+
+  if "$SYMLINKS_BINARY" --nice-io=fast "$TESTDIR" > /dev/null 2>&1 ||
+     "$SYMLINKS_BINARY" --nice-io=10, "$TESTDIR" > /dev/null 2>&1; then
+    echo "FAIL: invalid --nice-io rates were accepted"
+    FAIL=1
+  else
+    echo "OK: invalid --nice-io rates are rejected."
+  fi
+  echo
+}
+
+test_checkpoint() {
+  echo "==== Test 30: Interrupted Scans (--checkpoint / --resume) ===="
+  local plain before after pid d i
+  create_test_env
+  for d in $(seq 1 6); do
+    mkdir -p "$TESTDIR/ck_$d/sub"
+    for i in $(seq 1 25); do
+      ln -s "$TESTDIR/file1" "$TESTDIR/ck_$d/abs_$i"
+      ln -s "$TESTDIR/missing_$i" "$TESTDIR/ck_$d/sub/dangling_$i"
+    done
+  done
+  plain="$("$SYMLINKS_BINARY" -r -v -t "$TESTDIR" 2>/dev/null | sort)"
+  rm -f "$TESTDIR.ck"
+
+  # Paced to several seconds, killed a little way in
+  "$SYMLINKS_BINARY" -r -v -t -j 2 --nice-io=200 --checkpoint "$TESTDIR.ck" --checkpoint-interval 0.05 \
+    "$TESTDIR" > "$TESTDIR.out1" 2>/dev/null &
+  pid=$!
+  sleep 1.5
+  kill -9 "$pid"
+  wait "$pid" 2>/dev/null
+  if [ ! -s "$TESTDIR.ck" ]; then
+    echo "FAIL: no checkpoint was saved"
+    FAIL=1
+    echo
+    return
+  fi
+
+  # Other options than those the scan was saved with are refused, and the checkpoint kept
+  cp "$TESTDIR.ck" "$TESTDIR.ck.saved"
+  if "$SYMLINKS_BINARY" -v -t --resume "$TESTDIR.ck" > /dev/null 2>&1 ||
+     "$SYMLINKS_BINARY" -r -v -t -d --resume "$TESTDIR.ck" > /dev/null 2>&1 ||
+     ! cmp -s "$TESTDIR.ck" "$TESTDIR.ck.saved"; then
+    echo "FAIL: --resume took a checkpoint with different options, or lost it"
+    FAIL=1
+  else
+    echo "OK: --resume refuses other options and keeps the checkpoint."
+  fi
+  rm -f "$TESTDIR.ck.saved"
+
+  "$SYMLINKS_BINARY" -r -v -t -j 2 --resume "$TESTDIR.ck" > "$TESTDIR.out2" 2>/dev/null
+  before="$(sort -u "$TESTDIR.out1" "$TESTDIR.out2")"
+  after="$(sort -u "$TESTDIR.out2")"
+  if [ "$before" != "$plain" ]; then
+    echo "FAIL: the interrupted and resumed scans together reported differently from a plain scan"
+    diff <(echo "$plain") <(echo "$before")
+    FAIL=1
+  elif [ "$after" = "$plain" ]; then
+    echo "FAIL: --resume scanned everything again"
+    FAIL=1
+  elif [ -e "$TESTDIR.ck" ]; then
+    echo "FAIL: the checkpoint was left behind after the scan completed"
+    FAIL=1
+  else
+    echo "OK: --resume finishes an interrupted scan without redoing it."
+  fi
+
+  echo "not a checkpoint" > "$TESTDIR.ck"
+  if "$SYMLINKS_BINARY" -r --resume "$TESTDIR.ck" > /dev/null 2>&1 ||
+     "$SYMLINKS_BINARY" -r --resume "$TESTDIR.ck" "$TESTDIR" > /dev/null 2>&1; then
+    echo "FAIL: --resume accepted a bad checkpoint or a directory argument"
+    FAIL=1
+  else
+    echo "OK: --resume rejects bad checkpoints and directory arguments."
+  fi
+  rm -f "$TESTDIR.ck" "$TESTDIR.out1" "$TESTDIR.out2"
+  echo
+}
+
+test_summary() {
+  echo "==== Test 31: Aggregated Summary (--summary) ===="
+  local summary parallel links top i
+  create_test_env
+  mkdir -p "$TESTDIR/many/a/b" "$TESTDIR/many/c"
+  for i in 1 2 3 4 5; do
+    ln -s "/nonexistent_$i" "$TESTDIR/many/a/b/gone_$i"
+  done
+  for i in 1 2 3; do
+    ln -s "/nonexistent_$i" "$TESTDIR/many/c/gone_$i"
+  done
+
+  summary="$("$SYMLINKS_BINARY" -r -t --summary "$TESTDIR" 2>/dev/null)"
+  parallel="$("$SYMLINKS_BINARY" -r -t -j 4 --summary "$TESTDIR" 2>/dev/null)"
+  links="$(find "$TESTDIR" -type l | wc -l)"
+  top="$(echo "$summary" | awk '$NF ~ /\/many$/ {print $1, $2}')"
+  if [ "$summary" != "$parallel" ]; then
+    echo "FAIL: --summary differs between -j 1 and -j 4"
+    diff <(echo "$summary") <(echo "$parallel")
+    FAIL=1
+  elif ! echo "$summary" | grep -q "^links: $links;"; then
+    echo "FAIL: --summary total does not match the $links links in the tree"
+    echo "$summary"
+    FAIL=1
+  elif [ "$top" != "8 8" ]; then
+    echo "FAIL: the many/ subtree was not rolled up to 8 dangling links (got: $top)"
+    echo "$summary"
+    FAIL=1
+  elif ! echo "$summary" | grep -A1 "most dangling" | grep -q "^ *5  .*/many/a/b$"; then
+    echo "FAIL: many/a/b is not the directory with the most dangling links"
+    echo "$summary"
+    FAIL=1
+  elif echo "$summary" | grep -q "^dangling:"; then
+    echo "FAIL: --summary still printed a line per link"
+    FAIL=1
+  else
+    echo "OK: --summary rolls links up by class and subtree, the same under -j."
+  fi
+
+  if "$SYMLINKS_BINARY" -r --summary=x "$TESTDIR" > /dev/null 2>&1 ||
+     "$SYMLINKS_BINARY" -r --summary --format=jsonl "$TESTDIR" > /dev/null 2>&1 ||
+     "$SYMLINKS_BINARY" -r -t --summary --checkpoint "$TESTDIR.ck" "$TESTDIR" > /dev/null 2>&1; then
+    echo "FAIL: an invalid --summary was accepted"
+    FAIL=1
+  else
+    echo "OK: invalid --summary uses are rejected."
+  fi
   echo
 }
 
@@ -253,6 +950,13 @@ test_no_debug_mode() {
   # We'll verify a couple of known links that should end up normalized to 'subdir'
   verify_symlink_equiv "$TESTDIR/messy_link" "subdir"
   verify_symlink_equiv "$TESTDIR/lengthy_link" "subdir"
+  verify_symlink_equiv "$TESTDIR/updown_link" "file1"
+
+  # Collapsing "dir/.." must keep a relative link relative
+  case "$(readlink "$TESTDIR/updown_link")" in
+    /*) echo "FAIL: updown_link became absolute: $(readlink "$TESTDIR/updown_link")"; FAIL=1 ;;
+    *) echo "OK: updown_link stayed relative." ;;
+  esac
 
   echo
 }
@@ -276,6 +980,27 @@ test_shorten_convert
 test_other_fs
 test_test_mode
 test_no_debug_mode
+test_parallel
+test_io_uring
+test_target_cache
+test_index
+test_watch
+test_format
+test_plan_apply
+test_library_api
+test_stats
+test_chains
+test_deep_tree
+test_overlapping_roots
+test_device_lanes
+test_filters
+test_inode_order
+test_path_list
+test_archive
+test_path_fuzz_corpus
+test_nice_io
+test_checkpoint
+test_summary
 
 echo "All tests completed."
 
@@ -0,0 +1,237 @@
+// test_api.c
+//
+// Exercises the library API in symlinks.h directly: several contexts
+// scanning their own trees from concurrent threads, one context shared
+// by several threads, dry runs, and the error callback.
+//
+// Run it through meson: `meson test -C build`.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "symlinks.h"
+
+#define TREES 4
+#define DIRS_PER_TREE 20
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+struct counts {
+    atomic_int links;
+    atomic_int dangling;
+    atomic_int absolute;
+    atomic_int changed;
+    atomic_int would_delete;
+    atomic_int errors;
+};
+
+static void count_link(const struct symlinks_link* link, void* user) {
+    struct counts* c = user;
+    atomic_fetch_add(&c->links, 1);
+    if (!strcmp(link->cls, "dangling")) {
+        atomic_fetch_add(&c->dangling, 1);
+    }
+    if (!strcmp(link->cls, "absolute")) {
+        atomic_fetch_add(&c->absolute, 1);
+    }
+    if (!strcmp(link->action, "changed")) {
+        atomic_fetch_add(&c->changed, 1);
+    }
+    if (!strcmp(link->action, "would_delete")) {
+        atomic_fetch_add(&c->would_delete, 1);
+    }
+}
+
+static void count_error(const char* path, int err, const char* message, void* user) {
+    (void)path;
+    (void)err;
+    (void)message;
+    struct counts* c = user;
+    atomic_fetch_add(&c->errors, 1);
+}
+
+/*
+ * make_tree:
+ *   DIRS_PER_TREE directories under 'root', each with a file, an absolute
+ *   link to it and a dangling link.
+ */
+static void make_tree(const char* root) {
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    mkdir(root, 0755);
+    for (int i = 0; i < DIRS_PER_TREE; i++) {
+        snprintf(path, sizeof(path), "%s/d%d", root, i);
+        mkdir(path, 0755);
+        snprintf(target, sizeof(target), "%s/d%d/file", root, i);
+        fclose(fopen(target, "w"));
+        snprintf(path, sizeof(path), "%s/d%d/abs", root, i);
+        symlink(target, path);
+        snprintf(path, sizeof(path), "%s/d%d/dangling", root, i);
+        symlink("nowhere", path);
+    }
+}
+
+struct job {
+    struct symlinks_ctx* ctx;
+    const char* root;
+    int scanned;
+};
+
+static void* scan_thread(void* arg) {
+    struct job* job = arg;
+    job->scanned = symlinks_scan(job->ctx, &job->root, 1);
+    return NULL;
+}
+
+int main(void) {
+    char base[] = "/tmp/symlinks-api-XXXXXX";
+    if (!mkdtemp(base)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    char roots[TREES][256];
+    for (int i = 0; i < TREES; i++) {
+        snprintf(roots[i], sizeof(roots[i]), "%s/tree%d", base, i);
+        make_tree(roots[i]);
+    }
+
+    struct symlinks_options opts;
+    symlinks_options_init(&opts);
+    opts.recurse = 1;
+    opts.on_link = count_link;
+    opts.on_error = count_error;
+
+    /* Invalid options are refused, not fatal */
+    opts.jobs = 0;
+    errno = 0;
+    CHECK(symlinks_new(&opts) == NULL && errno == EINVAL);
+    opts.jobs = 1;
+
+    /* A dry run shared by all threads: everything reported, nothing touched */
+    struct counts shared = {0};
+    opts.dry_run = 1;
+    opts.convert = 1;
+    opts.delete_dangling = 1;
+    opts.jobs = 2;
+    opts.io_uring = 1;
+    opts.user = &shared;
+    struct symlinks_ctx* ctx = symlinks_new(&opts);
+    CHECK(ctx != NULL);
+    if (ctx) {
+        pthread_t threads[TREES];
+        struct job jobs[TREES];
+        for (int i = 0; i < TREES; i++) {
+            jobs[i] = (struct job){ctx, roots[i], 0};
+            pthread_create(&threads[i], NULL, scan_thread, &jobs[i]);
+        }
+        for (int i = 0; i < TREES; i++) {
+            pthread_join(threads[i], NULL);
+            CHECK(jobs[i].scanned == 1);
+        }
+        CHECK(symlinks_free(ctx) == 0);
+    }
+    CHECK(shared.links == TREES * DIRS_PER_TREE * 2);
+    CHECK(shared.would_delete == TREES * DIRS_PER_TREE);
+    CHECK(shared.changed == 0);
+    CHECK(shared.errors == 0);
+
+    /* One context per tree, converting for real, concurrently */
+    struct counts counts[TREES];
+    struct symlinks_ctx* ctxs[TREES];
+    struct job jobs[TREES];
+    pthread_t threads[TREES];
+    opts.dry_run = 0;
+    opts.delete_dangling = 0;
+    for (int i = 0; i < TREES; i++) {
+        memset(&counts[i], 0, sizeof(counts[i]));
+        opts.user = &counts[i];
+        ctxs[i] = symlinks_new(&opts);
+        CHECK(ctxs[i] != NULL);
+        jobs[i] = (struct job){ctxs[i], roots[i], 0};
+    }
+    for (int i = 0; i < TREES; i++) {
+        if (ctxs[i]) {
+            pthread_create(&threads[i], NULL, scan_thread, &jobs[i]);
+        }
+    }
+    for (int i = 0; i < TREES; i++) {
+        if (ctxs[i]) {
+            pthread_join(threads[i], NULL);
+            CHECK(symlinks_free(ctxs[i]) == 0);
+        }
+        CHECK(counts[i].absolute == DIRS_PER_TREE);
+        CHECK(counts[i].dangling == DIRS_PER_TREE);
+        CHECK(counts[i].changed == DIRS_PER_TREE);
+    }
+
+    char path[PATH_MAX];
+    char value[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/d0/abs", roots[0]);
+    ssize_t n = readlink(path, value, sizeof(value) - 1);
+    CHECK(n == 4 && !memcmp(value, "file", 4));
+
+    /* Errors go to the callback, and the path is not counted as scanned */
+    struct counts missing = {0};
+    opts.user = &missing;
+    ctx = symlinks_new(&opts);
+    CHECK(ctx != NULL);
+    if (ctx) {
+        snprintf(path, sizeof(path), "%s/missing", base);
+        const char* paths[] = {path};
+        CHECK(symlinks_scan(ctx, paths, 1) == 0);
+        CHECK(missing.errors == 1);
+        symlinks_free(ctx);
+    }
+
+    /* So do problems with the index: an invalid one on loading, an unwritable one on saving */
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/bad.idx", base);
+    FILE* bad = fopen(index_path, "w");
+    CHECK(bad != NULL);
+    if (bad) {
+        fputs("not an index, though long enough to hold an index header", bad);
+        fclose(bad);
+    }
+    struct counts index_errors = {0};
+    opts.user = &index_errors;
+    opts.index_path = index_path;
+    ctx = symlinks_new(&opts);
+    CHECK(ctx != NULL && index_errors.errors == 1);
+    CHECK(symlinks_free(ctx) == 0);
+    snprintf(index_path, sizeof(index_path), "%s/no/such/dir.idx", base);
+    ctx = symlinks_new(&opts);
+    CHECK(ctx != NULL);
+    CHECK(symlinks_free(ctx) != 0 && index_errors.errors == 2);
+    opts.index_path = NULL;
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", base);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "could not remove %s\n", base);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("library API: all checks passed\n");
+    return 0;
+}
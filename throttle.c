@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "throttle.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* A bucket holds this many seconds' worth of tokens, so short bursts pass */
+#define BURST_SECONDS 0.05
+
+/* Latency samples per back-off decision, and the bounds of the back-off */
+#define WINDOW 64
+#define MAX_SLOWDOWN 64.0
+
+/* Pauses shorter than this are saved up rather than slept one by one */
+#define MIN_PAUSE_NS 1000000
+
+/* Calls faster than this were served from memory and say nothing about the device */
+#define DEVICE_NS 50000
+
+struct bucket {
+    double rate; /* tokens per second, 0 = unlimited */
+    double tokens;
+    uint64_t last; /* when 'tokens' was last refilled */
+};
+
+/* The latency of one kind of call: recent, and the normal level */
+struct latency {
+    double recent_ns;
+    double normal_ns;
+    unsigned samples;
+};
+
+/*
+ * throttle:
+ *   A single mutex protects everything; it is taken once per system call,
+ *   which is nothing next to the pauses it hands out.
+ */
+struct throttle {
+    pthread_mutex_t lock;
+    struct bucket buckets[THROTTLE_NKINDS];
+
+    /* Back-off: latencies per kind of call, and how far to slow down */
+    struct latency latency[STATS_NOPS];
+    double slowdown;
+    uint64_t paused_ns;
+};
+
+/* Back-off pauses owed by this thread, not slept yet */
+static _Thread_local uint64_t owed_ns;
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = {(time_t)(ns / 1000000000u), (long)(ns % 1000000000u)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+struct throttle* throttle_new(double ops_per_sec, double changes_per_sec) {
+    struct throttle* t = calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    t->buckets[THROTTLE_METADATA].rate = ops_per_sec;
+    t->buckets[THROTTLE_CHANGE].rate = changes_per_sec;
+    uint64_t now = stats_now();
+    for (int i = 0; i < THROTTLE_NKINDS; i++) {
+        t->buckets[i].tokens = 1.0; /* the first call never waits */
+        t->buckets[i].last = now;
+    }
+    t->slowdown = 1.0;
+    return t;
+}
+
+void throttle_free(struct throttle* t) {
+    if (t) {
+        pthread_mutex_destroy(&t->lock);
+        free(t);
+    }
+}
+
+void throttle_wait(struct throttle* t, enum throttle_kind kind, unsigned n) {
+    struct bucket* b = &t->buckets[kind];
+    if (b->rate <= 0) {
+        return;
+    }
+
+    /*
+     * Tokens may go negative: the caller then owns the next ones to come,
+     * and sleeps until they have, so waiting threads are served in order.
+     */
+    pthread_mutex_lock(&t->lock);
+    uint64_t now = stats_now();
+    double burst = b->rate * BURST_SECONDS > 1.0 ? b->rate * BURST_SECONDS : 1.0;
+    b->tokens += (double)(now - b->last) * 1e-9 * b->rate;
+    if (b->tokens > burst) {
+        b->tokens = burst;
+    }
+    b->last = now;
+    b->tokens -= n;
+    uint64_t wait_ns = b->tokens < 0 ? (uint64_t)(-b->tokens / b->rate * 1e9) : 0;
+    t->paused_ns += wait_ns;
+    pthread_mutex_unlock(&t->lock);
+
+    if (wait_ns > 0) {
+        sleep_ns(wait_ns);
+    }
+}
+
+void throttle_observe(struct throttle* t, enum stats_op op, uint64_t ns) {
+    pthread_mutex_lock(&t->lock);
+    struct latency* l = &t->latency[op];
+    l->recent_ns = l->samples ? l->recent_ns + ((double)ns - l->recent_ns) / 16 : (double)ns;
+    l->samples++;
+
+    /*
+     * The normal level is the lowest recent latency seen, creeping up
+     * slowly so that a device that has become slower for good stops
+     * counting as busy after a while.  Kinds of call are kept apart, as a
+     * directory open normally takes many times as long as a lookup.
+     */
+    if (l->samples >= WINDOW) {
+        if (l->normal_ns == 0 || l->recent_ns < l->normal_ns) {
+            l->normal_ns = l->recent_ns;
+        }
+        else {
+            l->normal_ns += (l->recent_ns - l->normal_ns) / 1024;
+        }
+    }
+    if (l->samples % WINDOW == 0 && l->normal_ns > 0) {
+        if (l->recent_ns > 2 * l->normal_ns && l->recent_ns > DEVICE_NS) {
+            t->slowdown = t->slowdown * 2 < MAX_SLOWDOWN ? t->slowdown * 2 : MAX_SLOWDOWN;
+        }
+        else if (l->recent_ns < 1.5 * l->normal_ns || l->recent_ns <= DEVICE_NS) {
+            t->slowdown = t->slowdown * 0.75 > 1.0 ? t->slowdown * 0.75 : 1.0;
+        }
+    }
+    double slowdown = t->slowdown;
+    pthread_mutex_unlock(&t->lock);
+
+    /* Idle for (slowdown - 1) times as long as the call kept the device busy */
+    if (slowdown > 1.0) {
+        owed_ns += (uint64_t)((double)ns * (slowdown - 1.0));
+        if (owed_ns >= MIN_PAUSE_NS) {
+            uint64_t pause = owed_ns;
+            owed_ns = 0;
+            pthread_mutex_lock(&t->lock);
+            t->paused_ns += pause;
+            pthread_mutex_unlock(&t->lock);
+            sleep_ns(pause);
+        }
+    }
+}
+
+void throttle_counters(struct throttle* t, uint64_t* paused_ns, double* slowdown) {
+    pthread_mutex_lock(&t->lock);
+    *paused_ns = t->paused_ns;
+    *slowdown = t->slowdown;
+    pthread_mutex_unlock(&t->lock);
+}
@@ -0,0 +1,58 @@
+#ifndef SYMLINKS_THROTTLE_H
+#define SYMLINKS_THROTTLE_H
+
+/*
+ * Pacing for busy hosts (--nice-io).
+ *
+ * Two token buckets, shared by all threads of a context, cap the rate of
+ * metadata system calls (directory opens and reads, lstat, readlink,
+ * target lookups) and of changes (rewrites and deletions).  On top of
+ * that, an adaptive back-off watches the latency of those calls: when it
+ * climbs well above the lowest level seen, the device is busy with someone
+ * else's work, and each thread pauses after every call for a growing
+ * multiple of that call's latency, giving the device back a growing share
+ * of its time; the pauses shrink again as latency recovers.
+ */
+
+#include <stdint.h>
+
+#include "stats.h"
+
+enum throttle_kind {
+    THROTTLE_METADATA,
+    THROTTLE_CHANGE,
+    THROTTLE_NKINDS
+};
+
+struct throttle;
+
+/*
+ * throttle_new:
+ *   'ops_per_sec' and 'changes_per_sec' are the bucket rates, 0 for no
+ *   limit.  Returns NULL if out of memory.
+ */
+struct throttle* throttle_new(double ops_per_sec, double changes_per_sec);
+
+void throttle_free(struct throttle* t);
+
+/*
+ * throttle_wait:
+ *   Take 'n' tokens of 'kind', sleeping until the bucket allows them.
+ */
+void throttle_wait(struct throttle* t, enum throttle_kind kind, unsigned n);
+
+/*
+ * throttle_observe:
+ *   Report the latency of one call of kind 'op' made after throttle_wait();
+ *   may pause the calling thread for the back-off.
+ */
+void throttle_observe(struct throttle* t, enum stats_op op, uint64_t ns);
+
+/*
+ * throttle_counters:
+ *   The total time threads have spent waiting and pausing, and the
+ *   current back-off (1 when latency is normal).
+ */
+void throttle_counters(struct throttle* t, uint64_t* paused_ns, double* slowdown);
+
+#endif
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE /* struct statx */
+
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct uring {
+    int fd;
+    unsigned queued;   /* SQEs filled in but not yet submitted */
+    unsigned inflight; /* submitted, completion not reaped yet */
+
+    /* Submission queue */
+    void* sq_ring;
+    size_t sq_ring_sz;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_sz;
+
+    /* Completion queue (may share the SQ mapping) */
+    void* cq_ring;
+    size_t cq_ring_sz;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * supports_statx:
+ *   Ask the kernel whether IORING_OP_STATX is implemented (Linux 5.6+).
+ */
+static int supports_statx(int fd) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+    if (!probe) {
+        return 0;
+    }
+    int ok = 0;
+    if (sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+struct uring* uring_open(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!supports_statx(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    struct uring* ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_sz > ring->sq_ring_sz) {
+        ring->sq_ring_sz = ring->cq_ring_sz;
+    }
+
+    ring->sq_ring =
+        mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_close(ring);
+        return NULL;
+    }
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring =
+            mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_close(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_close(ring);
+        return NULL;
+    }
+
+    char* sq = ring->sq_ring;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned*)(sq + p.sq_off.ring_entries);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+
+    char* cq = ring->cq_ring;
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return ring;
+}
+
+void uring_close(struct uring* ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_sz);
+    }
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_sz);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_sz);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+int uring_queue_statx(struct uring* ring, int dirfd, const char* path, int flags, unsigned mask, struct statx* buf,
+                      uint64_t user_data) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    if (tail - head >= *ring->sq_entries) {
+        return -1;
+    }
+
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mask;
+    sqe->off = (uint64_t)(uintptr_t)buf;
+    sqe->statx_flags = (uint32_t)flags;
+    sqe->user_data = user_data;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return 0;
+}
+
+int uring_submit(struct uring* ring, unsigned wait_nr) {
+    unsigned to_submit = ring->queued;
+    for (;;) {
+        int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0) {
+            ring->queued -= (unsigned)ret;
+            ring->inflight += (unsigned)ret;
+            return ret;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+int uring_reap(struct uring* ring, uint64_t* user_data, int* res) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (ring->inflight > 0) {
+        ring->inflight--;
+    }
+    return 1;
+}
+
+int uring_drain(struct uring* ring) {
+    for (;;) {
+        uint64_t user_data;
+        int res;
+        while (uring_reap(ring, &user_data, &res)) {
+        }
+        if (ring->queued == 0 && ring->inflight == 0) {
+            return 0;
+        }
+        int ret = uring_submit(ring, 1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+#else /* !__linux__ */
+
+struct uring* uring_open(unsigned entries) {
+    (void)entries;
+    return NULL;
+}
+
+void uring_close(struct uring* ring) {
+    (void)ring;
+}
+
+int uring_queue_statx(struct uring* ring, int dirfd, const char* path, int flags, unsigned mask, struct statx* buf,
+                      uint64_t user_data) {
+    (void)ring, (void)dirfd, (void)path, (void)flags, (void)mask, (void)buf, (void)user_data;
+    return -1;
+}
+
+int uring_submit(struct uring* ring, unsigned wait_nr) {
+    (void)ring, (void)wait_nr;
+    return -ENOSYS;
+}
+
+int uring_reap(struct uring* ring, uint64_t* user_data, int* res) {
+    (void)ring, (void)user_data, (void)res;
+    return 0;
+}
+
+int uring_drain(struct uring* ring) {
+    (void)ring;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SYMLINKS_URING_H
+#define SYMLINKS_URING_H
+
+/*
+ * Minimal io_uring wrapper (raw syscalls, no liburing) used to keep many
+ * statx() requests in flight while classifying a directory's links.
+ */
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+struct uring;
+struct statx;
+
+/*
+ * uring_open:
+ *   Set up a ring with room for 'entries' requests.  Returns NULL when
+ *   io_uring is unavailable (old kernel, seccomp, sysctl) or lacks statx.
+ */
+struct uring* uring_open(unsigned entries);
+
+void uring_close(struct uring* ring);
+
+/*
+ * uring_queue_statx:
+ *   Queue statx(dirfd, path, flags, mask, buf); 'path' and 'buf' must stay
+ *   valid until the completion is reaped.  Returns -1 if the ring is full.
+ */
+int uring_queue_statx(struct uring* ring, int dirfd, const char* path, int flags, unsigned mask, struct statx* buf,
+                      uint64_t user_data);
+
+/*
+ * uring_submit:
+ *   Submit everything queued and wait until at least 'wait_nr' completions
+ *   are available.  Returns the number submitted, or -errno.
+ */
+int uring_submit(struct uring* ring, unsigned wait_nr);
+
+/*
+ * uring_reap:
+ *   Pop one completion if available.  Returns 1 and fills 'user_data' and
+ *   'res' (the syscall result, -errno on failure), or 0 if none is ready.
+ */
+int uring_reap(struct uring* ring, uint64_t* user_data, int* res);
+
+/*
+ * uring_drain:
+ *   Submit anything still queued and wait for every request in flight,
+ *   dropping their completions, so that no buffer or path handed to the
+ *   ring is used any more.  Returns 0, or -errno if waiting failed (the
+ *   ring must then be closed).
+ */
+int uring_drain(struct uring* ring);
+
+#endif
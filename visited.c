@@ -0,0 +1,120 @@
+#include "visited.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Open-addressing tables of 16-byte slots, split into shards by the high
+ * bits of the hash so that threads adding different directories rarely
+ * wait for each other.  (0, 0) marks a free slot: no directory has it.
+ */
+#define VISITED_SHARDS 16
+
+struct visited_slot {
+    uint64_t dev;
+    uint64_t ino;
+};
+
+struct visited_shard {
+    pthread_mutex_t lock;
+    struct visited_slot* slots;
+    size_t mask; /* slots - 1, a power of two minus one; 0 before the first add */
+    size_t count;
+};
+
+struct visited_set {
+    struct visited_shard shards[VISITED_SHARDS];
+};
+
+/* splitmix64 finaliser over both halves of the key */
+static uint64_t hash_dir(uint64_t dev, uint64_t ino) {
+    uint64_t h = ino ^ (dev * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+struct visited_set* visited_new(void) {
+    struct visited_set* set = calloc(1, sizeof(*set));
+    if (!set) {
+        return NULL;
+    }
+    for (int i = 0; i < VISITED_SHARDS; i++) {
+        pthread_mutex_init(&set->shards[i].lock, NULL);
+    }
+    return set;
+}
+
+void visited_free(struct visited_set* set) {
+    if (!set) {
+        return;
+    }
+    for (int i = 0; i < VISITED_SHARDS; i++) {
+        free(set->shards[i].slots);
+        pthread_mutex_destroy(&set->shards[i].lock);
+    }
+    free(set);
+}
+
+/*
+ * shard_grow:
+ *   Double the table (or create it), keeping it at most half full.
+ *   Returns 0 on success, -1 if out of memory.
+ */
+static int shard_grow(struct visited_shard* shard) {
+    size_t size = shard->slots ? (shard->mask + 1) * 2 : 64;
+    struct visited_slot* slots = calloc(size, sizeof(*slots));
+    if (!slots) {
+        return -1;
+    }
+    if (shard->slots) {
+        for (size_t i = 0; i <= shard->mask; i++) {
+            const struct visited_slot* s = &shard->slots[i];
+            if (!s->dev && !s->ino) {
+                continue;
+            }
+            size_t j = hash_dir(s->dev, s->ino) & (size - 1);
+            while (slots[j].dev || slots[j].ino) {
+                j = (j + 1) & (size - 1);
+            }
+            slots[j] = *s;
+        }
+        free(shard->slots);
+    }
+    shard->slots = slots;
+    shard->mask = size - 1;
+    return 0;
+}
+
+int visited_add(struct visited_set* set, dev_t dev, ino_t ino) {
+    uint64_t h = hash_dir((uint64_t)dev, (uint64_t)ino);
+    struct visited_shard* shard = &set->shards[h >> 60];
+    int added = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->count + 1) * 2 > (shard->slots ? shard->mask + 1 : 0) && shard_grow(shard) != 0) {
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+    size_t i = h & shard->mask;
+    for (;;) {
+        struct visited_slot* s = &shard->slots[i];
+        if (!s->dev && !s->ino) {
+            s->dev = (uint64_t)dev;
+            s->ino = (uint64_t)ino;
+            shard->count++;
+            break;
+        }
+        if (s->dev == (uint64_t)dev && s->ino == (uint64_t)ino) {
+            added = 0;
+            break;
+        }
+        i = (i + 1) & shard->mask;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return added;
+}
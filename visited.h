@@ -0,0 +1,30 @@
+#ifndef SYMLINKS_VISITED_H
+#define SYMLINKS_VISITED_H
+
+/*
+ * Set of the directories one scan has entered, by device and inode, shared
+ * by all its threads: however the roots overlap and however often bind
+ * mounts repeat a directory, it is read once.
+ */
+
+#include <sys/types.h>
+
+struct visited_set;
+
+/*
+ * visited_new:
+ *   Returns an empty set, or NULL if out of memory.
+ */
+struct visited_set* visited_new(void);
+
+void visited_free(struct visited_set* set);
+
+/*
+ * visited_add:
+ *   Returns 1 if the directory was not in the set (it is now), 0 if it
+ *   was.  Failing to allocate returns 1 without remembering it, so the
+ *   directory is scanned rather than skipped.
+ */
+int visited_add(struct visited_set* set, dev_t dev, ino_t ino);
+
+#endif
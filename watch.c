@@ -0,0 +1,822 @@
+#define _GNU_SOURCE /* open_by_handle_at, struct file_handle, ppoll */
+
+#include "watch.h"
+#include "path.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#endif
+
+/* A batch is handed out once events pause this long... */
+#define WATCH_DEBOUNCE_MS 50
+/* ...or once it is this old or this large, whichever comes first */
+#define WATCH_MAX_DELAY_MS 1000
+#define WATCH_MAX_BATCH 16384
+
+#define FANOTIFY_MASK (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+#define INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+enum watch_kind {
+    WATCH_FANOTIFY,
+    WATCH_INOTIFY,
+};
+
+/* A watched tree; with fanotify, also how handles on its filesystem are opened */
+struct watch_root {
+    char* path;
+    int fd;
+#ifdef __linux__
+    fsid_t fsid;
+#endif
+};
+
+/*
+ * Reverse map: target path -> links pointing at it (chained hash).
+ */
+struct link_ref {
+    struct link_ref* next;
+    char path[];
+};
+
+struct link_target {
+    struct link_target* next;
+    struct link_ref* links;
+    uint64_t hash;
+    char path[];
+};
+
+struct watcher {
+    enum watch_kind kind;
+    int fd;
+    int recursive;
+    symlinks_error_fn on_error;
+    void* user;
+
+    struct watch_root* roots;
+    int nroots;
+
+    /* inotify: directory path of each watch descriptor */
+    pthread_mutex_t dirs_lock;
+    char** dirs;
+    size_t ndirs;
+    int limit_reported;
+
+#ifdef __linux__
+    /* fanotify: last directory handle resolved, since events come in runs */
+    unsigned char last_handle[MAX_HANDLE_SZ + sizeof(struct file_handle)];
+    size_t last_handle_len;
+    char last_dir[PATH_MAX];
+#endif
+
+    pthread_mutex_t links_lock;
+    struct link_target** targets;
+    size_t ntargets_buckets; /* power of two */
+    size_t ntargets;
+};
+
+/*
+ * watch_report:
+ *   Hand an error about 'path' (errno 'err', or 0) to the error callback.
+ */
+__attribute__((format(printf, 4, 5))) static void
+watch_report(const struct watcher* w, const char* path, int err, const char* fmt, ...) {
+    if (!w->on_error) {
+        return;
+    }
+    char message[PATH_MAX + 256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    w->on_error(path, err, message, w->user);
+}
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/* ---- Batches ---- */
+
+/*
+ * batch_find:
+ *   Returns the slot for the first 'len' bytes of 'path': either the one
+ *   holding it or the empty one where it belongs.
+ */
+static uint32_t* batch_find(const struct watch_batch* batch, const char* path, size_t len) {
+    size_t mask = batch->nslots - 1;
+    size_t i = (size_t)hash_path(path, len) & mask;
+    for (;;) {
+        uint32_t* slot = &batch->slots[i];
+        if (*slot == 0) {
+            return slot;
+        }
+        const char* have = batch->changes[*slot - 1].path;
+        if (strncmp(have, path, len) == 0 && have[len] == '\0') {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/*
+ * batch_add:
+ *   Merge a change to 'path' into the batch.  Returns 0, or -1 if out of
+ *   memory (the batch is then flagged as overflowed).
+ */
+static int batch_add(struct watch_batch* batch, const char* path, unsigned flags) {
+    if (batch->nslots < 2 * (batch->count + 1)) {
+        size_t nslots = batch->nslots ? batch->nslots * 2 : 256;
+        uint32_t* slots = calloc(nslots, sizeof(*slots));
+        if (!slots) {
+            batch->overflow = 1;
+            return -1;
+        }
+        free(batch->slots);
+        batch->slots = slots;
+        batch->nslots = nslots;
+        for (size_t i = 0; i < batch->count; i++) {
+            const char* p = batch->changes[i].path;
+            *batch_find(batch, p, strlen(p)) = (uint32_t)(i + 1);
+        }
+    }
+
+    uint32_t* slot = batch_find(batch, path, strlen(path));
+    if (*slot == 0) {
+        if (batch->count == batch->cap) {
+            size_t cap = batch->cap ? batch->cap * 2 : 256;
+            struct watch_change* changes = realloc(batch->changes, cap * sizeof(*changes));
+            if (!changes) {
+                batch->overflow = 1;
+                return -1;
+            }
+            batch->changes = changes;
+            batch->cap = cap;
+        }
+        char* copy = strdup(path);
+        if (!copy) {
+            batch->overflow = 1;
+            return -1;
+        }
+        batch->changes[batch->count].path = copy;
+        batch->changes[batch->count].flags = 0;
+        *slot = (uint32_t)++batch->count;
+    }
+    batch->changes[*slot - 1].flags |= flags;
+    if ((batch->changes[*slot - 1].flags & (WATCH_GONE | WATCH_DIR)) == (WATCH_GONE | WATCH_DIR)) {
+        batch->gone_dirs = 1;
+    }
+    return 0;
+}
+
+static void batch_reset(struct watch_batch* batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->changes[i].path);
+    }
+    batch->count = 0;
+    batch->overflow = 0;
+    batch->gone_dirs = 0;
+    if (batch->slots) {
+        memset(batch->slots, 0, batch->nslots * sizeof(*batch->slots));
+    }
+}
+
+void watch_batch_free(struct watch_batch* batch) {
+    batch_reset(batch);
+    free(batch->changes);
+    free(batch->slots);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/*
+ * batch_is_gone:
+ *   Whether the first 'len' bytes of 'path' name something gone in 'batch'.
+ */
+static int batch_is_gone(const struct watch_batch* batch, const char* path, size_t len) {
+    if (batch->nslots == 0) {
+        return 0;
+    }
+    uint32_t slot = *batch_find(batch, path, len);
+    return slot != 0 && (batch->changes[slot - 1].flags & WATCH_GONE);
+}
+
+int watch_batch_in_dir(const struct watch_batch* batch, const char* path) {
+    if (batch->nslots == 0) {
+        return 0;
+    }
+    for (size_t len = strlen(path); len > 1;) {
+        while (len > 0 && path[len - 1] != '/') {
+            len--;
+        }
+        if (len > 1) {
+            len--; /* drop the slash */
+        }
+        uint32_t slot = *batch_find(batch, path, len);
+        if (slot != 0 && (batch->changes[slot - 1].flags & WATCH_DIR)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * in_roots:
+ *   Whether events on the entries of directory 'dir' concern us.
+ */
+static int in_roots(const struct watcher* w, const char* dir) {
+    for (int i = 0; i < w->nroots; i++) {
+        size_t len = strlen(w->roots[i].path);
+        if (strncmp(dir, w->roots[i].path, len) != 0) {
+            continue;
+        }
+        if (dir[len] == '\0' || (w->recursive && (dir[len] == '/' || len == 1))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void batch_add_entry(struct watch_batch* batch, const char* dir, const char* name, unsigned flags) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s%s%s", dir, strcmp(dir, "/") ? "/" : "", name) < (int)sizeof(path)) {
+        batch_add(batch, path, flags);
+    }
+}
+
+#ifdef __linux__
+
+/* ---- fanotify ---- */
+
+static int fanotify_start(struct watcher* w) {
+    w->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+    if (w->fd < 0) {
+        return -1;
+    }
+    w->kind = WATCH_FANOTIFY;
+    return 0;
+}
+
+static int inotify_start(struct watcher* w) {
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        return -1;
+    }
+    w->kind = WATCH_INOTIFY;
+    return 0;
+}
+
+/*
+ * fanotify_dir_path:
+ *   Resolve the directory handle of an event to its current path, reusing
+ *   the previous answer for the same handle.  Returns NULL if the directory
+ *   is gone or not on a watched filesystem.
+ */
+static const char* fanotify_dir_path(struct watcher* w, const struct fanotify_event_info_fid* fid) {
+    struct file_handle* fh = (struct file_handle*)fid->handle;
+    size_t handle_len = sizeof(*fh) + fh->handle_bytes;
+    if (handle_len > sizeof(w->last_handle)) {
+        return NULL;
+    }
+    if (handle_len == w->last_handle_len && memcmp(w->last_handle, fh, handle_len) == 0) {
+        return w->last_dir;
+    }
+
+    const struct watch_root* root = NULL;
+    for (int i = 0; i < w->nroots; i++) {
+        if (memcmp(&w->roots[i].fsid, &fid->fsid, sizeof(fid->fsid)) == 0) {
+            root = &w->roots[i];
+            break;
+        }
+    }
+    if (!root) {
+        return NULL;
+    }
+
+    int dfd = open_by_handle_at(root->fd, fh, O_PATH | O_CLOEXEC);
+    if (dfd < 0) {
+        return NULL;
+    }
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dfd);
+    ssize_t n = readlink(proc, w->last_dir, sizeof(w->last_dir) - 1);
+    close(dfd);
+    if (n <= 0) {
+        w->last_handle_len = 0;
+        return NULL;
+    }
+    w->last_dir[n] = '\0';
+    memcpy(w->last_handle, fh, handle_len);
+    w->last_handle_len = handle_len;
+    return w->last_dir;
+}
+
+static void fanotify_read(struct watcher* w, struct watch_batch* batch) {
+    char buf[65536] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t len;
+
+    while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+        struct fanotify_event_metadata* md = (struct fanotify_event_metadata*)buf;
+        for (; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+            if (md->mask & FAN_Q_OVERFLOW) {
+                batch->overflow = 1;
+                continue;
+            }
+            const struct fanotify_event_info_fid* fid =
+                (const struct fanotify_event_info_fid*)((const char*)md + md->metadata_len);
+            if (md->event_len < md->metadata_len + sizeof(*fid) ||
+                fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+            const struct file_handle* fh = (const struct file_handle*)fid->handle;
+            const char* name = (const char*)fh->f_handle + fh->handle_bytes;
+            if (!strcmp(name, ".")) {
+                continue;
+            }
+
+            const char* dir = fanotify_dir_path(w, fid);
+            if (!dir || !in_roots(w, dir)) {
+                continue;
+            }
+            unsigned flags = 0;
+            if (md->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+                flags |= WATCH_GONE;
+            }
+            if (md->mask & FAN_ONDIR) {
+                flags |= WATCH_DIR;
+            }
+            batch_add_entry(batch, dir, name, flags);
+        }
+    }
+}
+
+/* ---- inotify ---- */
+
+/*
+ * inotify_forget_under:
+ *   Drop the watches of 'path' and everything below it, after the
+ *   directory was moved away: their recorded paths are no longer valid.
+ */
+static void inotify_forget_under(struct watcher* w, const char* path) {
+    size_t len = strlen(path);
+    pthread_mutex_lock(&w->dirs_lock);
+    for (size_t wd = 0; wd < w->ndirs; wd++) {
+        const char* dir = w->dirs[wd];
+        if (dir && strncmp(dir, path, len) == 0 && (dir[len] == '\0' || dir[len] == '/')) {
+            inotify_rm_watch(w->fd, (int)wd);
+            free(w->dirs[wd]);
+            w->dirs[wd] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&w->dirs_lock);
+}
+
+static void inotify_read(struct watcher* w, struct watch_batch* batch) {
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len;) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                batch->overflow = 1;
+                continue;
+            }
+
+            pthread_mutex_lock(&w->dirs_lock);
+            if (ev->mask & IN_IGNORED) {
+                if (ev->wd >= 0 && (size_t)ev->wd < w->ndirs) {
+                    free(w->dirs[ev->wd]);
+                    w->dirs[ev->wd] = NULL;
+                }
+                pthread_mutex_unlock(&w->dirs_lock);
+                continue;
+            }
+            char dir[PATH_MAX];
+            int known = ev->len > 0 && ev->wd >= 0 && (size_t)ev->wd < w->ndirs && w->dirs[ev->wd];
+            if (known) {
+                snprintf(dir, sizeof(dir), "%s", w->dirs[ev->wd]);
+            }
+            pthread_mutex_unlock(&w->dirs_lock);
+            if (!known) {
+                continue;
+            }
+
+            unsigned flags = 0;
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                flags |= WATCH_GONE;
+            }
+            if (ev->mask & IN_ISDIR) {
+                flags |= WATCH_DIR;
+            }
+            batch_add_entry(batch, dir, ev->name, flags);
+
+            if ((ev->mask & (IN_MOVED_FROM | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
+                char path[PATH_MAX];
+                if (snprintf(path, sizeof(path), "%s%s%s", dir, strcmp(dir, "/") ? "/" : "", ev->name) <
+                    (int)sizeof(path)) {
+                    inotify_forget_under(w, path);
+                }
+            }
+        }
+    }
+}
+
+#else /* !__linux__ */
+
+static int fanotify_start(struct watcher* w) {
+    (void)w;
+    errno = ENOSYS;
+    return -1;
+}
+
+static int inotify_start(struct watcher* w) {
+    (void)w;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+/* ---- Watcher ---- */
+
+struct watcher* watch_open(int recursive, symlinks_error_fn on_error, void* user) {
+    struct watcher* w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+    w->fd = -1;
+    w->recursive = recursive;
+    w->on_error = on_error;
+    w->user = user;
+    w->ntargets_buckets = 1024;
+    w->targets = calloc(w->ntargets_buckets, sizeof(*w->targets));
+    if (!w->targets || (fanotify_start(w) != 0 && inotify_start(w) != 0)) {
+        int err = errno;
+        free(w->targets);
+        free(w);
+        errno = err;
+        return NULL;
+    }
+    pthread_mutex_init(&w->dirs_lock, NULL);
+    pthread_mutex_init(&w->links_lock, NULL);
+    return w;
+}
+
+const char* watch_backend(const struct watcher* w) {
+    return (w->kind == WATCH_FANOTIFY) ? "fanotify" : "inotify";
+}
+
+int watch_add_root(struct watcher* w, const char* path) {
+    struct watch_root* roots = realloc(w->roots, (size_t)(w->nroots + 1) * sizeof(*roots));
+    if (!roots) {
+        watch_report(w, path, ENOMEM, "Out of memory watching %s", path);
+        return -1;
+    }
+    w->roots = roots;
+    struct watch_root* root = &w->roots[w->nroots];
+    memset(root, 0, sizeof(*root));
+    root->fd = -1;
+    root->path = strdup(path);
+    if (!root->path) {
+        watch_report(w, path, ENOMEM, "Out of memory watching %s", path);
+        return -1;
+    }
+
+#ifdef __linux__
+    if (w->kind == WATCH_FANOTIFY) {
+        struct statfs sfs;
+        root->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (root->fd < 0 || fstatfs(root->fd, &sfs) != 0 ||
+            fanotify_mark(w->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, AT_FDCWD, path) != 0) {
+            int err = errno;
+            if (root->fd >= 0) {
+                close(root->fd);
+                root->fd = -1;
+            }
+            /* Typically EPERM without CAP_SYS_ADMIN: use inotify if nothing depends on fanotify yet */
+            if (w->nroots == 0) {
+                int old_fd = w->fd;
+                if (inotify_start(w) == 0) {
+                    close(old_fd);
+                    w->nroots++;
+                    return 0;
+                }
+            }
+            watch_report(w, path, err, "Cannot watch %s: %s", path, strerror(err));
+            free(root->path);
+            return -1;
+        }
+        root->fsid = sfs.f_fsid;
+    }
+#endif
+    w->nroots++;
+    return 0;
+}
+
+void watch_add_dir(struct watcher* w, const char* path) {
+#ifdef __linux__
+    if (w->kind != WATCH_INOTIFY) {
+        return;
+    }
+
+    pthread_mutex_lock(&w->dirs_lock);
+    int wd = inotify_add_watch(w->fd, path, INOTIFY_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !w->limit_reported) {
+            watch_report(w, path, ENOSPC, "inotify watch limit reached at %s; raise fs.inotify.max_user_watches", path);
+            w->limit_reported = 1;
+        }
+        pthread_mutex_unlock(&w->dirs_lock);
+        return;
+    }
+    if ((size_t)wd >= w->ndirs) {
+        size_t ndirs = w->ndirs ? w->ndirs : 256;
+        while (ndirs <= (size_t)wd) {
+            ndirs *= 2;
+        }
+        char** dirs = realloc(w->dirs, ndirs * sizeof(*dirs));
+        if (!dirs) {
+            inotify_rm_watch(w->fd, wd);
+            pthread_mutex_unlock(&w->dirs_lock);
+            return;
+        }
+        memset(dirs + w->ndirs, 0, (ndirs - w->ndirs) * sizeof(*dirs));
+        w->dirs = dirs;
+        w->ndirs = ndirs;
+    }
+    /* Watching a directory again returns its existing descriptor */
+    free(w->dirs[wd]);
+    w->dirs[wd] = strdup(path);
+    pthread_mutex_unlock(&w->dirs_lock);
+#else
+    (void)w;
+    (void)path;
+#endif
+}
+
+int watch_wait(struct watcher* w, struct watch_batch* batch, volatile sig_atomic_t* stop, const sigset_t* sigmask) {
+    batch_reset(batch);
+
+    struct pollfd pfd = {w->fd, POLLIN, 0};
+    struct timespec first;
+    const struct timespec debounce = {0, WATCH_DEBOUNCE_MS * 1000000L};
+    const struct timespec* timeout = NULL;
+
+    for (;;) {
+        if (*stop) {
+            return -1;
+        }
+        int n = ppoll(&pfd, 1, timeout, sigmask);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            watch_report(w, NULL, errno, "Cannot wait for changes: %s", strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            /* Quiet for WATCH_DEBOUNCE_MS */
+            if (batch->count > 0 || batch->overflow) {
+                return 0;
+            }
+            timeout = NULL;
+            continue;
+        }
+
+#ifdef __linux__
+        if (w->kind == WATCH_FANOTIFY) {
+            fanotify_read(w, batch);
+        }
+        else {
+            inotify_read(w, batch);
+        }
+#endif
+        if (batch->count == 0 && !batch->overflow) {
+            continue; /* nothing of interest */
+        }
+        if (!timeout) {
+            clock_gettime(CLOCK_MONOTONIC, &first);
+        }
+        if (batch->overflow || batch->count >= WATCH_MAX_BATCH || elapsed_ms(&first) >= WATCH_MAX_DELAY_MS) {
+            return 0;
+        }
+        timeout = &debounce;
+    }
+}
+
+void watch_close(struct watcher* w) {
+    if (!w) {
+        return;
+    }
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    for (int i = 0; i < w->nroots; i++) {
+        if (w->roots[i].fd >= 0) {
+            close(w->roots[i].fd);
+        }
+        free(w->roots[i].path);
+    }
+    free(w->roots);
+    for (size_t i = 0; i < w->ndirs; i++) {
+        free(w->dirs[i]);
+    }
+    free(w->dirs);
+    for (size_t b = 0; b < w->ntargets_buckets; b++) {
+        struct link_target* t = w->targets[b];
+        while (t) {
+            struct link_target* next_t = t->next;
+            struct link_ref* l = t->links;
+            while (l) {
+                struct link_ref* next_l = l->next;
+                free(l);
+                l = next_l;
+            }
+            free(t);
+            t = next_t;
+        }
+    }
+    free(w->targets);
+    pthread_mutex_destroy(&w->dirs_lock);
+    pthread_mutex_destroy(&w->links_lock);
+    free(w);
+}
+
+/* ---- Reverse map ---- */
+
+/*
+ * targets_grow:
+ *   Double the bucket array once there are more targets than buckets.
+ *   Failing to allocate just leaves the chains longer.
+ */
+static void targets_grow(struct watcher* w) {
+    size_t nbuckets = w->ntargets_buckets * 2;
+    struct link_target** buckets = calloc(nbuckets, sizeof(*buckets));
+    if (!buckets) {
+        return;
+    }
+    for (size_t b = 0; b < w->ntargets_buckets; b++) {
+        struct link_target* t = w->targets[b];
+        while (t) {
+            struct link_target* next = t->next;
+            t->next = buckets[t->hash & (nbuckets - 1)];
+            buckets[t->hash & (nbuckets - 1)] = t;
+            t = next;
+        }
+    }
+    free(w->targets);
+    w->targets = buckets;
+    w->ntargets_buckets = nbuckets;
+}
+
+void watch_note_link(struct watcher* w, const char* link_path, const char* target) {
+    size_t target_len = strlen(target);
+    uint64_t hash = hash_path(target, target_len);
+
+    pthread_mutex_lock(&w->links_lock);
+    struct link_target** slot = &w->targets[hash & (w->ntargets_buckets - 1)];
+    while (*slot && ((*slot)->hash != hash || strcmp((*slot)->path, target) != 0)) {
+        slot = &(*slot)->next;
+    }
+    struct link_target* t = *slot;
+    if (!t) {
+        t = malloc(sizeof(*t) + target_len + 1);
+        if (!t) {
+            pthread_mutex_unlock(&w->links_lock);
+            return;
+        }
+        memcpy(t->path, target, target_len + 1);
+        t->hash = hash;
+        t->links = NULL;
+        t->next = NULL;
+        *slot = t;
+        w->ntargets++;
+    }
+
+    for (struct link_ref* l = t->links; l; l = l->next) {
+        if (!strcmp(l->path, link_path)) {
+            pthread_mutex_unlock(&w->links_lock);
+            return;
+        }
+    }
+    size_t link_len = strlen(link_path);
+    struct link_ref* l = malloc(sizeof(*l) + link_len + 1);
+    if (l) {
+        memcpy(l->path, link_path, link_len + 1);
+        l->next = t->links;
+        t->links = l;
+    }
+    if (w->ntargets > w->ntargets_buckets) {
+        targets_grow(w);
+    }
+    pthread_mutex_unlock(&w->links_lock);
+}
+
+/*
+ * target_is_gone:
+ *   Whether 'target' or, if some directory went away, one of its parents
+ *   is marked gone in 'batch'.
+ */
+static int target_is_gone(const struct watch_batch* batch, const char* target) {
+    size_t len = strlen(target);
+    if (batch_is_gone(batch, target, len)) {
+        return 1;
+    }
+    if (batch->gone_dirs) {
+        while (len > 1) {
+            while (len > 0 && target[len - 1] != '/') {
+                len--;
+            }
+            if (len > 1) {
+                len--; /* drop the slash */
+            }
+            if (len > 0 && batch_is_gone(batch, target, len)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * detach_target:
+ *   Unlink the target at '*slot' from the map and move its links onto the
+ *   list '*found'.
+ */
+static void detach_target(struct watcher* w, struct link_target** slot, struct link_ref** found) {
+    struct link_target* t = *slot;
+    *slot = t->next;
+    struct link_ref* last = t->links;
+    while (last && last->next) {
+        last = last->next;
+    }
+    if (last) {
+        last->next = *found;
+        *found = t->links;
+    }
+    free(t);
+    w->ntargets--;
+}
+
+void watch_links_gone(struct watcher* w,
+                      const struct watch_batch* batch,
+                      void (*fn)(const char* link_path, void* ctx),
+                      void* ctx) {
+    struct link_ref* found = NULL;
+
+    /* Detach the matches under the lock; 'fn' will re-note links */
+    pthread_mutex_lock(&w->links_lock);
+    if (batch->gone_dirs) {
+        for (size_t b = 0; b < w->ntargets_buckets; b++) {
+            struct link_target** slot = &w->targets[b];
+            while (*slot) {
+                if (!target_is_gone(batch, (*slot)->path)) {
+                    slot = &(*slot)->next;
+                    continue;
+                }
+                detach_target(w, slot, &found);
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < batch->count; i++) {
+            const struct watch_change* c = &batch->changes[i];
+            if (!(c->flags & WATCH_GONE)) {
+                continue;
+            }
+            uint64_t hash = hash_path(c->path, strlen(c->path));
+            struct link_target** slot = &w->targets[hash & (w->ntargets_buckets - 1)];
+            while (*slot && ((*slot)->hash != hash || strcmp((*slot)->path, c->path) != 0)) {
+                slot = &(*slot)->next;
+            }
+            if (*slot) {
+                detach_target(w, slot, &found);
+            }
+        }
+    }
+    pthread_mutex_unlock(&w->links_lock);
+
+    while (found) {
+        struct link_ref* next = found->next;
+        fn(found->path, ctx);
+        free(found);
+        found = next;
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef SYMLINKS_WATCH_H
+#define SYMLINKS_WATCH_H
+
+/*
+ * Filesystem change notification for --watch.
+ *
+ * Two backends: fanotify with filesystem marks (one mark per watched
+ * filesystem, events carry the directory handle and entry name; needs
+ * CAP_SYS_ADMIN), and inotify with one watch per scanned directory.
+ * Events are coalesced per path and handed out in debounced batches.
+ *
+ * The watcher also keeps a reverse map from link targets to the links
+ * pointing at them, so deleting a target can re-check exactly those links.
+ */
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "symlinks.h"
+
+/* Flags of a watch_change */
+#define WATCH_GONE 0x1 /* deleted or moved away (at least once in the batch) */
+#define WATCH_DIR 0x2  /* the entry is, or was, a directory */
+
+struct watch_change {
+    char* path;
+    unsigned flags;
+};
+
+/*
+ * watch_batch:
+ *   Changes collected by watch_wait(), one per path.
+ */
+struct watch_batch {
+    struct watch_change* changes;
+    size_t count;
+    size_t cap;
+    int overflow; /* events were lost; everything must be scanned again */
+    int gone_dirs; /* some change has both WATCH_GONE and WATCH_DIR */
+
+    /* Open-addressing index into 'changes' (slot = index + 1, 0 = empty) */
+    uint32_t* slots;
+    size_t nslots;
+};
+
+struct watcher;
+
+/*
+ * watch_open:
+ *   Set up a watcher, preferring fanotify and falling back to inotify.
+ *   With 'recursive' unset, only direct entries of the roots are reported.
+ *   Errors while watching go to 'on_error' (may be NULL) with 'user'.
+ *   Returns NULL (with errno set) if neither backend is available.
+ */
+struct watcher* watch_open(int recursive, symlinks_error_fn on_error, void* user);
+
+void watch_close(struct watcher* w);
+
+/*
+ * watch_backend:
+ *   "fanotify" or "inotify".
+ */
+const char* watch_backend(const struct watcher* w);
+
+/*
+ * watch_add_root:
+ *   Watch the directory tree at absolute path 'path'.  With fanotify this
+ *   marks its filesystem; with inotify, directories are added one at a time
+ *   by watch_add_dir() as they are scanned.  Returns 0, or -1 after
+ *   reporting the error.
+ */
+int watch_add_root(struct watcher* w, const char* path);
+
+/*
+ * watch_add_dir:
+ *   Called for every directory scanned; adds an inotify watch if that is
+ *   the backend in use (thread-safe).  Call before reading the directory
+ *   so no entry created meanwhile is missed.
+ */
+void watch_add_dir(struct watcher* w, const char* path);
+
+/*
+ * watch_wait:
+ *   Block until something changes, then keep collecting until the events
+ *   go quiet for a moment (or a batch grows too large or too old), so a
+ *   burst of changes is handled as one batch.  'batch' is reset first.
+ *   'sigmask', if not NULL, is the signal mask while waiting, as for
+ *   ppoll(): with the stop signals blocked otherwise, one raised just
+ *   before the wait still interrupts it.  Returns 0 with a non-empty batch
+ *   (or overflow set), -1 when '*stop' was raised or on error.
+ */
+int watch_wait(struct watcher* w, struct watch_batch* batch, volatile sig_atomic_t* stop, const sigset_t* sigmask);
+
+void watch_batch_free(struct watch_batch* batch);
+
+/*
+ * watch_batch_in_dir:
+ *   Whether a directory above 'path' is itself in 'batch' (so scanning
+ *   that directory already covers 'path').
+ */
+int watch_batch_in_dir(const struct watch_batch* batch, const char* path);
+
+/*
+ * watch_note_link:
+ *   Remember that the link at 'link_path' points at 'target' (absolute,
+ *   lexically normalized).  Thread-safe.
+ */
+void watch_note_link(struct watcher* w, const char* link_path, const char* target);
+
+/*
+ * watch_links_gone:
+ *   Call 'fn' once for every remembered link whose target, or a directory
+ *   above it, is marked WATCH_GONE in 'batch'.  Links are forgotten as they
+ *   are handed out; 'fn' re-notes the ones that still resolve.
+ */
+void watch_links_gone(struct watcher* w,
+                      const struct watch_batch* batch,
+                      void (*fn)(const char* link_path, void* ctx),
+                      void* ctx);
+
+#endif